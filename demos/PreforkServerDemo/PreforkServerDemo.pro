@@ -0,0 +1,11 @@
+QT += core network concurrent
+QT -= gui
+
+CONFIG += c++11
+
+TEMPLATE = app
+
+include( $$PWD/../../library/JQLibrary/JQLibrary.pri )
+
+SOURCES += \
+    $$PWD/cpp/main.cpp
@@ -0,0 +1,58 @@
+﻿// Qt lib import
+#include <QtCore>
+
+// JQLibrary import
+#include <JQHttpServer>
+
+int main(int argc, char *argv[])
+{
+    qSetMessagePattern( "%{time hh:mm:ss.zzz}: %{message}" );
+
+#ifdef Q_OS_UNIX
+    // fork 必须在创建 QCoreApplication 和任何线程之前
+    JQHttpServer::Prefork::Options options;
+    options.workerCount     = 4;
+    options.listenEndpoints = { JQHttpServer::ListenEndpoint( QHostAddress::Any, 23414 ) };
+    options.statusCallback  = [ ](const QJsonObject &status)
+    {
+        qDebug() << "total:" << QJsonDocument( status[ "total" ].toObject() ).toJson( QJsonDocument::Compact );
+    };
+
+    const auto workerIndex = JQHttpServer::Prefork::run( options );
+    if ( workerIndex < 0 ) { return 0; }
+
+    QCoreApplication app( argc, argv );
+
+    JQHttpServer::TcpServerManage tcpServerManage( 2 );
+    tcpServerManage.setHttpAcceptedCallback( [ workerIndex ](const QPointer< JQHttpServer::Session > &session)
+    {
+        session->replyText( QString( "worker:%1 pid:%2" ).arg( workerIndex ).arg( QCoreApplication::applicationPid() ) );
+    } );
+
+    const auto listenSucceed = tcpServerManage.listen( JQHttpServer::Prefork::listenEndpoints() );
+    qDebug() << "worker" << workerIndex << "listen:" << listenSucceed << ", on port 23414";
+
+    // 定时把统计信息发给 supervisor 汇总
+    QTimer statusTimer;
+    QObject::connect( &statusTimer, &QTimer::timeout, [ &tcpServerManage ]()
+    {
+        JQHttpServer::Prefork::reportStatus( tcpServerManage.status() );
+    } );
+    statusTimer.start( 5 * 1000 );
+
+    // supervisor 停止时先处理完已经接受的请求再退出
+    JQHttpServer::Prefork::watchStop( [ &tcpServerManage ]()
+    {
+        tcpServerManage.shutdown( 5 * 1000 );
+        QCoreApplication::quit();
+    } );
+
+    return app.exec();
+#else
+    QCoreApplication app( argc, argv );
+
+    qDebug() << "prefork not support";
+
+    return 0;
+#endif
+}
@@ -2,3 +2,4 @@ TEMPLATE = subdirs
 
 SUBDIRS += HttpClientDemo
 SUBDIRS += HttpServerDemo
+SUBDIRS += PreforkServerDemo
@@ -135,9 +135,36 @@ contains( QT, network ) : contains( QT, concurrent ) : exists( $$PWD/src/jqhttps
     !contains( DEFINES, JQLIBRARY_EXPORT_ENABLE ) | contains( DEFINES, JQLIBRARY_EXPORT_MODE ) {
 
         HEADERS *= $$PWD/include/jqhttpserver.h
+        HEADERS *= $$PWD/include/jqhttpservercoroutine.h
 
         SOURCES *= $$PWD/src/jqhttpserver.cpp
     }
+
+    # io_uring 事件后端是可选的，找到 liburing 才编译，运行时内核不支持会回退到 epoll
+    linux {
+
+        CONFIG *= link_pkgconfig
+
+        packagesExist( liburing ) {
+
+            PKGCONFIG *= liburing
+
+            DEFINES *= JQHTTPSERVER_IO_URING_ENABLED
+        }
+    }
+
+    # WebSocket 的 permessage-deflate 需要 zlib，找不到时不协商压缩
+    unix {
+
+        CONFIG *= link_pkgconfig
+
+        packagesExist( zlib ) {
+
+            PKGCONFIG *= zlib
+
+            DEFINES *= JQHTTPSERVER_ZLIB_ENABLED
+        }
+    }
 }
 
 ios : exists( $$PWD/src/JQiOS.cpp ) {
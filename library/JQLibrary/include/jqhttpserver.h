@@ -46,7 +46,14 @@
 #include <QVector>
 #include <QMap>
 #include <QSet>
+#include <QStringList>
+#include <QQueue>
 #include <QMutex>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QJsonObject>
 #include <QHostAddress>
 #include <QUrl>
 #include <QTcpSocket>
@@ -59,24 +66,267 @@
 // JQLibrary lib import
 #include <JQDeclare>
 
+class QThread;
+class QAbstractEventDispatcher;
 class QThreadPool;
-class QTimer;
 class QImage;
 class QTcpServer;
 class QLocalServer;
+class QSocketNotifier;
+class QFileSystemWatcher;
 class QSslKey;
 class QSslConfiguration;
 
 namespace JQHttpServer
 {
 
+// 回复数据分块写入 socket 的策略
+struct WriteOptions
+{
+    qint64 lowWatermark  = 64 * 1024;   // Qt 写缓冲（bytesToWrite）低于这个值才继续读下一块
+    qint64 highWatermark = 1024 * 1024; // Qt 写缓冲的上限，每个慢客户端占用的内存不超过这个值
+    qint64 minChunkSize  = 16 * 1024;   // 内核发送队列满时（对端接收慢）每次补充的大小
+};
+
+// 回复写入的统计，每个 manager 一份，session 持有指针，manager 先析构也不影响
+struct WriteStatistics
+{
+    QAtomicInteger< qint64 > chunkCount             = 0;
+    QAtomicInteger< qint64 > chunkBytes             = 0;
+    QAtomicInteger< qint64 > watermarkStallCount    = 0;
+    QAtomicInteger< qint64 > socketBufferStallCount = 0;
+};
+
+// 延迟回复的统计，和 WriteStatistics 一样每个 manager 一份
+struct DeferredReplyStatistics
+{
+    QAtomicInteger< qint64 > replyCount   = 0;
+    QAtomicInteger< qint64 > timeoutCount = 0;
+};
+
+// HTTP 长连接，回复写完后同一个 socket 交给新的 session 处理下一个请求
+struct KeepAliveOptions
+{
+    bool enabled     = false;
+    int  idleTimeout = 5 * 1000; // 毫秒，等待下一个请求的时间
+    int  maxRequests = 100;      // 一个连接最多处理的请求数，最后一个回复带 Connection: close
+};
+
+// HTTP/2，TLS 连接通过 ALPN 协商，每个流交给一个 Session 处理，处理函数不需要修改
+struct Http2Options
+{
+    bool enabled              = false;
+    int  maxConcurrentStreams = 100;              // 每个连接同时处理的流，超过的流会被拒绝（REFUSED_STREAM），客户端会重试
+    int  initialWindowSize    = 1024 * 1024;      // 字节，连接和每个流的接收窗口
+    int  idleTimeout          = 60 * 1000;        // 毫秒，没有流的连接超过这个时间后关闭
+    int  maxRequestBodySize   = 16 * 1024 * 1024; // 字节，每个流的请求体上限，超过时回复 413 并重置流
+    int  maxBufferedBodySize  = 16 * 1024 * 1024; // 字节，每个连接缓存的没有 Content-Length 的请求体总量，超过时回复 413 并重置流
+    int  maxHeaderListSize    = 64 * 1024;        // 字节，解码后的请求头总大小（每个头的名字 + 值 + 32），通过 SETTINGS_MAX_HEADER_LIST_SIZE 告知对端，超过时回复 431
+    int  maxResetsPerSecond   = 100;              // 每秒被重置的流超过这个数量时发送 GOAWAY（ENHANCE_YOUR_CALM）断开连接
+};
+
+class Http2Connection;
+
+// HTTP/2 连接上的一个流，对 Session 来说是一个 socket：
+// 读到的是转换成 HTTP/1.1 格式的请求，写入的 HTTP/1.1 回复会转换成 HEADERS 和 DATA 帧
+class JQLIBRARY_EXPORT Http2Stream: public QIODevice
+{
+    Q_OBJECT
+    Q_DISABLE_COPY( Http2Stream )
+
+public:
+    Http2Stream(const QPointer< Http2Connection > &connection, const quint32 streamId, const QPointer< QTcpSocket > &connectionSocket);
+
+    ~Http2Stream() override;
+
+    inline quint32 streamId() const { return streamId_; }
+
+    // 所在连接的 socket，用来读取对端地址和证书
+    inline QPointer< QTcpSocket > connectionSocket() const { return connectionSocket_; }
+
+    bool isSequential() const override;
+
+    qint64 bytesAvailable() const override;
+
+    qint64 bytesToWrite() const override;
+
+    void close() override;
+
+    // 以下由 Http2Connection 调用
+    // flowControlled 为 true 的是请求体，Session 读走后才归还对应的接收窗口
+    void appendRequestData(const QByteArray &data, const bool flowControlled = false);
+
+    void notifyBytesWritten(const qint64 written);
+
+    // 连接断开或者流被重置，之后的写入会被丢弃
+    void detachConnection();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    QPointer< Http2Connection > connection_;
+    quint32                     streamId_ = 0;
+    QPointer< QTcpSocket >      connectionSocket_;
+    QByteArray                  readBuffer_;
+    qint64                      unflowControlledBytes_ = 0; // readBuffer_ 开头不计入流量控制的字节（转换出来的请求头）
+    qint64                      pendingWrittenBytes_   = 0;
+};
+
+// WebSocket，带 Upgrade: websocket 的 GET 请求不交给处理函数，socket 交给 WebSocket
+struct WebSocketOptions
+{
+    bool        enabled           = false;
+    int         maxMessageSize    = 16 * 1024 * 1024; // 字节，收到的消息（解压后）超过后用 1009 关闭
+    int         pingInterval      = 30 * 1000;        // 毫秒，定时发送 ping，0 表示不发送
+    int         idleTimeout       = 90 * 1000;        // 毫秒，超过这个时间没有收到任何数据（包括 pong）后断开，0 表示不限制
+    qint64      maxBufferedSize   = 16 * 1024 * 1024; // 字节，发送缓冲超过后断开，读得太慢的客户端不能占满内存
+    qint64      maxPendingSize    = 16 * 1024 * 1024; // 字节，收到但是回调还没有处理的消息超过后用 1008 关闭
+    bool        perMessageDeflate = true;             // 客户端请求时启用 permessage-deflate，需要编译时找到 zlib
+    int         compressMinSize   = 256;              // 字节，小于这个大小的消息不压缩
+    QStringList allowedOrigins;                       // 允许的 Origin（例如 https://example.com），其他来源回复 403，为空时不检查
+};
+
+// WebSocket 的统计，每个 manager 一份，连接持有指针
+struct WebSocketStatistics
+{
+    QAtomicInteger< qint64 > overflowCount        = 0; // 发送缓冲超过上限被断开的连接数
+    QAtomicInteger< qint64 > pendingOverflowCount = 0; // 没有处理的消息超过上限被关闭的连接数
+    QAtomicInteger< qint64 > rejectedCount        = 0; // 握手被拒绝的次数
+};
+
+// 升级后的 WebSocket 连接，在服务线程里读写，收到的消息在处理线程池里按顺序回调
+class JQLIBRARY_EXPORT WebSocket: public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY( WebSocket )
+
+public:
+    enum EventType
+    {
+        OpenedEvent,
+        MessageEvent,
+        ClosedEvent
+    };
+
+    struct Event
+    {
+        EventType  type = OpenedEvent;
+        QByteArray data;
+        bool       isText    = false;
+        int        closeCode = 0;
+    };
+
+    WebSocket(const QPointer< QIODevice > &socket, const QString &requestUrl, const QMap< QString, QString > &requestHeader, const QString &requestSourceIp, const WebSocketOptions &webSocketOptions);
+
+    ~WebSocket() override;
+
+    inline QString requestUrl() const { return requestUrl_; }
+
+    QString requestUrlPath() const;
+
+    inline QMap< QString, QString > requestHeader() const { return requestHeader_; }
+
+    inline QString requestSourceIp() const { return requestSourceIp_; }
+
+    inline bool isPerMessageDeflate() const { return perMessageDeflate_; }
+
+    // 可以在任意线程调用，发送 close 之后返回 false
+    inline bool isConnected() const { return connected_.loadAcquire() != 0; }
+
+    // 有新的事件时在服务线程调用，同一时间只会有一个处理线程在取事件
+    inline void setEventCallback(const std::function< void() > &callback) { eventCallback_ = callback; }
+
+    // 没有事件时返回 false，之后的新事件会再次调用 eventCallback
+    bool takeEvent(Event &event);
+
+    // 在服务线程调用，回复 101 并处理已经从 socket 读出的数据
+    void start(const QByteArray &receivedData);
+
+    // 直接断开，不发送 close
+    void abort();
+
+    inline void setStatistics(const QSharedPointer< WebSocketStatistics > &statistics) { statistics_ = statistics; }
+
+    // 以下由 AbstractManage 调用，Closed 回调返回后在 AbstractManage 的锁里设置，之后处理线程不会再使用这个连接
+    inline void setClosedDelivered() { closedDelivered_.storeRelease( 1 ); }
+
+    inline bool isClosedDelivered() const { return closedDelivered_.loadAcquire() != 0; }
+
+public slots:
+    // 以下函数可以在任意线程调用
+    void sendText(const QString &message);
+
+    void sendBinary(const QByteArray &message);
+
+    void close(const int closeCode = 1000, const QString &reason = QString());
+
+private:
+    void onReadyRead();
+
+    void onDisconnected();
+
+    void onPingTimeout();
+
+    void processReceiveBuffer();
+
+    bool processFrame(const int opcode, const bool isFinal, const bool isCompressed, const QByteArray &payload);
+
+    void sendMessage(const int opcode, const QByteArray &message);
+
+    void writeFrame(const int opcode, const QByteArray &payload, const bool isCompressed = false);
+
+    void sendClose(const int closeCode, const QByteArray &reason = QByteArray());
+
+    void failConnection(const int closeCode);
+
+    void disconnectSocket();
+
+    // 没有处理的消息超过 maxPendingSize 时返回 false，不加入队列
+    bool pushEvent(const Event &event);
+
+private:
+    QPointer< QIODevice >    socket_;
+    QString                  requestUrl_;
+    QMap< QString, QString > requestHeader_;
+    QString                  requestSourceIp_;
+    WebSocketOptions         webSocketOptions_;
+
+    bool       perMessageDeflate_     = false;
+    int        serverMaxWindowBits_   = 15;
+    QByteArray receiveBuffer_;
+    int        messageOpcode_         = 0; // 正在接收的分片消息，0 表示没有
+    bool       messageCompressed_     = false;
+    QByteArray messageBuffer_;
+    bool       closeSent_             = false;
+    bool       closeReceived_         = false;
+    bool       failed_                = false;
+    bool       finished_              = false;
+    int        closeCode_             = 1006;
+    QAtomicInt connected_             = 0;
+    QTimer     pingTimer_;
+    QTimer     idleTimer_;
+
+    QMutex                  eventMutex_;
+    QQueue< Event >         events_;
+    qint64                  pendingSize_   = 0;
+    bool                    eventHandling_ = false;
+    std::function< void() > eventCallback_;
+    QAtomicInt              closedDelivered_ = 0;
+
+    QSharedPointer< WebSocketStatistics > statistics_;
+};
+
 class JQLIBRARY_EXPORT Session: public QObject
 {
     Q_OBJECT
     Q_DISABLE_COPY( Session )
 
 public:
-    Session( const QPointer< QTcpSocket > &socket );
+    // socket 可以是 QTcpSocket、QSslSocket、QLocalSocket 或者 Http2Stream
+    Session( const QPointer< QIODevice > &socket );
 
     virtual ~Session() override;
 
@@ -84,7 +334,59 @@ public:
 
     inline void setHandlingAccepted(const bool handlingAccepted) { handlingAccepted_ = handlingAccepted; }
 
-    inline QPointer< QTcpSocket > socket() { return socket_; }
+    inline void setWriteOptions(const WriteOptions &writeOptions) { writeOptions_ = writeOptions; }
+
+    inline void setWriteStatistics(const QSharedPointer< WriteStatistics > &writeStatistics) { writeStatistics_ = writeStatistics; }
+
+    inline void setDeferredReplyStatistics(const QSharedPointer< DeferredReplyStatistics > &deferredReplyStatistics) { deferredReplyStatistics_ = deferredReplyStatistics; }
+
+    inline void setKeepAliveOptions(const KeepAliveOptions &keepAliveOptions) { keepAliveOptions_ = keepAliveOptions; }
+
+    // 长连接的下一个请求：参数是 socket 和下一个请求的序号，返回接管 socket 的 session，返回空时关闭连接
+    inline void setKeepAliveCallback(const std::function< QPointer< Session >(const QPointer< QIODevice > &socket, const int requestIndex) > &callback) { keepAliveCallback_ = callback; }
+
+    // 连接以 HTTP/2 连接前言开头时（h2c prior knowledge），socket 和已经收到的数据交给这个回调，session 随后删除
+    inline void setHttp2PrefaceCallback(const std::function< void(const QPointer< QTcpSocket > &socket, const QByteArray &receivedData) > &callback) { http2PrefaceCallback_ = callback; }
+
+    // 收到 WebSocket 握手请求时，在回复 101 之前调用，返回 false 时不升级，没有回复的话回复 403
+    inline void setWebSocketAcceptCallback(const std::function< bool(const QPointer< Session > &session) > &callback) { webSocketAcceptCallback_ = callback; }
+
+    // 收到 WebSocket 握手请求时，socket 和已经收到的数据交给这个回调，session 随后删除
+    inline void setWebSocketUpgradeCallback(const std::function< void(const QPointer< Session > &session, const QPointer< QIODevice > &socket, const QByteArray &receivedData) > &callback) { webSocketUpgradeCallback_ = callback; }
+
+    // 这个请求是连接上的第几个请求，从 0 开始
+    inline int requestIndex() const { return requestIndex_; }
+
+    // 客户端证书已经验证通过，长连接上的后续请求会继承这个标记
+    inline void setPeerVerified(const bool peerVerified) { peerVerified_ = peerVerified; }
+
+    inline bool isPeerVerified() const { return peerVerified_; }
+
+    // 不是 TCP 连接（比如 Unix domain socket）时返回空
+    // HTTP/2 的流也返回空，所在连接上还有其他流，对端地址和证书用 requestSourceIp() 和 peerCertificate()
+    QPointer< QTcpSocket > socket();
+
+    inline bool isHttp2() const { return qobject_cast< Http2Stream * >( socket_.data() ) != nullptr; }
+
+    inline QPointer< QIODevice > ioDevice() { return socket_; }
+
+    // 延迟回复：调用后处理函数可以直接返回并释放处理线程，session 会保留到回复完成或者超时，超时自动回复 504
+    void deferReply(const int timeout = 30 * 1000);
+
+    inline bool isReplyDeferred() const { return replyDeferred_; }
+
+    // future 完成后在 session 所在线程调用 onFinished( QPointer< Session >, QFuture< T > )，期间不占用处理线程
+    template< typename T, typename Callback >
+    void replyWhenFinished(const QFuture< T > &future, const Callback &onFinished, const int timeout = 30 * 1000);
+
+    // 还没有收到请求数据，也没有在处理或者回复，需要在 session 所在线程调用
+    bool isIdle() const;
+
+    // 立即断开连接，正在运行的处理函数之后的回复会被丢弃
+    void abort();
+
+    // 断开连接，处理函数返回之后再删除，需要在 session 所在线程调用
+    void abortAndDeleteLater();
 
 
     QString requestSourceIp() const;
@@ -141,12 +443,29 @@ private:
 
     void onBytesWritten(const qint64 written);
 
+    qint64 nextWriteChunkSize();
+
     void onStateChanged(const QAbstractSocket::SocketState &socketState);
 
+    bool isSocketConnected() const;
+
+    void disconnectSocket();
+
+    void onDeferredReplyTimeout();
+
+    QByteArray withConnectionHeader(const QByteArray &replyHeader) const;
+
+    bool handOverSocket();
+
+    bool handOverHttp2Connection();
+
+    bool handOverWebSocket();
+
 private:
     static QAtomicInt remainSession_;
 
-    QPointer< QTcpSocket >                               socket_;
+    QPointer< QIODevice >                                socket_;
+    QList< QMetaObject::Connection >                     socketConnections_;
     std::function< void( const QPointer< Session > & ) > handleAcceptedCallback_;
     QSharedPointer< QTimer >                             autoCloseTimer_;
 
@@ -162,6 +481,7 @@ private:
     bool   headerAcceptedFinished_  = false;
     bool   contentAcceptedFinished_ = false;
     bool   handlingAccepted_        = false;
+    bool   replyDeferred_           = false;
     qint64 contentLength_           = -1;
 
     int        replyHttpCode_ = -1;
@@ -170,6 +490,204 @@ private:
 
     qint64                      waitWrittenByteCount_ = -1;
     QSharedPointer< QIODevice > replyIoDevice_;
+
+    WriteOptions                      writeOptions_;
+    QSharedPointer< WriteStatistics > writeStatistics_;
+    int                               sendBufferSize_ = -1;
+
+    QSharedPointer< DeferredReplyStatistics > deferredReplyStatistics_;
+
+    KeepAliveOptions                                                                          keepAliveOptions_;
+    std::function< QPointer< Session >(const QPointer< QIODevice > &socket, const int requestIndex) > keepAliveCallback_;
+    bool                                                                                      keepAlive_    = false;
+    int                                                                                       requestIndex_ = 0;
+    bool                                                                                      peerVerified_ = false;
+    QByteArray                                                                                pendingData_; // 长连接上已经收到的下一个请求的数据
+
+    std::function< void(const QPointer< QTcpSocket > &socket, const QByteArray &receivedData) > http2PrefaceCallback_;
+    std::function< bool(const QPointer< Session > &session) > webSocketAcceptCallback_;
+    std::function< void(const QPointer< Session > &session, const QPointer< QIODevice > &socket, const QByteArray &receivedData) > webSocketUpgradeCallback_;
+};
+
+enum HandlePriority
+{
+    LowHandlePriority    = 0,
+    NormalHandlePriority = 50,
+    HighHandlePriority   = 100,
+};
+
+enum HandleScalePolicy
+{
+    FixedHandleScalePolicy,        // 线程数固定为 maxThreadCount
+    QueueLatencyHandleScalePolicy, // 根据排队等待时间在 [min, max] 之间伸缩，适合阻塞 I/O 的处理函数
+    CpuBoundHandleScalePolicy,     // 每个核心一个线程（限制在 [min, max] 之内），适合纯计算的处理函数
+};
+
+class HandlePoolScaler;
+
+class JQLIBRARY_EXPORT HandlePool
+{
+    Q_DISABLE_COPY( HandlePool )
+    friend class HandlePoolScaler;
+
+private:
+    struct Task
+    {
+        std::function< void() > callback;
+        int                     priority    = NormalHandlePriority;
+        qint64                  enqueueTime = 0;
+    };
+
+public:
+    HandlePool(const QString &name, const int maxThreadCount);
+
+    ~HandlePool();
+
+    inline QString name() const { return name_; }
+
+    inline QSharedPointer< QThreadPool > threadPool() { return threadPool_; }
+
+    // 每等待 agingInterval 毫秒，任务的有效优先级 +1，防止低优先级任务饿死
+    inline void setPriorityAgingInterval(const int agingInterval) { priorityAgingInterval_ = qMax( 1, agingInterval ); }
+
+    void setScalePolicy(const HandleScalePolicy scalePolicy, const int minThreadCount, const int maxThreadCount, const int targetQueueLatency = 50);
+
+    // 处理线程可以运行的核心，空表示不限制，nodeLocalMemory 为 true 时优先从这些核心所在的 NUMA 节点分配内存，仅 Linux
+    void setCpuAffinity(const QList< int > &cpus, const bool nodeLocalMemory = false);
+
+    QList< int > cpuAffinity() const;
+
+    void start(const std::function< void() > &callback, const int priority = NormalHandlePriority);
+
+    void waitForDone();
+
+    QJsonObject status() const;
+
+private:
+    void runWorker();
+
+    bool takeTask(Task &task);
+
+    // 由伸缩线程定时调用
+    void scale();
+
+    void autoScale(const qint64 currentTime);
+
+    void setThreadCount(const int threadCount);
+
+private:
+    QString                       name_;
+    QSharedPointer< QThreadPool > threadPool_;
+    QElapsedTimer                 elapsedTimer_;
+
+    mutable QMutex              mutex_;
+    QMap< int, QQueue< Task > > queues_;    // priority -> FIFO
+    int                         queueDepth_            = 0;
+    int                         maxQueueDepth_         = 0;
+    int                         workerCount_           = 0;
+    int                         priorityAgingInterval_ = 10;
+    qint64                      agedTakeCount_         = 0;
+    QList< int >                cpus_;
+    bool                        nodeLocalMemory_       = false;
+    QAtomicInt                  cpuAffinityGeneration_ = 0;
+
+    HandleScalePolicy scalePolicy_         = FixedHandleScalePolicy;
+    int               minThreadCount_      = 1;
+    int               maxThreadCount_      = 1;
+    int               targetQueueLatency_  = 50;
+    qint64            scaleWindowStart_    = 0;
+    qint64            scaleWindowWait_     = 0;    // 窗口内出队任务的等待时间总和，毫秒
+    qint64            scaleWindowTaken_    = 0;
+    qint64            scaleWindowBusy_     = 0;    // 窗口内出队时正在运行的任务数之和
+    qint64            scaleUpCount_        = 0;
+    qint64            scaleDownCount_      = 0;
+    double            lastQueueLatency_    = 0;
+    double            lastThroughput_      = 0;
+    qint64            lastFinishedCount_   = 0;
+    int               lastScaleAction_     = 0;    // 1: 扩容, -1: 缩容
+    double            lastScaleThroughput_ = 0;
+
+    QAtomicInt               runningCount_  = 0;
+    QAtomicInteger< qint64 > startedCount_  = 0;
+    QAtomicInteger< qint64 > finishedCount_ = 0;
+};
+
+template< typename T, typename Callback >
+void Session::replyWhenFinished(const QFuture< T > &future, const Callback &onFinished, const int timeout)
+{
+    this->deferReply( timeout );
+
+    // QFutureWatcher 需要事件循环，所以放到 session 所在的线程创建
+    QTimer::singleShot( 0, this, [ this, future, onFinished ]()
+    {
+        auto watcher = new QFutureWatcher< T >( this );
+
+        QObject::connect( watcher, &QFutureWatcherBase::finished, this, [ this, watcher, onFinished ]()
+        {
+            watcher->deleteLater();
+            onFinished( QPointer< Session >( this ), watcher->future() );
+        } );
+
+        watcher->setFuture( future );
+    } );
+}
+
+enum EventBackend
+{
+    QtEventBackend,      // Qt 默认的事件分发器（Unix 下是 poll）
+    EpollEventBackend,   // 仅 Linux，其他平台或者创建失败时回退到 QtEventBackend
+    IoUringEventBackend, // 仅 Linux 且编译时找到了 liburing，内核不支持时回退到 EpollEventBackend
+};
+
+// 监听地址，localServerName 不为空时是 Unix domain socket（忽略 address 和 port）
+// socketDescriptor 不为 -1 时直接使用这个已经 listen 的 socket（TCP 或者 Unix domain socket），忽略其他字段
+struct ListenEndpoint
+{
+    QHostAddress address = QHostAddress::Any; // Any 是双栈，AnyIPv4 和 AnyIPv6 可以分别监听同一个端口
+    quint16      port    = 0;
+    QString      localServerName;
+    qintptr      socketDescriptor = -1;
+
+    ListenEndpoint() = default;
+
+    ListenEndpoint(const QHostAddress &listenAddress, const quint16 listenPort): address( listenAddress ), port( listenPort ) { }
+
+    ListenEndpoint(const QString &listenLocalServerName): localServerName( listenLocalServerName ) { }
+
+    // 父进程传下来的监听 socket，关闭服务时会关闭这个 socket
+    static inline ListenEndpoint fromSocketDescriptor(const qintptr listenSocketDescriptor)
+    {
+        ListenEndpoint result;
+        result.socketDescriptor = listenSocketDescriptor;
+        return result;
+    }
+};
+
+// 目前只在 Unix 下生效
+struct SocketOptions
+{
+    bool noDelay             = true;  // TCP_NODELAY，接受连接时设置
+    bool quickAck            = false; // TCP_QUICKACK（Linux），接受连接时设置，内核之后会自动恢复延迟确认
+    int  sendBufferSize      = 0;     // SO_SNDBUF，0 表示系统默认，设置在监听 socket 上由连接继承
+    int  receiveBufferSize   = 0;     // SO_RCVBUF，同上
+    int  fastOpenQueueLength = 0;     // TCP_FASTOPEN，监听 socket，0 表示关闭
+    int  deferAcceptTimeout  = 0;     // TCP_DEFER_ACCEPT（Linux），秒，监听 socket，0 表示关闭
+    bool reusePort           = false; // SO_REUSEPORT，多个进程各自监听同一个端口，由内核分配连接，只在 bind 时生效，对继承来的 fd 无效
+};
+
+// 线程绑核，仅 Linux，需要在 listen 之前设置
+struct CpuAffinity
+{
+    QList< int > serverThreadCpus; // 服务线程（I/O）可以运行的核心，空表示不限制
+    QList< int > handleThreadCpus; // 默认处理线程池可以运行的核心，空表示服务线程所在 NUMA 节点的其他核心（serverThreadCpus 也为空时不限制）
+    bool         nodeLocalMemory = false; // 线程优先从自己所在的 NUMA 节点分配内存（MPOL_PREFERRED），session 的缓冲区在服务线程里分配
+};
+
+struct ShutdownResult
+{
+    int completedCount  = 0; // 开始关闭时在处理中、截止时间之前处理完成的连接
+    int abortedCount    = 0; // 截止时间到了强制断开的连接，处理函数返回后删除，包括关闭过程中长连接上的新请求
+    int idleClosedCount = 0; // 还没有收到请求，直接关闭的连接
 };
 
 class JQLIBRARY_EXPORT AbstractManage: public QObject
@@ -184,12 +702,104 @@ public:
 
     inline void setHttpAcceptedCallback(const std::function< void(const QPointer< Session > &session) > &httpAcceptedCallback) { httpAcceptedCallback_ = httpAcceptedCallback; }
 
+    inline void setHandlePoolSelector(const std::function< QSharedPointer< HandlePool >(const QPointer< Session > &session) > &handlePoolSelector) { handlePoolSelector_ = handlePoolSelector; }
+
+    inline void setPriorityClassifier(const std::function< int(const QPointer< Session > &session) > &priorityClassifier) { priorityClassifier_ = priorityClassifier; }
+
+    inline QSharedPointer< HandlePool > handlePool() { return handlePool_; }
+
     inline QSharedPointer< QThreadPool > handleThreadPool() { return handleThreadPool_; }
 
     inline QSharedPointer< QThreadPool > serverThreadPool() { return serverThreadPool_; }
 
+    // 需要在 listen 之前设置
+    inline void setEventBackend(const EventBackend &eventBackend) { eventBackend_ = eventBackend; }
+
+    inline EventBackend eventBackend() const { return eventBackend_; }
+
+    // 需要在 listen 之前设置，backlog 的实际上限由 net.core.somaxconn 决定
+    inline void setListenBacklog(const int listenBacklog) { listenBacklog_ = listenBacklog; }
+
+    inline void setMaxPendingConnections(const int maxPendingConnections) { maxPendingConnections_ = maxPendingConnections; }
+
+    inline void setSocketOptions(const SocketOptions &socketOptions) { socketOptions_ = socketOptions; }
+
+    inline SocketOptions socketOptions() const { return socketOptions_; }
+
+    // 需要 minChunkSize > 0、0 <= lowWatermark <= highWatermark，否则返回 false，保留原来的设置
+    bool setWriteOptions(const WriteOptions &writeOptions);
+
+    inline WriteOptions writeOptions() const { return writeOptions_; }
+
+    static bool isWriteOptionsValid(const WriteOptions &writeOptions);
+
+    inline void setKeepAliveOptions(const KeepAliveOptions &keepAliveOptions) { keepAliveOptions_ = keepAliveOptions; }
+
+    inline KeepAliveOptions keepAliveOptions() const { return keepAliveOptions_; }
+
+    // 需要在 listen 之前设置，SslServerManage 通过 ALPN 协商，TcpServerManage 识别连接前言（h2c prior knowledge）
+    inline void setHttp2Options(const Http2Options &http2Options) { http2Options_ = http2Options; }
+
+    inline Http2Options http2Options() const { return http2Options_; }
+
+    // 需要在 listen 之前设置
+    inline void setWebSocketOptions(const WebSocketOptions &webSocketOptions) { webSocketOptions_ = webSocketOptions; }
+
+    inline WebSocketOptions webSocketOptions() const { return webSocketOptions_; }
+
+    // 在服务线程里、回复 101 之前调用，可以检查认证信息，返回 false 时不升级，回调里没有回复的话回复 403
+    // 不经过 httpAcceptedCallback，不要在这里做耗时的操作
+    inline void setWebSocketAcceptCallback(const std::function< bool(const QPointer< Session > &session) > &callback) { webSocketAcceptCallback_ = callback; }
+
+    // 以下回调在处理线程池里执行，同一个连接的回调按顺序执行，不会并发
+    inline void setWebSocketOpenedCallback(const std::function< void(const QPointer< WebSocket > &webSocket) > &callback) { webSocketOpenedCallback_ = callback; }
+
+    inline void setWebSocketMessageCallback(const std::function< void(const QPointer< WebSocket > &webSocket, const QByteArray &message, const bool isText) > &callback) { webSocketMessageCallback_ = callback; }
+
+    // closeCode：收到 close 时是对端的关闭码，协议错误时是服务端发出的关闭码，直接断开时是 1006，回调返回后 WebSocket 会被删除
+    inline void setWebSocketClosedCallback(const std::function< void(const QPointer< WebSocket > &webSocket, const int closeCode) > &callback) { webSocketClosedCallback_ = callback; }
+
+    // 当前打开的 WebSocket 连接，用来推送消息
+    QList< QPointer< WebSocket > > webSockets();
+
+    inline QList< ListenEndpoint > listenEndpoints() const { return listenEndpoints_; }
+
+    inline void setCpuAffinity(const CpuAffinity &cpuAffinity) { cpuAffinity_ = cpuAffinity; }
+
+    inline CpuAffinity cpuAffinity() const { return cpuAffinity_; }
+
     virtual bool isRunning() = 0;
 
+    virtual QJsonObject status();
+
+    // systemd socket 激活（LISTEN_PID / LISTEN_FDS / LISTEN_FDNAMES）传下来的监听 socket，name 为空时返回全部
+    static QList< ListenEndpoint > systemdListenEndpoints(const QString &name = QString());
+
+    // Unix domain socket 地址，或者是 Unix domain socket 的监听 socket
+    static bool isLocalListenEndpoint(const ListenEndpoint &listenEndpoint);
+
+    // 每个 NUMA 节点的核心，来自 /sys/devices/system/node，不是 Linux 或者没有 NUMA 信息时返回一个包含所有核心的节点
+    static QList< QList< int > > numaNodeCpus();
+
+    // 解析 "0-3,8,10-11" 格式的核心列表
+    static QList< int > cpuListFromString(const QString &cpuList);
+
+    // 平滑升级，旧进程：在 handoffServerName 上等待新进程，把 TCP 监听 socket 通过 SCM_RIGHTS 交给新进程后停止 accept，
+    // 然后发出 listenSocketsHandedOff，已经接受的连接继续处理。只接受同一个用户的进程，名字正在被其他进程使用时返回 false。仅 Unix
+    bool startListenSocketHandoff(const QString &handoffServerName);
+
+    // 平滑升级，新进程：从旧进程取得监听 socket，没有旧进程时返回空，这时正常 listen 即可，对端不是同一个用户时也返回空
+    static QList< ListenEndpoint > receiveListenSockets(const QString &handoffServerName, const int timeout = 5000);
+
+    // 关闭监听 socket，已经接受的连接不受影响
+    void stopAccepting();
+
+    // 等待已经接受的连接全部结束，超时返回 false
+    bool waitForSessionsFinished(const int timeout);
+
+    // 停止 accept，关闭空闲连接，等待正在处理的请求完成，deadline 毫秒后强制断开剩下的连接，最后停止服务线程
+    ShutdownResult shutdown(const int deadline);
+
 protected Q_SLOTS:
     bool initialize();
 
@@ -200,28 +810,112 @@ protected:
 
     virtual void onFinish() = 0;
 
+    // 在服务线程关闭监听的 server
+    virtual void onStopAccepting() { }
+
+    // 明文 TCP 连接上是否识别 h2c 的连接前言，TLS 连接只通过 ALPN 使用 HTTP/2
+    virtual bool isHttp2CleartextSupported() const { return false; }
+
     bool startServerThread();
 
     void stopHandleThread();
 
     void stopServerThread();
 
+    bool listenTcpServer(QTcpServer *tcpServer, const ListenEndpoint &listenEndpoint);
+
+    QLocalServer *listenLocalServer(const ListenEndpoint &listenEndpoint);
+
+    void onConnectionAccepted(const qintptr socketDescriptor, const qintptr listenSocketDescriptor);
+
     void newSession(const QPointer< Session > &session);
 
+    // socket 已经确定使用 HTTP/2，receivedData 是已经从 socket 读出的数据
+    void newHttp2Connection(const QPointer< QTcpSocket > &socket, const QByteArray &receivedData);
+
+    // 在服务线程断开所有 HTTP/2 连接
+    void closeHttp2Connections();
+
+    QList< QPointer< Http2Connection > > takeHttp2Connections();
+
+    void newWebSocket(const QPointer< Session > &session, const QPointer< QIODevice > &socket, const QByteArray &receivedData);
+
+    // 断开所有 WebSocket 连接，等 Closed 回调返回后在服务线程删除
+    void closeWebSockets();
+
+    // 握手请求的 Origin 不在 allowedOrigins 里时回复 403
+    bool acceptWebSocket(const QPointer< Session > &session);
+
+    void handleWebSocketEvents(const QPointer< WebSocket > &webSocket);
+
     void handleAccepted(const QPointer< Session > &session);
 
+private:
+    void onHandoffConnection();
+
+    // 关闭交接用的 socket，socket 文件仍然是自己创建的那个时才删除，新进程可能已经在同一个名字上 listen
+    void closeListenSocketHandoff();
+
 signals:
     void readyToClose();
 
+    void listenSocketsHandedOff();
+
 protected:
     QSharedPointer< QThreadPool > serverThreadPool_;
+    QSharedPointer< HandlePool >  handlePool_;
     QSharedPointer< QThreadPool > handleThreadPool_;
 
+    QSharedPointer< QThread >            serverThread_;
+    qint64                               serverThreadId_ = 0;
+    EventBackend                         eventBackend_   = QtEventBackend;
+    QPointer< QAbstractEventDispatcher > eventDispatcher_;
+
+    QList< ListenEndpoint >  listenEndpoints_;
+    QList< qintptr >         listenSocketDescriptors_;
+    QPointer< QSocketNotifier > handoffNotifier_;
+    QByteArray               handoffPath_;
+    quint64                  handoffPathDevice_     = 0;
+    quint64                  handoffPathInode_      = 0;
+    int                      listenBacklog_         = 1024;
+    int                      maxPendingConnections_ = 30;
+    SocketOptions            socketOptions_;
+    WriteOptions             writeOptions_;
+    QSharedPointer< WriteStatistics > writeStatistics_;
+    QSharedPointer< DeferredReplyStatistics > deferredReplyStatistics_;
+    KeepAliveOptions         keepAliveOptions_;
+    bool                     acceptingStopped_      = false;
+    QAtomicInteger< qint64 > keepAliveRequestCount_ = 0;
+    Http2Options             http2Options_;
+    QAtomicInteger< qint64 > http2ConnectionCount_  = 0;
+    QAtomicInteger< qint64 > http2StreamCount_      = 0;
+    QAtomicInteger< qint64 > http2CleartextCount_   = 0;
+    WebSocketOptions         webSocketOptions_;
+    QAtomicInteger< qint64 > webSocketCount_        = 0;
+    QAtomicInteger< qint64 > webSocketMessageCount_ = 0;
+    QSharedPointer< WebSocketStatistics > webSocketStatistics_;
+    CpuAffinity              cpuAffinity_;
+    QAtomicInteger< qint64 > localNodeHandleCount_  = 0;
+    QAtomicInteger< qint64 > crossNodeHandleCount_  = 0;
+    QAtomicInteger< qint64 > acceptedCount_         = 0;
+    QAtomicInteger< qint64 > acceptErrorCount_      = 0;
+    QAtomicInteger< qint64 > acceptQueueFullCount_  = 0;
+    QAtomicInt               maxAcceptQueueLength_  = 0;
+
     QMutex mutex_;
 
-    std::function< void(const QPointer< Session > &session) > httpAcceptedCallback_;
+    std::function< void(const QPointer< Session > &session) >                         httpAcceptedCallback_;
+    std::function< QSharedPointer< HandlePool >(const QPointer< Session > &session) > handlePoolSelector_;
+    std::function< int(const QPointer< Session > &session) >                          priorityClassifier_;
 
-    QSet< Session * > availableSessions_;
+    std::function< bool(const QPointer< Session > &session) >                                                     webSocketAcceptCallback_;
+    std::function< void(const QPointer< WebSocket > &webSocket) >                                                 webSocketOpenedCallback_;
+    std::function< void(const QPointer< WebSocket > &webSocket, const QByteArray &message, const bool isText) > webSocketMessageCallback_;
+    std::function< void(const QPointer< WebSocket > &webSocket, const int closeCode) >                           webSocketClosedCallback_;
+
+    QSet< Session * >         availableSessions_;
+    QSet< Http2Connection * > http2Connections_;
+    QSet< WebSocket * >       webSockets_;
 };
 
 class JQLIBRARY_EXPORT TcpServerManage: public AbstractManage
@@ -236,6 +930,9 @@ public:
 
     bool listen( const QHostAddress &address, const quint16 port );
 
+    // 所有地址共用一个服务线程和处理线程池，可以混合 IPv4、IPv6、多个端口和 Unix domain socket
+    bool listen( const QList< ListenEndpoint > &listenEndpoints );
+
 private:
     bool isRunning() override;
 
@@ -243,16 +940,102 @@ private:
 
     void onFinish() override;
 
+    void onStopAccepting() override;
+
+    bool isHttp2CleartextSupported() const override { return true; }
+
+    void closeServers();
+
+private:
+    QList< QPointer< QTcpServer > >   tcpServers_;
+    QList< QPointer< QLocalServer > > localServers_;
+};
+
+// HTTP over Unix domain socket（Windows 下是命名管道），适合同一台机器上的 sidecar 或者反向代理
+class JQLIBRARY_EXPORT LocalServerManage: public AbstractManage
+{
+    Q_OBJECT
+    Q_DISABLE_COPY( LocalServerManage )
+
+public:
+    LocalServerManage(const int handleMaxThreadCount = 2);
+
+    virtual ~LocalServerManage() override;
+
+    // serverName 可以是名字（放在系统临时目录）或者完整路径，已经存在的同名 socket 文件会被删除
+    bool listen( const QString &serverName );
+
+    inline QString fullServerName() const { return fullServerName_; }
+
+private:
+    bool isRunning() override;
+
+    bool onStart() override;
+
+    void onFinish() override;
+
+    void onStopAccepting() override;
+
 private:
-    QPointer< QTcpServer > tcpServer_;
+    QPointer< QLocalServer > localServer_;
+
+    QString listenServerName_;
+    QString fullServerName_;
+};
+
+#ifdef Q_OS_UNIX
+// 多进程（prefork）模式，Prefork::run 必须在创建 QCoreApplication 和任何线程之前调用
+class JQLIBRARY_EXPORT Prefork
+{
+public:
+    struct Options
+    {
+        int           workerCount  = 0;         // 0 表示 CPU 核心数
+        int           restartDelay = 1000;      // 毫秒，worker 退出后等待多久重新 fork，防止崩溃循环
+        int           stopTimeout  = 10 * 1000; // 毫秒，收到 SIGTERM 后等待 worker 退出（watchStop 的回调里完成处理中的请求）的时间，超时 SIGKILL
+        int           listenBacklog = 1024;
+        SocketOptions socketOptions;
+
+        // 不为空时由 supervisor 创建监听 socket，worker 继承同一个 socket；为空时 worker 自己用 SocketOptions::reusePort 监听
+        QList< ListenEndpoint > listenEndpoints;
+
+        // supervisor 收到 worker 的统计信息时调用，参数是所有 worker 的汇总
+        std::function< void(const QJsonObject &status) > statusCallback;
+    };
+
+    // supervisor 进程一直运行到收到 SIGTERM 或者 SIGINT，返回 -1；worker 进程返回 worker 序号，调用方接着创建 QCoreApplication 和服务
+    static int run(const Options &options);
+
+    // worker 进程中使用，supervisor 创建的监听 socket
+    static QList< ListenEndpoint > listenEndpoints();
 
-    QHostAddress listenAddress_ = QHostAddress::Any;
-    quint16 listenPort_ = 0;
+    // worker 进程中使用，创建 QCoreApplication 之后调用。supervisor 停止（或者 worker 直接收到 SIGTERM、SIGINT）时
+    // 在主线程调用 callback，通常是 manage.shutdown() 然后 QCoreApplication::quit()；没有调用时 worker 收到信号直接退出
+    static bool watchStop(const std::function< void() > &callback);
+
+    // worker 进程中使用，把统计信息（通常是 manage.status()）发给 supervisor
+    static bool reportStatus(const QJsonObject &status);
 };
+#endif
 
 #ifndef QT_NO_SSL
 class SslServerHelper;
 
+struct HandshakeOptions
+{
+    int threadCount = 0;         // 专用握手线程数，0 表示在服务线程里握手
+    int maxInFlight = 0;         // 同时进行的握手上限，达到后暂停 accept，新连接留在内核的 accept 队列里，0 表示不限制
+    int timeout     = 10 * 1000; // 毫秒，握手超时后断开，<= 0 表示握手不限时（多证书时等待 ClientHello 仍然按默认的 10 秒）
+};
+
+// 一套证书链和私钥，私钥的算法（RSA、EC）自动识别
+struct ServerCertificate
+{
+    QString     crtFilePath;
+    QString     keyFilePath;
+    QStringList hostNames; // 按 SNI 选择证书时匹配的主机名，支持 *.example.com，为空时作为默认证书
+};
+
 class JQLIBRARY_EXPORT SslServerManage: public AbstractManage
 {
     Q_OBJECT
@@ -269,6 +1052,40 @@ public:
         const QString &     crtFilePath,
         const QString &     keyFilePath );
 
+    // 只支持 TCP 地址
+    bool listen(
+        const QList< ListenEndpoint > &listenEndpoints,
+        const QString &                crtFilePath,
+        const QString &                keyFilePath );
+
+    // 多套证书时，握手前先读取（MSG_PEEK）ClientHello，按 SNI 选择主机名匹配的证书，
+    // 同时有 RSA 和 EC 证书时，客户端支持 ECDSA 签名就用 EC 证书
+    bool listen(
+        const QList< ListenEndpoint > &  listenEndpoints,
+        const QList< ServerCertificate > &certificates );
+
+    // 重新读取证书文件，新的握手使用新证书，已经建立的连接不受影响；读取失败时继续使用原来的证书
+    bool reloadCertificates();
+
+    bool reloadCertificates(const QList< ServerCertificate > &certificates);
+
+    // 需要在 listen 之前设置，证书文件变化（包括被替换）后自动 reloadCertificates，资源文件（:/）不监视
+    inline void setWatchCertificateFiles(const bool watchCertificateFiles) { watchCertificateFiles_ = watchCertificateFiles; }
+
+    inline bool watchCertificateFiles() const { return watchCertificateFiles_; }
+
+    // 默认不要求客户端证书，QueryPeer 请求客户端证书但不校验，交给 Service 的 certificateVerifier 判断
+    void setPeerVerifyMode(const QSslSocket::PeerVerifyMode peerVerifyMode);
+
+    QSslSocket::PeerVerifyMode peerVerifyMode();
+
+    // 需要在 listen 之前设置
+    inline void setHandshakeOptions(const HandshakeOptions &handshakeOptions) { handshakeOptions_ = handshakeOptions; }
+
+    inline HandshakeOptions handshakeOptions() const { return handshakeOptions_; }
+
+    QJsonObject status() override;
+
 private:
     bool isRunning() override;
 
@@ -276,13 +1093,72 @@ private:
 
     void onFinish() override;
 
-private:
-    QPointer< SslServerHelper > tcpServer_;
+    void onStopAccepting() override;
+
+    void closeServers();
+
+    void startCertificateWatcher();
+
+    // 只有一套证书时直接开始握手，否则先等 ClientHello 到达再选择证书
+    void selectCertificate(const qintptr socketDescriptor, const QPointer< SslServerHelper > &tcpServer);
+
+    QSharedPointer< QSslConfiguration > sslConfigurationFor(const QString &serverName, const bool ecdsaSupported);
+
+    void startHandshake(const qintptr socketDescriptor, const QPointer< SslServerHelper > &tcpServer, const QSharedPointer< QSslConfiguration > &sslConfiguration);
 
-    QHostAddress listenAddress_ = QHostAddress::Any;
-    quint16      listenPort_    = 0;
+    // 握手完成，在服务线程按 ALPN 的结果交给 Session 或者 HTTP/2 连接
+    void onEncrypted(QSslSocket *sslSocket);
 
-    QSharedPointer< QSslConfiguration > sslConfiguration_;
+    // 等待 ClientHello 的连接也算进行中的握手，达到 maxInFlight 时暂停 accept
+    void increaseHandshakeInFlight();
+
+    // 任意线程调用，恢复 accept 的操作投递到 tcpServer 所在的服务线程
+    void decreaseHandshakeInFlight(const QPointer< SslServerHelper > &tcpServer);
+
+    // 超时的握手只计入 timeoutCount，不计入 failedCount
+    void onHandshakeFinished(const bool succeed, const bool timedOut, const qint64 latency, const QPointer< SslServerHelper > &tcpServer);
+
+private:
+    struct CertificateContext
+    {
+        ServerCertificate                   certificate;
+        QSsl::KeyAlgorithm                  keyAlgorithm = QSsl::Rsa;
+        QSharedPointer< QSslConfiguration > sslConfiguration;
+        qint64                              selectedCount = 0;
+    };
+
+    QList< QPointer< SslServerHelper > > tcpServers_;
+
+    QList< CertificateContext > certificates_;
+    QSet< QSocketNotifier * >   clientHelloNotifiers_;
+    qint64                      clientHelloTimeoutCount_ = 0;
+
+    QSslSocket::PeerVerifyMode     peerVerifyMode_        = QSslSocket::VerifyNone;
+    bool                           watchCertificateFiles_ = false;
+    QPointer< QFileSystemWatcher > certificateWatcher_;
+    qint64                         certificateReloadCount_       = 0;
+    qint64                         certificateReloadFailedCount_ = 0;
+    qint64                         lastCertificateReloadTime_    = 0; // 毫秒时间戳
+
+    HandshakeOptions                   handshakeOptions_;
+    QList< QSharedPointer< QThread > > handshakeThreads_;
+    int                                handshakeThreadIndex_ = 0;
+    QSet< QSslSocket * >               handshakingSockets_;
+    bool                               handshakeClosing_ = false;
+    bool                               acceptPaused_     = false;
+    QElapsedTimer                      handshakeElapsedTimer_;
+
+    int    handshakeInFlight_        = 0;
+    int    maxHandshakeInFlight_     = 0;
+    qint64 handshakeSucceedCount_    = 0;
+    qint64 handshakeFailedCount_     = 0;
+    qint64 handshakeTimeoutCount_    = 0;
+    qint64 acceptPauseCount_         = 0;
+    qint64 handshakeLatencySum_      = 0;  // 毫秒，成功的握手
+    qint64 maxHandshakeLatency_      = 0;
+    qint64 handshakeRateWindowStart_ = 0;
+    qint64 handshakeRateWindowCount_ = 0;
+    double lastHandshakeRate_        = 0;  // 每秒完成的握手数，按 1 秒的窗口统计
 };
 
 
@@ -295,6 +1171,48 @@ enum ServiceConfigEnum
     ServiceUuid,
     ServiceSslCrtFilePath,
     ServiceSslKeyFilePath,
+    ServiceSslCertificates, // QVariantList of QVariantMap: crtFilePath, keyFilePath, hostNames (QStringList), replaces crt / key file path
+    ServiceSslWatchCertificateFiles, // bool, reload certificates when the files change, default false
+    ServiceRouteHandleMaxThreadCount, // QVariantMap: apiPath -> maxThreadCount, dedicated pool per route
+    ServiceRoutePriority, // QVariantMap: apiPath -> HandlePriority (int)
+    ServicePriorityHeader, // QString: request header carrying priority, "high" / "normal" / "low" or int
+    ServicePriorityAgingInterval, // int: ms of queue wait per +1 effective priority
+    ServiceHandleMinThreadCount, // int, default 2
+    ServiceHandleMaxThreadCount, // int, default same as min
+    ServiceHandleScalePolicy, // HandleScalePolicy (int), default FixedHandleScalePolicy
+    ServiceHandleTargetQueueLatency, // int: ms, queue wait that triggers growing the pool, default 50
+    ServiceEventBackend, // EventBackend (int), default QtEventBackend
+    ServiceListenBacklog, // int, default 1024 (capped by net.core.somaxconn)
+    ServiceMaxPendingConnections, // int, default 30
+    ServiceSocketNoDelay, // bool, default true
+    ServiceSocketQuickAck, // bool, default false
+    ServiceSocketSendBufferSize, // int: bytes, default 0 (system default)
+    ServiceSocketReceiveBufferSize, // int: bytes, default 0 (system default)
+    ServiceSocketFastOpenQueueLength, // int, default 0 (disabled)
+    ServiceSocketDeferAcceptTimeout, // int: seconds, default 0 (disabled)
+    ServiceWriteLowWatermark, // qint64: bytes, default 64 KB
+    ServiceWriteHighWatermark, // qint64: bytes, default 1 MB
+    ServiceWriteMinChunkSize, // qint64: bytes, default 16 KB
+    ServiceHttpListenEndpoints, // QStringList: "0.0.0.0:80", "[::]:80", "unix:/run/app.sock", "fd:3", "systemd" or "systemd:name", replaces ServiceHttpListenPort
+    ServiceHttpsListenEndpoints, // QStringList: same as ServiceHttpListenEndpoints (TCP only), replaces ServiceHttpsListenPort
+    ServiceSocketReusePort, // bool, default false
+    ServiceServerThreadCpus, // QString: cpu list like "0" or "0-3,8", Linux only, default empty (no pinning)
+    ServiceHandleThreadCpus, // QString: cpu list, default empty (other cpus on the server thread's NUMA node)
+    ServiceNodeLocalMemory, // bool, default false
+    ServiceHandshakeThreadCount, // int: dedicated TLS handshake threads, default 0 (handshake on the server thread)
+    ServiceHandshakeMaxInFlight, // int: concurrent TLS handshakes before accept pauses, default 0 (unlimited)
+    ServiceHandshakeTimeout, // int: ms, default 10000
+    ServiceKeepAliveEnabled, // bool, default false
+    ServiceKeepAliveIdleTimeout, // int: ms, default 5000
+    ServiceKeepAliveMaxRequests, // int, default 100
+    ServiceHandoffServerName, // QString: local socket name for zero-downtime upgrade, Unix only, empty (default) disables
+    ServiceHandoffDrainTimeout, // int: ms, old process waits for in-flight sessions before quit, default 30000
+    ServiceCertificateVerifyCacheTtl, // int: ms, cache passed certificateVerifier results by fingerprint, 0 (default) disables
+    ServiceHttp2Enabled, // bool, negotiate h2 via ALPN on https, default false
+    ServiceHttp2MaxConcurrentStreams, // int, default 100
+    ServiceHttp2CleartextEnabled, // bool, accept h2c prior knowledge on http, default false
+    ServiceWebSocketEnabled, // bool, default false, messages go to processor slot webSocketMessage
+    ServiceWebSocketAllowedOrigins, // QStringList, allowed Origin headers for WebSocket upgrades, empty (default) allows any
 };
 
 class Service: public QObject
@@ -319,6 +1237,9 @@ private:
         QString             apiName;
         QString             slotName;
         ReceiveDataType     receiveDataType = UnknownReceiveDataType;
+        int                 priority        = -1; // -1: not set
+
+        QSharedPointer< JQHttpServer::HandlePool > handlePool; // null: use the manager default pool
     };
 
     class Recoder
@@ -338,7 +1259,7 @@ protected:
     Service() = default;
 
 public:
-    virtual ~Service() override = default;
+    virtual ~Service() override;
 
 
     static QSharedPointer< Service > createService( const QMap< ServiceConfigEnum, QVariant > &config );
@@ -346,6 +1267,11 @@ public:
 
     void registerProcessor( const QPointer< QObject > &processor );
 
+    // 返回 -1 表示交给 Service 的默认规则（请求头、路由配置、内置接口）
+    inline void setPriorityClassifier( const std::function< int( const QPointer< JQHttpServer::Session > &session ) > &priorityClassifier ) { priorityClassifier_ = priorityClassifier; }
+
+    QJsonObject status();
+
 
     virtual QJsonDocument extractPostJsonData( const QPointer< JQHttpServer::Session > &session );
 
@@ -375,6 +1301,28 @@ protected:
 private:
     void onSessionAccepted( const QPointer< JQHttpServer::Session > &session );
 
+    const ApiConfig *findApiConfig( const QPointer< JQHttpServer::Session > &session, QString *apiName = nullptr ) const;
+
+    QSharedPointer< JQHttpServer::HandlePool > selectHandlePool( const QPointer< JQHttpServer::Session > &session ) const;
+
+    int classifyPriority( const QPointer< JQHttpServer::Session > &session ) const;
+
+    void onListenSocketsHandedOff();
+
+    // 返回 false 表示证书没有通过验证，已经回复
+    bool verifyPeerCertificate( const QPointer< JQHttpServer::Session > &session );
+
+    // 客户端证书验证和 processor 的 webSocketAccept 槽函数，在服务线程调用
+    bool onWebSocketAccept( const QPointer< JQHttpServer::Session > &session );
+
+    void onWebSocketOpened( const QPointer< JQHttpServer::WebSocket > &webSocket );
+
+    void onWebSocketMessage( const QPointer< JQHttpServer::WebSocket > &webSocket, const QByteArray &message, const bool isText );
+
+    void onWebSocketClosed( const QPointer< JQHttpServer::WebSocket > &webSocket, const int closeCode );
+
+    QSharedPointer< JQHttpServer::HandlePool > routeHandlePool( const QString &poolName, const int maxThreadCount );
+
 
     static QString snakeCaseToCamelCase(const QString &source, const bool firstCharUpper = false);
 
@@ -388,6 +1336,29 @@ private:
     QMap< QString, QMap< QString, ApiConfig > > schedules_;    // apiMethod -> apiName -> API
     QMap< QString, std::function< void( const QPointer< JQHttpServer::Session > &session ) > > schedules2_; // apiPathPrefix -> callback
     QPointer< QObject > certificateVerifier_;
+    QPointer< QObject > webSocketProcessor_;
+    QSet< QString >     webSocketSlots_; // processor 实现了的 WebSocket 事件
+
+    int                         certificateVerifyCacheTtl_ = 0;
+    QMutex                      certificateVerifyMutex_;
+    QHash< QByteArray, qint64 > certificateVerifyCache_; // sha256 fingerprint -> expire time (ms since epoch)
+    qint64                      certificateVerifyCacheHitCount_  = 0;
+    qint64                      certificateVerifyCacheMissCount_ = 0;
+    qint64                      certificateVerifyPinnedCount_    = 0; // 长连接上已经验证过的请求
+
+    QMap< QString, int >                                        routeHandleMaxThreadCount_; // apiPath -> maxThreadCount
+    QMap< QString, QSharedPointer< JQHttpServer::HandlePool > > handlePools_;               // poolName -> pool
+    JQHttpServer::HandleScalePolicy                             handleScalePolicy_        = JQHttpServer::FixedHandleScalePolicy;
+    int                                                         handleMinThreadCount_     = 2;
+    int                                                         handleTargetQueueLatency_ = 50;
+
+    QMap< QString, int >                                                     routePriority_; // apiPath -> priority
+    QString                                                                  priorityHeader_;
+    int                                                                      priorityAgingInterval_ = 10;
+    std::function< int( const QPointer< JQHttpServer::Session > &session ) > priorityClassifier_;
+
+    int handoffPendingCount_ = 0;
+    int handoffDrainTimeout_ = 30 * 1000;
 };
 #endif
 
@@ -0,0 +1,692 @@
+﻿/*
+    This file is part of JQLibrary
+
+    Copyright: Jason and others
+
+    Contact email: 188080501@qq.com
+
+    Permission is hereby granted, free of charge, to any person obtaining
+    a copy of this software and associated documentation files (the
+    "Software"), to deal in the Software without restriction, including
+    without limitation the rights to use, copy, modify, merge, publish,
+    distribute, sublicense, and/or sell copies of the Software, and to
+    permit persons to whom the Software is furnished to do so, subject to
+    the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+    LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+    OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef JQLIBRARY_INCLUDE_JQHTTPSERVERCOROUTINE_H_
+#define JQLIBRARY_INCLUDE_JQHTTPSERVERCOROUTINE_H_
+
+// JQLibrary lib import
+#include <JQHttpServer>
+#include <JQNet>
+
+// 需要 C++20（qmake: CONFIG += c++2a 或 c++20），否则这个头文件里什么都没有
+#if defined( __cpp_impl_coroutine ) && ( __cpp_impl_coroutine >= 201902L ) && __has_include( <coroutine> )
+#   define JQHTTPSERVER_COROUTINE_ENABLED
+#endif
+
+#ifdef JQHTTPSERVER_COROUTINE_ENABLED
+
+// C++ lib import
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <type_traits>
+
+// Qt lib import
+#include <QDebug>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QTimer>
+
+namespace JQHttpServer
+{
+
+namespace Coroutine
+{
+
+// 协程帧分配器
+// 按 64 字节分档的线程局部空闲链表，帧释放后留给本线程的下一个协程复用，高并发时避免每个请求都 malloc/free
+class FrameAllocator
+{
+public:
+    static void *allocate(const std::size_t size)
+    {
+        const auto index = sizeClassIndex( size );
+        if ( index < 0 ) { return ::operator new( size ); }
+
+        auto &cache = FrameAllocator::cache();
+        auto node = cache.heads[ index ];
+
+        if ( node )
+        {
+            cache.heads[ index ] = node->next;
+            --cache.counts[ index ];
+            reusedCount_.fetch_add( 1, std::memory_order_relaxed );
+
+            return node;
+        }
+
+        allocatedCount_.fetch_add( 1, std::memory_order_relaxed );
+
+        return ::operator new( static_cast< std::size_t >( index + 1 ) * granularity_ );
+    }
+
+    static void deallocate(void *pointer, const std::size_t size)
+    {
+        const auto index = sizeClassIndex( size );
+        if ( index < 0 )
+        {
+            ::operator delete( pointer );
+            return;
+        }
+
+        // 帧可能在别的线程释放（协程在其他线程结束），直接放进当前线程的链表即可
+        auto &cache = FrameAllocator::cache();
+        if ( cache.counts[ index ] >= maxCachedFramePerClass_ )
+        {
+            ::operator delete( pointer );
+            return;
+        }
+
+        auto node = static_cast< FreeNode * >( pointer );
+        node->next = cache.heads[ index ];
+        cache.heads[ index ] = node;
+        ++cache.counts[ index ];
+    }
+
+    static QJsonObject status()
+    {
+        QJsonObject result;
+
+        result[ "allocatedCount" ] = static_cast< double >( allocatedCount_.load() );
+        result[ "reusedCount" ]    = static_cast< double >( reusedCount_.load() );
+
+        return result;
+    }
+
+private:
+    static constexpr int granularity_            = 64;
+    static constexpr int maxFrameSize_           = 4096;
+    static constexpr int sizeClassCount_         = maxFrameSize_ / granularity_;
+    static constexpr int maxCachedFramePerClass_ = 256;
+
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    struct Cache
+    {
+        FreeNode *heads[ sizeClassCount_ ]  = { };
+        int       counts[ sizeClassCount_ ] = { };
+
+        ~Cache()
+        {
+            for ( auto head: heads )
+            {
+                while ( head )
+                {
+                    auto next = head->next;
+                    ::operator delete( head );
+                    head = next;
+                }
+            }
+        }
+    };
+
+    static int sizeClassIndex(const std::size_t size)
+    {
+        if ( !size || ( size > static_cast< std::size_t >( maxFrameSize_ ) ) ) { return -1; }
+
+        return static_cast< int >( ( size + granularity_ - 1 ) / granularity_ ) - 1;
+    }
+
+    static Cache &cache()
+    {
+        thread_local Cache cache;
+        return cache;
+    }
+
+    static inline std::atomic< qint64 > allocatedCount_ { 0 };
+    static inline std::atomic< qint64 > reusedCount_ { 0 };
+};
+
+namespace Detail
+{
+
+struct PromiseAllocator
+{
+    static void *operator new(const std::size_t size) { return FrameAllocator::allocate( size ); }
+
+    static void operator delete(void *pointer, const std::size_t size) { FrameAllocator::deallocate( pointer, size ); }
+};
+
+template< typename Promise >
+struct FinalAwaiter
+{
+    bool await_ready() noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle< Promise > handle) noexcept
+    {
+        auto continuation = handle.promise().continuation_;
+        return ( continuation ) ? ( continuation ) : ( std::noop_coroutine() );
+    }
+
+    void await_resume() noexcept { }
+};
+
+class FunctionRunnable: public QRunnable
+{
+public:
+    FunctionRunnable(const std::function< void() > &callback):
+        callback_( callback )
+    { }
+
+    void run() final
+    {
+        callback_();
+    }
+
+private:
+    std::function< void() > callback_;
+};
+
+// 恢复一个挂起的协程，保证只恢复一次
+// 目标 context 在恢复前被销毁时，协程在销毁它的线程里恢复（此时 QPointer< Session > 已经为空），避免协程帧泄漏
+struct ResumeState
+{
+    std::coroutine_handle<> handle;
+    std::atomic_bool        resumed { false };
+    std::mutex              connectionMutex;
+    QMetaObject::Connection destroyedConnection;
+
+    void resume()
+    {
+        if ( resumed.exchange( true ) ) { return; }
+
+        // context 可能一直存在（Service、manager），每次 co_await 建立的连接都要断开
+        connectionMutex.lock();
+        QObject::disconnect( destroyedConnection );
+        connectionMutex.unlock();
+
+        handle.resume();
+    }
+
+    static void resumeWhenDestroyed(const std::shared_ptr< ResumeState > &state, QObject *context)
+    {
+        std::lock_guard< std::mutex > locker( state->connectionMutex );
+
+        state->destroyedConnection = QObject::connect( context, &QObject::destroyed, [ state ]() { state->resume(); } );
+        if ( state->resumed ) { QObject::disconnect( state->destroyedConnection ); }
+    }
+
+    static void resumeOn(const std::shared_ptr< ResumeState > &state, QObject *context, const int delay = 0)
+    {
+        if ( !context )
+        {
+            state->resume();
+            return;
+        }
+
+        resumeWhenDestroyed( state, context );
+        QTimer::singleShot( delay, context, [ state ]() { state->resume(); } );
+    }
+};
+
+}
+
+// 惰性启动的协程任务，可以在另一个协程里 co_await，结束时通过对称转移恢复等待者
+template< typename T = void >
+class Task
+{
+public:
+    struct promise_type: Detail::PromiseAllocator
+    {
+        std::coroutine_handle<> continuation_;
+        std::exception_ptr      exception_;
+        std::optional< T >      value_;
+
+        Task get_return_object() { return Task( std::coroutine_handle< promise_type >::from_promise( *this ) ); }
+
+        std::suspend_always initial_suspend() noexcept { return { }; }
+
+        Detail::FinalAwaiter< promise_type > final_suspend() noexcept { return { }; }
+
+        template< typename U >
+        void return_value(U &&value) { value_.emplace( std::forward< U >( value ) ); }
+
+        void unhandled_exception() { exception_ = std::current_exception(); }
+    };
+
+    Task(Task &&other) noexcept:
+        handle_( std::exchange( other.handle_, nullptr ) )
+    { }
+
+    Task(const Task &) = delete;
+
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if ( handle_ ) { handle_.destroy(); }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        handle_.promise().continuation_ = continuation;
+        return handle_;
+    }
+
+    T await_resume()
+    {
+        if ( handle_.promise().exception_ ) { std::rethrow_exception( handle_.promise().exception_ ); }
+
+        return std::move( *handle_.promise().value_ );
+    }
+
+private:
+    explicit Task(const std::coroutine_handle< promise_type > &handle):
+        handle_( handle )
+    { }
+
+private:
+    std::coroutine_handle< promise_type > handle_;
+};
+
+template<>
+class Task< void >
+{
+public:
+    struct promise_type: Detail::PromiseAllocator
+    {
+        std::coroutine_handle<> continuation_;
+        std::exception_ptr      exception_;
+
+        Task get_return_object() { return Task( std::coroutine_handle< promise_type >::from_promise( *this ) ); }
+
+        std::suspend_always initial_suspend() noexcept { return { }; }
+
+        Detail::FinalAwaiter< promise_type > final_suspend() noexcept { return { }; }
+
+        void return_void() { }
+
+        void unhandled_exception() { exception_ = std::current_exception(); }
+    };
+
+    Task(Task &&other) noexcept:
+        handle_( std::exchange( other.handle_, nullptr ) )
+    { }
+
+    Task(const Task &) = delete;
+
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if ( handle_ ) { handle_.destroy(); }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        handle_.promise().continuation_ = continuation;
+        return handle_;
+    }
+
+    void await_resume()
+    {
+        if ( handle_.promise().exception_ ) { std::rethrow_exception( handle_.promise().exception_ ); }
+    }
+
+private:
+    explicit Task(const std::coroutine_handle< promise_type > &handle):
+        handle_( handle )
+    { }
+
+private:
+    std::coroutine_handle< promise_type > handle_;
+};
+
+namespace Detail
+{
+
+struct DetachedTask
+{
+    struct promise_type: PromiseAllocator
+    {
+        DetachedTask get_return_object() noexcept { return { }; }
+
+        std::suspend_never initial_suspend() noexcept { return { }; }
+
+        std::suspend_never final_suspend() noexcept { return { }; }
+
+        void return_void() noexcept { }
+
+        void unhandled_exception() noexcept
+        {
+            qWarning() << "JQHttpServer::Coroutine: unhandled exception in coroutine handler";
+        }
+    };
+};
+
+inline DetachedTask runDetached(Task<> task)
+{
+    co_await task;
+}
+
+}
+
+// 在当前线程启动协程，运行到第一个挂起点后返回
+inline void start(Task<> &&task)
+{
+    Detail::runDetached( std::move( task ) );
+}
+
+// 把协程处理函数包装成 AbstractManage::setHttpAcceptedCallback 需要的回调
+// session 会自动进入延迟回复模式，协程挂起后处理线程立即释放
+inline std::function< void(const QPointer< Session > &) > bind(
+    const std::function< Task<>(QPointer< Session >) > &handler,
+    const int                                            timeout = 30 * 1000 )
+{
+    return [ handler, timeout ](const QPointer< Session > &session)
+    {
+        if ( !session ) { return; }
+
+        session->deferReply( timeout );
+        start( handler( session ) );
+    };
+}
+
+// co_await resumeOn( context )：切换到 context 所在的线程继续执行
+class resumeOn
+{
+public:
+    explicit resumeOn(QObject *context):
+        context_( context )
+    { }
+
+    bool await_ready() const noexcept
+    {
+        return context_.isNull() || ( QThread::currentThread() == context_->thread() );
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        auto state = std::make_shared< Detail::ResumeState >();
+        state->handle = handle;
+
+        Detail::ResumeState::resumeOn( state, context_.data() );
+    }
+
+    void await_resume() const noexcept { }
+
+private:
+    QPointer< QObject > context_;
+};
+
+// co_await sleep( context, msec )：等待 msec 毫秒，在 context 所在的线程恢复，不占用任何线程
+class sleep
+{
+public:
+    sleep(QObject *context, const int msec):
+        context_( context ),
+        msec_( msec )
+    { }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        auto state = std::make_shared< Detail::ResumeState >();
+        state->handle = handle;
+
+        Detail::ResumeState::resumeOn( state, context_.data(), msec_ );
+    }
+
+    void await_resume() const noexcept { }
+
+private:
+    QPointer< QObject > context_;
+    int                 msec_;
+};
+
+// co_await readBody( session )：Session 在收完整个请求体后才分发请求，所以这里总是立即返回
+class readBody
+{
+public:
+    explicit readBody(const QPointer< Session > &session):
+        session_( session )
+    { }
+
+    bool await_ready() const noexcept { return true; }
+
+    void await_suspend(std::coroutine_handle<>) const noexcept { }
+
+    QByteArray await_resume() const { return ( session_ ) ? ( session_->requestBody() ) : ( QByteArray() ); }
+
+private:
+    QPointer< Session > session_;
+};
+
+// co_await offload( context, threadPool, function )：在 threadPool 里执行 function，完成后回到 context 所在的线程
+template< typename Function >
+class offload
+{
+    using Result  = typename std::invoke_result< Function >::type;
+    using Storage = typename std::conditional< std::is_void< Result >::value, bool, Result >::type;
+
+    struct State: Detail::ResumeState
+    {
+        std::optional< Storage > result;
+    };
+
+public:
+    offload(QObject *context, QThreadPool *threadPool, Function function):
+        context_( context ),
+        threadPool_( threadPool ),
+        function_( std::move( function ) ),
+        state_( std::make_shared< State >() )
+    { }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        state_->handle = handle;
+
+        auto state    = state_;
+        auto function = function_;
+        auto context  = context_;
+
+        threadPool_->start( new Detail::FunctionRunnable( [ state, function, context ]() mutable
+        {
+            if constexpr ( std::is_void< Result >::value )
+            {
+                function();
+                state->result.emplace( true );
+            }
+            else
+            {
+                state->result.emplace( function() );
+            }
+
+            Detail::ResumeState::resumeOn( state, context.data() );
+        } ) );
+    }
+
+    Result await_resume()
+    {
+        if constexpr ( !std::is_void< Result >::value )
+        {
+            return std::move( *state_->result );
+        }
+    }
+
+private:
+    QPointer< QObject >      context_;
+    QThreadPool *            threadPool_;
+    Function                 function_;
+    std::shared_ptr< State > state_;
+};
+
+struct HttpReply
+{
+    bool                                  isSucceed = false;
+    QNetworkReply::NetworkError           error     = QNetworkReply::NoError;
+    QList< QNetworkReply::RawHeaderPair > rawHeaderPairs;
+    QByteArray                            data;
+};
+
+// co_await httpGet / httpPost / httpPut / httpDelete( context, request, ... )
+// 通过 JQNet 的异步接口在 context 所在的线程发起请求（该线程需要有事件循环，Session 所在的线程满足），完成后在该线程恢复
+class httpRequest
+{
+protected:
+    enum Method
+    {
+        Get,
+        Post,
+        Put,
+        Delete,
+    };
+
+    struct State: Detail::ResumeState
+    {
+        HttpReply reply;
+    };
+
+    httpRequest(const Method method, QObject *context, const QNetworkRequest &request, const QByteArray &body, const int timeout):
+        method_( method ),
+        context_( context ),
+        request_( request ),
+        body_( body ),
+        timeout_( timeout ),
+        state_( std::make_shared< State >() )
+    { }
+
+public:
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        state_->handle = handle;
+
+        auto state   = state_;
+        auto method  = method_;
+        auto request = request_;
+        auto body    = body_;
+        auto timeout = timeout_;
+
+        if ( !context_ )
+        {
+            state->resume();
+            return;
+        }
+
+        Detail::ResumeState::resumeWhenDestroyed( state, context_.data() );
+
+        QTimer::singleShot( 0, context_.data(), [ state, method, request, body, timeout ]()
+        {
+            const auto onFinished = [ state ](const QList< QNetworkReply::RawHeaderPair > &rawHeaderPairs, const QByteArray &data)
+            {
+                if ( state->resumed ) { return; }
+
+                state->reply.isSucceed      = true;
+                state->reply.rawHeaderPairs = rawHeaderPairs;
+                state->reply.data           = data;
+                state->resume();
+            };
+
+            const auto onError = [ state ](const QList< QNetworkReply::RawHeaderPair > &rawHeaderPairs, const QNetworkReply::NetworkError &code, const QByteArray &data)
+            {
+                if ( state->resumed ) { return; }
+
+                state->reply.error          = code;
+                state->reply.rawHeaderPairs = rawHeaderPairs;
+                state->reply.data           = data;
+                state->resume();
+            };
+
+            JQNet::HTTP http;
+
+            switch ( method )
+            {
+                case Get:    { http.get( request, onFinished, onError, timeout ); break; }
+                case Post:   { http.post( request, body, onFinished, onError, timeout ); break; }
+                case Put:    { http.put( request, body, onFinished, onError, timeout ); break; }
+                case Delete: { http.deleteResource( request, onFinished, onError, timeout ); break; }
+            }
+        } );
+    }
+
+    HttpReply await_resume() { return std::move( state_->reply ); }
+
+private:
+    Method                   method_;
+    QPointer< QObject >      context_;
+    QNetworkRequest          request_;
+    QByteArray               body_;
+    int                      timeout_;
+    std::shared_ptr< State > state_;
+};
+
+class httpGet: public httpRequest
+{
+public:
+    httpGet(QObject *context, const QNetworkRequest &request, const int timeout = 30 * 1000):
+        httpRequest( Get, context, request, { }, timeout )
+    { }
+};
+
+class httpPost: public httpRequest
+{
+public:
+    httpPost(QObject *context, const QNetworkRequest &request, const QByteArray &body, const int timeout = 30 * 1000):
+        httpRequest( Post, context, request, body, timeout )
+    { }
+};
+
+class httpPut: public httpRequest
+{
+public:
+    httpPut(QObject *context, const QNetworkRequest &request, const QByteArray &body, const int timeout = 30 * 1000):
+        httpRequest( Put, context, request, body, timeout )
+    { }
+};
+
+class httpDelete: public httpRequest
+{
+public:
+    httpDelete(QObject *context, const QNetworkRequest &request, const int timeout = 30 * 1000):
+        httpRequest( Delete, context, request, { }, timeout )
+    { }
+};
+
+}
+
+}
+
+#endif//JQHTTPSERVER_COROUTINE_ENABLED
+
+#endif//JQLIBRARY_INCLUDE_JQHTTPSERVERCOROUTINE_H_
@@ -27,10 +27,15 @@
 
 #include <JQHttpServer>
 
+// C++ lib import
+#include <limits>
+#include <map>
+
 // Qt lib import
 #include <QEventLoop>
 #include <QTimer>
 #include <QSemaphore>
+#include <QWaitCondition>
 #include <QMetaObject>
 #include <QThread>
 #include <QThreadPool>
@@ -42,6 +47,12 @@
 #include <QBuffer>
 #include <QPainter>
 #include <QtConcurrent>
+#include <QCoreApplication>
+#include <QAbstractEventDispatcher>
+#include <QSocketNotifier>
+#include <QDir>
+#include <QFileSystemWatcher>
+#include <QCryptographicHash>
 
 #include <QTcpServer>
 #include <QTcpSocket>
@@ -52,6 +63,40 @@
 #   include <QSslConfiguration>
 #endif
 
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+#   include <zlib.h>
+#endif
+
+// System lib import
+#ifdef Q_OS_UNIX
+#   include <errno.h>
+#   include <string.h>
+#   include <unistd.h>
+#   include <fcntl.h>
+#   include <poll.h>
+#   include <sched.h>
+#   include <signal.h>
+#   include <sys/wait.h>
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#   include <sys/stat.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#endif
+
+// Linux lib import
+#ifdef Q_OS_LINUX
+#   include <sys/ioctl.h>
+#   include <sys/prctl.h>
+#   include <sys/epoll.h>
+#   include <linux/sockios.h>
+#   include <sys/eventfd.h>
+#   include <sys/syscall.h>
+#   ifdef JQHTTPSERVER_IO_URING_ENABLED
+#       include <liburing.h>
+#   endif
+#endif
+
 #define JQHTTPSERVER_SESSION_PROTECTION( functionName, ... )                             \
     auto this_ = this;                                                                   \
     if ( !this_ || ( contentLength_ < -1 ) || ( waitWrittenByteCount_ < -1 ) )           \
@@ -69,12 +114,17 @@
         return __VA_ARGS__;                                                                                   \
     }
 
-#define JQHTTPSERVER_SESSION_REPLY_PROTECTION2( functionName, ... )                                    \
-    if ( socket_.isNull() || ( socket_->state() == QAbstractSocket::UnconnectedState ) )               \
-    {                                                                                                  \
-        qDebug().noquote() << QStringLiteral( "JQHttpServer::Session::" ) + functionName + ": error1"; \
-        this->deleteLater();                                                                           \
-        return __VA_ARGS__;                                                                            \
+#define JQHTTPSERVER_SESSION_REPLY_PROTECTION2( functionName, ... )                                            \
+    if ( !this->isSocketConnected() )                                                                          \
+    {                                                                                                          \
+        qDebug().noquote() << QStringLiteral( "JQHttpServer::Session::" ) + functionName + ": error1";         \
+        this->deleteLater();                                                                                   \
+        return __VA_ARGS__;                                                                                    \
+    }                                                                                                          \
+    if ( waitWrittenByteCount_ >= 0 )                                                                          \
+    {                                                                                                          \
+        qDebug().noquote() << QStringLiteral( "JQHttpServer::Session::" ) + functionName + ": already reply"; \
+        return __VA_ARGS__;                                                                                    \
     }
 
 static QString replyTextFormat(
@@ -137,7 +187,7 @@ static QString replyOptionsFormat(
 // Session
 QAtomicInt JQHttpServer::Session::remainSession_ = 0;
 
-JQHttpServer::Session::Session(const QPointer< QTcpSocket > &socket):
+JQHttpServer::Session::Session(const QPointer< QIODevice > &socket):
     socket_( socket ),
     autoCloseTimer_( new QTimer )
 {
@@ -147,10 +197,20 @@ JQHttpServer::Session::Session(const QPointer< QTcpSocket > &socket):
     {
         requestSourceIp_ = ( qobject_cast< QAbstractSocket * >( socket ) )->peerAddress().toString().replace( "::ffff:", "" );
     }
+    else if ( qobject_cast< QLocalSocket * >( socket ) )
+    {
+        // Unix domain socket 没有对端地址，只可能来自本机
+        requestSourceIp_ = "unix";
+    }
+    else if ( qobject_cast< Http2Stream * >( socket ) && qobject_cast< Http2Stream * >( socket )->connectionSocket() )
+    {
+        requestSourceIp_ = qobject_cast< Http2Stream * >( socket )->connectionSocket()->peerAddress().toString().replace( "::ffff:", "" );
+    }
 
-    connect(
+    // 长连接时 socket 会交给下一个 session，这些连接要能断开
+    socketConnections_.push_back( connect(
         socket_.data(),
-        &QTcpSocket::readyRead,
+        &QIODevice::readyRead,
         this,
         [ this ]()
         {
@@ -159,20 +219,46 @@ JQHttpServer::Session::Session(const QPointer< QTcpSocket > &socket):
             this->receiveBuffer_.append( this->socket_->readAll() );
             this->analyseBufferSetup1();
 
-            autoCloseTimer_->start();
-        } );
+            // 长连接等待下一个请求时用的是 idleTimeout，收到数据后恢复
+            autoCloseTimer_->start( 30 * 1000 );
+        } ) );
 
-    connect(
+    socketConnections_.push_back( connect(
         socket_.data(),
-        &QTcpSocket::bytesWritten,
-        std::bind( &JQHttpServer::Session::onBytesWritten, this, std::placeholders::_1 ) );
+        &QIODevice::bytesWritten,
+        std::bind( &JQHttpServer::Session::onBytesWritten, this, std::placeholders::_1 ) ) );
 
-    if ( qobject_cast< QTcpSocket * >( socket ) )
+    if ( qobject_cast< QAbstractSocket * >( socket ) )
     {
-        connect(
-            qobject_cast< QTcpSocket * >( socket ),
+        socketConnections_.push_back( connect(
+            qobject_cast< QAbstractSocket * >( socket ),
             &QAbstractSocket::stateChanged,
-            std::bind( &JQHttpServer::Session::onStateChanged, this, std::placeholders::_1 ) );
+            std::bind( &JQHttpServer::Session::onStateChanged, this, std::placeholders::_1 ) ) );
+    }
+    else if ( qobject_cast< QLocalSocket * >( socket ) )
+    {
+        socketConnections_.push_back( connect(
+            qobject_cast< QLocalSocket * >( socket ),
+            &QLocalSocket::stateChanged,
+            [ this ](const QLocalSocket::LocalSocketState &socketState)
+            {
+                if ( socketState == QLocalSocket::UnconnectedState )
+                {
+                    this->onStateChanged( QAbstractSocket::UnconnectedState );
+                }
+            } ) );
+    }
+    else if ( qobject_cast< Http2Stream * >( socket ) )
+    {
+        // 流没有连接状态，被关闭（对端重置或者连接断开）时当作断开
+        socketConnections_.push_back( connect(
+            socket_.data(),
+            &QIODevice::aboutToClose,
+            this,
+            [ this ]()
+            {
+                this->onStateChanged( QAbstractSocket::UnconnectedState );
+            } ) );
     }
 
     autoCloseTimer_->setInterval( 30 * 1000 );
@@ -341,14 +427,46 @@ qint64 JQHttpServer::Session::replyBodySize() const
     return replyBodySize_;
 }
 
+void JQHttpServer::Session::deferReply(const int timeout)
+{
+    JQHTTPSERVER_SESSION_PROTECTION( "deferReply" )
+
+    if ( replyDeferred_ ) { return; }
+
+    replyDeferred_ = true;
+    if ( deferredReplyStatistics_ ) { ++deferredReplyStatistics_->replyCount; }
+
+    // 定时器要在 session 所在线程创建，处理线程在回调返回后就不再属于这个 session 了
+    QTimer::singleShot( 0, this, [ this, timeout ]()
+    {
+        QTimer::singleShot( timeout, this, std::bind( &Session::onDeferredReplyTimeout, this ) );
+    } );
+}
+
+// HTTP/2 的流使用所在连接的 socket
+static QTcpSocket *tcpSocketOf(QIODevice *device)
+{
+    auto http2Stream = qobject_cast< JQHttpServer::Http2Stream * >( device );
+    if ( http2Stream ) { return http2Stream->connectionSocket().data(); }
+
+    return qobject_cast< QTcpSocket * >( device );
+}
+
+QPointer< QTcpSocket > JQHttpServer::Session::socket()
+{
+    // HTTP/2 的流不返回连接的 socket，直接读写会破坏连接上的其他流
+    return qobject_cast< QTcpSocket * >( socket_.data() );
+}
+
 #ifndef QT_NO_SSL
 QSslCertificate JQHttpServer::Session::peerCertificate() const
 {
     JQHTTPSERVER_SESSION_PROTECTION( "peerCertificate", QSslCertificate() )
 
-    if ( !qobject_cast< QSslSocket * >( socket_ ) ) { return QSslCertificate(); }
+    auto sslSocket = qobject_cast< QSslSocket * >( tcpSocketOf( socket_.data() ) );
+    if ( !sslSocket ) { return QSslCertificate(); }
 
-    return qobject_cast< QSslSocket * >( socket_ )->peerCertificate();
+    return sslSocket->peerCertificate();
 }
 #endif
 
@@ -372,6 +490,13 @@ void JQHttpServer::Session::replyText(const QString &replyData, const int httpSt
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyText" )
 
+    // 在 session 线程内直接调用时，前面跨线程分支里的赋值没有执行过
+    if ( replyBodySize_ < 0 )
+    {
+        replyHttpCode_ = httpStatusCode;
+        replyBodySize_ = replyData.toUtf8().size();
+    }
+
     const auto &&data = replyTextFormat
                             .arg(
                                 QString::number( httpStatusCode ),
@@ -380,8 +505,10 @@ void JQHttpServer::Session::replyText(const QString &replyData, const int httpSt
                                 replyData )
                             .toUtf8();
 
-    waitWrittenByteCount_ = data.size();
-    socket_->write( data );
+    const auto &&writeData = this->withConnectionHeader( data );
+
+    waitWrittenByteCount_ = writeData.size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::replyRedirects(const QUrl &targetUrl, const int httpStatusCode)
@@ -399,14 +526,19 @@ void JQHttpServer::Session::replyRedirects(const QUrl &targetUrl, const int http
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyRedirects" )
 
+    replyHttpCode_ = httpStatusCode;
+    replyBodySize_ = 0;
+
     const auto &&data = replyRedirectsFormat
                             .arg(
                                 QString::number( httpStatusCode ),
                                 targetUrl.toString() )
                             .toUtf8();
 
-    waitWrittenByteCount_ = data.size();
-    socket_->write( data );
+    const auto &&writeData = this->withConnectionHeader( data );
+
+    waitWrittenByteCount_ = writeData.size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::replyJsonObject(const QJsonObject &jsonObject, const int httpStatusCode)
@@ -425,6 +557,13 @@ void JQHttpServer::Session::replyJsonObject(const QJsonObject &jsonObject, const
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyJsonObject" )
 
+    if ( replyBuffer_.isEmpty() )
+    {
+        replyHttpCode_ = httpStatusCode;
+        replyBuffer_ = QJsonDocument( jsonObject ).toJson( QJsonDocument::Compact );
+        replyBodySize_ = replyBuffer_.size();
+    }
+
     const auto &&buffer = replyTextFormat
                               .arg(
                                   QString::number( httpStatusCode ),
@@ -433,8 +572,10 @@ void JQHttpServer::Session::replyJsonObject(const QJsonObject &jsonObject, const
                                   QString( replyBuffer_ ) )
                               .toUtf8();
 
-    waitWrittenByteCount_ = buffer.size();
-    socket_->write( buffer );
+    const auto &&writeData = this->withConnectionHeader( buffer );
+
+    waitWrittenByteCount_ = writeData.size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::replyJsonArray(const QJsonArray &jsonArray, const int httpStatusCode)
@@ -453,6 +594,13 @@ void JQHttpServer::Session::replyJsonArray(const QJsonArray &jsonArray, const in
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyJsonArray" )
 
+    if ( replyBuffer_.isEmpty() )
+    {
+        replyHttpCode_ = httpStatusCode;
+        replyBuffer_ = QJsonDocument( jsonArray ).toJson( QJsonDocument::Compact );
+        replyBodySize_ = replyBuffer_.size();
+    }
+
     const auto &&buffer = replyTextFormat
                               .arg(
                                   QString::number( httpStatusCode ),
@@ -461,8 +609,10 @@ void JQHttpServer::Session::replyJsonArray(const QJsonArray &jsonArray, const in
                                   QString( replyBuffer_ ) )
                               .toUtf8();
 
-    waitWrittenByteCount_ = buffer.size();
-    socket_->write( buffer );
+    const auto &&writeData = this->withConnectionHeader( buffer );
+
+    waitWrittenByteCount_ = writeData.size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::replyFile(const QString &filePath, const int httpStatusCode)
@@ -479,6 +629,8 @@ void JQHttpServer::Session::replyFile(const QString &filePath, const int httpSta
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyFile" )
 
+    replyHttpCode_ = httpStatusCode;
+
     replyIoDevice_.reset( new QFile( filePath ) );
     QPointer< QFile > file = ( qobject_cast< QFile * >( replyIoDevice_.data() ) );
 
@@ -499,8 +651,10 @@ void JQHttpServer::Session::replyFile(const QString &filePath, const int httpSta
                                 QString::number( replyBodySize_ ) )
                             .toUtf8();
 
-    waitWrittenByteCount_ = data.size() + file->size();
-    socket_->write( data );
+    const auto &&writeData = this->withConnectionHeader( data );
+
+    waitWrittenByteCount_ = writeData.size() + file->size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::replyFile(const QString &fileName, const QByteArray &fileData, const int httpStatusCode)
@@ -517,6 +671,8 @@ void JQHttpServer::Session::replyFile(const QString &fileName, const QByteArray
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyFile" )
 
+    replyHttpCode_ = httpStatusCode;
+
     auto buffer = new QBuffer;
     buffer->setData( fileData );
 
@@ -538,8 +694,10 @@ void JQHttpServer::Session::replyFile(const QString &fileName, const QByteArray
             .arg( QString::number( httpStatusCode ), fileName, QString::number( replyBodySize_ ) )
             .toUtf8();
 
-    waitWrittenByteCount_ = data.size() + fileData.size();
-    socket_->write( data );
+    const auto &&writeData = this->withConnectionHeader( data );
+
+    waitWrittenByteCount_ = writeData.size() + fileData.size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::replyImage(const QImage &image, const QString &format, const int httpStatusCode)
@@ -556,6 +714,8 @@ void JQHttpServer::Session::replyImage(const QImage &image, const QString &forma
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyImage" )
 
+    replyHttpCode_ = httpStatusCode;
+
     auto buffer = new QBuffer;
 
     if ( !buffer->open( QIODevice::ReadWrite ) )
@@ -584,8 +744,10 @@ void JQHttpServer::Session::replyImage(const QImage &image, const QString &forma
             .arg( QString::number( httpStatusCode ), format.toLower(), QString::number( replyBodySize_ ) )
             .toUtf8();
 
-    waitWrittenByteCount_ = data.size() + buffer->buffer().size();
-    socket_->write( data );
+    const auto &&writeData = this->withConnectionHeader( data );
+
+    waitWrittenByteCount_ = writeData.size() + buffer->buffer().size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::replyImage(const QString &imageFilePath, const int httpStatusCode)
@@ -602,6 +764,8 @@ void JQHttpServer::Session::replyImage(const QString &imageFilePath, const int h
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyImage" )
 
+    replyHttpCode_ = httpStatusCode;
+
     auto file = new QFile( imageFilePath );
 
     if ( !file->open( QIODevice::ReadOnly ) )
@@ -622,8 +786,10 @@ void JQHttpServer::Session::replyImage(const QString &imageFilePath, const int h
             .arg( QString::number( httpStatusCode ), QFileInfo( imageFilePath ).suffix(), QString::number( replyBodySize_ ) )
             .toUtf8();
 
-    waitWrittenByteCount_ = data.size() + file->size();
-    socket_->write( data );
+    const auto &&writeData = this->withConnectionHeader( data );
+
+    waitWrittenByteCount_ = writeData.size() + file->size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::replyBytes(const QByteArray &bytes, const QString &contentType, const int httpStatusCode, const QString &exHeader)
@@ -640,6 +806,8 @@ void JQHttpServer::Session::replyBytes(const QByteArray &bytes, const QString &c
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyBytes" )
 
+    replyHttpCode_ = httpStatusCode;
+
     auto buffer = new QBuffer;
     buffer->setData( bytes );
 
@@ -661,8 +829,10 @@ void JQHttpServer::Session::replyBytes(const QByteArray &bytes, const QString &c
             .arg( QString::number( httpStatusCode ), contentType, QString::number( replyBodySize_ ), exHeader )
             .toUtf8();
 
-    waitWrittenByteCount_ = data.size() + buffer->buffer().size();
-    socket_->write( data );
+    const auto &&writeData = this->withConnectionHeader( data );
+
+    waitWrittenByteCount_ = writeData.size() + buffer->buffer().size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::replyOptions()
@@ -679,16 +849,32 @@ void JQHttpServer::Session::replyOptions()
 
     JQHTTPSERVER_SESSION_REPLY_PROTECTION2( "replyOptions" )
 
+    replyHttpCode_ = 200;
     replyBodySize_ = 0;
 
     const auto &&buffer = replyOptionsFormat.toUtf8();
 
-    waitWrittenByteCount_ = buffer.size();
-    socket_->write( buffer );
+    const auto &&writeData = this->withConnectionHeader( buffer );
+
+    waitWrittenByteCount_ = writeData.size();
+    socket_->write( writeData );
 }
 
 void JQHttpServer::Session::analyseBufferSetup1()
 {
+    // 连接的第一个请求以 HTTP/2 连接前言开头，整个连接改用 HTTP/2 处理
+    if ( http2PrefaceCallback_ && ( requestIndex_ == 0 ) && requestMethod_.isEmpty() )
+    {
+        static const QByteArray http2Preface( "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" );
+
+        if ( http2Preface.startsWith( receiveBuffer_.left( http2Preface.size() ) ) )
+        {
+            if ( receiveBuffer_.size() < http2Preface.size() ) { return; }
+
+            if ( this->handOverHttp2Connection() ) { return; }
+        }
+    }
+
     if ( !headerAcceptedFinished_ )
     {
         forever
@@ -752,6 +938,20 @@ void JQHttpServer::Session::analyseBufferSetup1()
 
                 headerAcceptedFinished_ = true;
 
+                if ( keepAliveOptions_.enabled && keepAliveCallback_ && ( ( requestIndex_ + 1 ) < keepAliveOptions_.maxRequests ) )
+                {
+                    QString connection;
+                    for ( auto it = requestHeader_.begin(); it != requestHeader_.end(); ++it )
+                    {
+                        if ( it.key().toLower() == "connection" ) { connection = it.value().trimmed().toLower(); }
+                    }
+
+                    // HTTP/1.1 默认是长连接，HTTP/1.0 需要客户端明确要求
+                    keepAlive_ = ( requestCrlf_ == "HTTP/1.1" ) ? ( connection != "close" ) : ( connection == "keep-alive" );
+                }
+
+                if ( webSocketUpgradeCallback_ && this->handOverWebSocket() ) { return; }
+
                 if ( ( requestMethod_.toUpper() == "GET" ) ||
                      ( requestMethod_.toUpper() == "OPTIONS" ) ||
                      ( ( requestMethod_.toUpper() == "POST" ) && ( ( contentLength_ > 0 ) ? ( !receiveBuffer_.isEmpty() ) : ( true ) ) ) ||
@@ -799,7 +999,18 @@ void JQHttpServer::Session::analyseBufferSetup1()
 
 void JQHttpServer::Session::analyseBufferSetup2()
 {
-    requestBody_ += receiveBuffer_;
+    if ( keepAlive_ )
+    {
+        // 长连接上可能已经收到了下一个请求，请求体只取 Content-Length 以内的数据
+        const auto bodyRemaining = ( contentAcceptedFinished_ ) ? ( 0 ) : ( qMax( static_cast< qint64 >( 0 ), contentLength_ - requestBody_.size() ) );
+
+        requestBody_ += receiveBuffer_.left( static_cast< int >( bodyRemaining ) );
+        pendingData_ += receiveBuffer_.mid( static_cast< int >( bodyRemaining ) );
+    }
+    else
+    {
+        requestBody_ += receiveBuffer_;
+    }
     receiveBuffer_.clear();
 
     if ( !handleAcceptedCallback_ )
@@ -834,7 +1045,13 @@ void JQHttpServer::Session::onBytesWritten(const qint64 written)
     if ( this->waitWrittenByteCount_ <= 0 )
     {
         this->waitWrittenByteCount_ = 0;
-        socket_->disconnectFromHost();
+
+        // 延迟回复的 session 没有处理线程来清除这个标记，在回复写完后清除
+        if ( replyDeferred_ ) { handlingAccepted_ = false; }
+
+        if ( keepAlive_ && this->handOverSocket() ) { return; }
+
+        this->disconnectSocket();
         return;
     }
 
@@ -847,13 +1064,19 @@ void JQHttpServer::Session::onBytesWritten(const qint64 written)
         }
         else
         {
-            if ( requestSourceIp_ == "127.0.0.1" )
-            {
-                socket_->write( replyIoDevice_->read( 1024 * 1024 ) );
-            }
-            else
+            const auto chunkSize = this->nextWriteChunkSize();
+
+            if ( chunkSize > 0 )
             {
-                socket_->write( replyIoDevice_->read( 256 * 1024 ) );
+                const auto &&chunk = replyIoDevice_->read( chunkSize );
+
+                if ( writeStatistics_ )
+                {
+                    ++writeStatistics_->chunkCount;
+                    writeStatistics_->chunkBytes += chunk.size();
+                }
+
+                socket_->write( chunk );
             }
         }
     }
@@ -861,6 +1084,51 @@ void JQHttpServer::Session::onBytesWritten(const qint64 written)
     autoCloseTimer_->start();
 }
 
+qint64 JQHttpServer::Session::nextWriteChunkSize()
+{
+    // Qt 写缓冲里还有较多数据没进内核，等它写出去再补，下一次 bytesWritten 一定会来
+    const auto bytesToWrite = socket_->bytesToWrite();
+    if ( bytesToWrite > writeOptions_.lowWatermark )
+    {
+        if ( writeStatistics_ ) { ++writeStatistics_->watermarkStallCount; }
+        return 0;
+    }
+
+    auto chunkSize = qMax( writeOptions_.highWatermark - bytesToWrite, writeOptions_.minChunkSize );
+
+#ifdef Q_OS_LINUX
+    auto abstractSocket = qobject_cast< QAbstractSocket * >( socket_.data() );
+    const auto fd = ( abstractSocket ) ? ( static_cast< int >( abstractSocket->socketDescriptor() ) ) : ( -1 );
+    if ( fd < 0 ) { return chunkSize; }
+
+    // SO_SNDBUF 会被内核自动调整，只在第一次和发送队列满的时候重新读取
+    if ( sendBufferSize_ < 0 )
+    {
+        int       sendBufferSize = 0;
+        socklen_t length         = sizeof( sendBufferSize );
+        sendBufferSize_ = ( getsockopt( fd, SOL_SOCKET, SO_SNDBUF, &sendBufferSize, &length ) == 0 ) ? ( sendBufferSize ) : ( 0 );
+    }
+
+    // 内核发送队列里还没被对端确认的字节
+    int unackedBytes = 0;
+    if ( ( sendBufferSize_ <= 0 ) || ( ioctl( fd, SIOCOUTQ, &unackedBytes ) < 0 ) ) { return chunkSize; }
+
+    const auto freeBytes = static_cast< qint64 >( sendBufferSize_ - unackedBytes );
+    if ( freeBytes < writeOptions_.minChunkSize )
+    {
+        // 对端接收慢，只补一小块，数据留在文件里而不是内存里
+        if ( writeStatistics_ ) { ++writeStatistics_->socketBufferStallCount; }
+        sendBufferSize_ = -1;
+
+        return writeOptions_.minChunkSize;
+    }
+
+    chunkSize = qMin( chunkSize, qMax( freeBytes, writeOptions_.minChunkSize ) );
+#endif
+
+    return chunkSize;
+}
+
 void JQHttpServer::Session::onStateChanged(const QAbstractSocket::SocketState &socketState)
 {
     if ( socketState == QAbstractSocket::UnconnectedState )
@@ -881,363 +1149,8126 @@ void JQHttpServer::Session::onStateChanged(const QAbstractSocket::SocketState &s
     }
 }
 
-// AbstractManage
-JQHttpServer::AbstractManage::AbstractManage(const int handleMaxThreadCount)
-{
-    handleThreadPool_.reset( new QThreadPool );
-    serverThreadPool_.reset( new QThreadPool );
-
-    handleThreadPool_->setMaxThreadCount( handleMaxThreadCount );
-    serverThreadPool_->setMaxThreadCount( 1 );
-}
-
-JQHttpServer::AbstractManage::~AbstractManage()
+bool JQHttpServer::Session::isSocketConnected() const
 {
-    this->stopHandleThread();
-}
+    if ( socket_.isNull() ) { return false; }
 
-bool JQHttpServer::AbstractManage::initialize()
-{
-    if ( QThread::currentThread() != this->thread() )
+    if ( qobject_cast< QAbstractSocket * >( socket_.data() ) )
     {
-        qDebug() << "JQHttpServer::Manage::listen: error: listen from other thread";
-        return false;
+        return qobject_cast< QAbstractSocket * >( socket_.data() )->state() != QAbstractSocket::UnconnectedState;
     }
 
-    if ( this->isRunning() )
+    if ( qobject_cast< QLocalSocket * >( socket_.data() ) )
     {
-        qDebug() << "JQHttpServer::Manage::close: error: already running";
-        return false;
+        return qobject_cast< QLocalSocket * >( socket_.data() )->state() != QLocalSocket::UnconnectedState;
     }
 
-    return this->startServerThread();
+    return socket_->isOpen();
 }
 
-void JQHttpServer::AbstractManage::deinitialize()
+void JQHttpServer::Session::disconnectSocket()
 {
-    if ( !this->isRunning() )
+    if ( qobject_cast< QAbstractSocket * >( socket_.data() ) )
     {
-        qDebug() << "JQHttpServer::Manage::close: error: not running";
-        return;
+        qobject_cast< QAbstractSocket * >( socket_.data() )->disconnectFromHost();
     }
-
-    emit readyToClose();
-
-    if ( serverThreadPool_->activeThreadCount() )
+    else if ( qobject_cast< QLocalSocket * >( socket_.data() ) )
     {
-        this->stopServerThread();
+        qobject_cast< QLocalSocket * >( socket_.data() )->disconnectFromServer();
+    }
+    else if ( !socket_.isNull() )
+    {
+        socket_->close();
     }
 }
 
-bool JQHttpServer::AbstractManage::startServerThread()
+bool JQHttpServer::Session::isIdle() const
 {
-    QSemaphore semaphore;
-
-    auto f = QtConcurrent::run( serverThreadPool_.data(), [ &semaphore, this ]()
-    {
-        QEventLoop eventLoop;
-        QObject::connect(
-            this,
-            &AbstractManage::readyToClose,
-            &eventLoop,
-            &QEventLoop::quit );
-
-        if ( !this->onStart() )
-        {
-            semaphore.release( 1 );
-            return;
-        }
-
-        semaphore.release( 1 );
-
-        eventLoop.exec();
-
-        this->onFinish();
-    } );
-    Q_UNUSED( f );
-
-    semaphore.acquire( 1 );
-
-    return this->isRunning();
+    return receiveBuffer_.isEmpty() && !headerAcceptedFinished_ && !handlingAccepted_ && ( replyHttpCode_ < 0 ) && ( waitWrittenByteCount_ < 0 );
 }
 
-void JQHttpServer::AbstractManage::stopHandleThread()
+void JQHttpServer::Session::abort()
 {
-    handleThreadPool_->waitForDone();
+    if ( qobject_cast< QAbstractSocket * >( socket_.data() ) )
+    {
+        qobject_cast< QAbstractSocket * >( socket_.data() )->abort();
+    }
+    else if ( qobject_cast< QLocalSocket * >( socket_.data() ) )
+    {
+        qobject_cast< QLocalSocket * >( socket_.data() )->abort();
+    }
+    else if ( !socket_.isNull() )
+    {
+        socket_->close();
+    }
 }
 
-void JQHttpServer::AbstractManage::stopServerThread()
+void JQHttpServer::Session::abortAndDeleteLater()
 {
-    serverThreadPool_->waitForDone();
+    this->abort();
+
+    // 处理函数持有的只是 QPointer，返回之前不能删除，autoCloseTimer_ 每 10 毫秒检查一次
+    autoCloseTimer_->start( 10 );
 }
 
-void JQHttpServer::AbstractManage::newSession(const QPointer< Session > &session)
+QByteArray JQHttpServer::Session::withConnectionHeader(const QByteArray &replyHeader) const
 {
-    session->setHandleAcceptedCallback( [ this ](const QPointer< JQHttpServer::Session > &session){ this->handleAccepted( session ); } );
+    if ( !keepAliveOptions_.enabled ) { return replyHeader; }
 
-    auto session_ = session.data();
-    connect(
-        session.data(),
-        &QObject::destroyed,
-        [ this, session_ ]()
-        {
-            this->mutex_.lock();
-            this->availableSessions_.remove( session_ );
-            this->mutex_.unlock();
-        } );
-    availableSessions_.insert( session.data() );
+    // 插在状态行后面，没有开启长连接时保持原来的回复格式
+    const auto statusLineEnd = replyHeader.indexOf( "\r\n" );
+    if ( statusLineEnd < 0 ) { return replyHeader; }
+
+    return replyHeader.left( statusLineEnd + 2 ) +
+           ( ( keepAlive_ ) ? ( QByteArray( "Connection: keep-alive\r\n" ) ) : ( QByteArray( "Connection: close\r\n" ) ) ) +
+           replyHeader.mid( statusLineEnd + 2 );
 }
 
-void JQHttpServer::AbstractManage::handleAccepted(const QPointer< Session > &session)
+bool JQHttpServer::Session::handOverSocket()
 {
-    if ( session )
+    if ( !this->isSocketConnected() ) { return false; }
+
+    const auto nextSession = keepAliveCallback_( socket_, requestIndex_ + 1 );
+    if ( !nextSession ) { return false; }
+
+    for ( const auto &connection: socketConnections_ )
     {
-        session->setHandlingAccepted( true );
+        disconnect( connection );
     }
+    socketConnections_.clear();
+    socket_.clear();
+
+    nextSession->requestIndex_ = requestIndex_ + 1;
+    nextSession->peerVerified_ = peerVerified_;
+    nextSession->autoCloseTimer_->start( keepAliveOptions_.idleTimeout );
 
-    auto f =QtConcurrent::run( handleThreadPool_.data(), [ this, session ]()
+    // 已经收到的下一个请求的数据直接交给新的 session
+    if ( !pendingData_.isEmpty() )
     {
-        if ( !session )
-        {
-            return;
-        }
+        nextSession->receiveBuffer_ = pendingData_;
+        pendingData_.clear();
 
-        if ( !this->httpAcceptedCallback_ )
-        {
-            qDebug() << "JQHttpServer::Manage::handleAccepted: error, httpAcceptedCallback_ is nullptr";
-            session->setHandlingAccepted( false );
-            return;
-        }
+        nextSession->autoCloseTimer_->start( 30 * 1000 );
+        nextSession->analyseBufferSetup1();
+    }
 
-        this->httpAcceptedCallback_( session );
+    // 处理函数还没有返回时不能删除，等到 autoCloseTimer_ 超时再删除
+    if ( handlingAccepted_ )
+    {
+        autoCloseTimer_->start();
+    }
+    else
+    {
+        this->deleteLater();
+    }
 
-        if ( session )
-        {
-            session->setHandlingAccepted( false );
-        }
-    } );
-    Q_UNUSED( f )
+    return true;
 }
 
-// TcpServerManage
-JQHttpServer::TcpServerManage::TcpServerManage(const int handleMaxThreadCount):
-    AbstractManage( handleMaxThreadCount )
-{ }
-
-JQHttpServer::TcpServerManage::~TcpServerManage()
+bool JQHttpServer::Session::handOverHttp2Connection()
 {
-    if ( this->isRunning() )
+    auto tcpSocket = qobject_cast< QTcpSocket * >( socket_.data() );
+    if ( !tcpSocket ) { return false; }
+
+    for ( const auto &connection: socketConnections_ )
     {
-        this->deinitialize();
+        disconnect( connection );
     }
-}
+    socketConnections_.clear();
+    socket_.clear();
 
-bool JQHttpServer::TcpServerManage::listen(const QHostAddress &address, const quint16 port)
-{
-    listenAddress_ = address;
-    listenPort_ = port;
+    http2PrefaceCallback_( tcpSocket, receiveBuffer_ );
+    receiveBuffer_.clear();
 
-    return this->initialize();
-}
+    this->deleteLater();
 
-bool JQHttpServer::TcpServerManage::isRunning()
-{
-    return !tcpServer_.isNull();
+    return true;
 }
 
-bool JQHttpServer::TcpServerManage::onStart()
+bool JQHttpServer::Session::handOverWebSocket()
 {
-    mutex_.lock();
-
-    tcpServer_ = new QTcpServer;
+    // HTTP/2 的流不支持 Upgrade
+    if ( socket_.isNull() || qobject_cast< Http2Stream * >( socket_.data() ) ) { return false; }
+    if ( requestMethod_.toUpper() != "GET" ) { return false; }
+
+    QString upgrade;
+    QString connectionHeader;
+    QString version;
+    QString key;
+    for ( auto it = requestHeader_.begin(); it != requestHeader_.end(); ++it )
+    {
+        const auto &&name = it.key().toLower();
 
-    mutex_.unlock();
+        if ( name == "upgrade" )
+        {
+            upgrade = it.value().trimmed().toLower();
+        }
+        else if ( name == "connection" )
+        {
+            connectionHeader = it.value().toLower();
+        }
+        else if ( name == "sec-websocket-version" )
+        {
+            version = it.value().trimmed();
+        }
+        else if ( name == "sec-websocket-key" )
+        {
+            key = it.value().trimmed();
+        }
+    }
 
-    QObject::connect(
-        tcpServer_.data(),
-        &QTcpServer::newConnection,
-        tcpServer_.data(),
-        [ this ]()
+    if ( ( upgrade != "websocket" ) || !connectionHeader.contains( "upgrade" ) || ( version != "13" ) || key.isEmpty() ) { return false; }
+
+    // Sec-WebSocket-Key 必须是 16 字节随机数的 base64
+    const auto &&keyData = key.toLatin1();
+    const auto &&keyNonce = QByteArray::fromBase64( keyData );
+    if ( ( keyData.size() != 24 ) || ( keyNonce.size() != 16 ) || ( keyNonce.toBase64() != keyData ) )
+    {
+        this->replyText( "invalid Sec-WebSocket-Key", 400 );
+        return true;
+    }
+
+    if ( webSocketAcceptCallback_ && !webSocketAcceptCallback_( this ) )
+    {
+        if ( replyHttpCode_ < 0 ) { this->replyText( "forbidden", 403 ); }
+        return true;
+    }
+
+    for ( const auto &connection: socketConnections_ )
+    {
+        disconnect( connection );
+    }
+    socketConnections_.clear();
+
+    const auto socket = socket_;
+    socket_.clear();
+
+    webSocketUpgradeCallback_( this, socket, receiveBuffer_ );
+    receiveBuffer_.clear();
+
+    this->deleteLater();
+
+    return true;
+}
+
+void JQHttpServer::Session::onDeferredReplyTimeout()
+{
+    // 已经回复过（或者回复请求已经在排队中）
+    if ( ( replyHttpCode_ >= 0 ) || ( waitWrittenByteCount_ >= 0 ) ) { return; }
+
+    if ( deferredReplyStatistics_ ) { ++deferredReplyStatistics_->timeoutCount; }
+    handlingAccepted_ = false;
+
+    // 先占住 replyHttpCode_，之后从其他线程到来的回复都会被拒绝
+    replyHttpCode_ = 504;
+    replyBodySize_ = -1;
+
+    this->replyText( "deferred reply timeout", 504 );
+}
+
+// Http2
+// RFC 7541 附录 B 的 Huffman 编码表，下标是字节值，256 是 EOS
+static const quint32 hpackHuffmanCodes[ 257 ] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff
+};
+
+static const quint8 hpackHuffmanCodeLengths[ 257 ] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+// RFC 7541 附录 A 的静态表，索引从 1 开始
+static const char *const hpackStaticTable[ 61 ][ 2 ] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" }
+};
+
+struct HpackHuffmanNode
+{
+    qint16 children[ 2 ];
+    qint16 symbol; // 叶子节点的字节值，中间节点是 -1
+};
+
+static const QVector< HpackHuffmanNode > &hpackHuffmanTree()
+{
+    static const QVector< HpackHuffmanNode > tree = [ ]()
+    {
+        QVector< HpackHuffmanNode > nodes;
+        nodes.push_back( { { -1, -1 }, -1 } );
+
+        for ( auto symbol = 0; symbol < 257; ++symbol )
         {
-            auto socket = this->tcpServer_->nextPendingConnection();
+            auto node = 0;
 
-            this->newSession( new Session( socket ) );
-        } );
+            for ( auto bit = hpackHuffmanCodeLengths[ symbol ] - 1; bit >= 0; --bit )
+            {
+                const auto branch = ( hpackHuffmanCodes[ symbol ] >> bit ) & 1;
 
-    if ( !tcpServer_->listen( listenAddress_, listenPort_ ) )
+                if ( nodes[ node ].children[ branch ] < 0 )
+                {
+                    nodes[ node ].children[ branch ] = static_cast< qint16 >( nodes.size() );
+                    nodes.push_back( { { -1, -1 }, -1 } );
+                }
+
+                node = nodes[ node ].children[ branch ];
+            }
+
+            nodes[ node ].symbol = static_cast< qint16 >( symbol );
+        }
+
+        return nodes;
+    }();
+
+    return tree;
+}
+
+static bool hpackHuffmanDecode(const char *data, const int size, QByteArray &result)
+{
+    const auto &tree = hpackHuffmanTree();
+
+    auto node        = 0;
+    auto paddingBits = 0;
+    auto paddingOnes = true;
+
+    for ( auto index = 0; index < size; ++index )
     {
-        mutex_.lock();
+        const auto byte = static_cast< quint8 >( data[ index ] );
 
-        delete tcpServer_.data();
-        tcpServer_.clear();
+        for ( auto bit = 7; bit >= 0; --bit )
+        {
+            const auto branch = ( byte >> bit ) & 1;
 
-        mutex_.unlock();
+            node = tree[ node ].children[ branch ];
+            if ( node < 0 ) { return false; }
 
-        return false;
+            ++paddingBits;
+            if ( !branch ) { paddingOnes = false; }
+
+            const auto symbol = tree[ node ].symbol;
+            if ( symbol < 0 ) { continue; }
+
+            // 数据里不允许出现 EOS
+            if ( symbol == 256 ) { return false; }
+
+            result.append( static_cast< char >( symbol ) );
+
+            node        = 0;
+            paddingBits = 0;
+            paddingOnes = true;
+        }
+    }
+
+    // 结尾只能是不超过 7 位的 EOS 前缀（全 1）
+    return ( paddingBits <= 7 ) && paddingOnes;
+}
+
+static bool hpackDecodeInteger(const QByteArray &data, int &pos, const int prefixBits, quint32 &value)
+{
+    if ( pos >= data.size() ) { return false; }
+
+    const quint32 prefixMax = ( 1u << prefixBits ) - 1;
+
+    value = static_cast< quint8 >( data.at( pos++ ) ) & prefixMax;
+    if ( value < prefixMax ) { return true; }
+
+    quint64 result = value;
+    auto    shift  = 0;
+
+    forever
+    {
+        // 全是 0x80 的续字节不会让 result 变大，单独限制长度，避免移位超出 64 位
+        if ( ( pos >= data.size() ) || ( shift > 28 ) ) { return false; }
+
+        const auto byte = static_cast< quint8 >( data.at( pos++ ) );
+
+        result += static_cast< quint64 >( byte & 0x7f ) << shift;
+        shift += 7;
+
+        // 用到的长度和索引都不会超过 2^24
+        if ( result > 0xffffff ) { return false; }
+
+        if ( !( byte & 0x80 ) ) { break; }
     }
 
+    value = static_cast< quint32 >( result );
     return true;
 }
 
-void JQHttpServer::TcpServerManage::onFinish()
+static void hpackEncodeInteger(QByteArray &buffer, const quint8 flags, const int prefixBits, quint32 value)
 {
-    this->mutex_.lock();
+    const quint32 prefixMax = ( 1u << prefixBits ) - 1;
+
+    if ( value < prefixMax )
+    {
+        buffer.append( static_cast< char >( flags | value ) );
+        return;
+    }
 
-    tcpServer_->close();
-    delete tcpServer_.data();
-    tcpServer_.clear();
+    buffer.append( static_cast< char >( flags | prefixMax ) );
+    value -= prefixMax;
 
-    this->mutex_.unlock();
+    while ( value >= 0x80 )
+    {
+        buffer.append( static_cast< char >( ( value & 0x7f ) | 0x80 ) );
+        value >>= 7;
+    }
+
+    buffer.append( static_cast< char >( value ) );
+}
+
+static bool hpackDecodeString(const QByteArray &data, int &pos, QByteArray &result)
+{
+    if ( pos >= data.size() ) { return false; }
+
+    const auto huffman = ( static_cast< quint8 >( data.at( pos ) ) & 0x80 ) != 0;
+
+    quint32 length = 0;
+    if ( !hpackDecodeInteger( data, pos, 7, length ) ) { return false; }
+    if ( length > static_cast< quint32 >( data.size() - pos ) ) { return false; }
+
+    result.clear();
+
+    if ( huffman )
+    {
+        if ( !hpackHuffmanDecode( data.constData() + pos, static_cast< int >( length ), result ) ) { return false; }
+    }
+    else
+    {
+        result = data.mid( pos, static_cast< int >( length ) );
+    }
+
+    pos += static_cast< int >( length );
+    return true;
+}
+
+// 回复头不使用动态表和 Huffman 编码，名字在静态表里时引用静态表的索引
+static void hpackEncodeHeader(QByteArray &buffer, const QByteArray &name, const QByteArray &value)
+{
+    auto nameIndex = 0;
+
+    for ( auto index = 0; index < 61; ++index )
+    {
+        if ( name != hpackStaticTable[ index ][ 0 ] ) { continue; }
+
+        if ( value == hpackStaticTable[ index ][ 1 ] )
+        {
+            hpackEncodeInteger( buffer, 0x80, 7, static_cast< quint32 >( index + 1 ) );
+            return;
+        }
+
+        if ( !nameIndex ) { nameIndex = index + 1; }
+    }
+
+    // 不加入动态表的字面量
+    hpackEncodeInteger( buffer, 0x00, 4, static_cast< quint32 >( nameIndex ) );
+
+    if ( !nameIndex )
+    {
+        hpackEncodeInteger( buffer, 0x00, 7, static_cast< quint32 >( name.size() ) );
+        buffer.append( name );
+    }
+
+    hpackEncodeInteger( buffer, 0x00, 7, static_cast< quint32 >( value.size() ) );
+    buffer.append( value );
 }
 
-// SslServerManage
-#ifndef QT_NO_SSL
 namespace JQHttpServer
 {
 
-class SslServerHelper: public QTcpServer
+enum HpackDecodeResult
 {
-    void incomingConnection(qintptr socketDescriptor) final;
+    HpackDecodeSucceed,
+    HpackDecodeFailed,
+    HpackHeaderListTooLarge, // 头部块已经完整解码，动态表仍然和对端一致，只需要拒绝这个流
+};
 
+// 请求头的解码，每个连接一个，动态表在连接的所有请求之间共享
+class HpackDecoder
+{
 public:
-    std::function< void(qintptr socketDescriptor) > onIncomingConnectionCallback_;
+    // 解码后的头（名字 + 值 + 32）累计超过 maxHeaderListSize 时继续解码以更新动态表，但不再保存头
+    HpackDecodeResult decode(const QByteArray &headerBlock, QList< QPair< QByteArray, QByteArray > > &headers, const int maxHeaderListSize);
+
+private:
+    bool entry(const quint32 index, QByteArray &name, QByteArray &value) const;
+
+    void insert(const QByteArray &name, const QByteArray &value);
+
+    void evict();
+
+private:
+    QList< QPair< QByteArray, QByteArray > > dynamicTable_; // 新加入的在前面
+    int                                      dynamicTableSize_    = 0;
+    int                                      maxDynamicTableSize_ = 4096; // 不超过 SETTINGS_HEADER_TABLE_SIZE 的默认值 4096
 };
 
-void JQHttpServer::SslServerHelper::incomingConnection(qintptr socketDescriptor)
-{
-    onIncomingConnectionCallback_( socketDescriptor );
 }
 
-}
+JQHttpServer::HpackDecodeResult JQHttpServer::HpackDecoder::decode(const QByteArray &headerBlock, QList< QPair< QByteArray, QByteArray > > &headers, const int maxHeaderListSize)
+{
+    auto   pos            = 0;
+    auto   headerCount    = 0;
+    qint64 headerListSize = 0;
 
-JQHttpServer::SslServerManage::SslServerManage(const int handleMaxThreadCount):
-    AbstractManage( handleMaxThreadCount )
-{ }
+    headers.clear();
 
-JQHttpServer::SslServerManage::~SslServerManage()
+    while ( pos < headerBlock.size() )
+    {
+        const auto byte = static_cast< quint8 >( headerBlock.at( pos ) );
+
+        QByteArray name;
+        QByteArray value;
+        quint32    index = 0;
+
+        if ( byte & 0x80 )
+        {
+            // 索引
+            if ( !hpackDecodeInteger( headerBlock, pos, 7, index ) ) { return HpackDecodeFailed; }
+            if ( !this->entry( index, name, value ) ) { return HpackDecodeFailed; }
+        }
+        else if ( byte & 0x40 )
+        {
+            // 加入动态表的字面量
+            if ( !hpackDecodeInteger( headerBlock, pos, 6, index ) ) { return HpackDecodeFailed; }
+            if ( index && !this->entry( index, name, value ) ) { return HpackDecodeFailed; }
+            if ( !index && !hpackDecodeString( headerBlock, pos, name ) ) { return HpackDecodeFailed; }
+            if ( !hpackDecodeString( headerBlock, pos, value ) ) { return HpackDecodeFailed; }
+
+            this->insert( name, value );
+        }
+        else if ( byte & 0x20 )
+        {
+            // 动态表大小更新，只能出现在头部块的开头
+            if ( headerCount ) { return HpackDecodeFailed; }
+            if ( !hpackDecodeInteger( headerBlock, pos, 5, index ) ) { return HpackDecodeFailed; }
+            if ( index > 4096 ) { return HpackDecodeFailed; }
+
+            maxDynamicTableSize_ = static_cast< int >( index );
+            this->evict();
+            continue;
+        }
+        else
+        {
+            // 不加入动态表的字面量（0x00）和永不索引的字面量（0x10）
+            if ( !hpackDecodeInteger( headerBlock, pos, 4, index ) ) { return HpackDecodeFailed; }
+            if ( index && !this->entry( index, name, value ) ) { return HpackDecodeFailed; }
+            if ( !index && !hpackDecodeString( headerBlock, pos, name ) ) { return HpackDecodeFailed; }
+            if ( !hpackDecodeString( headerBlock, pos, value ) ) { return HpackDecodeFailed; }
+        }
+
+        ++headerCount;
+
+        // 一个很大的条目加入动态表后用 1 字节的索引反复引用，头部块很小但是解码后可以非常大
+        headerListSize += name.size() + value.size() + 32;
+        if ( headerListSize > maxHeaderListSize )
+        {
+            headers.clear();
+            continue;
+        }
+
+        headers.push_back( { name, value } );
+    }
+
+    return ( headerListSize > maxHeaderListSize ) ? ( HpackHeaderListTooLarge ) : ( HpackDecodeSucceed );
+}
+
+bool JQHttpServer::HpackDecoder::entry(const quint32 index, QByteArray &name, QByteArray &value) const
 {
-    if ( this->isRunning() )
+    if ( !index ) { return false; }
+
+    if ( index <= 61 )
     {
-        this->deinitialize();
+        name  = hpackStaticTable[ index - 1 ][ 0 ];
+        value = hpackStaticTable[ index - 1 ][ 1 ];
+        return true;
     }
+
+    const auto dynamicIndex = static_cast< int >( index - 62 );
+    if ( dynamicIndex >= dynamicTable_.size() ) { return false; }
+
+    name  = dynamicTable_.at( dynamicIndex ).first;
+    value = dynamicTable_.at( dynamicIndex ).second;
+    return true;
 }
 
-bool JQHttpServer::SslServerManage::listen(
-    const QHostAddress &address,
-    const quint16       port,
-    const QString &     crtFilePath,
-    const QString &     keyFilePath )
+void JQHttpServer::HpackDecoder::insert(const QByteArray &name, const QByteArray &value)
 {
-    listenAddress_ = address;
-    listenPort_ = port;
+    // 每个条目额外计 32 字节
+    const auto entrySize = name.size() + value.size() + 32;
 
-    QFile crtFile( crtFilePath );
-    if ( !crtFile.open( QIODevice::ReadOnly ) )
+    // 比整个表还大的条目会清空动态表，但本身不加入
+    if ( entrySize > maxDynamicTableSize_ )
     {
-        qDebug() << "SslServerManage::listen: error: can not open file:" << crtFilePath;
-        return false;
+        dynamicTable_.clear();
+        dynamicTableSize_ = 0;
+        return;
     }
 
-    QFile keyFile( keyFilePath );
-    if ( !keyFile.open( QIODevice::ReadOnly ) )
+    dynamicTable_.prepend( { name, value } );
+    dynamicTableSize_ += entrySize;
+
+    this->evict();
+}
+
+void JQHttpServer::HpackDecoder::evict()
+{
+    while ( ( dynamicTableSize_ > maxDynamicTableSize_ ) && !dynamicTable_.isEmpty() )
     {
-        qDebug() << "SslServerManage::listen: error: can not open file:" << keyFilePath;
-        return false;
+        const auto &last = dynamicTable_.last();
+        dynamicTableSize_ -= last.first.size() + last.second.size() + 32;
+        dynamicTable_.removeLast();
     }
+}
 
-    QSslKey sslKey( keyFile.readAll(), QSsl::Rsa, QSsl::Pem, QSsl::PrivateKey );
-    QList< QSslCertificate > localCertificateChain;
-    QList< QSslCertificate > caCertificates;
+enum Http2FrameType
+{
+    Http2DataFrame         = 0x0,
+    Http2HeadersFrame      = 0x1,
+    Http2PriorityFrame     = 0x2,
+    Http2RstStreamFrame    = 0x3,
+    Http2SettingsFrame     = 0x4,
+    Http2PushPromiseFrame  = 0x5,
+    Http2PingFrame         = 0x6,
+    Http2GoAwayFrame       = 0x7,
+    Http2WindowUpdateFrame = 0x8,
+    Http2ContinuationFrame = 0x9,
+};
 
-#if ( QT_VERSION >= QT_VERSION_CHECK( 5, 15, 0 ) )
-    localCertificateChain = QSslCertificate::fromPath( crtFilePath );
-#else
-    localCertificateChain.push_back( QSslCertificate( crtFile.readAll(), QSsl::Pem ) );
-#endif
+enum Http2FrameFlag
+{
+    Http2EndStreamFlag  = 0x1,
+    Http2AckFlag        = 0x1,
+    Http2EndHeadersFlag = 0x4,
+    Http2PaddedFlag     = 0x8,
+    Http2PriorityFlag   = 0x20,
+};
 
-    sslConfiguration_.reset( new QSslConfiguration );
-    sslConfiguration_->setLocalCertificateChain( localCertificateChain );
-    sslConfiguration_->setPrivateKey( sslKey );
-    sslConfiguration_->setProtocol( QSsl::TlsV1_2OrLater );
-    sslConfiguration_->setCaCertificates( caCertificates );
+enum Http2ErrorCode
+{
+    Http2NoError           = 0x0,
+    Http2ProtocolError     = 0x1,
+    Http2InternalError     = 0x2,
+    Http2FlowControlError  = 0x3,
+    Http2StreamClosedError = 0x5,
+    Http2FrameSizeError    = 0x6,
+    Http2RefusedStream     = 0x7,
+    Http2CancelError       = 0x8,
+    Http2CompressionError  = 0x9,
+    Http2EnhanceYourCalm   = 0xb,
+};
 
-    return this->initialize();
+static const QByteArray http2ConnectionPreface( "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" );
+static const int        http2MaxFrameSize        = 16384;       // 不修改 SETTINGS_MAX_FRAME_SIZE，收到的帧不能超过默认值
+static const int        http2MaxHeaderBlockSize  = 256 * 1024;  // HEADERS + CONTINUATION 的总大小上限
+static const qint64     http2SocketHighWatermark = 1024 * 1024; // socket 写缓冲超过这个值时暂停发送 DATA
+static const qint64     http2MaxWindowSize       = 0x7fffffff;
+
+static quint32 http2ReadUInt32(const char *data)
+{
+    return ( static_cast< quint32 >( static_cast< quint8 >( data[ 0 ] ) ) << 24 ) |
+           ( static_cast< quint32 >( static_cast< quint8 >( data[ 1 ] ) ) << 16 ) |
+           ( static_cast< quint32 >( static_cast< quint8 >( data[ 2 ] ) ) << 8 ) |
+           ( static_cast< quint32 >( static_cast< quint8 >( data[ 3 ] ) ) );
 }
 
-bool JQHttpServer::SslServerManage::isRunning()
+static void http2AppendUInt32(QByteArray &buffer, const quint32 value)
 {
-    return !tcpServer_.isNull();
+    buffer.append( static_cast< char >( ( value >> 24 ) & 0xff ) );
+    buffer.append( static_cast< char >( ( value >> 16 ) & 0xff ) );
+    buffer.append( static_cast< char >( ( value >> 8 ) & 0xff ) );
+    buffer.append( static_cast< char >( value & 0xff ) );
 }
 
-bool JQHttpServer::SslServerManage::onStart()
+// 去掉 PADDED 标记的填充，填充长度不合法时返回 false
+static bool http2RemovePadding(QByteArray &payload, const quint8 flags)
 {
-    mutex_.lock();
+    if ( !( flags & Http2PaddedFlag ) ) { return true; }
+    if ( payload.isEmpty() ) { return false; }
 
-    tcpServer_ = new SslServerHelper;
+    const auto padLength = static_cast< quint8 >( payload.at( 0 ) );
+    if ( padLength >= payload.size() ) { return false; }
 
-    mutex_.unlock();
+    payload = payload.mid( 1, payload.size() - 1 - padLength );
+    return true;
+}
+
+// content-type -> Content-Type，处理函数按 HTTP/1.1 的习惯读取请求头
+static QByteArray http2CanonicalHeaderName(const QByteArray &name)
+{
+    auto result = name;
+    auto upper  = true;
+
+    for ( auto index = 0; index < result.size(); ++index )
+    {
+        if ( upper && ( result[ index ] >= 'a' ) && ( result[ index ] <= 'z' ) )
+        {
+            result[ index ] = static_cast< char >( result[ index ] - 'a' + 'A' );
+        }
+
+        upper = ( result[ index ] == '-' );
+    }
+
+    return result;
+}
+
+namespace JQHttpServer
+{
+
+// 一个 HTTP/2 连接：帧的收发、HPACK、流量控制，每个流交给一个 Http2Stream + Session 处理
+// 请求头转换成 HTTP/1.1 格式交给 Session，带 Content-Length 的请求体边收边交给 Session，没有的收完（END_STREAM）后一起交给 Session，
+// Session 写出的 HTTP/1.1 回复再转换成 HEADERS 和 DATA 帧
+class Http2Connection: public QObject
+{
+public:
+    Http2Connection(const QPointer< QTcpSocket > &socket, const Http2Options &http2Options, const std::function< void(const QPointer< Session > &) > &newSessionCallback);
+
+    ~Http2Connection() override;
+
+    // receivedData 是已经从 socket 读出的数据，从连接前言开始
+    void start(const QByteArray &receivedData);
+
+    // 发送 GOAWAY，不再接受新的流，已有的流回复完后断开
+    void goAway();
+
+    void abort();
+
+    // 以下由 Http2Stream 调用
+    qint64 streamBytesToWrite(const quint32 streamId) const;
+
+    // 返回可以立即视为已写出的字节数（回复头、超出 Content-Length 的部分，或者流已经结束）
+    qint64 writeStreamData(const quint32 streamId, const QByteArray &data);
+
+    void closeStream(const quint32 streamId);
+
+    void onStreamDestroyed(const quint32 streamId);
+
+    // Session 读走了 size 字节的请求体，归还接收窗口
+    void onStreamDataRead(const quint32 streamId, const int size);
+
+private:
+    struct StreamState
+    {
+        QPointer< Http2Stream > stream;
+        QPointer< Session >     session;
+
+        QList< QPair< QByteArray, QByteArray > > requestHeaders;
+        QByteArray                               requestBody;                 // 没有 Content-Length 时缓存的请求体
+        bool                                     requestEnded         = false;
+        bool                                     dispatched           = false; // 请求头已经交给 Session
+        qint64                                   requestContentLength = -1;
+        qint64                                   requestBodyReceived  = 0;
+        int                                      receiveHeld          = 0; // 交给 Session 但是还没有被读走的请求体
+        int                                      receiveConsumed      = 0; // 还没有用 WINDOW_UPDATE 归还的接收窗口
+
+        qint64     sendWindow = 65535;
+        QByteArray replyHeaderBuffer;        // 还没有收完的 HTTP/1.1 回复头
+        bool       replyHeadersSent   = false;
+        qint64     replyContentLength = -1;
+        qint64     replyBodyQueued    = 0;
+        QByteArray pendingData;              // 等待发送窗口的回复体
+        bool       closed             = false; // Session 已经关闭了流
+        bool       endStreamSent      = false;
+    };
+
+    void onReadyRead();
+
+    void onDisconnected();
+
+    void processFrames();
+
+    bool onFrame(const quint8 type, const quint8 flags, const quint32 streamId, QByteArray &payload);
+
+    bool onHeaderBlock();
+
+    void dispatchRequest(const quint32 streamId);
+
+    bool sendReplyHeaders(const quint32 streamId, StreamState &state, const QByteArray &replyHeader);
+
+    void flush();
+
+    void writeFrame(const quint8 type, const quint8 flags, const quint32 streamId, const QByteArray &payload);
+
+    void sendWindowUpdate(const quint32 streamId, const int increment);
+
+    // 接收的数据已经处理，累计到窗口的一半后用 WINDOW_UPDATE 归还，streamId 为 0 时只归还连接的窗口
+    void consumeReceiveWindow(const quint32 streamId, const int size);
+
+    void resetStream(const quint32 streamId, const quint32 errorCode);
+
+    // 直接回复一个没有内容的状态码（比如 413），对端还在发送请求体时再重置流
+    void rejectStream(const quint32 streamId, const int statusCode);
+
+    void removeStream(const quint32 streamId);
+
+    void countStreamReset();
+
+    void connectionError(const quint32 errorCode);
+
+    void updateIdleTimer();
+
+    int activeStreamCount();
+
+private:
+    QPointer< QTcpSocket >                               socket_;
+    Http2Options                                         http2Options_;
+    std::function< void(const QPointer< Session > &) > newSessionCallback_;
+    QTimer                                               idleTimer_;
+
+    QByteArray receiveBuffer_;
+    int        receiveOffset_   = 0;
+    bool       prefaceReceived_ = false;
+    bool       failed_          = false;
+    bool       goingAway_       = false;
+    bool       goAwayReceived_  = false;
+    bool       peerVerified_    = false; // 连接上任意一个请求通过了客户端证书验证，之后的流继承
+
+    HpackDecoder hpackDecoder_;
+    QByteArray   headerBlock_;
+    quint32      headerBlockStreamId_  = 0;
+    bool         headerBlockEndStream_ = false;
+    bool         expectContinuation_   = false;
+
+    std::map< quint32, StreamState > streams_; // 按流 ID 排序，发送时轮流分配窗口
+    quint32                          lastStreamId_ = 0;
+    QList< QPointer< Session > >     resetSessions_; // 流被重置时还没有结束的 Session，删除前继续计入并发的流
+    QElapsedTimer                    resetRateTimer_;
+    int                              resetRateCount_ = 0;
+
+    qint64 connectionSendWindow_      = 65535;
+    qint64 peerInitialWindowSize_     = 65535;
+    int    peerMaxFrameSize_          = 16384;
+    int    connectionReceiveConsumed_ = 0;
+    qint64 bufferedBodySize_          = 0; // 所有流缓存的没有 Content-Length 的请求体
+};
+
+}
+
+JQHttpServer::Http2Connection::Http2Connection(const QPointer< QTcpSocket > &socket, const Http2Options &http2Options, const std::function< void(const QPointer< Session > &) > &newSessionCallback):
+    socket_( socket ),
+    http2Options_( http2Options ),
+    newSessionCallback_( newSessionCallback )
+{
+    idleTimer_.setSingleShot( true );
+    idleTimer_.setInterval( http2Options_.idleTimeout );
+
+    connect( &idleTimer_, &QTimer::timeout, this, &Http2Connection::goAway );
+}
+
+JQHttpServer::Http2Connection::~Http2Connection()
+{
+    for ( auto &it: streams_ )
+    {
+        if ( it.second.stream ) { it.second.stream->detachConnection(); }
+    }
+    streams_.clear();
+
+    if ( !socket_.isNull() )
+    {
+        QObject::disconnect( socket_.data(), nullptr, this, nullptr );
+        delete socket_.data();
+    }
+}
+
+void JQHttpServer::Http2Connection::start(const QByteArray &receivedData)
+{
+    connect( socket_.data(), &QIODevice::readyRead, this, &Http2Connection::onReadyRead );
+    connect( socket_.data(), &QIODevice::bytesWritten, this, &Http2Connection::flush );
+    connect( socket_.data(), &QAbstractSocket::disconnected, this, &Http2Connection::onDisconnected );
+
+    // 服务端的连接前言：SETTINGS，然后把连接的接收窗口调到和流一样大
+    QByteArray settings;
+    settings.append( '\0' );
+    settings.append( static_cast< char >( 0x3 ) ); // SETTINGS_MAX_CONCURRENT_STREAMS
+    http2AppendUInt32( settings, static_cast< quint32 >( http2Options_.maxConcurrentStreams ) );
+    settings.append( '\0' );
+    settings.append( static_cast< char >( 0x4 ) ); // SETTINGS_INITIAL_WINDOW_SIZE
+    http2AppendUInt32( settings, static_cast< quint32 >( http2Options_.initialWindowSize ) );
+    settings.append( '\0' );
+    settings.append( static_cast< char >( 0x6 ) ); // SETTINGS_MAX_HEADER_LIST_SIZE
+    http2AppendUInt32( settings, static_cast< quint32 >( http2Options_.maxHeaderListSize ) );
+    this->writeFrame( Http2SettingsFrame, 0, 0, settings );
+
+    if ( http2Options_.initialWindowSize > 65535 )
+    {
+        this->sendWindowUpdate( 0, http2Options_.initialWindowSize - 65535 );
+    }
+
+    this->updateIdleTimer();
+
+    receiveBuffer_ = receivedData;
+    this->onReadyRead();
+}
+
+void JQHttpServer::Http2Connection::goAway()
+{
+    if ( goingAway_ || failed_ || socket_.isNull() ) { return; }
+    goingAway_ = true;
+
+    QByteArray payload;
+    http2AppendUInt32( payload, lastStreamId_ );
+    http2AppendUInt32( payload, Http2NoError );
+    this->writeFrame( Http2GoAwayFrame, 0, 0, payload );
+
+    this->updateIdleTimer();
+}
+
+void JQHttpServer::Http2Connection::abort()
+{
+    if ( socket_.isNull() ) { return; }
+
+    socket_->abort();
+}
+
+qint64 JQHttpServer::Http2Connection::streamBytesToWrite(const quint32 streamId) const
+{
+    const auto it = streams_.find( streamId );
+    if ( it == streams_.end() ) { return 0; }
+
+    return it->second.replyHeaderBuffer.size() + it->second.pendingData.size();
+}
+
+qint64 JQHttpServer::Http2Connection::writeStreamData(const quint32 streamId, const QByteArray &data)
+{
+    auto it = streams_.find( streamId );
+
+    // 流已经被重置或者回复已经结束，数据直接丢弃
+    if ( ( it == streams_.end() ) || it->second.endStreamSent || failed_ ) { return data.size(); }
+
+    auto & state   = it->second;
+    auto   body    = data;
+    qint64 written = 0;
+
+    if ( !state.replyHeadersSent )
+    {
+        state.replyHeaderBuffer.append( data );
+
+        const auto headerEnd = state.replyHeaderBuffer.indexOf( "\r\n\r\n" );
+        if ( headerEnd < 0 )
+        {
+            if ( state.replyHeaderBuffer.size() > http2MaxHeaderBlockSize ) { this->resetStream( streamId, Http2InternalError ); }
+            return 0;
+        }
+
+        const auto &&replyHeader = state.replyHeaderBuffer.left( headerEnd + 4 );
+        body = state.replyHeaderBuffer.mid( headerEnd + 4 );
+        state.replyHeaderBuffer.clear();
+
+        // 之前的 write 里缓存的回复头也在这里一起计入
+        written = replyHeader.size();
+
+        if ( !this->sendReplyHeaders( streamId, state, replyHeader ) )
+        {
+            this->resetStream( streamId, Http2InternalError );
+            return data.size();
+        }
+    }
+
+    if ( state.replyContentLength >= 0 )
+    {
+        // 超出 Content-Length 的部分不发送
+        const auto allowed = qMax( static_cast< qint64 >( 0 ), state.replyContentLength - state.replyBodyQueued );
+        if ( body.size() > allowed )
+        {
+            written += body.size() - allowed;
+            body = body.left( static_cast< int >( allowed ) );
+        }
+    }
+
+    state.pendingData.append( body );
+    state.replyBodyQueued += body.size();
+
+    this->flush();
+
+    return written;
+}
+
+void JQHttpServer::Http2Connection::closeStream(const quint32 streamId)
+{
+    auto it = streams_.find( streamId );
+    if ( it == streams_.end() ) { return; }
+
+    auto &state = it->second;
+
+    if ( state.session && state.session->isPeerVerified() ) { peerVerified_ = true; }
+
+    state.closed = true;
+
+    // 没有回复就关闭（比如请求格式不支持），告诉客户端这个流失败了
+    if ( !state.replyHeadersSent )
+    {
+        this->resetStream( streamId, Http2InternalError );
+        return;
+    }
+
+    // 没有 Content-Length 的回复在这里结束，剩下的数据发完后带上 END_STREAM
+    state.replyContentLength = state.replyBodyQueued;
+
+    this->flush();
+}
+
+void JQHttpServer::Http2Connection::onStreamDestroyed(const quint32 streamId)
+{
+    auto it = streams_.find( streamId );
+    if ( it == streams_.end() ) { return; }
+
+    auto &state = it->second;
+    state.stream = nullptr;
+
+    // 还没有被读走的请求体不会再被读取
+    this->consumeReceiveWindow( 0, state.receiveHeld );
+    state.receiveHeld = 0;
+
+    // Session 超时或者出错被删除，回复没有完成
+    if ( !state.closed && !state.endStreamSent )
+    {
+        this->resetStream( streamId, Http2InternalError );
+        return;
+    }
+
+    if ( state.endStreamSent )
+    {
+        streams_.erase( it );
+        this->updateIdleTimer();
+    }
+}
+
+void JQHttpServer::Http2Connection::onStreamDataRead(const quint32 streamId, const int size)
+{
+    auto it = streams_.find( streamId );
+    if ( it == streams_.end() ) { return; }
+
+    it->second.receiveHeld -= size;
+
+    this->consumeReceiveWindow( streamId, size );
+}
+
+void JQHttpServer::Http2Connection::onReadyRead()
+{
+    if ( socket_.isNull() ) { return; }
+
+    const auto &&data = socket_->readAll();
+
+    // 已经发送 GOAWAY 等待断开，之后收到的数据直接丢弃
+    if ( failed_ ) { return; }
+
+    receiveBuffer_.append( data );
+
+    this->processFrames();
+    this->flush();
+}
+
+void JQHttpServer::Http2Connection::onDisconnected()
+{
+    idleTimer_.stop();
+
+    for ( auto &it: streams_ )
+    {
+        if ( it.second.stream ) { it.second.stream->detachConnection(); }
+    }
+    streams_.clear();
+
+    this->deleteLater();
+}
+
+void JQHttpServer::Http2Connection::processFrames()
+{
+    if ( failed_ ) { return; }
+
+    if ( !prefaceReceived_ )
+    {
+        const auto available = receiveBuffer_.size() - receiveOffset_;
+        const auto compared  = qMin( available, http2ConnectionPreface.size() );
+
+        if ( receiveBuffer_.mid( receiveOffset_, compared ) != http2ConnectionPreface.left( compared ) )
+        {
+            this->connectionError( Http2ProtocolError );
+            return;
+        }
+
+        if ( compared < http2ConnectionPreface.size() ) { return; }
+
+        receiveOffset_ += http2ConnectionPreface.size();
+        prefaceReceived_ = true;
+    }
+
+    while ( ( receiveBuffer_.size() - receiveOffset_ ) >= 9 )
+    {
+        const auto header = receiveBuffer_.constData() + receiveOffset_;
+
+        const auto length   = static_cast< int >( http2ReadUInt32( header ) >> 8 );
+        const auto type     = static_cast< quint8 >( header[ 3 ] );
+        const auto flags    = static_cast< quint8 >( header[ 4 ] );
+        const auto streamId = http2ReadUInt32( header + 5 ) & 0x7fffffff;
+
+        if ( length > http2MaxFrameSize )
+        {
+            this->connectionError( Http2FrameSizeError );
+            return;
+        }
+
+        if ( ( receiveBuffer_.size() - receiveOffset_ ) < ( 9 + length ) ) { break; }
+
+        auto payload = receiveBuffer_.mid( receiveOffset_ + 9, length );
+        receiveOffset_ += 9 + length;
+
+        if ( !this->onFrame( type, flags, streamId, payload ) || failed_ ) { return; }
+    }
+
+    // 已经处理的数据积累到一定量再移除，避免每个帧都移动缓冲区
+    if ( receiveOffset_ >= ( receiveBuffer_.size() / 2 ) )
+    {
+        receiveBuffer_.remove( 0, receiveOffset_ );
+        receiveOffset_ = 0;
+    }
+}
+
+bool JQHttpServer::Http2Connection::onFrame(const quint8 type, const quint8 flags, const quint32 streamId, QByteArray &payload)
+{
+    // 头部块没有结束之前只能收到同一个流的 CONTINUATION
+    if ( expectContinuation_ && ( ( type != Http2ContinuationFrame ) || ( streamId != headerBlockStreamId_ ) ) )
+    {
+        this->connectionError( Http2ProtocolError );
+        return false;
+    }
+
+    switch ( type )
+    {
+        case Http2DataFrame:
+        {
+            if ( !streamId )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            // 填充也计入流量控制
+            const auto frameSize = payload.size();
+
+            if ( !http2RemovePadding( payload, flags ) )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            auto it = streams_.find( streamId );
+            if ( ( it == streams_.end() ) || it->second.requestEnded )
+            {
+                if ( streamId > lastStreamId_ )
+                {
+                    this->connectionError( Http2ProtocolError );
+                    return false;
+                }
+
+                // 已经重置或者拒绝的流，对端可能还有在途的数据，丢弃后归还连接的窗口
+                this->consumeReceiveWindow( 0, frameSize );
+                return true;
+            }
+
+            auto &     state     = it->second;
+            const auto endStream = ( flags & Http2EndStreamFlag ) != 0;
+
+            state.requestBodyReceived += payload.size();
+
+            if ( state.requestBodyReceived > http2Options_.maxRequestBodySize )
+            {
+                this->consumeReceiveWindow( 0, frameSize );
+                this->rejectStream( streamId, 413 );
+                return true;
+            }
+
+            if ( ( state.requestContentLength >= 0 ) &&
+                 ( ( state.requestBodyReceived > state.requestContentLength ) ||
+                   ( endStream && ( state.requestBodyReceived != state.requestContentLength ) ) ) )
+            {
+                this->consumeReceiveWindow( 0, frameSize );
+                this->resetStream( streamId, Http2ProtocolError );
+                return true;
+            }
+
+            if ( endStream ) { state.requestEnded = true; }
+
+            if ( !state.dispatched )
+            {
+                // 没有 Content-Length，请求体缓存到 END_STREAM，缓存不超过 maxRequestBodySize，窗口直接归还，
+                // 所以整个连接缓存的总量要单独限制，不然并发的流一共可以缓存 maxConcurrentStreams 倍的 maxRequestBodySize
+                if ( ( bufferedBodySize_ + payload.size() ) > http2Options_.maxBufferedBodySize )
+                {
+                    this->consumeReceiveWindow( 0, frameSize );
+                    this->rejectStream( streamId, 413 );
+                    return true;
+                }
+
+                state.requestBody.append( payload );
+                bufferedBodySize_ += payload.size();
+                this->consumeReceiveWindow( streamId, frameSize );
+
+                if ( endStream ) { this->dispatchRequest( streamId ); }
+
+                return true;
+            }
+
+            // 请求体交给 Session，读走后才归还窗口，处理得慢时对端会停止发送
+            this->consumeReceiveWindow( streamId, frameSize - payload.size() );
+
+            const auto stream = state.stream;
+            if ( !stream || payload.isEmpty() )
+            {
+                // Session 已经提前回复并关闭了流，剩下的请求体直接丢弃
+                this->consumeReceiveWindow( streamId, payload.size() );
+                return true;
+            }
+
+            state.receiveHeld += payload.size();
+
+            // readyRead 里 Session 可能会回复并移除这个流，之后不能再使用 state
+            stream->appendRequestData( payload, true );
+
+            return true;
+        }
+        case Http2HeadersFrame:
+        {
+            if ( !streamId || !http2RemovePadding( payload, flags ) )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            // 不支持优先级，跳过依赖的流和权重
+            if ( flags & Http2PriorityFlag )
+            {
+                if ( payload.size() < 5 )
+                {
+                    this->connectionError( Http2FrameSizeError );
+                    return false;
+                }
+
+                payload.remove( 0, 5 );
+            }
+
+            headerBlock_          = payload;
+            headerBlockStreamId_  = streamId;
+            headerBlockEndStream_ = ( flags & Http2EndStreamFlag ) != 0;
+            expectContinuation_   = !( flags & Http2EndHeadersFlag );
+
+            if ( expectContinuation_ ) { return true; }
+
+            return this->onHeaderBlock();
+        }
+        case Http2ContinuationFrame:
+        {
+            if ( !expectContinuation_ )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            headerBlock_.append( payload );
+            if ( headerBlock_.size() > http2MaxHeaderBlockSize )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            expectContinuation_ = !( flags & Http2EndHeadersFlag );
+
+            if ( expectContinuation_ ) { return true; }
+
+            return this->onHeaderBlock();
+        }
+        case Http2PriorityFrame:
+        {
+            if ( !streamId )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            if ( payload.size() != 5 ) { this->resetStream( streamId, Http2FrameSizeError ); }
+
+            return true;
+        }
+        case Http2RstStreamFrame:
+        {
+            if ( !streamId || ( streamId > lastStreamId_ ) )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            if ( payload.size() != 4 )
+            {
+                this->connectionError( Http2FrameSizeError );
+                return false;
+            }
+
+            // 客户端取消了请求，关闭流，Session 之后的回复会被丢弃
+            if ( streams_.find( streamId ) != streams_.end() )
+            {
+                this->removeStream( streamId );
+                this->updateIdleTimer();
+                this->countStreamReset();
+            }
+
+            return !failed_;
+        }
+        case Http2SettingsFrame:
+        {
+            if ( streamId )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            if ( flags & Http2AckFlag )
+            {
+                if ( !payload.isEmpty() )
+                {
+                    this->connectionError( Http2FrameSizeError );
+                    return false;
+                }
+
+                return true;
+            }
+
+            if ( payload.size() % 6 )
+            {
+                this->connectionError( Http2FrameSizeError );
+                return false;
+            }
+
+            for ( auto offset = 0; offset < payload.size(); offset += 6 )
+            {
+                const auto identifier = ( static_cast< quint8 >( payload.at( offset ) ) << 8 ) | static_cast< quint8 >( payload.at( offset + 1 ) );
+                const auto value      = http2ReadUInt32( payload.constData() + offset + 2 );
+
+                if ( identifier == 0x4 )
+                {
+                    // SETTINGS_INITIAL_WINDOW_SIZE，已经打开的流按差值调整发送窗口
+                    if ( value > http2MaxWindowSize )
+                    {
+                        this->connectionError( Http2FlowControlError );
+                        return false;
+                    }
+
+                    const auto delta = static_cast< qint64 >( value ) - peerInitialWindowSize_;
+                    for ( auto &it: streams_ )
+                    {
+                        it.second.sendWindow += delta;
+                    }
+                    peerInitialWindowSize_ = value;
+                }
+                else if ( identifier == 0x5 )
+                {
+                    // SETTINGS_MAX_FRAME_SIZE
+                    if ( ( value < 16384 ) || ( value > 16777215 ) )
+                    {
+                        this->connectionError( Http2ProtocolError );
+                        return false;
+                    }
+
+                    peerMaxFrameSize_ = static_cast< int >( value );
+                }
+            }
+
+            this->writeFrame( Http2SettingsFrame, Http2AckFlag, 0, { } );
+            return true;
+        }
+        case Http2PushPromiseFrame:
+        {
+            // 客户端不能推送
+            this->connectionError( Http2ProtocolError );
+            return false;
+        }
+        case Http2PingFrame:
+        {
+            if ( streamId )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            if ( payload.size() != 8 )
+            {
+                this->connectionError( Http2FrameSizeError );
+                return false;
+            }
+
+            if ( !( flags & Http2AckFlag ) ) { this->writeFrame( Http2PingFrame, Http2AckFlag, 0, payload ); }
+
+            return true;
+        }
+        case Http2GoAwayFrame:
+        {
+            if ( streamId )
+            {
+                this->connectionError( Http2ProtocolError );
+                return false;
+            }
+
+            // 客户端不会再发起新的流，已有的流回复完后断开
+            goAwayReceived_ = true;
+            this->updateIdleTimer();
+
+            return true;
+        }
+        case Http2WindowUpdateFrame:
+        {
+            if ( payload.size() != 4 )
+            {
+                this->connectionError( Http2FrameSizeError );
+                return false;
+            }
+
+            const auto increment = static_cast< qint64 >( http2ReadUInt32( payload.constData() ) & 0x7fffffff );
+
+            if ( !streamId )
+            {
+                if ( !increment )
+                {
+                    this->connectionError( Http2ProtocolError );
+                    return false;
+                }
+
+                if ( ( connectionSendWindow_ + increment ) > http2MaxWindowSize )
+                {
+                    this->connectionError( Http2FlowControlError );
+                    return false;
+                }
+
+                connectionSendWindow_ += increment;
+                return true;
+            }
+
+            auto it = streams_.find( streamId );
+            if ( it == streams_.end() ) { return true; }
+
+            if ( !increment )
+            {
+                this->resetStream( streamId, Http2ProtocolError );
+                return true;
+            }
+
+            if ( ( it->second.sendWindow + increment ) > http2MaxWindowSize )
+            {
+                this->resetStream( streamId, Http2FlowControlError );
+                return true;
+            }
+
+            it->second.sendWindow += increment;
+            return true;
+        }
+        default:
+        {
+            // 未知类型的帧直接忽略
+            return true;
+        }
+    }
+}
+
+bool JQHttpServer::Http2Connection::onHeaderBlock()
+{
+    QList< QPair< QByteArray, QByteArray > > headers;
+
+    // 解码失败时动态表已经和对端不一致，只能断开整个连接
+    const auto decodeResult = hpackDecoder_.decode( headerBlock_, headers, http2Options_.maxHeaderListSize );
+    if ( decodeResult == HpackDecodeFailed )
+    {
+        this->connectionError( Http2CompressionError );
+        return false;
+    }
+    headerBlock_.clear();
+
+    const auto streamId = headerBlockStreamId_;
+
+    auto it = streams_.find( streamId );
+    if ( it != streams_.end() )
+    {
+        auto &state = it->second;
+
+        // 请求的 trailer，必须结束请求，内容不转交给 Session
+        if ( state.requestEnded ) { return true; }
+
+        if ( decodeResult == HpackHeaderListTooLarge )
+        {
+            this->resetStream( streamId, Http2EnhanceYourCalm );
+            return true;
+        }
+
+        if ( !headerBlockEndStream_ )
+        {
+            this->resetStream( streamId, Http2ProtocolError );
+            return true;
+        }
+
+        state.requestEnded = true;
+
+        if ( !state.dispatched )
+        {
+            this->dispatchRequest( streamId );
+        }
+        else if ( state.requestBodyReceived != state.requestContentLength )
+        {
+            this->resetStream( streamId, Http2ProtocolError );
+        }
+
+        return true;
+    }
+
+    if ( ( streamId <= lastStreamId_ ) || !( streamId & 1 ) )
+    {
+        // 已经重置的流上的 trailer
+        if ( ( streamId <= lastStreamId_ ) && ( streamId & 1 ) ) { return true; }
+
+        this->connectionError( Http2ProtocolError );
+        return false;
+    }
+
+    lastStreamId_ = streamId;
+
+    if ( goingAway_ || ( this->activeStreamCount() >= http2Options_.maxConcurrentStreams ) )
+    {
+        this->resetStream( streamId, Http2RefusedStream );
+        return true;
+    }
+
+    StreamState state;
+    state.sendWindow     = peerInitialWindowSize_;
+    state.requestHeaders = headers;
+    state.requestEnded   = headerBlockEndStream_;
+
+    streams_[ streamId ] = state;
+    idleTimer_.stop();
+
+    if ( decodeResult == HpackHeaderListTooLarge )
+    {
+        this->rejectStream( streamId, 431 );
+        this->countStreamReset();
+        return true;
+    }
+
+    // 带 Content-Length 的请求立即交给 Session，请求体边收边读
+    auto hasContentLength = false;
+    for ( const auto &header: headers )
+    {
+        if ( header.first == "content-length" ) { hasContentLength = true; }
+    }
+
+    if ( headerBlockEndStream_ || hasContentLength ) { this->dispatchRequest( streamId ); }
+
+    return true;
+}
+
+void JQHttpServer::Http2Connection::dispatchRequest(const quint32 streamId)
+{
+    auto &state = streams_[ streamId ];
+
+    QByteArray          method;
+    QByteArray          path;
+    QByteArray          authority;
+    QByteArray          headerLines;
+    QList< QByteArray > cookies;
+    qint64              contentLength     = -1;
+    auto                regularHeaderSeen = false;
+    auto                malformed         = false;
+
+    for ( const auto &header: state.requestHeaders )
+    {
+        const auto &name  = header.first;
+        const auto &value = header.second;
+
+        // 转换成 HTTP/1.1 文本后这些字符会破坏请求格式
+        if ( name.isEmpty() || name.contains( '\r' ) || name.contains( '\n' ) || name.contains( '\0' ) ||
+             value.contains( '\r' ) || value.contains( '\n' ) || value.contains( '\0' ) )
+        {
+            malformed = true;
+            break;
+        }
+
+        if ( name.startsWith( ':' ) )
+        {
+            if ( regularHeaderSeen ) { malformed = true; break; }
+
+            if ( name == ":method" ) { method = value; }
+            else if ( name == ":path" ) { path = value; }
+            else if ( name == ":authority" ) { authority = value; }
+            else if ( name != ":scheme" ) { malformed = true; break; }
+
+            continue;
+        }
+
+        regularHeaderSeen = true;
+
+        if ( name != name.toLower() ) { malformed = true; break; }
+
+        // HTTP/2 里不允许出现连接相关的头
+        if ( ( name == "connection" ) || ( name == "keep-alive" ) || ( name == "proxy-connection" ) ||
+             ( name == "transfer-encoding" ) || ( name == "upgrade" ) )
+        {
+            malformed = true;
+            break;
+        }
+
+        if ( name == "content-length" )
+        {
+            auto       ok     = false;
+            const auto length = value.toLongLong( &ok );
+
+            if ( !ok || ( length < 0 ) || ( ( contentLength >= 0 ) && ( length != contentLength ) ) ) { malformed = true; break; }
+
+            contentLength = length;
+            continue;
+        }
+
+        if ( name == "cookie" )
+        {
+            cookies.push_back( value );
+            continue;
+        }
+
+        if ( name == "host" )
+        {
+            if ( authority.isEmpty() ) { authority = value; }
+            continue;
+        }
+
+        headerLines += http2CanonicalHeaderName( name ) + ": " + value + "\r\n";
+    }
+
+    if ( method.isEmpty() || path.isEmpty() || path.contains( ' ' ) ) { malformed = true; }
+
+    // 请求已经结束时，请求体就是缓存的数据
+    if ( state.requestEnded )
+    {
+        if ( contentLength < 0 )
+        {
+            contentLength = state.requestBody.size();
+        }
+        else if ( contentLength != state.requestBody.size() )
+        {
+            malformed = true;
+        }
+    }
+
+    if ( malformed )
+    {
+        this->resetStream( streamId, Http2ProtocolError );
+        return;
+    }
+
+    if ( contentLength > http2Options_.maxRequestBodySize )
+    {
+        this->rejectStream( streamId, 413 );
+        return;
+    }
+
+    // 请求行的版本是 HTTP/2，Session 不会把它当成 HTTP/1.1 长连接
+    QByteArray request;
+    request += method + " " + path + " HTTP/2\r\n";
+    if ( !authority.isEmpty() ) { request += "Host: " + authority + "\r\n"; }
+    if ( !cookies.isEmpty() ) { request += "Cookie: " + cookies.join( "; " ) + "\r\n"; }
+    request += headerLines;
+    request += "Content-Length: " + QByteArray::number( contentLength ) + "\r\n";
+    request += "\r\n";
+    request += state.requestBody;
+
+    bufferedBodySize_ -= state.requestBody.size();
+
+    state.requestHeaders.clear();
+    state.requestBody.clear();
+    state.dispatched           = true;
+    state.requestContentLength = contentLength;
+
+    auto stream = new Http2Stream( this, streamId, socket_ );
+    auto session = new Session( stream );
+    session->setPeerVerified( peerVerified_ );
+
+    state.stream  = stream;
+    state.session = session;
+
+    newSessionCallback_( session );
+
+    stream->appendRequestData( request );
+}
+
+bool JQHttpServer::Http2Connection::sendReplyHeaders(const quint32 streamId, StreamState &state, const QByteArray &replyHeader)
+{
+    const auto &&lines = replyHeader.split( '\n' );
+
+    // 状态行 "HTTP/1.1 200 OK"
+    const auto &&statusLine = lines.first().trimmed().split( ' ' );
+    const auto   statusCode = statusLine.value( 1 ).toInt();
+    if ( ( statusCode < 100 ) || ( statusCode > 999 ) ) { return false; }
+
+    QByteArray headerBlock;
+    hpackEncodeHeader( headerBlock, ":status", QByteArray::number( statusCode ) );
+
+    for ( auto index = 1; index < lines.size(); ++index )
+    {
+        const auto &line  = lines[ index ];
+        const auto  colon = line.indexOf( ':' );
+        if ( colon <= 0 ) { continue; }
+
+        const auto &&name  = line.left( colon ).trimmed().toLower();
+        const auto &&value = line.mid( colon + 1 ).trimmed();
+
+        if ( ( name == "connection" ) || ( name == "keep-alive" ) || ( name == "proxy-connection" ) ||
+             ( name == "transfer-encoding" ) || ( name == "upgrade" ) || ( name == "host" ) )
+        {
+            continue;
+        }
+
+        if ( name == "content-length" ) { state.replyContentLength = value.toLongLong(); }
+
+        hpackEncodeHeader( headerBlock, name, value );
+    }
+
+    state.replyHeadersSent = true;
+
+    const auto endStream = ( state.replyContentLength == 0 );
+    if ( endStream ) { state.endStreamSent = true; }
+
+    // 超过对端帧大小上限的头部块拆成 HEADERS + CONTINUATION
+    auto offset = 0;
+    do
+    {
+        const auto fragment = headerBlock.mid( offset, peerMaxFrameSize_ );
+        const auto first    = ( offset == 0 );
+        offset += fragment.size();
+
+        quint8 flags = ( offset >= headerBlock.size() ) ? ( Http2EndHeadersFlag ) : ( 0 );
+        if ( first && endStream ) { flags |= Http2EndStreamFlag; }
+
+        this->writeFrame( ( first ) ? ( Http2HeadersFrame ) : ( Http2ContinuationFrame ), flags, streamId, fragment );
+    }
+    while ( offset < headerBlock.size() );
+
+    return true;
+}
+
+void JQHttpServer::Http2Connection::flush()
+{
+    if ( failed_ || socket_.isNull() ) { return; }
+
+    // 每一轮每个流最多发一帧，多个流轮流使用连接的发送窗口
+    auto progressed = true;
+    while ( progressed )
+    {
+        progressed = false;
+
+        for ( auto &it: streams_ )
+        {
+            const auto streamId = it.first;
+            auto &     state    = it.second;
+
+            if ( !state.replyHeadersSent || state.endStreamSent ) { continue; }
+
+            const auto bodyFinished = ( state.replyContentLength >= 0 ) && ( state.replyBodyQueued >= state.replyContentLength );
+
+            if ( state.pendingData.isEmpty() )
+            {
+                if ( !bodyFinished ) { continue; }
+
+                this->writeFrame( Http2DataFrame, Http2EndStreamFlag, streamId, { } );
+                state.endStreamSent = true;
+                progressed          = true;
+                continue;
+            }
+
+            // socket 写缓冲太多时等 bytesWritten 再继续，对端读得慢时数据留在 Session 那边
+            if ( socket_->bytesToWrite() > http2SocketHighWatermark ) { break; }
+
+            const auto size = static_cast< int >( qMin( qMin( static_cast< qint64 >( state.pendingData.size() ), static_cast< qint64 >( peerMaxFrameSize_ ) ),
+                                                        qMin( state.sendWindow, connectionSendWindow_ ) ) );
+            if ( size <= 0 ) { continue; }
+
+            const auto &&chunk = state.pendingData.left( size );
+            state.pendingData.remove( 0, size );
+            state.sendWindow -= size;
+            connectionSendWindow_ -= size;
+
+            const auto endStream = bodyFinished && state.pendingData.isEmpty();
+            this->writeFrame( Http2DataFrame, ( endStream ) ? ( Http2EndStreamFlag ) : ( 0 ), streamId, chunk );
+            if ( endStream ) { state.endStreamSent = true; }
+
+            if ( state.stream ) { state.stream->notifyBytesWritten( size ); }
+
+            progressed = true;
+        }
+    }
+
+    // 回复已经结束并且 Session 已经关闭或者删除的流可以移除了
+    for ( auto it = streams_.begin(); it != streams_.end(); )
+    {
+        if ( it->second.endStreamSent && ( it->second.closed || !it->second.stream ) )
+        {
+            this->consumeReceiveWindow( 0, it->second.receiveHeld );
+            it = streams_.erase( it );
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    this->updateIdleTimer();
+}
+
+void JQHttpServer::Http2Connection::writeFrame(const quint8 type, const quint8 flags, const quint32 streamId, const QByteArray &payload)
+{
+    if ( socket_.isNull() ) { return; }
+
+    QByteArray frame;
+    frame.reserve( 9 + payload.size() );
+
+    http2AppendUInt32( frame, ( static_cast< quint32 >( payload.size() ) << 8 ) | type );
+    frame.append( static_cast< char >( flags ) );
+    http2AppendUInt32( frame, streamId & 0x7fffffff );
+    frame.append( payload );
+
+    socket_->write( frame );
+}
+
+void JQHttpServer::Http2Connection::sendWindowUpdate(const quint32 streamId, const int increment)
+{
+    QByteArray payload;
+    http2AppendUInt32( payload, static_cast< quint32 >( increment ) );
+
+    this->writeFrame( Http2WindowUpdateFrame, 0, streamId, payload );
+}
+
+void JQHttpServer::Http2Connection::consumeReceiveWindow(const quint32 streamId, const int size)
+{
+    if ( size <= 0 ) { return; }
+
+    connectionReceiveConsumed_ += size;
+    if ( connectionReceiveConsumed_ >= ( http2Options_.initialWindowSize / 2 ) )
+    {
+        this->sendWindowUpdate( 0, connectionReceiveConsumed_ );
+        connectionReceiveConsumed_ = 0;
+    }
+
+    if ( !streamId ) { return; }
+
+    // 请求已经结束的流不会再收到数据，不需要归还流的窗口
+    auto it = streams_.find( streamId );
+    if ( ( it == streams_.end() ) || it->second.requestEnded ) { return; }
+
+    auto &state = it->second;
+    state.receiveConsumed += size;
+    if ( state.receiveConsumed >= ( http2Options_.initialWindowSize / 2 ) )
+    {
+        this->sendWindowUpdate( streamId, state.receiveConsumed );
+        state.receiveConsumed = 0;
+    }
+}
+
+void JQHttpServer::Http2Connection::resetStream(const quint32 streamId, const quint32 errorCode)
+{
+    QByteArray payload;
+    http2AppendUInt32( payload, errorCode );
+    this->writeFrame( Http2RstStreamFrame, 0, streamId, payload );
+
+    this->removeStream( streamId );
+    this->updateIdleTimer();
+
+    // 服务端自己的原因重置的流不计数，其他的都是对端的请求有问题
+    if ( ( errorCode != Http2NoError ) && ( errorCode != Http2InternalError ) ) { this->countStreamReset(); }
+}
+
+void JQHttpServer::Http2Connection::rejectStream(const quint32 streamId, const int statusCode)
+{
+    auto it = streams_.find( streamId );
+    if ( it == streams_.end() ) { return; }
+
+    // Session 已经开始回复，只能重置
+    if ( it->second.replyHeadersSent )
+    {
+        this->resetStream( streamId, Http2CancelError );
+        return;
+    }
+
+    QByteArray headerBlock;
+    hpackEncodeHeader( headerBlock, ":status", QByteArray::number( statusCode ) );
+    hpackEncodeHeader( headerBlock, "content-length", "0" );
+    this->writeFrame( Http2HeadersFrame, Http2EndHeadersFlag | Http2EndStreamFlag, streamId, headerBlock );
+
+    it->second.replyHeadersSent = true;
+    it->second.endStreamSent    = true;
+
+    // 请求已经结束的流两端都关闭了，不能再发送 RST_STREAM
+    if ( it->second.requestEnded )
+    {
+        this->removeStream( streamId );
+        this->updateIdleTimer();
+        return;
+    }
+
+    this->resetStream( streamId, Http2NoError );
+}
+
+void JQHttpServer::Http2Connection::removeStream(const quint32 streamId)
+{
+    auto it = streams_.find( streamId );
+    if ( it == streams_.end() ) { return; }
+
+    const auto stream   = it->second.stream;
+    const auto session  = it->second.session;
+    const auto finished = it->second.endStreamSent;
+
+    // Session 还没有读走的请求体不会再被读取
+    this->consumeReceiveWindow( 0, it->second.receiveHeld );
+    bufferedBodySize_ -= it->second.requestBody.size();
+
+    streams_.erase( it );
+
+    if ( !finished && session ) { resetSessions_.push_back( session ); }
+
+    if ( stream ) { stream->detachConnection(); }
+}
+
+void JQHttpServer::Http2Connection::countStreamReset()
+{
+    // 客户端反复发起和重置流时断开连接
+    if ( !resetRateTimer_.isValid() || ( resetRateTimer_.elapsed() >= 1000 ) )
+    {
+        resetRateTimer_.start();
+        resetRateCount_ = 0;
+    }
+
+    if ( ++resetRateCount_ > http2Options_.maxResetsPerSecond ) { this->connectionError( Http2EnhanceYourCalm ); }
+}
+
+void JQHttpServer::Http2Connection::connectionError(const quint32 errorCode)
+{
+    if ( failed_ || socket_.isNull() ) { return; }
+    failed_ = true;
+
+    qDebug() << "JQHttpServer::Http2Connection::connectionError: error:" << errorCode;
+
+    QByteArray payload;
+    http2AppendUInt32( payload, lastStreamId_ );
+    http2AppendUInt32( payload, errorCode );
+    this->writeFrame( Http2GoAwayFrame, 0, 0, payload );
+
+    socket_->disconnectFromHost();
+}
+
+void JQHttpServer::Http2Connection::updateIdleTimer()
+{
+    if ( !streams_.empty() )
+    {
+        idleTimer_.stop();
+        return;
+    }
+
+    // 已经发送或者收到 GOAWAY，没有流之后断开
+    if ( goingAway_ || goAwayReceived_ )
+    {
+        if ( !socket_.isNull() && ( socket_->state() == QAbstractSocket::ConnectedState ) ) { socket_->disconnectFromHost(); }
+        return;
+    }
+
+    if ( !idleTimer_.isActive() ) { idleTimer_.start(); }
+}
+
+int JQHttpServer::Http2Connection::activeStreamCount()
+{
+    auto count = 0;
+
+    for ( const auto &it: streams_ )
+    {
+        if ( !it.second.endStreamSent ) { ++count; }
+    }
+
+    // 客户端发起后立即重置的流，处理函数仍然在运行，同样占用并发数（rapid reset）
+    for ( auto it = resetSessions_.begin(); it != resetSessions_.end(); )
+    {
+        if ( it->isNull() )
+        {
+            it = resetSessions_.erase( it );
+        }
+        else
+        {
+            ++count;
+            ++it;
+        }
+    }
+
+    return count;
+}
+
+// Http2Stream
+JQHttpServer::Http2Stream::Http2Stream(const QPointer< Http2Connection > &connection, const quint32 streamId, const QPointer< QTcpSocket > &connectionSocket):
+    connection_( connection ),
+    streamId_( streamId ),
+    connectionSocket_( connectionSocket )
+{
+    this->open( QIODevice::ReadWrite | QIODevice::Unbuffered );
+}
+
+JQHttpServer::Http2Stream::~Http2Stream()
+{
+    if ( connection_ ) { connection_->onStreamDestroyed( streamId_ ); }
+}
+
+bool JQHttpServer::Http2Stream::isSequential() const
+{
+    return true;
+}
+
+qint64 JQHttpServer::Http2Stream::bytesAvailable() const
+{
+    return readBuffer_.size() + QIODevice::bytesAvailable();
+}
+
+qint64 JQHttpServer::Http2Stream::bytesToWrite() const
+{
+    return ( connection_ ) ? ( connection_->streamBytesToWrite( streamId_ ) ) : ( 0 );
+}
+
+void JQHttpServer::Http2Stream::close()
+{
+    if ( !this->isOpen() ) { return; }
+
+    const auto connection = connection_;
+
+    QIODevice::close();
+
+    if ( connection ) { connection->closeStream( streamId_ ); }
+}
+
+void JQHttpServer::Http2Stream::appendRequestData(const QByteArray &data, const bool flowControlled)
+{
+    readBuffer_.append( data );
+    if ( !flowControlled ) { unflowControlledBytes_ += data.size(); }
+
+    emit this->readyRead();
+}
+
+void JQHttpServer::Http2Stream::notifyBytesWritten(const qint64 written)
+{
+    if ( written <= 0 ) { return; }
+
+    // 合并成一次 bytesWritten，在下一轮事件循环发出，避免在 Session 的 write 调用里重入
+    if ( !pendingWrittenBytes_ )
+    {
+        QMetaObject::invokeMethod( this, [ this ]()
+        {
+            const auto written = pendingWrittenBytes_;
+            pendingWrittenBytes_ = 0;
+
+            emit this->bytesWritten( written );
+        }, Qt::QueuedConnection );
+    }
+
+    pendingWrittenBytes_ += written;
+}
+
+void JQHttpServer::Http2Stream::detachConnection()
+{
+    connection_.clear();
+
+    // 对 Session 来说等同于连接断开
+    if ( this->isOpen() ) { QIODevice::close(); }
+}
+
+qint64 JQHttpServer::Http2Stream::readData(char *data, qint64 maxSize)
+{
+    const auto size = qMin( maxSize, static_cast< qint64 >( readBuffer_.size() ) );
+    if ( size <= 0 ) { return 0; }
+
+    memcpy( data, readBuffer_.constData(), static_cast< size_t >( size ) );
+    readBuffer_.remove( 0, static_cast< int >( size ) );
+
+    // 转换出来的请求头在最前面，之后读到的是请求体
+    const auto unflowControlled = qMin( size, unflowControlledBytes_ );
+    unflowControlledBytes_ -= unflowControlled;
+
+    if ( connection_ && ( size > unflowControlled ) ) { connection_->onStreamDataRead( streamId_, static_cast< int >( size - unflowControlled ) ); }
+
+    return size;
+}
+
+qint64 JQHttpServer::Http2Stream::writeData(const char *data, qint64 maxSize)
+{
+    if ( !connection_ ) { return maxSize; }
+
+    this->notifyBytesWritten( connection_->writeStreamData( streamId_, QByteArray( data, static_cast< int >( maxSize ) ) ) );
+
+    return maxSize;
+}
+
+// WebSocket
+namespace JQHttpServer
+{
+
+enum WebSocketOpcode
+{
+    WebSocketContinuationFrame = 0x0,
+    WebSocketTextFrame         = 0x1,
+    WebSocketBinaryFrame       = 0x2,
+    WebSocketCloseFrame        = 0x8,
+    WebSocketPingFrame         = 0x9,
+    WebSocketPongFrame         = 0xa
+};
+
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+// permessage-deflate 协商的是双向 no_context_takeover，每条消息单独压缩和解压，
+// 所以同一个线程里的连接可以共用 zlib 的状态，不需要每个连接保留几百 KB 的压缩窗口
+class WebSocketDeflate
+{
+public:
+    WebSocketDeflate(const int windowBits);
+
+    ~WebSocketDeflate();
+
+    // 压缩一条消息，去掉结尾的 00 00 ff ff
+    bool compress(const QByteArray &message, QByteArray &payload);
+
+    // 解压一条消息，数据有误或者解压后超过 maxSize 时返回 false
+    bool decompress(const QByteArray &payload, const qint64 maxSize, QByteArray &message);
+
+    // 当前线程里 windowBits 对应的实例
+    static WebSocketDeflate *threadLocal(const int windowBits);
+
+private:
+    int      windowBits_   = 15;
+    z_stream deflateStream_;
+    z_stream inflateStream_;
+    bool     deflateReady_ = false;
+    bool     inflateReady_ = false;
+};
+#endif
+
+}
+
+// RFC 6455 4.2.2，Sec-WebSocket-Accept 是 key 加上固定 GUID 的 SHA-1 的 base64
+static QByteArray webSocketAcceptKey(const QByteArray &key)
+{
+    return QCryptographicHash::hash( key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", QCryptographicHash::Sha1 ).toBase64();
+}
+
+// 服务端发出的帧不分片、不加掩码
+static QByteArray webSocketFrame(const int opcode, const QByteArray &payload, const bool isCompressed)
+{
+    QByteArray frame;
+    frame.reserve( payload.size() + 10 );
+
+    frame.append( static_cast< char >( 0x80 | ( ( isCompressed ) ? ( 0x40 ) : ( 0 ) ) | opcode ) );
+
+    if ( payload.size() < 126 )
+    {
+        frame.append( static_cast< char >( payload.size() ) );
+    }
+    else if ( payload.size() <= 0xffff )
+    {
+        frame.append( static_cast< char >( 126 ) );
+        frame.append( static_cast< char >( ( payload.size() >> 8 ) & 0xff ) );
+        frame.append( static_cast< char >( payload.size() & 0xff ) );
+    }
+    else
+    {
+        frame.append( static_cast< char >( 127 ) );
+
+        const auto size = static_cast< quint64 >( payload.size() );
+        for ( auto shift = 56; shift >= 0; shift -= 8 )
+        {
+            frame.append( static_cast< char >( ( size >> shift ) & 0xff ) );
+        }
+    }
+
+    frame.append( payload );
+
+    return frame;
+}
+
+static bool isValidUtf8(const QByteArray &data)
+{
+    const auto bytes = reinterpret_cast< const uchar * >( data.constData() );
+    const auto size  = data.size();
+
+    for ( auto index = 0; index < size; )
+    {
+        const auto byte = bytes[ index ];
+        if ( byte < 0x80 )
+        {
+            ++index;
+            continue;
+        }
+
+        auto length       = 0;
+        uint codePoint    = 0;
+        uint minCodePoint = 0;
+
+        if ( ( byte & 0xe0 ) == 0xc0 )
+        {
+            length       = 2;
+            codePoint    = byte & 0x1f;
+            minCodePoint = 0x80;
+        }
+        else if ( ( byte & 0xf0 ) == 0xe0 )
+        {
+            length       = 3;
+            codePoint    = byte & 0x0f;
+            minCodePoint = 0x800;
+        }
+        else if ( ( byte & 0xf8 ) == 0xf0 )
+        {
+            length       = 4;
+            codePoint    = byte & 0x07;
+            minCodePoint = 0x10000;
+        }
+        else
+        {
+            return false;
+        }
+
+        if ( ( index + length ) > size ) { return false; }
+
+        for ( auto offset = 1; offset < length; ++offset )
+        {
+            if ( ( bytes[ index + offset ] & 0xc0 ) != 0x80 ) { return false; }
+
+            codePoint = ( codePoint << 6 ) | ( bytes[ index + offset ] & 0x3f );
+        }
+
+        // 过长编码、代理区和超出 Unicode 范围的码点都是无效的
+        if ( ( codePoint < minCodePoint ) || ( codePoint > 0x10ffff ) || ( ( codePoint >= 0xd800 ) && ( codePoint <= 0xdfff ) ) ) { return false; }
+
+        index += length;
+    }
+
+    return true;
+}
+
+// RFC 6455 7.4，1005、1006、1015 只在本地使用，不能出现在 close 帧里
+static bool isValidWebSocketCloseCode(const int closeCode)
+{
+    if ( ( closeCode >= 3000 ) && ( closeCode <= 4999 ) ) { return true; }
+
+    return ( closeCode >= 1000 ) && ( closeCode <= 1014 ) && ( closeCode != 1004 ) && ( closeCode != 1005 ) && ( closeCode != 1006 );
+}
+
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+static const QByteArray webSocketDeflateTail( "\x00\x00\xff\xff", 4 );
+
+// 从客户端的 Sec-WebSocket-Extensions 里选出第一个可以接受的 permessage-deflate（RFC 7692），返回回复的扩展，不接受时返回空
+static QByteArray webSocketDeflateResponse(const QString &extensions, int &serverMaxWindowBits)
+{
+    for ( const auto &offer: extensions.split( ',' ) )
+    {
+        const auto &&parameters = offer.split( ';' );
+        if ( parameters.first().trimmed().toLower() != "permessage-deflate" ) { continue; }
+
+        auto            accepted            = true;
+        auto            windowBits          = 15;
+        auto            hasServerWindowBits = false;
+        QSet< QString > names;
+
+        for ( auto index = 1; index < parameters.size(); ++index )
+        {
+            const auto &&parameter  = parameters[ index ].trimmed();
+            const auto   equalIndex = parameter.indexOf( '=' );
+            const auto &&name       = ( ( equalIndex < 0 ) ? ( parameter ) : ( parameter.left( equalIndex ) ) ).trimmed().toLower();
+
+            auto value = ( equalIndex < 0 ) ? ( QString() ) : ( parameter.mid( equalIndex + 1 ).trimmed() );
+            if ( ( value.size() >= 2 ) && value.startsWith( '"' ) && value.endsWith( '"' ) ) { value = value.mid( 1, value.size() - 2 ); }
+
+            // 参数重复或者不认识时这个 offer 无效
+            if ( names.contains( name ) )
+            {
+                accepted = false;
+                break;
+            }
+            names.insert( name );
+
+            auto isNumber = false;
+
+            if ( ( name == "server_no_context_takeover" ) || ( name == "client_no_context_takeover" ) )
+            {
+                accepted = equalIndex < 0;
+            }
+            else if ( name == "server_max_window_bits" )
+            {
+                // zlib 的原始 deflate 不支持 8 位的窗口
+                windowBits          = value.toInt( &isNumber );
+                accepted            = isNumber && ( windowBits >= 9 ) && ( windowBits <= 15 );
+                hasServerWindowBits = true;
+            }
+            else if ( name == "client_max_window_bits" )
+            {
+                // 只是告诉服务端客户端支持这个参数，解压时总是使用最大的窗口
+                if ( equalIndex >= 0 )
+                {
+                    const auto clientWindowBits = value.toInt( &isNumber );
+                    accepted = isNumber && ( clientWindowBits >= 8 ) && ( clientWindowBits <= 15 );
+                }
+            }
+            else
+            {
+                accepted = false;
+            }
+
+            if ( !accepted ) { break; }
+        }
+
+        if ( !accepted ) { continue; }
+
+        serverMaxWindowBits = windowBits;
+
+        QByteArray response( "permessage-deflate; server_no_context_takeover; client_no_context_takeover" );
+        if ( hasServerWindowBits ) { response += "; server_max_window_bits=" + QByteArray::number( windowBits ); }
+
+        return response;
+    }
+
+    return { };
+}
+
+// WebSocketDeflate
+JQHttpServer::WebSocketDeflate::WebSocketDeflate(const int windowBits):
+    windowBits_( windowBits )
+{ }
+
+JQHttpServer::WebSocketDeflate::~WebSocketDeflate()
+{
+    if ( deflateReady_ ) { deflateEnd( &deflateStream_ ); }
+    if ( inflateReady_ ) { inflateEnd( &inflateStream_ ); }
+}
+
+bool JQHttpServer::WebSocketDeflate::compress(const QByteArray &message, QByteArray &payload)
+{
+    if ( !deflateReady_ )
+    {
+        memset( &deflateStream_, 0, sizeof( deflateStream_ ) );
+
+        // windowBits 为负数时是不带 zlib 头的原始 deflate 数据
+        if ( deflateInit2( &deflateStream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -windowBits_, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+        {
+            qDebug() << "JQHttpServer::WebSocketDeflate::compress: error: deflateInit2 failed";
+            return false;
+        }
+
+        deflateReady_ = true;
+    }
+    else
+    {
+        deflateReset( &deflateStream_ );
+    }
+
+    payload.resize( static_cast< int >( deflateBound( &deflateStream_, static_cast< uLong >( message.size() ) ) ) + 16 );
+
+    deflateStream_.next_in   = reinterpret_cast< Bytef * >( const_cast< char * >( message.constData() ) );
+    deflateStream_.avail_in  = static_cast< uInt >( message.size() );
+    deflateStream_.next_out  = reinterpret_cast< Bytef * >( payload.data() );
+    deflateStream_.avail_out = static_cast< uInt >( payload.size() );
+
+    forever
+    {
+        const auto result = deflate( &deflateStream_, Z_SYNC_FLUSH );
+        if ( ( result != Z_OK ) && ( result != Z_BUF_ERROR ) ) { return false; }
+
+        if ( deflateStream_.avail_out ) { break; }
+
+        // 输出缓冲写满时 zlib 可能还有数据没有输出
+        const auto used = payload.size();
+        payload.resize( used * 2 );
+
+        deflateStream_.next_out  = reinterpret_cast< Bytef * >( payload.data() + used );
+        deflateStream_.avail_out = static_cast< uInt >( used );
+    }
+
+    payload.resize( payload.size() - static_cast< int >( deflateStream_.avail_out ) );
+
+    if ( payload.endsWith( webSocketDeflateTail ) ) { payload.chop( webSocketDeflateTail.size() ); }
+
+    return true;
+}
+
+bool JQHttpServer::WebSocketDeflate::decompress(const QByteArray &payload, const qint64 maxSize, QByteArray &message)
+{
+    if ( !inflateReady_ )
+    {
+        memset( &inflateStream_, 0, sizeof( inflateStream_ ) );
+
+        // 客户端的窗口不会超过 15 位，按最大的窗口解压
+        if ( inflateInit2( &inflateStream_, -15 ) != Z_OK )
+        {
+            qDebug() << "JQHttpServer::WebSocketDeflate::decompress: error: inflateInit2 failed";
+            return false;
+        }
+
+        inflateReady_ = true;
+    }
+    else
+    {
+        inflateReset( &inflateStream_ );
+    }
+
+    // 发送方去掉了结尾的 00 00 ff ff，解压前补回来
+    const auto &&input = payload + webSocketDeflateTail;
+
+    inflateStream_.next_in  = reinterpret_cast< Bytef * >( const_cast< char * >( input.constData() ) );
+    inflateStream_.avail_in = static_cast< uInt >( input.size() );
+
+    message.clear();
+
+    char buffer[ 16 * 1024 ];
+    forever
+    {
+        inflateStream_.next_out  = reinterpret_cast< Bytef * >( buffer );
+        inflateStream_.avail_out = sizeof( buffer );
+
+        const auto result = inflate( &inflateStream_, Z_SYNC_FLUSH );
+        if ( ( result != Z_OK ) && ( result != Z_STREAM_END ) && ( result != Z_BUF_ERROR ) ) { return false; }
+
+        const auto produced = static_cast< int >( sizeof( buffer ) - inflateStream_.avail_out );
+        message.append( buffer, produced );
+
+        if ( message.size() > maxSize ) { return false; }
+
+        // 输出缓冲没有写满说明输入已经处理完了
+        if ( ( result != Z_OK ) || inflateStream_.avail_out ) { break; }
+    }
+
+    return true;
+}
+
+JQHttpServer::WebSocketDeflate *JQHttpServer::WebSocketDeflate::threadLocal(const int windowBits)
+{
+    static thread_local QMap< int, QSharedPointer< WebSocketDeflate > > instances;
+
+    auto &instance = instances[ windowBits ];
+    if ( !instance ) { instance.reset( new WebSocketDeflate( windowBits ) ); }
+
+    return instance.data();
+}
+#endif
+
+JQHttpServer::WebSocket::WebSocket(const QPointer< QIODevice > &socket, const QString &requestUrl, const QMap< QString, QString > &requestHeader, const QString &requestSourceIp, const WebSocketOptions &webSocketOptions):
+    socket_( socket ),
+    requestUrl_( requestUrl ),
+    requestHeader_( requestHeader ),
+    requestSourceIp_( requestSourceIp ),
+    webSocketOptions_( webSocketOptions )
+{
+    pingTimer_.setInterval( webSocketOptions_.pingInterval );
+
+    idleTimer_.setSingleShot( true );
+    idleTimer_.setInterval( webSocketOptions_.idleTimeout );
+
+    connect( &pingTimer_, &QTimer::timeout, this, &WebSocket::onPingTimeout );
+    connect( &idleTimer_, &QTimer::timeout, this, &WebSocket::abort );
+}
+
+JQHttpServer::WebSocket::~WebSocket()
+{
+    if ( !socket_.isNull() )
+    {
+        QObject::disconnect( socket_.data(), nullptr, this, nullptr );
+        delete socket_.data();
+    }
+}
+
+QString JQHttpServer::WebSocket::requestUrlPath() const
+{
+    const auto indexForQueryStart = requestUrl_.indexOf( "?" );
+
+    return ( indexForQueryStart >= 0 ) ? ( requestUrl_.mid( 0, indexForQueryStart ) ) : ( requestUrl_ );
+}
+
+bool JQHttpServer::WebSocket::takeEvent(Event &event)
+{
+    eventMutex_.lock();
+
+    if ( events_.isEmpty() )
+    {
+        eventHandling_ = false;
+        eventMutex_.unlock();
+        return false;
+    }
+
+    event = events_.dequeue();
+    pendingSize_ -= event.data.size();
+
+    eventMutex_.unlock();
+
+    return true;
+}
+
+void JQHttpServer::WebSocket::start(const QByteArray &receivedData)
+{
+    QString key;
+    QString extensions;
+    for ( auto it = requestHeader_.begin(); it != requestHeader_.end(); ++it )
+    {
+        const auto &&name = it.key().toLower();
+
+        if ( name == "sec-websocket-key" )
+        {
+            key = it.value().trimmed();
+        }
+        else if ( name == "sec-websocket-extensions" )
+        {
+            extensions = it.value();
+        }
+    }
+
+    QByteArray extensionResponse;
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+    if ( webSocketOptions_.perMessageDeflate ) { extensionResponse = webSocketDeflateResponse( extensions, serverMaxWindowBits_ ); }
+#endif
+    perMessageDeflate_ = !extensionResponse.isEmpty();
+
+    QByteArray response( "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: " );
+    response += webSocketAcceptKey( key.toLatin1() ) + "\r\n";
+    if ( perMessageDeflate_ ) { response += "Sec-WebSocket-Extensions: " + extensionResponse + "\r\n"; }
+    response += "\r\n";
+
+    connect( socket_.data(), &QIODevice::readyRead, this, &WebSocket::onReadyRead );
+
+    if ( qobject_cast< QAbstractSocket * >( socket_.data() ) )
+    {
+        connect( qobject_cast< QAbstractSocket * >( socket_.data() ), &QAbstractSocket::disconnected, this, &WebSocket::onDisconnected );
+    }
+    else if ( qobject_cast< QLocalSocket * >( socket_.data() ) )
+    {
+        connect( qobject_cast< QLocalSocket * >( socket_.data() ), &QLocalSocket::disconnected, this, &WebSocket::onDisconnected );
+    }
+
+    socket_->write( response );
+    connected_.storeRelease( 1 );
+
+    if ( webSocketOptions_.pingInterval > 0 ) { pingTimer_.start(); }
+    if ( webSocketOptions_.idleTimeout > 0 ) { idleTimer_.start(); }
+
+    Event event;
+    event.type = OpenedEvent;
+    this->pushEvent( event );
+
+    // 握手请求后面可能紧跟着第一个帧
+    receiveBuffer_ = receivedData;
+    this->processReceiveBuffer();
+
+    // 交接之前客户端已经断开的话不会再收到 disconnected
+    const auto abstractSocket = qobject_cast< QAbstractSocket * >( socket_.data() );
+    if ( abstractSocket && ( abstractSocket->state() == QAbstractSocket::UnconnectedState ) ) { this->onDisconnected(); }
+}
+
+void JQHttpServer::WebSocket::abort()
+{
+    if ( qobject_cast< QAbstractSocket * >( socket_.data() ) )
+    {
+        qobject_cast< QAbstractSocket * >( socket_.data() )->abort();
+    }
+    else if ( qobject_cast< QLocalSocket * >( socket_.data() ) )
+    {
+        qobject_cast< QLocalSocket * >( socket_.data() )->abort();
+    }
+    else if ( !socket_.isNull() )
+    {
+        socket_->close();
+    }
+
+    this->onDisconnected();
+}
+
+void JQHttpServer::WebSocket::sendText(const QString &message)
+{
+    if ( QThread::currentThread() != this->thread() )
+    {
+        QMetaObject::invokeMethod( this, "sendText", Qt::QueuedConnection, Q_ARG( QString, message ) );
+        return;
+    }
+
+    this->sendMessage( WebSocketTextFrame, message.toUtf8() );
+}
+
+void JQHttpServer::WebSocket::sendBinary(const QByteArray &message)
+{
+    if ( QThread::currentThread() != this->thread() )
+    {
+        QMetaObject::invokeMethod( this, "sendBinary", Qt::QueuedConnection, Q_ARG( QByteArray, message ) );
+        return;
+    }
+
+    this->sendMessage( WebSocketBinaryFrame, message );
+}
+
+void JQHttpServer::WebSocket::close(const int closeCode, const QString &reason)
+{
+    if ( QThread::currentThread() != this->thread() )
+    {
+        QMetaObject::invokeMethod( this, "close", Qt::QueuedConnection, Q_ARG( int, closeCode ), Q_ARG( QString, reason ) );
+        return;
+    }
+
+    if ( closeSent_ || finished_ ) { return; }
+
+    this->sendClose( closeCode, reason.toUtf8() );
+
+    // 对端一直不回复 close 时强制断开
+    QTimer::singleShot( 5 * 1000, this, &WebSocket::abort );
+}
+
+void JQHttpServer::WebSocket::onReadyRead()
+{
+    receiveBuffer_.append( socket_->readAll() );
+
+    if ( webSocketOptions_.idleTimeout > 0 ) { idleTimer_.start(); }
+
+    this->processReceiveBuffer();
+}
+
+void JQHttpServer::WebSocket::onDisconnected()
+{
+    if ( finished_ ) { return; }
+
+    finished_ = true;
+    connected_.storeRelease( 0 );
+
+    pingTimer_.stop();
+    idleTimer_.stop();
+
+    Event event;
+    event.type      = ClosedEvent;
+    event.closeCode = closeCode_;
+    this->pushEvent( event );
+}
+
+void JQHttpServer::WebSocket::onPingTimeout()
+{
+    this->writeFrame( WebSocketPingFrame, QByteArray() );
+}
+
+void JQHttpServer::WebSocket::processReceiveBuffer()
+{
+    // 一次读到多个帧时最后再从缓冲区移除，避免每个帧都移动一次剩下的数据
+    int offset = 0;
+
+    forever
+    {
+        // 关闭握手之后或者连接出错之后收到的数据直接丢弃
+        if ( closeReceived_ || failed_ || finished_ )
+        {
+            receiveBuffer_.clear();
+            return;
+        }
+
+        const auto available = receiveBuffer_.size() - offset;
+        if ( available < 2 ) { break; }
+
+        const auto bytes        = reinterpret_cast< const uchar * >( receiveBuffer_.constData() + offset );
+        const auto isFinal      = ( bytes[ 0 ] & 0x80 ) != 0;
+        const auto isCompressed = ( bytes[ 0 ] & 0x40 ) != 0;
+        const auto opcode       = bytes[ 0 ] & 0x0f;
+        const auto isMasked     = ( bytes[ 1 ] & 0x80 ) != 0;
+        const auto isControl    = ( opcode & 0x08 ) != 0;
+
+        int     headerSize  = 2;
+        quint64 payloadSize = bytes[ 1 ] & 0x7f;
+
+        if ( payloadSize == 126 )
+        {
+            if ( available < 4 ) { break; }
+
+            payloadSize = ( static_cast< quint64 >( bytes[ 2 ] ) << 8 ) | bytes[ 3 ];
+            headerSize  = 4;
+        }
+        else if ( payloadSize == 127 )
+        {
+            if ( available < 10 ) { break; }
+
+            payloadSize = 0;
+            for ( auto index = 2; index < 10; ++index )
+            {
+                payloadSize = ( payloadSize << 8 ) | bytes[ index ];
+            }
+            headerSize = 10;
+        }
+
+        // 客户端的帧必须加掩码，RSV2 和 RSV3 没有对应的扩展，控制帧不超过 125 字节
+        if ( !isMasked || ( bytes[ 0 ] & 0x30 ) || ( isControl && ( payloadSize > 125 ) ) )
+        {
+            this->failConnection( 1002 );
+            return;
+        }
+
+        // 超过上限的消息不等收完，直接关闭
+        if ( !isControl && ( ( static_cast< quint64 >( messageBuffer_.size() ) + payloadSize ) > static_cast< quint64 >( webSocketOptions_.maxMessageSize ) ) )
+        {
+            this->failConnection( 1009 );
+            return;
+        }
+
+        // 帧头（包括掩码）还没有收完
+        headerSize += 4;
+        if ( available < headerSize ) { break; }
+        if ( static_cast< quint64 >( available - headerSize ) < payloadSize ) { break; }
+
+        const auto mask = bytes + headerSize - 4;
+
+        QByteArray payload( reinterpret_cast< const char * >( bytes + headerSize ), static_cast< int >( payloadSize ) );
+        auto       payloadData = payload.data();
+        for ( auto index = 0; index < payload.size(); ++index )
+        {
+            payloadData[ index ] = static_cast< char >( payloadData[ index ] ^ mask[ index % 4 ] );
+        }
+
+        offset += headerSize + static_cast< int >( payloadSize );
+
+        if ( !this->processFrame( opcode, isFinal, isCompressed, payload ) )
+        {
+            receiveBuffer_.clear();
+            return;
+        }
+    }
+
+    receiveBuffer_.remove( 0, offset );
+}
+
+bool JQHttpServer::WebSocket::processFrame(const int opcode, const bool isFinal, const bool isCompressed, const QByteArray &payload)
+{
+    switch ( opcode )
+    {
+        case WebSocketContinuationFrame:
+        case WebSocketTextFrame:
+        case WebSocketBinaryFrame:
+        {
+            // 续帧必须接在没有结束的消息后面，新消息不能插在分片中间，RSV1 只能出现在第一帧
+            const auto isContinuation = opcode == WebSocketContinuationFrame;
+            if ( ( isContinuation ) ? ( !messageOpcode_ || isCompressed ) : ( ( messageOpcode_ != 0 ) || ( isCompressed && !perMessageDeflate_ ) ) )
+            {
+                this->failConnection( 1002 );
+                return false;
+            }
+
+            if ( !isContinuation )
+            {
+                messageOpcode_     = opcode;
+                messageCompressed_ = isCompressed;
+            }
+
+            messageBuffer_.append( payload );
+            if ( !isFinal ) { return true; }
+
+            QByteArray message;
+            message.swap( messageBuffer_ );
+
+            const auto isText     = messageOpcode_ == WebSocketTextFrame;
+            const auto compressed = messageCompressed_;
+
+            messageOpcode_     = 0;
+            messageCompressed_ = false;
+
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+            if ( compressed )
+            {
+                QByteArray decompressed;
+                if ( !WebSocketDeflate::threadLocal( serverMaxWindowBits_ )->decompress( message, webSocketOptions_.maxMessageSize, decompressed ) )
+                {
+                    this->failConnection( ( decompressed.size() > webSocketOptions_.maxMessageSize ) ? ( 1009 ) : ( 1007 ) );
+                    return false;
+                }
+
+                message = decompressed;
+            }
+#else
+            Q_UNUSED( compressed );
+#endif
+
+            if ( isText && !isValidUtf8( message ) )
+            {
+                this->failConnection( 1007 );
+                return false;
+            }
+
+            Event event;
+            event.type   = MessageEvent;
+            event.data   = message;
+            event.isText = isText;
+
+            // 回调处理得比客户端发送慢，继续缓存只会占满内存
+            if ( !this->pushEvent( event ) )
+            {
+                if ( statistics_ ) { ++statistics_->pendingOverflowCount; }
+                qDebug() << "JQHttpServer::WebSocket::processFrame: error: pending messages overflow:" << requestSourceIp_;
+
+                this->failConnection( 1008 );
+                return false;
+            }
+
+            return true;
+        }
+        case WebSocketPingFrame:
+        case WebSocketPongFrame:
+        case WebSocketCloseFrame:
+        {
+            // 控制帧不能分片，也不能压缩
+            if ( !isFinal || isCompressed )
+            {
+                this->failConnection( 1002 );
+                return false;
+            }
+
+            if ( opcode == WebSocketPingFrame )
+            {
+                this->writeFrame( WebSocketPongFrame, payload );
+                return true;
+            }
+
+            // pong 只用来刷新空闲计时，收到数据时已经刷新过了
+            if ( opcode == WebSocketPongFrame ) { return true; }
+
+            auto closeCode = 1005;
+            if ( payload.size() == 1 )
+            {
+                this->failConnection( 1002 );
+                return false;
+            }
+            else if ( payload.size() >= 2 )
+            {
+                closeCode = ( static_cast< uchar >( payload[ 0 ] ) << 8 ) | static_cast< uchar >( payload[ 1 ] );
+
+                if ( !isValidWebSocketCloseCode( closeCode ) )
+                {
+                    this->failConnection( 1002 );
+                    return false;
+                }
+
+                if ( !isValidUtf8( payload.mid( 2 ) ) )
+                {
+                    this->failConnection( 1007 );
+                    return false;
+                }
+            }
+
+            closeReceived_ = true;
+            closeCode_     = closeCode;
+
+            // 回复 close 后由服务端先断开 TCP 连接
+            if ( !closeSent_ ) { this->sendClose( ( closeCode == 1005 ) ? ( 0 ) : ( closeCode ) ); }
+            this->disconnectSocket();
+
+            return false;
+        }
+        default:
+        {
+            this->failConnection( 1002 );
+            return false;
+        }
+    }
+}
+
+void JQHttpServer::WebSocket::sendMessage(const int opcode, const QByteArray &message)
+{
+    if ( closeSent_ || finished_ || socket_.isNull() ) { return; }
+
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+    // 压缩后没有变小的消息（比如已经压缩过的图片）直接发送
+    if ( perMessageDeflate_ && ( message.size() >= webSocketOptions_.compressMinSize ) )
+    {
+        QByteArray payload;
+        if ( WebSocketDeflate::threadLocal( serverMaxWindowBits_ )->compress( message, payload ) && ( payload.size() < message.size() ) )
+        {
+            this->writeFrame( opcode, payload, true );
+            return;
+        }
+    }
+#endif
+
+    this->writeFrame( opcode, message );
+}
+
+void JQHttpServer::WebSocket::writeFrame(const int opcode, const QByteArray &payload, const bool isCompressed)
+{
+    if ( finished_ || socket_.isNull() ) { return; }
+
+    socket_->write( webSocketFrame( opcode, payload, isCompressed ) );
+
+    // 客户端读得太慢，继续缓冲只会占满内存
+    if ( ( webSocketOptions_.maxBufferedSize > 0 ) && ( socket_->bytesToWrite() > webSocketOptions_.maxBufferedSize ) )
+    {
+        if ( statistics_ ) { ++statistics_->overflowCount; }
+        qDebug() << "JQHttpServer::WebSocket::writeFrame: error: send buffer overflow:" << requestSourceIp_;
+
+        this->abort();
+    }
+}
+
+void JQHttpServer::WebSocket::sendClose(const int closeCode, const QByteArray &reason)
+{
+    if ( closeSent_ ) { return; }
+
+    closeSent_ = true;
+    connected_.storeRelease( 0 );
+    pingTimer_.stop();
+
+    // closeCode 为 0 时发送不带关闭码的 close
+    QByteArray payload;
+    if ( closeCode > 0 )
+    {
+        payload.append( static_cast< char >( ( closeCode >> 8 ) & 0xff ) );
+        payload.append( static_cast< char >( closeCode & 0xff ) );
+        payload.append( reason.left( 123 ) );
+    }
+
+    this->writeFrame( WebSocketCloseFrame, payload );
+}
+
+void JQHttpServer::WebSocket::failConnection(const int closeCode)
+{
+    failed_    = true;
+    closeCode_ = closeCode;
+
+    this->sendClose( closeCode );
+    this->disconnectSocket();
+}
+
+void JQHttpServer::WebSocket::disconnectSocket()
+{
+    if ( qobject_cast< QAbstractSocket * >( socket_.data() ) )
+    {
+        qobject_cast< QAbstractSocket * >( socket_.data() )->disconnectFromHost();
+    }
+    else if ( qobject_cast< QLocalSocket * >( socket_.data() ) )
+    {
+        qobject_cast< QLocalSocket * >( socket_.data() )->disconnectFromServer();
+    }
+    else if ( !socket_.isNull() )
+    {
+        socket_->close();
+        this->onDisconnected();
+    }
+}
+
+bool JQHttpServer::WebSocket::pushEvent(const Event &event)
+{
+    eventMutex_.lock();
+
+    // 队列为空时总是放入，单条消息的大小由 maxMessageSize 限制
+    if ( ( event.type == MessageEvent ) && ( webSocketOptions_.maxPendingSize > 0 ) && pendingSize_ &&
+         ( ( pendingSize_ + event.data.size() ) > webSocketOptions_.maxPendingSize ) )
+    {
+        eventMutex_.unlock();
+        return false;
+    }
+
+    events_.enqueue( event );
+    pendingSize_ += event.data.size();
+
+    const auto startHandling = !eventHandling_;
+    eventHandling_ = true;
+
+    eventMutex_.unlock();
+
+    if ( startHandling && eventCallback_ ) { eventCallback_(); }
+
+    return true;
+}
+
+// CpuAffinity
+QList< int > JQHttpServer::AbstractManage::cpuListFromString(const QString &cpuList)
+{
+    QList< int > result;
+
+#if ( QT_VERSION >= QT_VERSION_CHECK( 5, 15, 0 ) )
+    const auto &&items = cpuList.split( ',', Qt::SkipEmptyParts );
+#else
+    const auto &&items = cpuList.split( ',', QString::SkipEmptyParts );
+#endif
+
+    for ( const auto &item: items )
+    {
+        const auto range = item.trimmed().split( '-' );
+        if ( range.size() > 2 ) { continue; }
+
+        auto firstOk = false;
+        auto lastOk  = true;
+        const auto first = range.first().toInt( &firstOk );
+        const auto last  = ( range.size() == 2 ) ? ( range.last().toInt( &lastOk ) ) : ( first );
+        if ( !firstOk || !lastOk ) { continue; }
+
+        for ( auto cpu = first; cpu <= last; ++cpu )
+        {
+            if ( !result.contains( cpu ) ) { result.push_back( cpu ); }
+        }
+    }
+
+    return result;
+}
+
+// 内核的节点编号 -> 核心，来自 /sys/devices/system/node/nodeN/cpulist
+static QMap< int, QList< int > > numaTopology()
+{
+    static const auto result = [ ]()
+    {
+        QMap< int, QList< int > > topology;
+
+#ifdef Q_OS_LINUX
+        const auto nodeNames = QDir( "/sys/devices/system/node" ).entryList( { "node*" }, QDir::Dirs );
+        for ( const auto &nodeName: nodeNames )
+        {
+            auto ok = false;
+            const auto node = nodeName.mid( 4 ).toInt( &ok );
+            if ( !ok ) { continue; }
+
+            QFile file( QString( "/sys/devices/system/node/%1/cpulist" ).arg( nodeName ) );
+            if ( !file.open( QIODevice::ReadOnly ) ) { continue; }
+
+            const auto cpus = JQHttpServer::AbstractManage::cpuListFromString( QString::fromLatin1( file.readAll() ) );
+            if ( !cpus.isEmpty() ) { topology[ node ] = cpus; }
+        }
+#endif
+
+        return topology;
+    }();
+
+    return result;
+}
+
+QList< QList< int > > JQHttpServer::AbstractManage::numaNodeCpus()
+{
+    auto result = numaTopology().values();
+
+    if ( result.isEmpty() )
+    {
+        QList< int > cpus;
+        for ( auto cpu = 0; cpu < QThread::idealThreadCount(); ++cpu ) { cpus.push_back( cpu ); }
+        result.push_back( cpus );
+    }
+
+    return result;
+}
+
+#ifdef Q_OS_LINUX
+// 核心所在的 NUMA 节点（内核编号），未知时返回 -1
+static int cpuNumaNode(const int cpu)
+{
+    static const auto cpuNodes = [ ]()
+    {
+        QMap< int, int > result;
+
+        const auto topology = numaTopology();
+        for ( auto it = topology.begin(); it != topology.end(); ++it )
+        {
+            for ( const auto &nodeCpu: it.value() ) { result[ nodeCpu ] = it.key(); }
+        }
+
+        return result;
+    }();
+
+    return cpuNodes.value( cpu, -1 );
+}
+
+// sched_getcpu 走 vDSO，每个请求调用一次的开销可以忽略
+static int currentCpuNumaNode()
+{
+    return cpuNumaNode( sched_getcpu() );
+}
+
+// 设置当前线程可以运行的核心，nodeLocalMemory 为 true 时优先从第一个核心所在的节点分配内存
+// glibc 的 malloc 按线程分配 arena，线程固定在节点上之后，新分配的页按 first-touch 落在本节点
+// cpus 为空时恢复成所有核心和默认的内存策略，线程池里的线程之前可能绑过核
+static bool setCurrentThreadCpuAffinity(const QList< int > &cpus, const bool nodeLocalMemory)
+{
+    cpu_set_t cpuSet;
+    CPU_ZERO( &cpuSet );
+
+    if ( cpus.isEmpty() )
+    {
+        // 内核会和 cgroup 允许的核心取交集
+        const auto cpuCount = qMin( static_cast< int >( sysconf( _SC_NPROCESSORS_CONF ) ), static_cast< int >( CPU_SETSIZE ) );
+        for ( auto cpu = 0; cpu < cpuCount; ++cpu ) { CPU_SET( cpu, &cpuSet ); }
+    }
+    else
+    {
+        for ( const auto &cpu: cpus )
+        {
+            if ( ( cpu >= 0 ) && ( cpu < CPU_SETSIZE ) ) { CPU_SET( cpu, &cpuSet ); }
+        }
+    }
+
+    if ( sched_setaffinity( 0, sizeof( cpuSet ), &cpuSet ) )
+    {
+        qDebug() << "JQHttpServer::setCurrentThreadCpuAffinity: error: sched_setaffinity:" << strerror( errno );
+        return false;
+    }
+
+    // MPOL_DEFAULT 和 MPOL_PREFERRED，避免依赖 libnuma 的 numaif.h
+    static const int mpolDefault   = 0;
+    static const int mpolPreferred = 1;
+
+    if ( cpus.isEmpty() || !nodeLocalMemory )
+    {
+        syscall( SYS_set_mempolicy, mpolDefault, nullptr, 0 );
+        return true;
+    }
+
+    const auto node = cpuNumaNode( cpus.first() );
+    if ( ( node < 0 ) || ( node >= static_cast< int >( sizeof( unsigned long ) * 8 ) ) ) { return false; }
+
+    const unsigned long nodeMask = 1UL << node;
+    if ( syscall( SYS_set_mempolicy, mpolPreferred, &nodeMask, sizeof( nodeMask ) * 8 + 1 ) )
+    {
+        qDebug() << "JQHttpServer::setCurrentThreadCpuAffinity: error: set_mempolicy:" << strerror( errno );
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+// HandlePool
+namespace JQHttpServer
+{
+
+class HandleRunnable: public QRunnable
+{
+public:
+    HandleRunnable(const std::function< void() > &callback):
+        callback_( callback )
+    { }
+
+    void run() final
+    {
+        callback_();
+    }
+
+private:
+    std::function< void() > callback_;
+};
+
+// 按排队时间伸缩的线程池共用一个定时线程，worker 全部阻塞、没有任务出队时也能扩容
+class HandlePoolScaler: public QThread
+{
+public:
+    static HandlePoolScaler *instance()
+    {
+        static HandlePoolScaler scaler;
+        return &scaler;
+    }
+
+    ~HandlePoolScaler()
+    {
+        mutex_.lock();
+        handlePools_.clear();
+        condition_.wakeAll();
+        mutex_.unlock();
+
+        this->wait();
+    }
+
+    void add(HandlePool *handlePool)
+    {
+        mutex_.lock();
+
+        handlePools_.insert( handlePool );
+
+        // 没有线程池时线程会退出，上一个线程已经离开循环，等它结束后重新启动
+        if ( !running_ )
+        {
+            running_ = true;
+            this->wait();
+            this->start();
+        }
+
+        mutex_.unlock();
+    }
+
+    // 返回之后不会再调用这个线程池
+    void remove(HandlePool *handlePool)
+    {
+        mutex_.lock();
+        handlePools_.remove( handlePool );
+        mutex_.unlock();
+    }
+
+private:
+    void run() final
+    {
+        static const int scaleInterval = 100;
+
+        mutex_.lock();
+
+        while ( !handlePools_.isEmpty() )
+        {
+            for ( const auto &handlePool: handlePools_ )
+            {
+                handlePool->scale();
+            }
+
+            condition_.wait( &mutex_, scaleInterval );
+        }
+
+        running_ = false;
+
+        mutex_.unlock();
+    }
+
+private:
+    QMutex                mutex_;
+    QWaitCondition        condition_;
+    QSet< HandlePool * >  handlePools_;
+    bool                  running_ = false;
+};
+
+}
+
+JQHttpServer::HandlePool::HandlePool(const QString &name, const int maxThreadCount):
+    name_( name ),
+    threadPool_( new QThreadPool ),
+    minThreadCount_( qMax( 1, maxThreadCount ) ),
+    maxThreadCount_( qMax( 1, maxThreadCount ) )
+{
+    threadPool_->setMaxThreadCount( maxThreadCount_ );
+    elapsedTimer_.start();
+}
+
+JQHttpServer::HandlePool::~HandlePool()
+{
+    HandlePoolScaler::instance()->remove( this );
+
+    this->waitForDone();
+}
+
+void JQHttpServer::HandlePool::setScalePolicy(const HandleScalePolicy scalePolicy, const int minThreadCount, const int maxThreadCount, const int targetQueueLatency)
+{
+    // 不能持有 mutex_ 调用，伸缩线程先拿自己的锁再拿 mutex_
+    if ( scalePolicy == QueueLatencyHandleScalePolicy )
+    {
+        HandlePoolScaler::instance()->add( this );
+    }
+    else
+    {
+        HandlePoolScaler::instance()->remove( this );
+    }
+
+    QMutexLocker locker( &mutex_ );
+
+    scalePolicy_        = scalePolicy;
+    minThreadCount_     = qMax( 1, minThreadCount );
+    maxThreadCount_     = qMax( minThreadCount_, maxThreadCount );
+    targetQueueLatency_ = qMax( 1, targetQueueLatency );
+    lastScaleAction_    = 0;
+    scaleWindowStart_   = elapsedTimer_.elapsed();
+    scaleWindowWait_    = 0;
+    scaleWindowTaken_   = 0;
+    scaleWindowBusy_    = 0;
+
+    switch ( scalePolicy_ )
+    {
+        case QueueLatencyHandleScalePolicy:
+        {
+            this->setThreadCount( minThreadCount_ );
+            break;
+        }
+        case CpuBoundHandleScalePolicy:
+        {
+            this->setThreadCount( qBound( minThreadCount_, QThread::idealThreadCount(), maxThreadCount_ ) );
+            break;
+        }
+        default:
+        {
+            this->setThreadCount( maxThreadCount_ );
+            break;
+        }
+    }
+}
+
+void JQHttpServer::HandlePool::setCpuAffinity(const QList< int > &cpus, const bool nodeLocalMemory)
+{
+    QMutexLocker locker( &mutex_ );
+
+    cpus_            = cpus;
+    nodeLocalMemory_ = nodeLocalMemory;
+
+    // 已经在运行的线程在下一次取任务时重新设置
+    cpuAffinityGeneration_.fetchAndAddOrdered( 1 );
+}
+
+QList< int > JQHttpServer::HandlePool::cpuAffinity() const
+{
+    QMutexLocker locker( &mutex_ );
+
+    return cpus_;
+}
+
+void JQHttpServer::HandlePool::start(const std::function< void() > &callback, const int priority)
+{
+    Task task;
+    task.callback    = callback;
+    task.priority    = priority;
+    task.enqueueTime = elapsedTimer_.elapsed();
+
+    mutex_.lock();
+
+    queues_[ priority ].enqueue( task );
+    ++queueDepth_;
+    maxQueueDepth_ = qMax( maxQueueDepth_, queueDepth_ );
+
+    this->autoScale( task.enqueueTime );
+
+    const auto needNewWorker = workerCount_ < threadPool_->maxThreadCount();
+    if ( needNewWorker ) { ++workerCount_; }
+
+    mutex_.unlock();
+
+    if ( needNewWorker )
+    {
+        threadPool_->start( new HandleRunnable( std::bind( &HandlePool::runWorker, this ) ) );
+    }
+}
+
+void JQHttpServer::HandlePool::waitForDone()
+{
+    threadPool_->waitForDone();
+}
+
+QJsonObject JQHttpServer::HandlePool::status() const
+{
+    QJsonObject result;
+
+    result[ "name" ]           = name_;
+    result[ "threadCount" ]    = threadPool_->maxThreadCount();
+    result[ "runningCount" ]   = runningCount_.loadAcquire();
+    result[ "startedCount" ]   = static_cast< double >( startedCount_.loadAcquire() );
+    result[ "finishedCount" ]  = static_cast< double >( finishedCount_.loadAcquire() );
+
+    mutex_.lock();
+
+    QJsonObject queueDepthByPriority;
+    for ( auto it = queues_.begin(); it != queues_.end(); ++it )
+    {
+        if ( it.value().isEmpty() ) { continue; }
+
+        queueDepthByPriority[ QString::number( it.key() ) ] = it.value().size();
+    }
+
+    result[ "queueDepth" ]           = queueDepth_;
+    result[ "maxQueueDepth" ]        = maxQueueDepth_;
+    result[ "queueDepthByPriority" ] = queueDepthByPriority;
+    result[ "agedTakeCount" ]        = static_cast< double >( agedTakeCount_ );
+
+    static const QStringList scalePolicyNames( { "fixed", "queueLatency", "cpuBound" } );
+
+    result[ "scalePolicy" ]        = scalePolicyNames.value( scalePolicy_ );
+    result[ "minThreadCount" ]     = minThreadCount_;
+    result[ "maxThreadCount" ]     = maxThreadCount_;
+    result[ "targetQueueLatency" ] = targetQueueLatency_;
+    result[ "queueLatency" ]       = lastQueueLatency_;
+    result[ "throughput" ]         = lastThroughput_;
+    result[ "scaleUpCount" ]       = static_cast< double >( scaleUpCount_ );
+    result[ "scaleDownCount" ]     = static_cast< double >( scaleDownCount_ );
+
+    QJsonArray cpus;
+    for ( const auto &cpu: cpus_ ) { cpus.push_back( cpu ); }
+    result[ "cpus" ] = cpus;
+
+    mutex_.unlock();
+
+    return result;
+}
+
+void JQHttpServer::HandlePool::runWorker()
+{
+#ifdef Q_OS_LINUX
+    // 线程池里的线程只属于这一个 HandlePool，记录每个线程已经应用过的设置
+    static thread_local int appliedCpuAffinityGeneration = 0;
+
+    const auto cpuAffinityGeneration = cpuAffinityGeneration_.loadAcquire();
+    if ( appliedCpuAffinityGeneration != cpuAffinityGeneration )
+    {
+        appliedCpuAffinityGeneration = cpuAffinityGeneration;
+
+        mutex_.lock();
+        const auto cpus            = cpus_;
+        const auto nodeLocalMemory = nodeLocalMemory_;
+        mutex_.unlock();
+
+        setCurrentThreadCpuAffinity( cpus, nodeLocalMemory );
+    }
+#endif
+
+    Task task;
+
+    while ( this->takeTask( task ) )
+    {
+        runningCount_.fetchAndAddOrdered( 1 );
+        startedCount_.fetchAndAddOrdered( 1 );
+
+        task.callback();
+        task.callback = nullptr;
+
+        runningCount_.fetchAndSubOrdered( 1 );
+        finishedCount_.fetchAndAddOrdered( 1 );
+    }
+}
+
+bool JQHttpServer::HandlePool::takeTask(Task &task)
+{
+    QMutexLocker locker( &mutex_ );
+
+    // 线程池被调小时，多出来的 worker 直接退出
+    if ( !queueDepth_ || ( workerCount_ > threadPool_->maxThreadCount() ) )
+    {
+        --workerCount_;
+        return false;
+    }
+
+    // 每个优先级的队首都是该优先级里等待最久的任务，只需要比较队首的有效优先级
+    const auto currentTime = elapsedTimer_.elapsed();
+    auto       bestIt      = queues_.end();
+    auto       bestEffectivePriority = std::numeric_limits< qint64 >::min();
+
+    for ( auto it = queues_.begin(); it != queues_.end(); ++it )
+    {
+        if ( it.value().isEmpty() ) { continue; }
+
+        const auto effectivePriority = it.key() + ( currentTime - it.value().head().enqueueTime ) / priorityAgingInterval_;
+        if ( effectivePriority > bestEffectivePriority )
+        {
+            bestEffectivePriority = effectivePriority;
+            bestIt = it;
+        }
+    }
+
+    // 被选中的不是最高优先级的非空队列，说明是老化机制让它插了队
+    for ( auto it = queues_.end(); it != queues_.begin(); )
+    {
+        --it;
+        if ( it.value().isEmpty() ) { continue; }
+        if ( it != bestIt ) { ++agedTakeCount_; }
+        break;
+    }
+
+    task = bestIt.value().dequeue();
+    --queueDepth_;
+
+    scaleWindowWait_ += currentTime - task.enqueueTime;
+    ++scaleWindowTaken_;
+    scaleWindowBusy_ += runningCount_.loadAcquire();
+
+    this->autoScale( currentTime );
+
+    return true;
+}
+
+void JQHttpServer::HandlePool::scale()
+{
+    QMutexLocker locker( &mutex_ );
+
+    this->autoScale( elapsedTimer_.elapsed() );
+}
+
+void JQHttpServer::HandlePool::autoScale(const qint64 currentTime)
+{
+    static const qint64 scaleWindowInterval = 500;
+
+    if ( scalePolicy_ != QueueLatencyHandleScalePolicy ) { return; }
+
+    const auto windowTime = currentTime - scaleWindowStart_;
+    if ( windowTime < scaleWindowInterval ) { return; }
+
+    const auto finishedCount = finishedCount_.loadAcquire();
+    const auto threadCount   = threadPool_->maxThreadCount();
+
+    lastThroughput_    = static_cast< double >( finishedCount - lastFinishedCount_ ) * 1000 / windowTime;
+    lastQueueLatency_  = ( scaleWindowTaken_ ) ? ( static_cast< double >( scaleWindowWait_ ) / scaleWindowTaken_ ) : ( 0 );
+    lastFinishedCount_ = finishedCount;
+
+    // 还在队列里的任务也要算进去，否则所有线程都被阻塞时窗口内没有任务出队，等待时间会被低估
+    auto oldestWait = static_cast< qint64 >( 0 );
+    for ( auto it = queues_.begin(); it != queues_.end(); ++it )
+    {
+        if ( it.value().isEmpty() ) { continue; }
+
+        oldestWait = qMax( oldestWait, currentTime - it.value().head().enqueueTime );
+    }
+
+    const auto queueLatency = qMax( lastQueueLatency_, static_cast< double >( oldestWait ) );
+    const auto utilization  = ( scaleWindowTaken_ ) ? ( static_cast< double >( scaleWindowBusy_ ) / scaleWindowTaken_ / threadCount ) : ( 0 );
+
+    // 上一次扩容后吞吐量没有提升，说明瓶颈不在线程数（例如 CPU 已经跑满），这个窗口先不继续扩容
+    const auto growthUseless = ( lastScaleAction_ == 1 ) && ( lastThroughput_ < ( lastScaleThroughput_ * 1.05 ) );
+
+    if ( ( queueLatency > targetQueueLatency_ ) && queueDepth_ && ( threadCount < maxThreadCount_ ) && !growthUseless )
+    {
+        this->setThreadCount( qMin( maxThreadCount_, threadCount + qMax( 1, threadCount / 4 ) ) );
+
+        ++scaleUpCount_;
+        lastScaleAction_ = 1;
+        lastScaleThroughput_ = lastThroughput_;
+    }
+    else if ( ( queueLatency < ( targetQueueLatency_ / 4.0 ) ) && !queueDepth_ && ( utilization < 0.5 ) && ( threadCount > minThreadCount_ ) )
+    {
+        this->setThreadCount( threadCount - 1 );
+
+        ++scaleDownCount_;
+        lastScaleAction_ = -1;
+        lastScaleThroughput_ = lastThroughput_;
+    }
+    else
+    {
+        lastScaleAction_ = 0;
+    }
+
+    scaleWindowStart_ = currentTime;
+    scaleWindowWait_  = 0;
+    scaleWindowTaken_ = 0;
+    scaleWindowBusy_  = 0;
+}
+
+void JQHttpServer::HandlePool::setThreadCount(const int threadCount)
+{
+    threadPool_->setMaxThreadCount( threadCount );
+
+    // 扩容后立刻补足 worker，否则要等到下一次 start 才会有新线程处理积压的任务
+    while ( ( workerCount_ < threadCount ) && ( workerCount_ < queueDepth_ ) )
+    {
+        ++workerCount_;
+        threadPool_->start( new HandleRunnable( std::bind( &HandlePool::runWorker, this ) ) );
+    }
+}
+
+// ServerThread
+namespace JQHttpServer
+{
+
+// 替换了事件分发器的服务线程，分发器必须在线程启动前设置，所以不能用线程池里的线程
+class ServerThread: public QThread
+{
+public:
+    ServerThread(const std::function< void() > &routine):
+        routine_( routine )
+    { }
+
+private:
+    void run() final
+    {
+        routine_();
+    }
+
+private:
+    std::function< void() > routine_;
+};
+
+}
+
+// EventDispatcher
+#ifdef Q_OS_LINUX
+#if ( QT_VERSION < QT_VERSION_CHECK( 6, 0, 0 ) )
+Q_CORE_EXPORT uint qGlobalPostedEventsCount();
+#endif
+
+namespace JQHttpServer
+{
+
+// 服务线程的事件分发器，定时器和 QSocketNotifier 在这里管理，等待就绪事件交给子类（epoll / io_uring）
+// 每轮只处理就绪的描述符，空闲连接不参与轮询，连接数很多时开销不随连接数增长
+// 就绪事件按水平触发处理：QAbstractSocket 每次写通知只写一块数据，QTcpServer 达到等待上限后会暂停 accept，
+// 这些都依赖水平触发的语义，改成边沿触发会导致连接卡住
+class EventDispatcher: public QAbstractEventDispatcher
+{
+public:
+    EventDispatcher();
+
+    ~EventDispatcher() override;
+
+    virtual bool isValid() const;
+
+    QJsonObject status() const;
+
+    bool processEvents(QEventLoop::ProcessEventsFlags flags) override;
+
+#if ( QT_VERSION < QT_VERSION_CHECK( 6, 0, 0 ) )
+    bool hasPendingEvents() override;
+
+    void flush() override { }
+#endif
+
+    void registerSocketNotifier(QSocketNotifier *notifier) override;
+
+    void unregisterSocketNotifier(QSocketNotifier *notifier) override;
+
+#if ( QT_VERSION < QT_VERSION_CHECK( 6, 0, 0 ) )
+    void registerTimer(int timerId, int interval, Qt::TimerType timerType, QObject *object) override;
+#else
+    void registerTimer(int timerId, qint64 interval, Qt::TimerType timerType, QObject *object) override;
+#endif
+
+    bool unregisterTimer(int timerId) override;
+
+    bool unregisterTimers(QObject *object) override;
+
+    QList< TimerInfo > registeredTimers(QObject *object) const override;
+
+    int remainingTime(int timerId) override;
+
+    void wakeUp() override;
+
+    void interrupt() override;
+
+protected:
+    struct SocketNotifiers
+    {
+        QSocketNotifier *read      = nullptr;
+        QSocketNotifier *write     = nullptr;
+        QSocketNotifier *exception = nullptr;
+
+        quint32 registeredEvents = 0; // 已经交给内核的关注事件（EPOLL* 掩码）
+        quint64 pollId           = 0; // io_uring：当前有效的 poll 请求
+    };
+
+    virtual QString backendName() const = 0;
+
+    // 等待就绪事件，结果放到 readyEvents_ 里，timeout 为 -1 表示一直等待
+    virtual void waitForEvents(const int timeout) = 0;
+
+    // 描述符的关注事件变化了，events 为 0 表示不再关注
+    virtual void updateInterest(const int fd, SocketNotifiers &notifiers, const quint32 events) = 0;
+
+private:
+    void updateSocket(const int fd);
+
+    int nextTimerTimeout() const;
+
+    bool activateSocketNotifiers();
+
+    bool activateTimers();
+
+protected:
+    int wakeUpFd_ = -1;
+
+    QHash< int, SocketNotifiers > socketNotifiers_; // fd -> notifiers
+    QVector< QPair< int, quint32 > > readyEvents_; // fd -> EPOLL* 掩码
+
+    QAtomicInteger< qint64 > syscallCount_;
+
+private:
+    struct Timer
+    {
+        int            timerId;
+        qint64         interval;
+        Qt::TimerType  timerType;
+        QObject *      object;
+        qint64         deadline;
+        bool           activating = false;
+
+        std::multimap< qint64, int >::iterator deadlineIterator;
+    };
+
+    QAtomicInt wakeUpPending_;
+    QAtomicInt interrupted_;
+
+    QElapsedTimer                clock_;
+    QVector< QSocketNotifier * > pendingNotifiers_;
+    QHash< int, Timer >          timers_;          // timerId -> timer
+    std::multimap< qint64, int > timerDeadlines_;  // deadline -> timerId
+
+    QAtomicInteger< qint64 > loopCount_;
+    QAtomicInteger< qint64 > readyEventCount_;
+};
+
+class EpollEventDispatcher: public EventDispatcher
+{
+public:
+    EpollEventDispatcher();
+
+    ~EpollEventDispatcher() override;
+
+    bool isValid() const override;
+
+private:
+    inline QString backendName() const override { return "epoll"; }
+
+    void waitForEvents(const int timeout) override;
+
+    void updateInterest(const int fd, SocketNotifiers &notifiers, const quint32 events) override;
+
+private:
+    int epollFd_ = -1;
+
+    epoll_event events_[ 256 ];
+};
+
+#ifdef JQHTTPSERVER_IO_URING_ENABLED
+// 用 io_uring 的单次 poll 请求代替 epoll：关注事件的变化只是往提交队列里放请求，
+// 和等待一起在一次 io_uring_enter 里提交，省掉 epoll_ctl 的系统调用
+// 单次 poll 在提交时会检查一次当前状态，触发后重新提交，效果等同于水平触发
+class IoUringEventDispatcher: public EventDispatcher
+{
+public:
+    IoUringEventDispatcher();
+
+    ~IoUringEventDispatcher() override;
+
+    bool isValid() const override;
+
+private:
+    inline QString backendName() const override { return "io_uring"; }
+
+    void waitForEvents(const int timeout) override;
+
+    void updateInterest(const int fd, SocketNotifiers &notifiers, const quint32 events) override;
+
+    io_uring_sqe *nextSqe();
+
+    quint64 addPoll(const int fd, const quint32 events);
+
+    void removePoll(const quint64 pollId);
+
+private:
+    io_uring ring_;
+    bool     ringInitialized_ = false;
+
+    quint32        pollSequence_ = 0;
+    quint64        wakeUpPollId_ = 0;
+    QVector< int > rearmFds_; // poll 已经触发，等待重新提交的描述符
+};
+#endif
+
+}
+
+JQHttpServer::EventDispatcher::EventDispatcher()
+{
+    wakeUpFd_ = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+
+    if ( wakeUpFd_ < 0 )
+    {
+        qDebug() << "JQHttpServer::EventDispatcher: error: can not create eventfd:" << strerror( errno );
+    }
+
+    clock_.start();
+}
+
+JQHttpServer::EventDispatcher::~EventDispatcher()
+{
+    if ( wakeUpFd_ >= 0 ) { close( wakeUpFd_ ); }
+}
+
+bool JQHttpServer::EventDispatcher::isValid() const
+{
+    return wakeUpFd_ >= 0;
+}
+
+QJsonObject JQHttpServer::EventDispatcher::status() const
+{
+    QJsonObject result;
+
+    result[ "backend" ]         = this->backendName();
+    result[ "loopCount" ]       = static_cast< double >( loopCount_.loadAcquire() );
+    result[ "readyEventCount" ] = static_cast< double >( readyEventCount_.loadAcquire() );
+    result[ "syscallCount" ]    = static_cast< double >( syscallCount_.loadAcquire() );
+
+    return result;
+}
+
+bool JQHttpServer::EventDispatcher::processEvents(QEventLoop::ProcessEventsFlags flags)
+{
+    interrupted_.storeRelease( 0 );
+
+    emit awake();
+
+    // 跨线程调用、deleteLater 等投递的事件
+    QCoreApplication::sendPostedEvents();
+
+    const auto canWait = ( flags & QEventLoop::WaitForMoreEvents ) && !interrupted_.loadAcquire();
+    if ( canWait )
+    {
+        emit aboutToBlock();
+    }
+
+    readyEvents_.clear();
+    this->waitForEvents( ( canWait ) ? ( this->nextTimerTimeout() ) : ( 0 ) );
+
+    ++loopCount_;
+    readyEventCount_ += readyEvents_.size();
+
+    if ( canWait )
+    {
+        emit awake();
+    }
+
+    auto processed = false;
+
+    for ( const auto &readyEvent: readyEvents_ )
+    {
+        const auto fd     = readyEvent.first;
+        const auto events = readyEvent.second;
+
+        if ( fd == wakeUpFd_ )
+        {
+            // 先清标记再读，清标记之后的 wakeUp 一定会再写一次
+            wakeUpPending_.storeRelease( 0 );
+
+            eventfd_t value;
+            eventfd_read( wakeUpFd_, &value );
+            ++syscallCount_;
+
+            processed = true;
+            continue;
+        }
+
+        if ( flags & QEventLoop::ExcludeSocketNotifiers ) { continue; }
+
+        const auto it = socketNotifiers_.constFind( fd );
+        if ( it == socketNotifiers_.constEnd() ) { continue; }
+
+        if ( it->read && ( events & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) )
+        {
+            pendingNotifiers_.push_back( it->read );
+        }
+
+        if ( it->write && ( events & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) ) )
+        {
+            pendingNotifiers_.push_back( it->write );
+        }
+
+        if ( it->exception && ( events & EPOLLPRI ) )
+        {
+            pendingNotifiers_.push_back( it->exception );
+        }
+    }
+
+    processed |= this->activateSocketNotifiers();
+
+    if ( !( flags & QEventLoop::X11ExcludeTimers ) )
+    {
+        processed |= this->activateTimers();
+    }
+
+    return processed;
+}
+
+#if ( QT_VERSION < QT_VERSION_CHECK( 6, 0, 0 ) )
+bool JQHttpServer::EventDispatcher::hasPendingEvents()
+{
+    return qGlobalPostedEventsCount();
+}
+#endif
+
+void JQHttpServer::EventDispatcher::registerSocketNotifier(QSocketNotifier *notifier)
+{
+    const auto fd = static_cast< int >( notifier->socket() );
+    auto &notifiers = socketNotifiers_[ fd ];
+
+    switch ( notifier->type() )
+    {
+        case QSocketNotifier::Read:
+        {
+            notifiers.read = notifier;
+            break;
+        }
+        case QSocketNotifier::Write:
+        {
+            notifiers.write = notifier;
+            break;
+        }
+        case QSocketNotifier::Exception:
+        {
+            notifiers.exception = notifier;
+            break;
+        }
+    }
+
+    this->updateSocket( fd );
+}
+
+void JQHttpServer::EventDispatcher::unregisterSocketNotifier(QSocketNotifier *notifier)
+{
+    const auto fd = static_cast< int >( notifier->socket() );
+    auto it = socketNotifiers_.find( fd );
+    if ( it == socketNotifiers_.end() ) { return; }
+
+    if ( it->read == notifier ) { it->read = nullptr; }
+    if ( it->write == notifier ) { it->write = nullptr; }
+    if ( it->exception == notifier ) { it->exception = nullptr; }
+
+    // 本轮还没分发的通知也要去掉，notifier 可能马上就被删除
+    pendingNotifiers_.removeAll( notifier );
+
+    this->updateSocket( fd );
+}
+
+#if ( QT_VERSION < QT_VERSION_CHECK( 6, 0, 0 ) )
+void JQHttpServer::EventDispatcher::registerTimer(int timerId, int interval, Qt::TimerType timerType, QObject *object)
+#else
+void JQHttpServer::EventDispatcher::registerTimer(int timerId, qint64 interval, Qt::TimerType timerType, QObject *object)
+#endif
+{
+    Timer timer;
+    timer.timerId   = timerId;
+    timer.interval  = interval;
+    timer.timerType = timerType;
+    timer.object    = object;
+    timer.deadline  = clock_.elapsed() + interval;
+
+    timer.deadlineIterator = timerDeadlines_.insert( { timer.deadline, timerId } );
+
+    timers_[ timerId ] = timer;
+}
+
+bool JQHttpServer::EventDispatcher::unregisterTimer(int timerId)
+{
+    auto it = timers_.find( timerId );
+    if ( it == timers_.end() ) { return false; }
+
+    timerDeadlines_.erase( it->deadlineIterator );
+    timers_.erase( it );
+
+    return true;
+}
+
+bool JQHttpServer::EventDispatcher::unregisterTimers(QObject *object)
+{
+    auto removed = false;
+
+    for ( auto it = timers_.begin(); it != timers_.end(); )
+    {
+        if ( it->object != object )
+        {
+            ++it;
+            continue;
+        }
+
+        timerDeadlines_.erase( it->deadlineIterator );
+        it = timers_.erase( it );
+        removed = true;
+    }
+
+    return removed;
+}
+
+QList< QAbstractEventDispatcher::TimerInfo > JQHttpServer::EventDispatcher::registeredTimers(QObject *object) const
+{
+    QList< TimerInfo > result;
+
+    for ( const auto &timer: timers_ )
+    {
+        if ( timer.object != object ) { continue; }
+
+        result.push_back( TimerInfo( timer.timerId, static_cast< int >( timer.interval ), timer.timerType ) );
+    }
+
+    return result;
+}
+
+int JQHttpServer::EventDispatcher::remainingTime(int timerId)
+{
+    const auto it = timers_.constFind( timerId );
+    if ( it == timers_.constEnd() ) { return -1; }
+
+    return static_cast< int >( qMax( qint64( 0 ), it->deadline - clock_.elapsed() ) );
+}
+
+void JQHttpServer::EventDispatcher::wakeUp()
+{
+    if ( wakeUpPending_.testAndSetAcquire( 0, 1 ) )
+    {
+        eventfd_write( wakeUpFd_, 1 );
+        ++syscallCount_;
+    }
+}
+
+void JQHttpServer::EventDispatcher::interrupt()
+{
+    interrupted_.storeRelease( 1 );
+    this->wakeUp();
+}
+
+void JQHttpServer::EventDispatcher::updateSocket(const int fd)
+{
+    auto it = socketNotifiers_.find( fd );
+    if ( it == socketNotifiers_.end() ) { return; }
+
+    quint32 events = 0;
+    if ( it->read ) { events |= EPOLLIN | EPOLLRDHUP; }
+    if ( it->write ) { events |= EPOLLOUT; }
+    if ( it->exception ) { events |= EPOLLPRI; }
+
+    this->updateInterest( fd, *it, events );
+
+    if ( !events )
+    {
+        socketNotifiers_.erase( it );
+    }
+}
+
+int JQHttpServer::EventDispatcher::nextTimerTimeout() const
+{
+    if ( timerDeadlines_.empty() ) { return -1; }
+
+    const auto remaining = timerDeadlines_.begin()->first - clock_.elapsed();
+
+    return static_cast< int >( qBound( qint64( 0 ), remaining, qint64( std::numeric_limits< int >::max() ) ) );
+}
+
+bool JQHttpServer::EventDispatcher::activateSocketNotifiers()
+{
+    if ( pendingNotifiers_.isEmpty() ) { return false; }
+
+    while ( !pendingNotifiers_.isEmpty() )
+    {
+        auto notifier = pendingNotifiers_.takeFirst();
+
+        QEvent event( QEvent::SockAct );
+        QCoreApplication::sendEvent( notifier, &event );
+    }
+
+    return true;
+}
+
+bool JQHttpServer::EventDispatcher::activateTimers()
+{
+    const auto now = clock_.elapsed();
+
+    // 先取出本轮到期的定时器，0 间隔的定时器重新排期后不会在同一轮里反复触发
+    QVector< int > expiredTimerIds;
+    for ( auto it = timerDeadlines_.begin(); ( it != timerDeadlines_.end() ) && ( it->first <= now ); ++it )
+    {
+        expiredTimerIds.push_back( it->second );
+    }
+
+    for ( const auto timerId: expiredTimerIds )
+    {
+        auto it = timers_.find( timerId );
+        if ( ( it == timers_.end() ) || it->activating ) { continue; }
+
+        it->deadline += it->interval;
+        if ( it->deadline < now ) { it->deadline = now + it->interval; }
+
+        timerDeadlines_.erase( it->deadlineIterator );
+        it->deadlineIterator = timerDeadlines_.insert( { it->deadline, timerId } );
+        it->activating       = true;
+
+        auto object = it->object;
+
+        QTimerEvent event( timerId );
+        QCoreApplication::sendEvent( object, &event );
+
+        // 回调里可能注销或者新增了定时器，迭代器已经失效
+        it = timers_.find( timerId );
+        if ( it != timers_.end() ) { it->activating = false; }
+    }
+
+    return !expiredTimerIds.isEmpty();
+}
+
+// EpollEventDispatcher
+JQHttpServer::EpollEventDispatcher::EpollEventDispatcher()
+{
+    epollFd_ = epoll_create1( EPOLL_CLOEXEC );
+
+    if ( epollFd_ < 0 )
+    {
+        qDebug() << "JQHttpServer::EpollEventDispatcher: error: can not create epoll:" << strerror( errno );
+        return;
+    }
+
+    if ( wakeUpFd_ >= 0 )
+    {
+        epoll_event event;
+        event.events  = EPOLLIN;
+        event.data.fd = wakeUpFd_;
+        epoll_ctl( epollFd_, EPOLL_CTL_ADD, wakeUpFd_, &event );
+    }
+}
+
+JQHttpServer::EpollEventDispatcher::~EpollEventDispatcher()
+{
+    if ( epollFd_ >= 0 ) { close( epollFd_ ); }
+}
+
+bool JQHttpServer::EpollEventDispatcher::isValid() const
+{
+    return EventDispatcher::isValid() && ( epollFd_ >= 0 );
+}
+
+void JQHttpServer::EpollEventDispatcher::waitForEvents(const int timeout)
+{
+    const auto eventCount = epoll_wait( epollFd_, events_, static_cast< int >( sizeof( events_ ) / sizeof( events_[ 0 ] ) ), timeout );
+    ++syscallCount_;
+
+    if ( ( eventCount < 0 ) && ( errno != EINTR ) )
+    {
+        qDebug() << "JQHttpServer::EpollEventDispatcher::waitForEvents: error:" << strerror( errno );
+    }
+
+    for ( auto index = 0; index < eventCount; ++index )
+    {
+        readyEvents_.push_back( { events_[ index ].data.fd, events_[ index ].events } );
+    }
+}
+
+void JQHttpServer::EpollEventDispatcher::updateInterest(const int fd, SocketNotifiers &notifiers, const quint32 events)
+{
+    if ( notifiers.registeredEvents == events ) { return; }
+
+    epoll_event event;
+    event.events  = events;
+    event.data.fd = fd;
+
+    if ( !events )
+    {
+        epoll_ctl( epollFd_, EPOLL_CTL_DEL, fd, &event );
+        ++syscallCount_;
+
+        notifiers.registeredEvents = 0;
+        return;
+    }
+
+    auto result = epoll_ctl( epollFd_, ( notifiers.registeredEvents ) ? ( EPOLL_CTL_MOD ) : ( EPOLL_CTL_ADD ), fd, &event );
+    ++syscallCount_;
+
+    // 描述符被关闭后又复用时，epoll 里的记录可能已经不在了（或者还在）
+    if ( ( result < 0 ) && ( errno == ENOENT ) ) { result = epoll_ctl( epollFd_, EPOLL_CTL_ADD, fd, &event ); ++syscallCount_; }
+    if ( ( result < 0 ) && ( errno == EEXIST ) ) { result = epoll_ctl( epollFd_, EPOLL_CTL_MOD, fd, &event ); ++syscallCount_; }
+
+    if ( result < 0 )
+    {
+        qDebug() << "JQHttpServer::EpollEventDispatcher::updateInterest: error:" << fd << strerror( errno );
+        return;
+    }
+
+    notifiers.registeredEvents = events;
+}
+
+// IoUringEventDispatcher
+#ifdef JQHTTPSERVER_IO_URING_ENABLED
+JQHttpServer::IoUringEventDispatcher::IoUringEventDispatcher()
+{
+    const auto result = io_uring_queue_init( 1024, &ring_, 0 );
+    if ( result < 0 )
+    {
+        // 内核太旧或者被 seccomp 禁用（常见于容器），由调用方回退到 epoll
+        qDebug() << "JQHttpServer::IoUringEventDispatcher: error: can not create io_uring:" << strerror( -result );
+        return;
+    }
+
+    ringInitialized_ = true;
+
+    if ( wakeUpFd_ >= 0 )
+    {
+        wakeUpPollId_ = this->addPoll( wakeUpFd_, EPOLLIN );
+    }
+}
+
+JQHttpServer::IoUringEventDispatcher::~IoUringEventDispatcher()
+{
+    if ( ringInitialized_ ) { io_uring_queue_exit( &ring_ ); }
+}
+
+bool JQHttpServer::IoUringEventDispatcher::isValid() const
+{
+    return EventDispatcher::isValid() && ringInitialized_;
+}
+
+void JQHttpServer::IoUringEventDispatcher::waitForEvents(const int timeout)
+{
+    if ( !wakeUpPollId_ && ( wakeUpFd_ >= 0 ) )
+    {
+        wakeUpPollId_ = this->addPoll( wakeUpFd_, EPOLLIN );
+    }
+
+    for ( const auto fd: rearmFds_ )
+    {
+        auto it = socketNotifiers_.find( fd );
+        if ( ( it == socketNotifiers_.end() ) || it->pollId || !it->registeredEvents ) { continue; }
+
+        it->pollId = this->addPoll( fd, it->registeredEvents );
+    }
+    rearmFds_.clear();
+
+    // 这一轮积累的 poll 请求和等待合并成一次 io_uring_enter
+    int result = 0;
+    if ( timeout < 0 )
+    {
+        result = io_uring_submit_and_wait( &ring_, 1 );
+        ++syscallCount_;
+    }
+    else if ( timeout == 0 )
+    {
+        result = io_uring_submit( &ring_ );
+        if ( result > 0 ) { ++syscallCount_; }
+    }
+    else
+    {
+        __kernel_timespec timespec;
+        timespec.tv_sec  = timeout / 1000;
+        timespec.tv_nsec = ( timeout % 1000 ) * 1000 * 1000;
+
+        // 内核支持 EXT_ARG（5.11 起）时 io_uring_wait_cqe_timeout 不会提交，上面积累的 poll 请求（包括唤醒用的 eventfd）
+        // 要在等待之前提交，否则新连接和跨线程唤醒要等到定时器超时才会被处理
+        io_uring_cqe *cqe = nullptr;
+#ifdef IO_URING_CHECK_VERSION
+        result = io_uring_submit_and_wait_timeout( &ring_, &cqe, 1, &timespec, nullptr );
+        ++syscallCount_;
+#else
+        if ( io_uring_submit( &ring_ ) > 0 ) { ++syscallCount_; }
+
+        result = io_uring_wait_cqe_timeout( &ring_, &cqe, &timespec );
+        ++syscallCount_;
+#endif
+    }
+
+    if ( ( result < 0 ) && ( result != -ETIME ) && ( result != -EINTR ) )
+    {
+        qDebug() << "JQHttpServer::IoUringEventDispatcher::waitForEvents: error:" << strerror( -result );
+    }
+
+    io_uring_cqe *cqe = nullptr;
+    unsigned      head;
+    unsigned      cqeCount = 0;
+
+    io_uring_for_each_cqe( &ring_, head, cqe )
+    {
+        ++cqeCount;
+
+        const auto pollId = static_cast< quint64 >( cqe->user_data );
+        const auto res    = cqe->res;
+
+        // 0 是 poll remove 请求本身，LIBURING_UDATA_TIMEOUT 是 liburing 内部的超时请求
+        if ( !pollId || ( pollId == LIBURING_UDATA_TIMEOUT ) ) { continue; }
+
+        if ( pollId == wakeUpPollId_ )
+        {
+            wakeUpPollId_ = 0;
+            if ( res > 0 ) { readyEvents_.push_back( { wakeUpFd_, static_cast< quint32 >( res ) } ); }
+            continue;
+        }
+
+        // 已经被取消或者替换的 poll 请求
+        const auto fd = static_cast< int >( pollId & 0xffffffff );
+        auto it = socketNotifiers_.find( fd );
+        if ( ( it == socketNotifiers_.end() ) || ( it->pollId != pollId ) ) { continue; }
+
+        it->pollId = 0;
+
+        if ( res < 0 )
+        {
+            // 不再重新提交，交给 QSocketNotifier 的持有者处理错误
+            qDebug() << "JQHttpServer::IoUringEventDispatcher::waitForEvents: poll error:" << fd << strerror( -res );
+            readyEvents_.push_back( { fd, EPOLLERR } );
+            continue;
+        }
+
+        rearmFds_.push_back( fd );
+        readyEvents_.push_back( { fd, static_cast< quint32 >( res ) } );
+    }
+
+    io_uring_cq_advance( &ring_, cqeCount );
+}
+
+void JQHttpServer::IoUringEventDispatcher::updateInterest(const int fd, SocketNotifiers &notifiers, const quint32 events)
+{
+    if ( notifiers.pollId )
+    {
+        if ( notifiers.registeredEvents == events ) { return; }
+
+        this->removePoll( notifiers.pollId );
+        notifiers.pollId = 0;
+    }
+
+    notifiers.registeredEvents = events;
+
+    if ( events )
+    {
+        notifiers.pollId = this->addPoll( fd, events );
+    }
+}
+
+io_uring_sqe *JQHttpServer::IoUringEventDispatcher::nextSqe()
+{
+    auto sqe = io_uring_get_sqe( &ring_ );
+    if ( sqe ) { return sqe; }
+
+    // 提交队列满了，先提交一批
+    io_uring_submit( &ring_ );
+    ++syscallCount_;
+
+    return io_uring_get_sqe( &ring_ );
+}
+
+quint64 JQHttpServer::IoUringEventDispatcher::addPoll(const int fd, const quint32 events)
+{
+    auto sqe = this->nextSqe();
+    if ( !sqe )
+    {
+        qDebug() << "JQHttpServer::IoUringEventDispatcher::addPoll: error: submission queue full";
+        return 0;
+    }
+
+    // 高 32 位是序号，低 32 位是描述符，描述符复用时旧请求的完成事件不会被误认
+    if ( !++pollSequence_ ) { ++pollSequence_; }
+    const auto pollId = ( static_cast< quint64 >( pollSequence_ ) << 32 ) | static_cast< quint32 >( fd );
+
+    io_uring_prep_poll_add( sqe, fd, events );
+    sqe->user_data = pollId;
+
+    return pollId;
+}
+
+void JQHttpServer::IoUringEventDispatcher::removePoll(const quint64 pollId)
+{
+    auto sqe = this->nextSqe();
+    if ( !sqe ) { return; }
+
+    // io_uring_prep_poll_remove 的参数类型在 liburing 2.2 改过，这里直接填
+    io_uring_prep_rw( IORING_OP_POLL_REMOVE, sqe, -1, nullptr, 0, 0 );
+    sqe->addr      = pollId;
+    sqe->user_data = 0;
+}
+#endif
+
+template< typename EventDispatcherType >
+static JQHttpServer::EventDispatcher *createEventDispatcher()
+{
+    auto eventDispatcher = new EventDispatcherType;
+    if ( eventDispatcher->isValid() ) { return eventDispatcher; }
+
+    delete eventDispatcher;
+    return nullptr;
+}
+
+// 线程的读写系统调用次数，来自 /proc/self/task/<tid>/io 的 syscr / syscw
+static QJsonObject threadIoStatus(const qint64 threadId)
+{
+    QJsonObject result;
+
+    QFile file( QString( "/proc/self/task/%1/io" ).arg( threadId ) );
+    if ( !file.open( QIODevice::ReadOnly ) ) { return result; }
+
+    for ( const auto &line: file.readAll().split( '\n' ) )
+    {
+        if ( line.startsWith( "syscr:" ) )
+        {
+            result[ "readSyscallCount" ] = line.mid( 6 ).trimmed().toDouble();
+        }
+        else if ( line.startsWith( "syscw:" ) )
+        {
+            result[ "writeSyscallCount" ] = line.mid( 6 ).trimmed().toDouble();
+        }
+    }
+
+    return result;
+}
+#endif
+
+// ListenSocket
+#ifdef Q_OS_UNIX
+// 自己创建监听 socket，QTcpServer::listen 的 backlog 固定为 50（Qt 6.3 之前不能修改）
+static void setSocketOption(const int fd, const int level, const int option, const int value, const char *optionName)
+{
+    if ( setsockopt( fd, level, option, &value, sizeof( value ) ) < 0 )
+    {
+        qDebug() << "JQHttpServer::Manage: warning: can not set" << optionName << value << strerror( errno );
+    }
+}
+
+// 设置在监听 socket 上、由接受的连接继承的选项，已经 listen 的 socket（继承来的 fd）也可以设置
+// SO_REUSEPORT 只在 bind 时生效，不在这里
+static void applyListenSocketOptions(const int fd, const JQHttpServer::SocketOptions &socketOptions)
+{
+    if ( socketOptions.sendBufferSize > 0 ) { setSocketOption( fd, SOL_SOCKET, SO_SNDBUF, socketOptions.sendBufferSize, "SO_SNDBUF" ); }
+    if ( socketOptions.receiveBufferSize > 0 ) { setSocketOption( fd, SOL_SOCKET, SO_RCVBUF, socketOptions.receiveBufferSize, "SO_RCVBUF" ); }
+
+#ifdef TCP_FASTOPEN
+    if ( socketOptions.fastOpenQueueLength > 0 ) { setSocketOption( fd, IPPROTO_TCP, TCP_FASTOPEN, socketOptions.fastOpenQueueLength, "TCP_FASTOPEN" ); }
+#endif
+
+#ifdef TCP_DEFER_ACCEPT
+    if ( socketOptions.deferAcceptTimeout > 0 ) { setSocketOption( fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, socketOptions.deferAcceptTimeout, "TCP_DEFER_ACCEPT" ); }
+#endif
+}
+
+static int createListenSocket(const QHostAddress &address, const quint16 port, const int backlog, const JQHttpServer::SocketOptions &socketOptions)
+{
+    sockaddr_storage storage;
+    memset( &storage, 0, sizeof( storage ) );
+
+    socklen_t length    = 0;
+    auto      family    = AF_INET;
+    auto      dualStack = false;
+
+    if ( ( address == QHostAddress::Any ) || ( address.protocol() == QAbstractSocket::IPv6Protocol ) )
+    {
+        auto address6 = reinterpret_cast< sockaddr_in6 * >( &storage );
+        address6->sin6_family = AF_INET6;
+        address6->sin6_port   = htons( port );
+
+        if ( address == QHostAddress::Any )
+        {
+            address6->sin6_addr = in6addr_any;
+            dualStack           = true;
+        }
+        else
+        {
+            const auto ipv6Address = address.toIPv6Address();
+            memcpy( &address6->sin6_addr, &ipv6Address, sizeof( address6->sin6_addr ) );
+        }
+
+        family = AF_INET6;
+        length = sizeof( sockaddr_in6 );
+    }
+    else
+    {
+        auto address4 = reinterpret_cast< sockaddr_in * >( &storage );
+        address4->sin_family      = AF_INET;
+        address4->sin_port        = htons( port );
+        address4->sin_addr.s_addr = htonl( address.toIPv4Address() );
+
+        length = sizeof( sockaddr_in );
+    }
+
+    const auto fd = socket( family, SOCK_STREAM, 0 );
+    if ( fd < 0 )
+    {
+        // 系统禁用了 IPv6
+        if ( dualStack ) { return createListenSocket( QHostAddress::AnyIPv4, port, backlog, socketOptions ); }
+
+        qDebug() << "JQHttpServer::Manage::listen: error: can not create socket:" << strerror( errno );
+        return -1;
+    }
+
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+    int enable = 1;
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof( enable ) );
+
+    // 明确指定 IPv6 地址时只监听 IPv6，这样 AnyIPv4 和 AnyIPv6 可以各自监听同一个端口
+    if ( family == AF_INET6 )
+    {
+        int v6Only = ( dualStack ) ? ( 0 ) : ( 1 );
+        setsockopt( fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof( v6Only ) );
+    }
+
+    // 缓冲区大小要在 listen 之前设置，窗口缩放是在握手时按这个值协商的
+    applyListenSocketOptions( fd, socketOptions );
+
+#ifdef SO_REUSEPORT
+    if ( socketOptions.reusePort ) { setSocketOption( fd, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT" ); }
+#endif
+
+    if ( ( bind( fd, reinterpret_cast< sockaddr * >( &storage ), length ) < 0 ) ||
+         ( ::listen( fd, backlog ) < 0 ) )
+    {
+        qDebug() << "JQHttpServer::Manage::listen: error:" << address << port << strerror( errno );
+        close( fd );
+        return -1;
+    }
+
+    return fd;
+}
+
+// 已经 listen 的 socket 的地址族，不是监听 socket 时返回 -1
+static int listenSocketFamily(const qintptr socketDescriptor)
+{
+    const auto fd = static_cast< int >( socketDescriptor );
+
+    int       acceptConnection = 0;
+    socklen_t length           = sizeof( acceptConnection );
+    if ( ( getsockopt( fd, SOL_SOCKET, SO_ACCEPTCONN, &acceptConnection, &length ) < 0 ) || !acceptConnection ) { return -1; }
+
+    sockaddr_storage storage;
+    length = sizeof( storage );
+    if ( getsockname( fd, reinterpret_cast< sockaddr * >( &storage ), &length ) < 0 ) { return -1; }
+
+    return storage.ss_family;
+}
+
+// 平滑升级时交接监听 socket 的消息：新进程先发送 4 字节标识请求交接，旧进程回复 4 字节标识 + SCM_RIGHTS 附带的 fd
+static const char handoffMagic[ 4 ] = { 'J', 'Q', 'H', 'S' };
+static const int  handoffMaxSocketCount = 64;
+
+static bool sendListenSockets(const int fd, const QList< qintptr > &listenSocketDescriptors)
+{
+    QVector< int > socketDescriptors;
+    for ( const auto &listenSocketDescriptor: listenSocketDescriptors )
+    {
+        socketDescriptors.push_back( static_cast< int >( listenSocketDescriptor ) );
+    }
+
+    iovec iov;
+    iov.iov_base = const_cast< char * >( handoffMagic );
+    iov.iov_len  = sizeof( handoffMagic );
+
+    msghdr message;
+    memset( &message, 0, sizeof( message ) );
+    message.msg_iov    = &iov;
+    message.msg_iovlen = 1;
+
+    QByteArray control;
+    if ( !socketDescriptors.isEmpty() )
+    {
+        const auto dataSize = static_cast< socklen_t >( sizeof( int ) * static_cast< size_t >( socketDescriptors.size() ) );
+
+        control.fill( 0, static_cast< int >( CMSG_SPACE( dataSize ) ) );
+        message.msg_control    = control.data();
+        message.msg_controllen = static_cast< decltype( message.msg_controllen ) >( control.size() );
+
+        auto cmsg = CMSG_FIRSTHDR( &message );
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN( dataSize );
+        memcpy( CMSG_DATA( cmsg ), socketDescriptors.constData(), dataSize );
+    }
+
+    auto flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+
+    return sendmsg( fd, &message, flags ) == static_cast< ssize_t >( sizeof( handoffMagic ) );
+}
+
+// 和 QLocalServer 的规则一致：不是绝对路径时放在临时目录
+static QByteArray handoffSocketPath(const QString &handoffServerName)
+{
+    return QFile::encodeName( ( handoffServerName.startsWith( '/' ) ) ? ( handoffServerName ) : ( QDir::tempPath() + '/' + handoffServerName ) );
+}
+
+static bool handoffSocketAddress(const QByteArray &path, sockaddr_un &address)
+{
+    memset( &address, 0, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+    if ( static_cast< size_t >( path.size() ) >= sizeof( address.sun_path ) ) { return false; }
+    memcpy( address.sun_path, path.constData(), static_cast< size_t >( path.size() ) );
+
+    return true;
+}
+
+// 有进程在这个地址上 listen，连接被拒绝或者文件不存在时说明是残留的文件
+static bool isHandoffSocketInUse(const sockaddr_un &address)
+{
+    const auto fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( fd < 0 ) { return true; }
+
+    // 非阻塞连接，对方的 backlog 满了也不会卡住
+    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+
+    const auto connected = ::connect( fd, reinterpret_cast< const sockaddr * >( &address ), sizeof( address ) ) == 0;
+    const auto inUse     = connected || ( ( errno != ECONNREFUSED ) && ( errno != ENOENT ) );
+
+    close( fd );
+
+    return inUse;
+}
+
+// 监听 socket 只和同一个用户的进程交接，双方都要检查
+static bool isSameUserPeer(const int fd)
+{
+#ifdef Q_OS_LINUX
+    ucred     credentials;
+    socklen_t length = sizeof( credentials );
+    if ( getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length ) < 0 ) { return false; }
+
+    return credentials.uid == geteuid();
+#else
+    uid_t uid = 0;
+    gid_t gid = 0;
+    if ( getpeereid( fd, &uid, &gid ) < 0 ) { return false; }
+
+    return uid == geteuid();
+#endif
+}
+
+// 每个接受的连接单独设置
+static void applyAcceptedSocketOptions(const qintptr socketDescriptor, const JQHttpServer::SocketOptions &socketOptions)
+{
+    const auto fd = static_cast< int >( socketDescriptor );
+    if ( fd < 0 ) { return; }
+
+    if ( socketOptions.noDelay ) { setSocketOption( fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY" ); }
+
+#ifdef TCP_QUICKACK
+    if ( socketOptions.quickAck ) { setSocketOption( fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK" ); }
+#endif
+}
+#endif
+
+#ifdef Q_OS_LINUX
+// 当前 accept 队列长度和 backlog，监听 socket 的 TCP_INFO 里 tcpi_unacked / tcpi_sacked 就是这两个值
+static bool acceptQueueInfo(const qintptr listenSocketDescriptor, int &queueLength, int &backlog)
+{
+    tcp_info  info;
+    socklen_t length = sizeof( info );
+
+    if ( getsockopt( static_cast< int >( listenSocketDescriptor ), IPPROTO_TCP, TCP_INFO, &info, &length ) < 0 ) { return false; }
+
+    queueLength = static_cast< int >( info.tcpi_unacked );
+    backlog     = static_cast< int >( info.tcpi_sacked );
+
+    return true;
+}
+
+// 整个系统的 accept 队列溢出次数，来自 /proc/net/netstat 的 TcpExt
+static QJsonObject systemListenOverflowStatus()
+{
+    QJsonObject result;
+
+    QFile file( "/proc/net/netstat" );
+    if ( !file.open( QIODevice::ReadOnly ) ) { return result; }
+
+    QList< QByteArray > names;
+    for ( const auto &line: file.readAll().split( '\n' ) )
+    {
+        if ( !line.startsWith( "TcpExt:" ) ) { continue; }
+
+        // 第一行是字段名，第二行是数值
+        if ( names.isEmpty() )
+        {
+            names = line.simplified().split( ' ' );
+            continue;
+        }
+
+        const auto &&values = line.simplified().split( ' ' );
+        for ( auto index = 1; ( index < names.size() ) && ( index < values.size() ); ++index )
+        {
+            if ( ( names[ index ] == "ListenOverflows" ) || ( names[ index ] == "ListenDrops" ) )
+            {
+                result[ QString::fromLatin1( names[ index ] ) ] = values[ index ].toDouble();
+            }
+        }
+        break;
+    }
+
+    return result;
+}
+#endif
+
+// ListenEndpoint
+static QString listenEndpointToString(const JQHttpServer::ListenEndpoint &listenEndpoint)
+{
+    if ( listenEndpoint.socketDescriptor >= 0 ) { return QString( "fd:%1" ).arg( listenEndpoint.socketDescriptor ); }
+
+    if ( !listenEndpoint.localServerName.isEmpty() ) { return "unix:" + listenEndpoint.localServerName; }
+
+    if ( listenEndpoint.address.protocol() == QAbstractSocket::IPv6Protocol )
+    {
+        return QString( "[%1]:%2" ).arg( listenEndpoint.address.toString() ).arg( listenEndpoint.port );
+    }
+
+    return QString( "%1:%2" ).arg( listenEndpoint.address.toString() ).arg( listenEndpoint.port );
+}
+
+// 在 object 所在的线程同步执行 callback
+static void invokeInObjectThread(QObject *object, const std::function< void() > &callback)
+{
+    if ( !object ) { return; }
+
+    if ( QThread::currentThread() == object->thread() )
+    {
+        callback();
+        return;
+    }
+
+    QMetaObject::invokeMethod( object, callback, Qt::BlockingQueuedConnection );
+}
+
+// AbstractManage
+JQHttpServer::AbstractManage::AbstractManage(const int handleMaxThreadCount)
+{
+    handlePool_.reset( new HandlePool( "default", handleMaxThreadCount ) );
+    handleThreadPool_ = handlePool_->threadPool();
+    serverThreadPool_.reset( new QThreadPool );
+    writeStatistics_.reset( new WriteStatistics );
+    deferredReplyStatistics_.reset( new DeferredReplyStatistics );
+    webSocketStatistics_.reset( new WebSocketStatistics );
+
+    serverThreadPool_->setMaxThreadCount( 1 );
+}
+
+JQHttpServer::AbstractManage::~AbstractManage()
+{
+    this->closeListenSocketHandoff();
+    this->stopHandleThread();
+}
+
+bool JQHttpServer::AbstractManage::initialize()
+{
+    if ( QThread::currentThread() != this->thread() )
+    {
+        qDebug() << "JQHttpServer::Manage::listen: error: listen from other thread";
+        return false;
+    }
+
+    if ( this->isRunning() )
+    {
+        qDebug() << "JQHttpServer::Manage::close: error: already running";
+        return false;
+    }
+
+    mutex_.lock();
+    acceptingStopped_ = false;
+    mutex_.unlock();
+
+    return this->startServerThread();
+}
+
+void JQHttpServer::AbstractManage::deinitialize()
+{
+    if ( !this->isRunning() )
+    {
+        qDebug() << "JQHttpServer::Manage::close: error: not running";
+        return;
+    }
+
+    emit readyToClose();
+
+    if ( serverThreadPool_->activeThreadCount() || serverThread_ )
+    {
+        this->stopServerThread();
+    }
+}
+
+QList< JQHttpServer::ListenEndpoint > JQHttpServer::AbstractManage::systemdListenEndpoints(const QString &name)
+{
+    QList< ListenEndpoint > result;
+
+#ifdef Q_OS_UNIX
+    // 环境变量会被子进程继承，LISTEN_PID 不是自己时说明不是传给当前进程的
+    if ( qgetenv( "LISTEN_PID" ).toLongLong() != static_cast< qint64 >( getpid() ) ) { return result; }
+
+    const auto listenFdCount = qgetenv( "LISTEN_FDS" ).toInt();
+    const auto listenFdNames = QString::fromUtf8( qgetenv( "LISTEN_FDNAMES" ) ).split( ':' );
+
+    // SD_LISTEN_FDS_START
+    for ( auto index = 0; index < listenFdCount; ++index )
+    {
+        if ( !name.isEmpty() && ( ( index >= listenFdNames.size() ) || ( listenFdNames[ index ] != name ) ) ) { continue; }
+
+        const auto fd = 3 + index;
+        fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+        result.push_back( ListenEndpoint::fromSocketDescriptor( fd ) );
+    }
+#else
+    Q_UNUSED( name );
+#endif
+
+    return result;
+}
+
+bool JQHttpServer::AbstractManage::isLocalListenEndpoint(const ListenEndpoint &listenEndpoint)
+{
+    if ( listenEndpoint.socketDescriptor < 0 ) { return !listenEndpoint.localServerName.isEmpty(); }
+
+#ifdef Q_OS_UNIX
+    return listenSocketFamily( listenEndpoint.socketDescriptor ) == AF_UNIX;
+#else
+    return false;
+#endif
+}
+
+bool JQHttpServer::AbstractManage::setWriteOptions(const WriteOptions &writeOptions)
+{
+    if ( !AbstractManage::isWriteOptionsValid( writeOptions ) )
+    {
+        qDebug() << "JQHttpServer::AbstractManage::setWriteOptions: error: invalid options:" << writeOptions.lowWatermark << writeOptions.highWatermark << writeOptions.minChunkSize;
+        return false;
+    }
+
+    writeOptions_ = writeOptions;
+
+    return true;
+}
+
+bool JQHttpServer::AbstractManage::isWriteOptionsValid(const WriteOptions &writeOptions)
+{
+    // minChunkSize 为 0 时发送队列满会一直写空块，highWatermark 小于 lowWatermark 时永远等不到补数据
+    return ( writeOptions.minChunkSize > 0 ) &&
+           ( writeOptions.lowWatermark >= 0 ) &&
+           ( writeOptions.highWatermark >= writeOptions.lowWatermark );
+}
+
+bool JQHttpServer::AbstractManage::startListenSocketHandoff(const QString &handoffServerName)
+{
+#ifdef Q_OS_UNIX
+    if ( !handoffNotifier_.isNull() )
+    {
+        qDebug() << "JQHttpServer::Manage::startListenSocketHandoff: error: already started";
+        return false;
+    }
+
+    const auto &&path = handoffSocketPath( handoffServerName );
+
+    sockaddr_un address;
+    if ( !handoffSocketAddress( path, address ) )
+    {
+        qDebug() << "JQHttpServer::Manage::startListenSocketHandoff: error: name too long:" << handoffServerName;
+        return false;
+    }
+
+    // 刚交出监听 socket 的旧进程会马上关闭交接 socket，稍等一下；一直有进程在用时不能抢占
+    QElapsedTimer elapsedTimer;
+    elapsedTimer.start();
+
+    while ( isHandoffSocketInUse( address ) )
+    {
+        if ( elapsedTimer.elapsed() >= 1000 )
+        {
+            qDebug() << "JQHttpServer::Manage::startListenSocketHandoff: error: name in use:" << handoffServerName;
+            return false;
+        }
+
+        QThread::msleep( 10 );
+    }
+
+    // 进程异常退出时留下的文件
+    unlink( path.constData() );
+
+    const auto fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( fd < 0 )
+    {
+        qDebug() << "JQHttpServer::Manage::startListenSocketHandoff: error:" << strerror( errno );
+        return false;
+    }
+
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+
+    struct stat pathStat;
+    if ( ( bind( fd, reinterpret_cast< sockaddr * >( &address ), sizeof( address ) ) < 0 ) ||
+         ( ::listen( fd, 1 ) < 0 ) ||
+         ( stat( path.constData(), &pathStat ) < 0 ) )
+    {
+        qDebug() << "JQHttpServer::Manage::startListenSocketHandoff: error:" << handoffServerName << strerror( errno );
+        close( fd );
+        return false;
+    }
+
+    handoffPath_       = path;
+    handoffPathDevice_ = static_cast< quint64 >( pathStat.st_dev );
+    handoffPathInode_  = static_cast< quint64 >( pathStat.st_ino );
+    handoffNotifier_   = new QSocketNotifier( fd, QSocketNotifier::Read, this );
+
+    QObject::connect( handoffNotifier_.data(), &QSocketNotifier::activated, this, &AbstractManage::onHandoffConnection );
+
+    return true;
+#else
+    Q_UNUSED( handoffServerName );
+
+    qDebug() << "JQHttpServer::Manage::startListenSocketHandoff: error: only supported on Unix";
+    return false;
+#endif
+}
+
+QList< JQHttpServer::ListenEndpoint > JQHttpServer::AbstractManage::receiveListenSockets(const QString &handoffServerName, const int timeout)
+{
+    QList< ListenEndpoint > result;
+
+#ifdef Q_OS_UNIX
+    sockaddr_un address;
+    if ( !handoffSocketAddress( handoffSocketPath( handoffServerName ), address ) ) { return result; }
+
+    const auto fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( fd < 0 ) { return result; }
+
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+    // 连接失败说明没有旧进程
+    if ( ::connect( fd, reinterpret_cast< sockaddr * >( &address ), sizeof( address ) ) < 0 )
+    {
+        close( fd );
+        return result;
+    }
+
+    // 别的用户可以在临时目录里抢先创建同名 socket，不能用它给的监听 socket
+    if ( !isSameUserPeer( fd ) )
+    {
+        qDebug() << "JQHttpServer::Manage::receiveListenSockets: error: peer is not the same user:" << handoffServerName;
+        close( fd );
+        return result;
+    }
+
+    auto sendFlags = 0;
+#ifdef MSG_NOSIGNAL
+    sendFlags |= MSG_NOSIGNAL;
+#endif
+
+    // 只连接不发送请求的（例如检查名字是否被占用）不会触发交接
+    if ( send( fd, handoffMagic, sizeof( handoffMagic ), sendFlags ) != static_cast< ssize_t >( sizeof( handoffMagic ) ) )
+    {
+        qDebug() << "JQHttpServer::Manage::receiveListenSockets: error: send fail:" << handoffServerName << strerror( errno );
+        close( fd );
+        return result;
+    }
+
+    pollfd pollFd;
+    pollFd.fd      = fd;
+    pollFd.events  = POLLIN;
+    pollFd.revents = 0;
+    if ( poll( &pollFd, 1, timeout ) <= 0 )
+    {
+        qDebug() << "JQHttpServer::Manage::receiveListenSockets: error: timeout:" << handoffServerName;
+        close( fd );
+        return result;
+    }
+
+    char payload[ sizeof( handoffMagic ) ];
+    iovec iov;
+    iov.iov_base = payload;
+    iov.iov_len  = sizeof( payload );
+
+    QByteArray control( static_cast< int >( CMSG_SPACE( sizeof( int ) * handoffMaxSocketCount ) ), 0 );
+
+    msghdr message;
+    memset( &message, 0, sizeof( message ) );
+    message.msg_iov        = &iov;
+    message.msg_iovlen     = 1;
+    message.msg_control    = control.data();
+    message.msg_controllen = static_cast< decltype( message.msg_controllen ) >( control.size() );
+
+    auto flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+    const auto received = recvmsg( fd, &message, flags );
+    close( fd );
+
+    if ( ( received != static_cast< ssize_t >( sizeof( handoffMagic ) ) ) || memcmp( payload, handoffMagic, sizeof( handoffMagic ) ) )
+    {
+        qDebug() << "JQHttpServer::Manage::receiveListenSockets: error: bad message:" << handoffServerName;
+        return result;
+    }
+
+    for ( auto cmsg = CMSG_FIRSTHDR( &message ); cmsg; cmsg = CMSG_NXTHDR( &message, cmsg ) )
+    {
+        if ( ( cmsg->cmsg_level != SOL_SOCKET ) || ( cmsg->cmsg_type != SCM_RIGHTS ) ) { continue; }
+
+        const auto count = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+        for ( size_t index = 0; index < count; ++index )
+        {
+            int socketDescriptor = -1;
+            memcpy( &socketDescriptor, CMSG_DATA( cmsg ) + index * sizeof( int ), sizeof( int ) );
+
+            fcntl( socketDescriptor, F_SETFD, FD_CLOEXEC );
+            result.push_back( ListenEndpoint::fromSocketDescriptor( socketDescriptor ) );
+        }
+    }
+#else
+    Q_UNUSED( handoffServerName );
+    Q_UNUSED( timeout );
+#endif
+
+    return result;
+}
+
+void JQHttpServer::AbstractManage::stopAccepting()
+{
+    this->onStopAccepting();
+
+    mutex_.lock();
+    listenSocketDescriptors_.clear();
+    acceptingStopped_ = true;
+    mutex_.unlock();
+
+    // HTTP/2 连接上不再接受新的流，客户端会在新连接上重试
+    for ( const auto &connection: this->takeHttp2Connections() )
+    {
+        invokeInObjectThread( connection.data(), [ connection ]()
+        {
+            if ( connection ) { connection->goAway(); }
+        } );
+    }
+
+    // 1001 表示服务端正在下线
+    for ( const auto &webSocket: this->webSockets() )
+    {
+        invokeInObjectThread( webSocket.data(), [ webSocket ]()
+        {
+            if ( webSocket ) { webSocket->close( 1001 ); }
+        } );
+    }
+}
+
+bool JQHttpServer::AbstractManage::waitForSessionsFinished(const int timeout)
+{
+    QElapsedTimer elapsedTimer;
+    elapsedTimer.start();
+
+    forever
+    {
+        mutex_.lock();
+        const auto sessionCount = availableSessions_.size();
+        mutex_.unlock();
+
+        if ( !sessionCount ) { return true; }
+        if ( elapsedTimer.elapsed() >= timeout ) { return false; }
+
+        // 当前线程的事件继续处理，回调可能需要在这里执行
+        QEventLoop eventLoop;
+        QTimer::singleShot( 10, &eventLoop, &QEventLoop::quit );
+        eventLoop.exec();
+    }
+}
+
+JQHttpServer::ShutdownResult JQHttpServer::AbstractManage::shutdown(const int deadline)
+{
+    ShutdownResult result;
+
+    if ( !this->isRunning() ) { return result; }
+
+    QElapsedTimer elapsedTimer;
+    elapsedTimer.start();
+
+    this->stopAccepting();
+
+    const auto takeSessions = [ this ]()
+    {
+        QList< QPointer< Session > > sessions;
+
+        this->mutex_.lock();
+
+        for ( const auto &session: this->availableSessions_ )
+        {
+            sessions.push_back( session );
+        }
+
+        this->mutex_.unlock();
+
+        return sessions;
+    };
+
+    // 空闲连接没有处理函数引用，可以直接删除
+    QList< QPointer< Session > > inFlightSessions;
+    for ( const auto &session: takeSessions() )
+    {
+        auto isIdle = false;
+
+        invokeInObjectThread( session.data(), [ session, &isIdle ]()
+        {
+            if ( !session || !session->isIdle() ) { return; }
+
+            isIdle = true;
+            delete session.data();
+        } );
+
+        if ( isIdle )
+        {
+            ++result.idleClosedCount;
+        }
+        else if ( session )
+        {
+            inFlightSessions.push_back( session );
+        }
+    }
+
+    auto abortedInFlightCount = 0;
+
+    if ( !this->waitForSessionsFinished( qMax( 0, deadline - static_cast< int >( elapsedTimer.elapsed() ) ) ) )
+    {
+        // 只断开连接，处理函数之后的回复被丢弃，session 等处理函数返回后自己删除
+        for ( const auto &session: takeSessions() )
+        {
+            const auto isInFlight = inFlightSessions.contains( session );
+            auto       isAborted  = false;
+
+            invokeInObjectThread( session.data(), [ session, &isAborted ]()
+            {
+                if ( !session ) { return; }
+
+                isAborted = true;
+                session->abortAndDeleteLater();
+            } );
+
+            if ( !isAborted ) { continue; }
+
+            ++result.abortedCount;
+            if ( isInFlight ) { ++abortedInFlightCount; }
+        }
+
+        // 服务线程停止后 session 就不会再被删除了，等处理函数返回
+        if ( !this->waitForSessionsFinished( 5 * 1000 ) )
+        {
+            qDebug() << "JQHttpServer::Manage::shutdown: error: handler still running after abort";
+        }
+    }
+
+    // 开始时在处理中的 session，没有被强制断开的就是正常完成的
+    result.completedCount = inFlightSessions.size() - abortedInFlightCount;
+
+    this->deinitialize();
+
+    return result;
+}
+
+void JQHttpServer::AbstractManage::onHandoffConnection()
+{
+#ifdef Q_OS_UNIX
+    if ( handoffNotifier_.isNull() ) { return; }
+
+    const auto fd = accept( static_cast< int >( handoffNotifier_->socket() ), nullptr, nullptr );
+    if ( fd < 0 ) { return; }
+
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+    if ( !isSameUserPeer( fd ) )
+    {
+        qDebug() << "JQHttpServer::Manage::onHandoffConnection: error: peer is not the same user";
+        close( fd );
+        return;
+    }
+
+    // 新进程连接后马上发送请求，没有请求的连接直接关闭，交接 socket 保持打开
+    char request[ sizeof( handoffMagic ) ];
+
+    pollfd pollFd;
+    pollFd.fd      = fd;
+    pollFd.events  = POLLIN;
+    pollFd.revents = 0;
+    if ( ( poll( &pollFd, 1, 1000 ) <= 0 ) ||
+         ( recv( fd, request, sizeof( request ), 0 ) != static_cast< ssize_t >( sizeof( request ) ) ) ||
+         memcmp( request, handoffMagic, sizeof( handoffMagic ) ) )
+    {
+        close( fd );
+        return;
+    }
+
+    mutex_.lock();
+    const auto listenSocketDescriptors = listenSocketDescriptors_;
+    mutex_.unlock();
+
+    // Unix domain socket 的监听不交接，QLocalServer 关闭时会删除 socket 文件
+    QList< qintptr > tcpListenSocketDescriptors;
+    for ( const auto &listenSocketDescriptor: listenSocketDescriptors )
+    {
+        const auto family = listenSocketFamily( listenSocketDescriptor );
+        if ( ( family == AF_INET ) || ( family == AF_INET6 ) )
+        {
+            tcpListenSocketDescriptors.push_back( listenSocketDescriptor );
+        }
+    }
+
+    // 新进程最多接收 handoffMaxSocketCount 个，截断的话 stopAccepting 会关闭没有交出去的监听 socket
+    if ( tcpListenSocketDescriptors.size() > handoffMaxSocketCount )
+    {
+        qDebug() << "JQHttpServer::Manage::onHandoffConnection: error: too many listen sockets:" << tcpListenSocketDescriptors.size();
+        close( fd );
+        return;
+    }
+
+    // 失败时交接 socket 保持打开，新进程可以重试
+    const auto sent = sendListenSockets( fd, tcpListenSocketDescriptors );
+    if ( !sent ) { qDebug() << "JQHttpServer::Manage::onHandoffConnection: error: send fail:" << strerror( errno ); }
+
+    close( fd );
+
+    if ( !sent ) { return; }
+
+    // 交接完成后关闭交接用的 socket，新进程收到监听 socket 后可以在同一个名字上等待下一次升级
+    this->closeListenSocketHandoff();
+
+    // 新进程已经持有同一个监听 socket，内核里排队的连接由新进程接受
+    this->stopAccepting();
+
+    emit listenSocketsHandedOff();
+#endif
+}
+
+void JQHttpServer::AbstractManage::closeListenSocketHandoff()
+{
+#ifdef Q_OS_UNIX
+    if ( handoffNotifier_.isNull() ) { return; }
+
+    const auto fd = static_cast< int >( handoffNotifier_->socket() );
+
+    handoffNotifier_->setEnabled( false );
+    delete handoffNotifier_.data();
+    close( fd );
+
+    // 新进程等待超时后可能已经在同一个名字上 listen，这时文件不是自己的，不能删除
+    struct stat pathStat;
+    if ( ( stat( handoffPath_.constData(), &pathStat ) == 0 ) &&
+         ( static_cast< quint64 >( pathStat.st_dev ) == handoffPathDevice_ ) &&
+         ( static_cast< quint64 >( pathStat.st_ino ) == handoffPathInode_ ) )
+    {
+        unlink( handoffPath_.constData() );
+    }
+
+    handoffPath_.clear();
+    handoffPathDevice_ = 0;
+    handoffPathInode_  = 0;
+#endif
+}
+
+bool JQHttpServer::AbstractManage::startServerThread()
+{
+    QSemaphore semaphore;
+
+#ifdef Q_OS_LINUX
+    // 没有指定处理线程的核心时，用服务线程所在节点的其他核心，session 的数据交给处理线程时不用跨节点访问
+    auto handleThreadCpus = cpuAffinity_.handleThreadCpus;
+    if ( handleThreadCpus.isEmpty() && !cpuAffinity_.serverThreadCpus.isEmpty() )
+    {
+        const auto node = cpuNumaNode( cpuAffinity_.serverThreadCpus.first() );
+        const auto topology = numaTopology();
+
+        for ( const auto &cpu: topology.value( node ) )
+        {
+            if ( !cpuAffinity_.serverThreadCpus.contains( cpu ) ) { handleThreadCpus.push_back( cpu ); }
+        }
+
+        // 节点上只有服务线程的核心时，和服务线程共用
+        if ( handleThreadCpus.isEmpty() ) { handleThreadCpus = topology.value( node, cpuAffinity_.serverThreadCpus ); }
+    }
+
+    if ( !handleThreadCpus.isEmpty() || !handlePool_->cpuAffinity().isEmpty() )
+    {
+        handlePool_->setCpuAffinity( handleThreadCpus, cpuAffinity_.nodeLocalMemory );
+    }
+#endif
+
+    const std::function< void() > serverRoutine = [ &semaphore, this ]()
+    {
+#ifdef Q_OS_LINUX
+        // 在 onStart 之前绑定，监听 socket 和之后所有 session 的内存都在这个线程里分配
+        setCurrentThreadCpuAffinity( cpuAffinity_.serverThreadCpus, cpuAffinity_.nodeLocalMemory );
+#endif
+
+        QEventLoop eventLoop;
+        QObject::connect(
+            this,
+            &AbstractManage::readyToClose,
+            &eventLoop,
+            &QEventLoop::quit );
+
+        if ( !this->onStart() )
+        {
+            semaphore.release( 1 );
+            return;
+        }
+
+#ifdef Q_OS_LINUX
+        serverThreadId_ = static_cast< qint64 >( syscall( SYS_gettid ) );
+#endif
+
+        semaphore.release( 1 );
+
+        eventLoop.exec();
+
+        this->onFinish();
+    };
+
+    QAbstractEventDispatcher *eventDispatcher = nullptr;
+
+#ifdef Q_OS_LINUX
+#   ifdef JQHTTPSERVER_IO_URING_ENABLED
+    if ( eventBackend_ == IoUringEventBackend )
+    {
+        eventDispatcher = createEventDispatcher< IoUringEventDispatcher >();
+    }
+#   endif
+
+    if ( !eventDispatcher && ( eventBackend_ != QtEventBackend ) )
+    {
+        if ( eventBackend_ == IoUringEventBackend )
+        {
+            qDebug() << "JQHttpServer::Manage::startServerThread: warning: io_uring not available, fall back to epoll";
+            eventBackend_ = EpollEventBackend;
+        }
+
+        eventDispatcher = createEventDispatcher< EpollEventDispatcher >();
+    }
+#endif
+
+    if ( ( eventBackend_ != QtEventBackend ) && !eventDispatcher )
+    {
+        qDebug() << "JQHttpServer::Manage::startServerThread: warning: event backend not available, fall back to Qt event dispatcher";
+        eventBackend_ = QtEventBackend;
+    }
+
+    if ( eventDispatcher )
+    {
+        eventDispatcher_ = eventDispatcher;
+
+        serverThread_.reset( new ServerThread( serverRoutine ) );
+        serverThread_->setEventDispatcher( eventDispatcher );
+        serverThread_->start();
+    }
+    else
+    {
+        auto f = QtConcurrent::run( serverThreadPool_.data(), serverRoutine );
+        Q_UNUSED( f );
+    }
+
+    semaphore.acquire( 1 );
+
+    return this->isRunning();
+}
+
+QJsonObject JQHttpServer::AbstractManage::status()
+{
+    QJsonObject result;
+
+    result[ "isRunning" ]     = this->isRunning();
+    result[ "eventBackend" ]  = ( eventBackend_ == IoUringEventBackend ) ? ( "io_uring" ) : ( ( eventBackend_ == EpollEventBackend ) ? ( "epoll" ) : ( "qt" ) );
+    result[ "handlePool" ]    = handlePool_->status();
+
+    QJsonObject deferredReply;
+
+    deferredReply[ "deferredReplyCount" ]        = static_cast< double >( deferredReplyStatistics_->replyCount.loadAcquire() );
+    deferredReply[ "deferredReplyTimeoutCount" ] = static_cast< double >( deferredReplyStatistics_->timeoutCount.loadAcquire() );
+
+    result[ "deferredReply" ] = deferredReply;
+
+    QJsonObject write;
+
+    write[ "writeChunkCount" ]        = static_cast< double >( writeStatistics_->chunkCount.loadAcquire() );
+    write[ "writeChunkBytes" ]        = static_cast< double >( writeStatistics_->chunkBytes.loadAcquire() );
+    write[ "watermarkStallCount" ]    = static_cast< double >( writeStatistics_->watermarkStallCount.loadAcquire() );
+    write[ "socketBufferStallCount" ] = static_cast< double >( writeStatistics_->socketBufferStallCount.loadAcquire() );
+
+    result[ "write" ] = write;
+
+    QJsonArray listenEndpoints;
+    for ( const auto &listenEndpoint: listenEndpoints_ )
+    {
+        listenEndpoints.push_back( listenEndpointToString( listenEndpoint ) );
+    }
+    result[ "listenEndpoints" ] = listenEndpoints;
+
+#ifdef Q_OS_LINUX
+    if ( eventDispatcher_ )
+    {
+        result[ "eventDispatcher" ] = static_cast< EventDispatcher * >( eventDispatcher_.data() )->status();
+    }
+
+    if ( serverThreadId_ )
+    {
+        result[ "serverThreadIo" ] = threadIoStatus( serverThreadId_ );
+    }
+#endif
+
+    QJsonObject accept;
+
+    accept[ "listenBacklog" ]         = listenBacklog_;
+    accept[ "maxPendingConnections" ] = maxPendingConnections_;
+    accept[ "acceptedCount" ]         = static_cast< double >( acceptedCount_.loadAcquire() );
+    accept[ "acceptErrorCount" ]      = static_cast< double >( acceptErrorCount_.loadAcquire() );
+    accept[ "acceptQueueFullCount" ]  = static_cast< double >( acceptQueueFullCount_.loadAcquire() );
+
+    mutex_.lock();
+
+    result[ "sessionCount" ] = availableSessions_.size();
+
+#ifdef Q_OS_LINUX
+    // 多个监听 socket 时队列长度取总和
+    auto acceptQueueLength   = 0;
+    auto kernelListenBacklog = 0;
+    for ( const auto &listenSocketDescriptor: listenSocketDescriptors_ )
+    {
+        int queueLength = 0;
+        int backlog     = 0;
+        if ( !acceptQueueInfo( listenSocketDescriptor, queueLength, backlog ) ) { continue; }
+
+        acceptQueueLength += queueLength;
+        kernelListenBacklog = qMax( kernelListenBacklog, backlog );
+    }
+
+    if ( !listenSocketDescriptors_.isEmpty() )
+    {
+        accept[ "acceptQueueLength" ]   = acceptQueueLength;
+        accept[ "kernelListenBacklog" ] = kernelListenBacklog;
+    }
+#endif
+
+    mutex_.unlock();
+
+    accept[ "maxAcceptQueueLength" ] = maxAcceptQueueLength_.loadAcquire();
+
+#ifdef Q_OS_LINUX
+    accept[ "system" ] = systemListenOverflowStatus();
+#endif
+
+    result[ "accept" ] = accept;
+
+    QJsonObject socketOptions;
+
+    socketOptions[ "noDelay" ]             = socketOptions_.noDelay;
+    socketOptions[ "quickAck" ]            = socketOptions_.quickAck;
+    socketOptions[ "sendBufferSize" ]      = socketOptions_.sendBufferSize;
+    socketOptions[ "receiveBufferSize" ]   = socketOptions_.receiveBufferSize;
+    socketOptions[ "fastOpenQueueLength" ] = socketOptions_.fastOpenQueueLength;
+    socketOptions[ "deferAcceptTimeout" ]  = socketOptions_.deferAcceptTimeout;
+    socketOptions[ "reusePort" ]           = socketOptions_.reusePort;
+
+    result[ "socketOptions" ] = socketOptions;
+
+    QJsonObject cpuAffinity;
+    QJsonArray  serverThreadCpus;
+    QJsonArray  handleThreadCpus;
+
+    for ( const auto &cpu: cpuAffinity_.serverThreadCpus ) { serverThreadCpus.push_back( cpu ); }
+    for ( const auto &cpu: handlePool_->cpuAffinity() ) { handleThreadCpus.push_back( cpu ); }
+
+    cpuAffinity[ "serverThreadCpus" ]     = serverThreadCpus;
+    cpuAffinity[ "handleThreadCpus" ]     = handleThreadCpus;
+    cpuAffinity[ "nodeLocalMemory" ]      = cpuAffinity_.nodeLocalMemory;
+    cpuAffinity[ "numaNodeCount" ]        = numaNodeCpus().size();
+    cpuAffinity[ "localNodeHandleCount" ] = static_cast< double >( localNodeHandleCount_.loadAcquire() );
+    cpuAffinity[ "crossNodeHandleCount" ] = static_cast< double >( crossNodeHandleCount_.loadAcquire() );
+
+    result[ "cpuAffinity" ] = cpuAffinity;
+
+    QJsonObject keepAlive;
+
+    keepAlive[ "enabled" ]      = keepAliveOptions_.enabled;
+    keepAlive[ "idleTimeout" ]  = keepAliveOptions_.idleTimeout;
+    keepAlive[ "maxRequests" ]  = keepAliveOptions_.maxRequests;
+    keepAlive[ "requestCount" ] = static_cast< double >( keepAliveRequestCount_.loadAcquire() ); // 复用已有连接的请求数
+
+    result[ "keepAlive" ] = keepAlive;
+
+    QJsonObject http2;
+
+    mutex_.lock();
+    http2[ "activeConnectionCount" ] = http2Connections_.size();
+    mutex_.unlock();
+
+    http2[ "enabled" ]              = http2Options_.enabled;
+    http2[ "maxConcurrentStreams" ] = http2Options_.maxConcurrentStreams;
+    http2[ "cleartextCount" ]       = static_cast< double >( http2CleartextCount_.loadAcquire() );
+    http2[ "connectionCount" ]      = static_cast< double >( http2ConnectionCount_.loadAcquire() );
+    http2[ "streamCount" ]          = static_cast< double >( http2StreamCount_.loadAcquire() );
+
+    result[ "http2" ] = http2;
+
+    QJsonObject webSocket;
+
+    mutex_.lock();
+    webSocket[ "activeConnectionCount" ] = webSockets_.size();
+    mutex_.unlock();
+
+    webSocket[ "enabled" ]         = webSocketOptions_.enabled;
+    webSocket[ "connectionCount" ] = static_cast< double >( webSocketCount_.loadAcquire() );
+    webSocket[ "messageCount" ]    = static_cast< double >( webSocketMessageCount_.loadAcquire() ); // 收到的消息数
+    webSocket[ "overflowCount" ]        = static_cast< double >( webSocketStatistics_->overflowCount.loadAcquire() );
+    webSocket[ "pendingOverflowCount" ] = static_cast< double >( webSocketStatistics_->pendingOverflowCount.loadAcquire() );
+    webSocket[ "rejectedCount" ]        = static_cast< double >( webSocketStatistics_->rejectedCount.loadAcquire() );
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+    webSocket[ "perMessageDeflateSupported" ] = true;
+#else
+    webSocket[ "perMessageDeflateSupported" ] = false;
+#endif
+
+    result[ "webSocket" ] = webSocket;
+
+    return result;
+}
+
+bool JQHttpServer::AbstractManage::listenTcpServer(QTcpServer *tcpServer, const ListenEndpoint &listenEndpoint)
+{
+    tcpServer->setMaxPendingConnections( maxPendingConnections_ );
+
+    QObject::connect(
+        tcpServer,
+        &QTcpServer::acceptError,
+        tcpServer,
+        [ this, tcpServer ](const QAbstractSocket::SocketError &socketError)
+        {
+            ++acceptErrorCount_;
+            qDebug() << "JQHttpServer::Manage: accept error:" << socketError << tcpServer->errorString();
+
+            // 非临时错误（例如文件描述符用完）时 QTcpServer 会暂停 accept，过一会儿再恢复
+            QTimer::singleShot( 100, tcpServer, [ tcpServer ]() { tcpServer->resumeAccepting(); } );
+        } );
+
+    if ( listenEndpoint.socketDescriptor >= 0 )
+    {
+#ifdef Q_OS_UNIX
+        const auto family = listenSocketFamily( listenEndpoint.socketDescriptor );
+        if ( ( family != AF_INET ) && ( family != AF_INET6 ) )
+        {
+            qDebug() << "JQHttpServer::Manage::listen: error: not a tcp listen socket:" << listenEndpoint.socketDescriptor;
+            return false;
+        }
+
+        // 对已经 listen 的 socket 再调用一次 listen 只会修改 backlog，排队中的连接不受影响
+        ::listen( static_cast< int >( listenEndpoint.socketDescriptor ), listenBacklog_ );
+
+        // 继承来的 fd 由别的进程创建，监听 socket 上的选项在这里补上，之后接受的连接就会继承
+        applyListenSocketOptions( static_cast< int >( listenEndpoint.socketDescriptor ), socketOptions_ );
+#endif
+
+        if ( !tcpServer->setSocketDescriptor( listenEndpoint.socketDescriptor ) )
+        {
+            qDebug() << "JQHttpServer::Manage::listen: error:" << listenEndpoint.socketDescriptor << tcpServer->errorString();
+            return false;
+        }
+    }
+    else
+    {
+#ifdef Q_OS_UNIX
+        const auto listenSocket = createListenSocket( listenEndpoint.address, listenEndpoint.port, listenBacklog_, socketOptions_ );
+        if ( listenSocket < 0 ) { return false; }
+
+        if ( !tcpServer->setSocketDescriptor( listenSocket ) )
+        {
+            qDebug() << "JQHttpServer::Manage::listen: error:" << tcpServer->errorString();
+            close( listenSocket );
+            return false;
+        }
+#else
+        if ( !tcpServer->listen( listenEndpoint.address, listenEndpoint.port ) ) { return false; }
+#endif
+    }
+
+    mutex_.lock();
+    listenSocketDescriptors_.push_back( tcpServer->socketDescriptor() );
+    mutex_.unlock();
+
+    return true;
+}
+
+// 能连上说明另一个服务正在使用这个名字，只有连接被拒绝（进程异常退出留下的 socket 文件）时才删除
+static bool removeStaleLocalServer(const QString &serverName)
+{
+    QLocalSocket socket;
+    socket.connectToServer( serverName );
+
+    if ( socket.waitForConnected( 1000 ) )
+    {
+        socket.abort();
+        return false;
+    }
+
+    switch ( socket.error() )
+    {
+        case QLocalSocket::ServerNotFoundError:
+        case QLocalSocket::ConnectionRefusedError:
+        {
+            QLocalServer::removeServer( serverName );
+            return true;
+        }
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+QLocalServer *JQHttpServer::AbstractManage::listenLocalServer(const ListenEndpoint &listenEndpoint)
+{
+    auto localServer = new QLocalServer;
+
+    localServer->setMaxPendingConnections( maxPendingConnections_ );
+
+    QObject::connect(
+        localServer,
+        &QLocalServer::newConnection,
+        localServer,
+        [ this, localServer ]()
+        {
+            while ( localServer->hasPendingConnections() )
+            {
+                auto socket = localServer->nextPendingConnection();
+
+                // TCP 的 socket 选项对 Unix domain socket 无效，这里只计数
+                ++acceptedCount_;
+                this->newSession( new Session( socket ) );
+            }
+        } );
+
+    auto isListening = false;
+    if ( listenEndpoint.socketDescriptor >= 0 )
+    {
+        isListening = localServer->listen( listenEndpoint.socketDescriptor );
+    }
+    else if ( !removeStaleLocalServer( listenEndpoint.localServerName ) )
+    {
+        // 不能抢占正在运行的服务的 socket
+        qDebug() << "JQHttpServer::Manage::listen: error: server name in use:" << listenEndpointToString( listenEndpoint );
+        delete localServer;
+        return nullptr;
+    }
+    else
+    {
+        isListening = localServer->listen( listenEndpoint.localServerName );
+    }
+
+    if ( !isListening )
+    {
+        qDebug() << "JQHttpServer::Manage::listen: error:" << listenEndpointToString( listenEndpoint ) << localServer->errorString();
+        delete localServer;
+        return nullptr;
+    }
+
+    return localServer;
+}
+
+void JQHttpServer::AbstractManage::onConnectionAccepted(const qintptr socketDescriptor, const qintptr listenSocketDescriptor)
+{
+#ifdef Q_OS_UNIX
+    applyAcceptedSocketOptions( socketDescriptor, socketOptions_ );
+#else
+    Q_UNUSED( socketDescriptor );
+#endif
+
+#ifdef Q_OS_LINUX
+    // 每 64 个连接采样一次 accept 队列，避免每个连接都多一次系统调用
+    if ( ( ++acceptedCount_ % 64 ) != 0 ) { return; }
+
+    int queueLength = 0;
+    int backlog     = 0;
+    if ( !acceptQueueInfo( listenSocketDescriptor, queueLength, backlog ) ) { return; }
+
+    auto maxAcceptQueueLength = maxAcceptQueueLength_.loadAcquire();
+    while ( ( queueLength > maxAcceptQueueLength ) && !maxAcceptQueueLength_.testAndSetOrdered( maxAcceptQueueLength, queueLength ) )
+    {
+        maxAcceptQueueLength = maxAcceptQueueLength_.loadAcquire();
+    }
+
+    // 队列已满时内核会丢弃新的 SYN / ACK
+    if ( ( backlog > 0 ) && ( queueLength >= backlog ) )
+    {
+        ++acceptQueueFullCount_;
+    }
+#else
+    Q_UNUSED( listenSocketDescriptor );
+
+    ++acceptedCount_;
+#endif
+}
+
+void JQHttpServer::AbstractManage::stopHandleThread()
+{
+    handlePool_->waitForDone();
+}
+
+void JQHttpServer::AbstractManage::stopServerThread()
+{
+    serverThreadPool_->waitForDone();
+
+    if ( serverThread_ )
+    {
+        serverThread_->wait();
+        serverThread_.clear();
+    }
+}
+
+void JQHttpServer::AbstractManage::newSession(const QPointer< Session > &session)
+{
+    session->setHandleAcceptedCallback( [ this ](const QPointer< JQHttpServer::Session > &session){ this->handleAccepted( session ); } );
+    session->setWriteOptions( writeOptions_ );
+    session->setWriteStatistics( writeStatistics_ );
+    session->setDeferredReplyStatistics( deferredReplyStatistics_ );
+    session->setKeepAliveOptions( keepAliveOptions_ );
+    session->setKeepAliveCallback( [ this ](const QPointer< QIODevice > &socket, const int requestIndex)->QPointer< Session >
+    {
+        Q_UNUSED( requestIndex );
+
+        // 停止 accept 之后不再保持连接，让 shutdown 能尽快排空
+        this->mutex_.lock();
+        const auto acceptingStopped = this->acceptingStopped_;
+        this->mutex_.unlock();
+
+        if ( acceptingStopped ) { return nullptr; }
+
+        ++keepAliveRequestCount_;
+
+        auto nextSession = new Session( socket );
+        this->newSession( nextSession );
+
+        return nextSession;
+    } );
+
+    // 只有 TcpServerManage 的明文连接支持 h2c，TLS 上没有协商 h2 的连接必须按 HTTP/1.1 处理
+    if ( http2Options_.enabled && this->isHttp2CleartextSupported() )
+    {
+        session->setHttp2PrefaceCallback( [ this ](const QPointer< QTcpSocket > &socket, const QByteArray &receivedData)
+        {
+            ++http2CleartextCount_;
+            this->newHttp2Connection( socket, receivedData );
+        } );
+    }
+
+    if ( webSocketOptions_.enabled )
+    {
+        session->setWebSocketAcceptCallback( [ this ](const QPointer< Session > &session)
+        {
+            return this->acceptWebSocket( session );
+        } );
+        session->setWebSocketUpgradeCallback( [ this ](const QPointer< Session > &session, const QPointer< QIODevice > &socket, const QByteArray &receivedData)
+        {
+            this->newWebSocket( session, socket, receivedData );
+        } );
+    }
+
+    auto session_ = session.data();
+    connect(
+        session.data(),
+        &QObject::destroyed,
+        [ this, session_ ]()
+        {
+            this->mutex_.lock();
+            this->availableSessions_.remove( session_ );
+            this->mutex_.unlock();
+        } );
+
+    this->mutex_.lock();
+    availableSessions_.insert( session.data() );
+    this->mutex_.unlock();
+}
+
+void JQHttpServer::AbstractManage::newHttp2Connection(const QPointer< QTcpSocket > &socket, const QByteArray &receivedData)
+{
+    ++http2ConnectionCount_;
+
+    auto connection = new Http2Connection( socket, http2Options_, [ this ](const QPointer< Session > &session)
+    {
+        ++http2StreamCount_;
+        this->newSession( session );
+    } );
+
+    connect(
+        connection,
+        &QObject::destroyed,
+        [ this, connection ]()
+        {
+            this->mutex_.lock();
+            this->http2Connections_.remove( connection );
+            this->mutex_.unlock();
+        } );
+
+    this->mutex_.lock();
+    http2Connections_.insert( connection );
+    this->mutex_.unlock();
+
+    connection->start( receivedData );
+}
+
+void JQHttpServer::AbstractManage::closeHttp2Connections()
+{
+    for ( const auto &connection: this->takeHttp2Connections() )
+    {
+        invokeInObjectThread( connection.data(), [ connection ]()
+        {
+            if ( !connection ) { return; }
+
+            connection->abort();
+            delete connection.data();
+        } );
+    }
+}
+
+QList< QPointer< JQHttpServer::Http2Connection > > JQHttpServer::AbstractManage::takeHttp2Connections()
+{
+    QList< QPointer< Http2Connection > > connections;
+
+    this->mutex_.lock();
+
+    for ( const auto &connection: http2Connections_ )
+    {
+        connections.push_back( connection );
+    }
+
+    this->mutex_.unlock();
+
+    return connections;
+}
+
+void JQHttpServer::AbstractManage::newWebSocket(const QPointer< Session > &session, const QPointer< QIODevice > &socket, const QByteArray &receivedData)
+{
+    ++webSocketCount_;
+
+    auto webSocket = new WebSocket( socket, session->requestUrl(), session->requestHeader(), session->requestSourceIp(), webSocketOptions_ );
+    webSocket->setStatistics( webSocketStatistics_ );
+
+    const QPointer< WebSocket > webSocketPointer( webSocket );
+    webSocket->setEventCallback( [ this, webSocketPointer ]()
+    {
+        this->handleWebSocketEvents( webSocketPointer );
+    } );
+
+    connect(
+        webSocket,
+        &QObject::destroyed,
+        [ this, webSocket ]()
+        {
+            this->mutex_.lock();
+            this->webSockets_.remove( webSocket );
+            this->mutex_.unlock();
+        } );
+
+    this->mutex_.lock();
+    webSockets_.insert( webSocket );
+    this->mutex_.unlock();
+
+    webSocket->start( receivedData );
+}
+
+void JQHttpServer::AbstractManage::closeWebSockets()
+{
+    const auto &&webSockets = this->webSockets();
+
+    // 直接断开，Closed 事件照常交给处理线程回调
+    for ( const auto &webSocket: webSockets )
+    {
+        invokeInObjectThread( webSocket.data(), [ webSocket ]()
+        {
+            if ( webSocket ) { webSocket->abort(); }
+        } );
+    }
+
+    // 处理线程取完事件之前删除的话会访问已经删除的连接，回调一直不返回时最多等 5 秒
+    QElapsedTimer elapsedTimer;
+    elapsedTimer.start();
+
+    for ( const auto &webSocket: webSockets )
+    {
+        auto closedDelivered = false;
+
+        forever
+        {
+            this->mutex_.lock();
+            closedDelivered = webSocket && webSocket->isClosedDelivered();
+            this->mutex_.unlock();
+
+            if ( !webSocket || closedDelivered || ( elapsedTimer.elapsed() >= ( 5 * 1000 ) ) ) { break; }
+
+            QThread::msleep( 1 );
+        }
+
+        invokeInObjectThread( webSocket.data(), [ this, webSocket, closedDelivered ]()
+        {
+            if ( !webSocket ) { return; }
+
+            webSocket->setEventCallback( nullptr );
+
+            if ( closedDelivered )
+            {
+                delete webSocket.data();
+                return;
+            }
+
+            // Closed 回调还没有返回，处理线程之后还会使用这个连接，不能删除，留给回调返回后的 deleteLater；
+            // 到时候 Manage 可能已经删除，先断开 destroyed 的处理
+            qDebug() << "JQHttpServer::Manage::closeWebSockets: error: closed callback not returned, connection not deleted";
+
+            QObject::disconnect( webSocket.data(), &QObject::destroyed, nullptr, nullptr );
+
+            this->mutex_.lock();
+            this->webSockets_.remove( webSocket.data() );
+            this->mutex_.unlock();
+        } );
+    }
+}
+
+bool JQHttpServer::AbstractManage::acceptWebSocket(const QPointer< Session > &session)
+{
+    if ( !webSocketOptions_.allowedOrigins.isEmpty() )
+    {
+        QString origin;
+
+        const auto &&requestHeader = session->requestHeader();
+        for ( auto it = requestHeader.begin(); it != requestHeader.end(); ++it )
+        {
+            if ( it.key().toLower() == "origin" ) { origin = it.value().trimmed(); }
+        }
+
+        // 浏览器总会带上 Origin，没有 Origin 的是其他客户端，不受跨站限制
+        if ( !origin.isEmpty() && !webSocketOptions_.allowedOrigins.contains( origin, Qt::CaseInsensitive ) )
+        {
+            ++webSocketStatistics_->rejectedCount;
+            session->replyText( "origin not allowed", 403 );
+            return false;
+        }
+    }
+
+    if ( webSocketAcceptCallback_ && !webSocketAcceptCallback_( session ) )
+    {
+        ++webSocketStatistics_->rejectedCount;
+        return false;
+    }
+
+    return true;
+}
+
+QList< QPointer< JQHttpServer::WebSocket > > JQHttpServer::AbstractManage::webSockets()
+{
+    QList< QPointer< WebSocket > > webSockets;
+
+    this->mutex_.lock();
+
+    for ( const auto &webSocket: webSockets_ )
+    {
+        webSockets.push_back( webSocket );
+    }
+
+    this->mutex_.unlock();
+
+    return webSockets;
+}
+
+void JQHttpServer::AbstractManage::handleWebSocketEvents(const QPointer< WebSocket > &webSocket)
+{
+    // 同一个连接的事件按顺序在一个处理线程里取完，不会并发调用回调
+    handlePool_->start( [ this, webSocket ]()
+    {
+        WebSocket::Event event;
+
+        while ( webSocket && webSocket->takeEvent( event ) )
+        {
+            switch ( event.type )
+            {
+                case WebSocket::OpenedEvent:
+                {
+                    if ( webSocketOpenedCallback_ ) { webSocketOpenedCallback_( webSocket ); }
+                    break;
+                }
+                case WebSocket::MessageEvent:
+                {
+                    ++webSocketMessageCount_;
+                    if ( webSocketMessageCallback_ ) { webSocketMessageCallback_( webSocket, event.data, event.isText ); }
+                    break;
+                }
+                case WebSocket::ClosedEvent:
+                {
+                    if ( webSocketClosedCallback_ ) { webSocketClosedCallback_( webSocket, event.closeCode ); }
+
+                    // 标记和 deleteLater 在锁里一起完成，closeWebSockets 在锁里看到标记之后才会删除，不会和这里同时访问
+                    this->mutex_.lock();
+
+                    if ( webSocket )
+                    {
+                        webSocket->setClosedDelivered();
+                        webSocket->deleteLater();
+                    }
+
+                    this->mutex_.unlock();
+                    return;
+                }
+            }
+        }
+    } );
+}
+
+void JQHttpServer::AbstractManage::handleAccepted(const QPointer< Session > &session)
+{
+    if ( session )
+    {
+        session->setHandlingAccepted( true );
+    }
+
+    auto handlePool = handlePool_;
+    if ( handlePoolSelector_ )
+    {
+        const auto selectedHandlePool = handlePoolSelector_( session );
+        if ( selectedHandlePool ) { handlePool = selectedHandlePool; }
+    }
+
+    const auto priority = ( priorityClassifier_ ) ? ( priorityClassifier_( session ) ) : ( NormalHandlePriority );
+
+#ifdef Q_OS_LINUX
+    // 在服务线程里记录所在节点，处理线程拿到任务时对比，统计 session 数据跨节点访问的次数
+    const auto dispatchNode = currentCpuNumaNode();
+#else
+    const auto dispatchNode = -1;
+#endif
+
+    handlePool->start( [ this, session, dispatchNode ]()
+    {
+#ifdef Q_OS_LINUX
+        const auto handleNode = currentCpuNumaNode();
+        if ( ( dispatchNode >= 0 ) && ( handleNode >= 0 ) )
+        {
+            if ( dispatchNode == handleNode )
+            {
+                localNodeHandleCount_.fetchAndAddOrdered( 1 );
+            }
+            else
+            {
+                crossNodeHandleCount_.fetchAndAddOrdered( 1 );
+            }
+        }
+#else
+        Q_UNUSED( dispatchNode );
+#endif
+
+        if ( !session )
+        {
+            return;
+        }
+
+        if ( !this->httpAcceptedCallback_ )
+        {
+            qDebug() << "JQHttpServer::Manage::handleAccepted: error, httpAcceptedCallback_ is nullptr";
+            session->setHandlingAccepted( false );
+            return;
+        }
+
+        this->httpAcceptedCallback_( session );
+
+        // 延迟回复的 session 在回复完成或者超时后才清除处理中标记
+        if ( session && !session->isReplyDeferred() )
+        {
+            session->setHandlingAccepted( false );
+        }
+    }, priority );
+}
+
+// TcpServerManage
+JQHttpServer::TcpServerManage::TcpServerManage(const int handleMaxThreadCount):
+    AbstractManage( handleMaxThreadCount )
+{ }
+
+JQHttpServer::TcpServerManage::~TcpServerManage()
+{
+    if ( this->isRunning() )
+    {
+        this->deinitialize();
+    }
+}
+
+bool JQHttpServer::TcpServerManage::listen(const QHostAddress &address, const quint16 port)
+{
+    return this->listen( QList< ListenEndpoint >( { ListenEndpoint( address, port ) } ) );
+}
+
+bool JQHttpServer::TcpServerManage::listen(const QList< ListenEndpoint > &listenEndpoints)
+{
+    if ( listenEndpoints.isEmpty() )
+    {
+        qDebug() << "JQHttpServer::TcpServerManage::listen: error: no listen endpoint";
+        return false;
+    }
+
+    listenEndpoints_ = listenEndpoints;
+
+    return this->initialize();
+}
+
+bool JQHttpServer::TcpServerManage::isRunning()
+{
+    mutex_.lock();
+
+    const auto isRunning = !tcpServers_.isEmpty() || !localServers_.isEmpty();
+
+    mutex_.unlock();
+
+    return isRunning;
+}
+
+bool JQHttpServer::TcpServerManage::onStart()
+{
+    for ( const auto &listenEndpoint: listenEndpoints_ )
+    {
+        if ( this->isLocalListenEndpoint( listenEndpoint ) )
+        {
+            auto localServer = this->listenLocalServer( listenEndpoint );
+            if ( !localServer )
+            {
+                this->closeServers();
+                return false;
+            }
+
+            mutex_.lock();
+            localServers_.push_back( localServer );
+            mutex_.unlock();
+
+            continue;
+        }
+
+        auto tcpServer = new QTcpServer;
+
+        mutex_.lock();
+        tcpServers_.push_back( tcpServer );
+        mutex_.unlock();
+
+        QObject::connect(
+            tcpServer,
+            &QTcpServer::newConnection,
+            tcpServer,
+            [ this, tcpServer ]()
+            {
+                // 取完所有等待的连接，QTcpServer 内部会用 accept4 一直接受到 EAGAIN 或者达到等待上限
+                while ( tcpServer->hasPendingConnections() )
+                {
+                    auto socket = tcpServer->nextPendingConnection();
+
+                    this->onConnectionAccepted( socket->socketDescriptor(), tcpServer->socketDescriptor() );
+                    this->newSession( new Session( socket ) );
+                }
+            } );
+
+        if ( !this->listenTcpServer( tcpServer, listenEndpoint ) )
+        {
+            this->closeServers();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void JQHttpServer::TcpServerManage::onFinish()
+{
+    this->closeServers();
+}
+
+void JQHttpServer::TcpServerManage::onStopAccepting()
+{
+    this->mutex_.lock();
+
+    const auto tcpServers   = tcpServers_;
+    const auto localServers = localServers_;
+
+    this->mutex_.unlock();
+
+    for ( const auto &tcpServer: tcpServers )
+    {
+        invokeInObjectThread( tcpServer.data(), [ tcpServer ]() { if ( tcpServer ) { tcpServer->close(); } } );
+    }
+
+    for ( const auto &localServer: localServers )
+    {
+        invokeInObjectThread( localServer.data(), [ localServer ]() { if ( localServer ) { localServer->close(); } } );
+    }
+}
+
+void JQHttpServer::TcpServerManage::closeServers()
+{
+    this->mutex_.lock();
+
+    listenSocketDescriptors_.clear();
+
+    const auto tcpServers   = tcpServers_;
+    const auto localServers = localServers_;
+    tcpServers_.clear();
+    localServers_.clear();
+
+    this->mutex_.unlock();
+
+    for ( const auto &tcpServer: tcpServers )
+    {
+        if ( !tcpServer ) { continue; }
+
+        tcpServer->close();
+        delete tcpServer.data();
+    }
+
+    for ( const auto &localServer: localServers )
+    {
+        if ( !localServer ) { continue; }
+
+        localServer->close();
+        delete localServer.data();
+    }
+
+    this->closeHttp2Connections();
+    this->closeWebSockets();
+}
+
+// LocalServerManage
+JQHttpServer::LocalServerManage::LocalServerManage(const int handleMaxThreadCount):
+    AbstractManage( handleMaxThreadCount )
+{ }
+
+JQHttpServer::LocalServerManage::~LocalServerManage()
+{
+    if ( this->isRunning() )
+    {
+        this->deinitialize();
+    }
+}
+
+bool JQHttpServer::LocalServerManage::listen(const QString &serverName)
+{
+    listenServerName_ = serverName;
+    listenEndpoints_  = QList< ListenEndpoint >( { ListenEndpoint( serverName ) } );
+
+    return this->initialize();
+}
+
+bool JQHttpServer::LocalServerManage::isRunning()
+{
+    return !localServer_.isNull();
+}
+
+bool JQHttpServer::LocalServerManage::onStart()
+{
+    auto localServer = this->listenLocalServer( ListenEndpoint( listenServerName_ ) );
+    if ( !localServer ) { return false; }
+
+    mutex_.lock();
+
+    localServer_    = localServer;
+    fullServerName_ = localServer->fullServerName();
+
+    mutex_.unlock();
+
+    return true;
+}
+
+void JQHttpServer::LocalServerManage::onStopAccepting()
+{
+    this->mutex_.lock();
+
+    const auto localServer = localServer_;
+
+    this->mutex_.unlock();
+
+    invokeInObjectThread( localServer.data(), [ localServer ]() { if ( localServer ) { localServer->close(); } } );
+}
+
+void JQHttpServer::LocalServerManage::onFinish()
+{
+    this->mutex_.lock();
+
+    localServer_->close();
+    delete localServer_.data();
+    localServer_.clear();
+
+    this->mutex_.unlock();
+
+    this->closeWebSockets();
+}
+
+// Prefork
+#ifdef Q_OS_UNIX
+namespace JQHttpServer
+{
+
+struct PreforkWorker
+{
+    pid_t       pid          = -1;
+    int         statusFd     = -1;  // supervisor 这一端的读端
+    QByteArray  statusBuffer;
+    QJsonObject status;
+    int         restartCount = 0;
+    qint64      restartTime  = -1;  // 等待重新 fork 的时间点，-1 表示正在运行
+};
+
+}
+
+static int                                   preforkStatusFd = -1;  // worker 这一端的写端
+static QList< JQHttpServer::ListenEndpoint > preforkListenEndpoints;
+static QMutex                                preforkStatusMutex;
+static int                                   preforkSignalPipe[ 2 ] = { -1, -1 };
+static int                                   preforkStopPipe[ 2 ]   = { -1, -1 }; // worker 收到 SIGTERM / SIGINT
+static volatile sig_atomic_t                 preforkStopWatched     = 0;
+
+static void preforkSignalHandler(int signalNumber)
+{
+    const auto savedErrno = errno;
+    const auto value      = static_cast< char >( signalNumber );
+
+    const auto written = write( preforkSignalPipe[ 1 ], &value, 1 );
+    Q_UNUSED( written );
+
+    errno = savedErrno;
+}
+
+static void preforkWorkerSignalHandler(int signalNumber)
+{
+    // 没有调用 Prefork::watchStop 时和默认行为一样直接退出
+    if ( !preforkStopWatched )
+    {
+        signal( signalNumber, SIG_DFL );
+        raise( signalNumber );
+        return;
+    }
+
+    const auto savedErrno = errno;
+    const auto value      = static_cast< char >( signalNumber );
+
+    const auto written = write( preforkStopPipe[ 1 ], &value, 1 );
+    Q_UNUSED( written );
+
+    errno = savedErrno;
+}
+
+static void setPreforkSignalHandler(const int signalNumber, void (*handler)(int))
+{
+    struct sigaction action;
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = handler;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset( &action.sa_mask );
+
+    sigaction( signalNumber, &action, nullptr );
+}
+
+// 汇总时相加的计数，其他数值（配置、比值、所有 worker 共享的监听队列和系统统计等）保留第一个 worker 的
+static const QSet< QString > preforkStatusCounterKeys = {
+    "runningCount", "startedCount", "finishedCount", "queueDepth", "agedTakeCount", "scaleUpCount", "scaleDownCount",
+    "loopCount", "readyEventCount", "syscallCount", "readSyscallCount", "writeSyscallCount",
+    "sessionCount", "deferredReplyCount", "deferredReplyTimeoutCount",
+    "writeChunkCount", "writeChunkBytes", "watermarkStallCount", "socketBufferStallCount",
+    "acceptedCount", "acceptErrorCount", "acceptQueueFullCount", "localNodeHandleCount", "crossNodeHandleCount", "requestCount",
+    "activeConnectionCount", "cleartextCount", "connectionCount", "streamCount",
+    "messageCount", "overflowCount", "pendingOverflowCount", "rejectedCount",
+    "inFlight", "succeedCount", "failedCount", "timeoutCount", "clientHelloTimeoutCount", "acceptPauseCount",
+    "reloadCount", "reloadFailedCount", "cacheHitCount", "cacheMissCount", "pinnedCount" };
+
+// 子对象里的数值都是计数，例如按优先级统计的队列长度
+static const QSet< QString > preforkStatusCounterObjectKeys = { "queueDepthByPriority" };
+
+// 峰值、延迟和比值取最大
+static const QSet< QString > preforkStatusMaxKeys = {
+    "maxAcceptQueueLength", "maxQueueDepth", "maxInFlightReached", "maxLatency", "averageLatency", "queueLatency",
+    "requestsPerHandshake", "lastReloadTime" };
+
+// 第一个 worker 的统计整个复制，之后只累加计数、更新最大值，子对象递归，其他值不变
+static void addJsonObject(QJsonObject &target, const QJsonObject &source, const bool allCounters = false)
+{
+    for ( auto it = source.begin(); it != source.end(); ++it )
+    {
+        if ( it.value().isDouble() )
+        {
+            if ( allCounters || preforkStatusCounterKeys.contains( it.key() ) )
+            {
+                target[ it.key() ] = target[ it.key() ].toDouble() + it.value().toDouble();
+            }
+            else if ( preforkStatusMaxKeys.contains( it.key() ) )
+            {
+                target[ it.key() ] = qMax( target[ it.key() ].toDouble(), it.value().toDouble() );
+            }
+            else if ( !target.contains( it.key() ) )
+            {
+                target[ it.key() ] = it.value();
+            }
+        }
+        else if ( it.value().isObject() )
+        {
+            auto child = target[ it.key() ].toObject();
+            addJsonObject( child, it.value().toObject(), allCounters || preforkStatusCounterObjectKeys.contains( it.key() ) );
+            target[ it.key() ] = child;
+        }
+    }
+}
+
+static QJsonObject preforkStatus(const QVector< JQHttpServer::PreforkWorker > &workers)
+{
+    QJsonObject result;
+    QJsonArray  workerStatus;
+    QJsonObject total;
+    auto        totalInitialized = false;
+    auto        restartCount     = 0;
+
+    for ( auto index = 0; index < workers.size(); ++index )
+    {
+        const auto &worker = workers[ index ];
+
+        QJsonObject item;
+        item[ "index" ]        = index;
+        item[ "pid" ]          = static_cast< int >( worker.pid );
+        item[ "restartCount" ] = worker.restartCount;
+        item[ "status" ]       = worker.status;
+        workerStatus.push_back( item );
+
+        // 还没有上报过的 worker 不参与汇总
+        if ( !worker.status.isEmpty() )
+        {
+            if ( totalInitialized )
+            {
+                addJsonObject( total, worker.status );
+            }
+            else
+            {
+                total            = worker.status;
+                totalInitialized = true;
+            }
+        }
+
+        restartCount += worker.restartCount;
+    }
+
+    result[ "workerCount" ]  = workers.size();
+    result[ "restartCount" ] = restartCount;
+    result[ "workers" ]      = workerStatus;
+    result[ "total" ]        = total;
+
+    return result;
+}
+
+int JQHttpServer::Prefork::run(const Options &options)
+{
+    const auto workerCount = ( options.workerCount > 0 ) ? ( options.workerCount ) : ( qMax( 1, QThread::idealThreadCount() ) );
+
+    // supervisor 先创建监听 socket，fork 之后所有 worker 共用同一个 accept 队列
+    QList< int > listenSockets;
+    for ( const auto &listenEndpoint: options.listenEndpoints )
+    {
+        auto fd = static_cast< int >( listenEndpoint.socketDescriptor );
+        if ( fd < 0 )
+        {
+            if ( !listenEndpoint.localServerName.isEmpty() )
+            {
+                qDebug() << "JQHttpServer::Prefork::run: error: local server not supported:" << listenEndpoint.localServerName;
+                fd = -1;
+            }
+            else
+            {
+                fd = createListenSocket( listenEndpoint.address, listenEndpoint.port, options.listenBacklog, options.socketOptions );
+            }
+        }
+
+        if ( fd < 0 )
+        {
+            for ( const auto &listenSocket: listenSockets ) { close( listenSocket ); }
+            return -1;
+        }
+
+        listenSockets.push_back( fd );
+    }
+
+    if ( pipe( preforkSignalPipe ) < 0 )
+    {
+        qDebug() << "JQHttpServer::Prefork::run: error: pipe:" << strerror( errno );
+        return -1;
+    }
+
+    for ( const auto &fd: preforkSignalPipe )
+    {
+        fcntl( fd, F_SETFD, FD_CLOEXEC );
+        fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+    }
+
+    setPreforkSignalHandler( SIGTERM, preforkSignalHandler );
+    setPreforkSignalHandler( SIGINT, preforkSignalHandler );
+    setPreforkSignalHandler( SIGCHLD, preforkSignalHandler );
+
+    QVector< PreforkWorker > workers( workerCount );
+    QElapsedTimer            elapsedTimer;
+    elapsedTimer.start();
+
+    // 返回 true 表示当前是新 fork 出来的 worker 进程
+    const auto spawnWorker = [ & ](const int index)
+    {
+        auto &worker = workers[ index ];
+
+        int statusPipe[ 2 ];
+        if ( pipe( statusPipe ) < 0 )
+        {
+            qDebug() << "JQHttpServer::Prefork::run: error: pipe:" << strerror( errno );
+            worker.restartTime = elapsedTimer.elapsed() + options.restartDelay;
+            return false;
+        }
+
+        const auto supervisorPid = getpid();
+        const auto pid           = fork();
+        if ( !pid )
+        {
+            close( statusPipe[ 0 ] );
+            close( preforkSignalPipe[ 0 ] );
+            close( preforkSignalPipe[ 1 ] );
+
+            for ( const auto &otherWorker: workers )
+            {
+                if ( otherWorker.statusFd >= 0 ) { close( otherWorker.statusFd ); }
+            }
+
+            // supervisor 退出时给 worker 发 SIGTERM，终端的 Ctrl+C 也会发给所有 worker，worker 里转成 watchStop 的回调
+            if ( pipe( preforkStopPipe ) == 0 )
+            {
+                for ( const auto &fd: preforkStopPipe )
+                {
+                    fcntl( fd, F_SETFD, FD_CLOEXEC );
+                    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+                }
+
+                setPreforkSignalHandler( SIGTERM, preforkWorkerSignalHandler );
+                setPreforkSignalHandler( SIGINT, preforkWorkerSignalHandler );
+            }
+            else
+            {
+                setPreforkSignalHandler( SIGTERM, SIG_DFL );
+                setPreforkSignalHandler( SIGINT, SIG_DFL );
+            }
+            setPreforkSignalHandler( SIGCHLD, SIG_DFL );
+
+#ifdef Q_OS_LINUX
+            // supervisor 意外退出时 worker 跟着退出，设置之前 supervisor 已经退出的话收不到信号，需要再检查一次
+            prctl( PR_SET_PDEATHSIG, SIGTERM );
+            if ( getppid() != supervisorPid ) { _exit( 1 ); }
+#else
+            Q_UNUSED( supervisorPid );
+#endif
+
+            fcntl( statusPipe[ 1 ], F_SETFD, FD_CLOEXEC );
+            preforkStatusFd = statusPipe[ 1 ];
+
+            preforkListenEndpoints.clear();
+            for ( const auto &listenSocket: listenSockets )
+            {
+                preforkListenEndpoints.push_back( ListenEndpoint::fromSocketDescriptor( listenSocket ) );
+            }
+
+            return true;
+        }
+
+        close( statusPipe[ 1 ] );
+
+        if ( pid < 0 )
+        {
+            qDebug() << "JQHttpServer::Prefork::run: error: fork:" << strerror( errno );
+            close( statusPipe[ 0 ] );
+            worker.restartTime = elapsedTimer.elapsed() + options.restartDelay;
+            return false;
+        }
+
+        fcntl( statusPipe[ 0 ], F_SETFD, FD_CLOEXEC );
+        fcntl( statusPipe[ 0 ], F_SETFL, fcntl( statusPipe[ 0 ], F_GETFL ) | O_NONBLOCK );
+
+        worker.pid         = pid;
+        worker.statusFd    = statusPipe[ 0 ];
+        worker.restartTime = -1;
+        worker.statusBuffer.clear();
+        worker.status = QJsonObject();
+
+        return false;
+    };
+
+    for ( auto index = 0; index < workerCount; ++index )
+    {
+        if ( spawnWorker( index ) ) { return index; }
+    }
+
+    auto stopping = false;
+    while ( !stopping )
+    {
+        QVector< pollfd > pollFds;
+        QVector< int >    pollWorkers;
+
+        pollfd signalPollFd;
+        signalPollFd.fd      = preforkSignalPipe[ 0 ];
+        signalPollFd.events  = POLLIN;
+        signalPollFd.revents = 0;
+        pollFds.push_back( signalPollFd );
+        pollWorkers.push_back( -1 );
+
+        auto timeout = -1;
+        for ( auto index = 0; index < workers.size(); ++index )
+        {
+            const auto &worker = workers[ index ];
+
+            if ( worker.statusFd >= 0 )
+            {
+                pollfd statusPollFd;
+                statusPollFd.fd      = worker.statusFd;
+                statusPollFd.events  = POLLIN;
+                statusPollFd.revents = 0;
+                pollFds.push_back( statusPollFd );
+                pollWorkers.push_back( index );
+            }
+
+            if ( worker.restartTime >= 0 )
+            {
+                const auto remaining = static_cast< int >( qMax( static_cast< qint64 >( 0 ), worker.restartTime - elapsedTimer.elapsed() ) );
+                timeout = ( timeout < 0 ) ? ( remaining ) : ( qMin( timeout, remaining ) );
+            }
+        }
+
+        if ( ( poll( pollFds.data(), static_cast< nfds_t >( pollFds.size() ), timeout ) < 0 ) && ( errno != EINTR ) )
+        {
+            qDebug() << "JQHttpServer::Prefork::run: error: poll:" << strerror( errno );
+            break;
+        }
+
+        for ( auto pollIndex = 0; pollIndex < pollFds.size(); ++pollIndex )
+        {
+            if ( !pollFds[ pollIndex ].revents ) { continue; }
+
+            if ( pollWorkers[ pollIndex ] < 0 )
+            {
+                char signalNumbers[ 64 ];
+                ssize_t count = 0;
+                while ( ( count = read( preforkSignalPipe[ 0 ], signalNumbers, sizeof( signalNumbers ) ) ) > 0 )
+                {
+                    for ( auto index = 0; index < count; ++index )
+                    {
+                        if ( ( signalNumbers[ index ] == SIGTERM ) || ( signalNumbers[ index ] == SIGINT ) ) { stopping = true; }
+                    }
+                }
+
+                // 回收退出的 worker，稍后重新 fork
+                int   exitStatus = 0;
+                pid_t pid        = 0;
+                while ( ( pid = waitpid( -1, &exitStatus, WNOHANG ) ) > 0 )
+                {
+                    for ( auto &worker: workers )
+                    {
+                        if ( worker.pid != pid ) { continue; }
+
+                        qDebug() << "JQHttpServer::Prefork::run: worker exited:" << pid << "status:" << exitStatus;
+
+                        worker.pid         = -1;
+                        worker.restartTime = elapsedTimer.elapsed() + options.restartDelay;
+                        ++worker.restartCount;
+                    }
+                }
+
+                continue;
+            }
+
+            auto &worker = workers[ pollWorkers[ pollIndex ] ];
+
+            char    buffer[ 4096 ];
+            ssize_t count = 0;
+            while ( ( count = read( worker.statusFd, buffer, sizeof( buffer ) ) ) > 0 )
+            {
+                worker.statusBuffer.append( buffer, static_cast< int >( count ) );
+            }
+
+            // worker 已经退出
+            if ( !count )
+            {
+                close( worker.statusFd );
+                worker.statusFd = -1;
+            }
+
+            // 每行一个 JSON，只保留最新的一个
+            const auto lineEnd = worker.statusBuffer.lastIndexOf( '\n' );
+            if ( lineEnd < 0 ) { continue; }
+
+            const auto lineStart = worker.statusBuffer.lastIndexOf( '\n', lineEnd - 1 ) + 1;
+            worker.status = QJsonDocument::fromJson( worker.statusBuffer.mid( lineStart, lineEnd - lineStart ) ).object();
+            worker.statusBuffer.remove( 0, lineEnd + 1 );
+
+            if ( options.statusCallback ) { options.statusCallback( preforkStatus( workers ) ); }
+        }
+
+        if ( stopping ) { break; }
+
+        for ( auto index = 0; index < workers.size(); ++index )
+        {
+            const auto &worker = workers[ index ];
+            if ( ( worker.pid >= 0 ) || ( worker.restartTime < 0 ) || ( worker.restartTime > elapsedTimer.elapsed() ) ) { continue; }
+
+            if ( worker.statusFd >= 0 )
+            {
+                close( workers[ index ].statusFd );
+                workers[ index ].statusFd = -1;
+            }
+
+            if ( spawnWorker( index ) ) { return index; }
+        }
+    }
+
+    // 通知所有 worker 退出，超时后强制结束
+    for ( const auto &worker: workers )
+    {
+        if ( worker.pid > 0 ) { kill( worker.pid, SIGTERM ); }
+    }
+
+    QElapsedTimer stopTimer;
+    stopTimer.start();
+
+    forever
+    {
+        auto remainCount = 0;
+        for ( auto &worker: workers )
+        {
+            if ( worker.pid <= 0 ) { continue; }
+
+            if ( waitpid( worker.pid, nullptr, WNOHANG ) == worker.pid )
+            {
+                worker.pid = -1;
+                continue;
+            }
+
+            if ( stopTimer.elapsed() >= options.stopTimeout )
+            {
+                kill( worker.pid, SIGKILL );
+                waitpid( worker.pid, nullptr, 0 );
+                worker.pid = -1;
+                continue;
+            }
+
+            ++remainCount;
+        }
+
+        if ( !remainCount ) { break; }
+
+        QThread::msleep( 10 );
+    }
+
+    for ( const auto &worker: workers )
+    {
+        if ( worker.statusFd >= 0 ) { close( worker.statusFd ); }
+    }
+
+    for ( const auto &listenSocket: listenSockets ) { close( listenSocket ); }
+
+    setPreforkSignalHandler( SIGTERM, SIG_DFL );
+    setPreforkSignalHandler( SIGINT, SIG_DFL );
+    setPreforkSignalHandler( SIGCHLD, SIG_DFL );
+
+    close( preforkSignalPipe[ 0 ] );
+    close( preforkSignalPipe[ 1 ] );
+    preforkSignalPipe[ 0 ] = -1;
+    preforkSignalPipe[ 1 ] = -1;
+
+    return -1;
+}
+
+QList< JQHttpServer::ListenEndpoint > JQHttpServer::Prefork::listenEndpoints()
+{
+    return preforkListenEndpoints;
+}
+
+bool JQHttpServer::Prefork::watchStop(const std::function< void() > &callback)
+{
+    if ( ( preforkStopPipe[ 0 ] < 0 ) || !QCoreApplication::instance() ) { return false; }
+
+    auto notifier = new QSocketNotifier( preforkStopPipe[ 0 ], QSocketNotifier::Read, QCoreApplication::instance() );
+    QObject::connect( notifier, &QSocketNotifier::activated, notifier, [ notifier, callback ]()
+    {
+        char    buffer[ 16 ];
+        ssize_t count = 0;
+        while ( ( count = read( preforkStopPipe[ 0 ], buffer, sizeof( buffer ) ) ) > 0 ) { }
+
+        // 只通知一次，之后的信号忽略，supervisor 超过 stopTimeout 会 SIGKILL
+        notifier->setEnabled( false );
+
+        if ( callback ) { callback(); }
+    } );
+
+    preforkStopWatched = 1;
+
+    return true;
+}
+
+bool JQHttpServer::Prefork::reportStatus(const QJsonObject &status)
+{
+    if ( preforkStatusFd < 0 ) { return false; }
+
+    auto data = QJsonDocument( status ).toJson( QJsonDocument::Compact );
+    data.append( '\n' );
+
+    // 超过 PIPE_BUF 的写入不是原子的，多个线程同时上报时需要串行
+    preforkStatusMutex.lock();
+
+    qint64 offset = 0;
+    while ( offset < data.size() )
+    {
+        const auto written = write( preforkStatusFd, data.constData() + offset, static_cast< size_t >( data.size() - offset ) );
+        if ( written < 0 )
+        {
+            if ( errno == EINTR ) { continue; }
+            break;
+        }
+
+        offset += written;
+    }
+
+    preforkStatusMutex.unlock();
+
+    return offset == data.size();
+}
+#endif
+
+// SslServerManage
+#ifndef QT_NO_SSL
+namespace JQHttpServer
+{
+
+class SslServerHelper: public QTcpServer
+{
+    void incomingConnection(qintptr socketDescriptor) final;
+
+public:
+    std::function< void(qintptr socketDescriptor) > onIncomingConnectionCallback_;
+};
+
+void JQHttpServer::SslServerHelper::incomingConnection(qintptr socketDescriptor)
+{
+    onIncomingConnectionCallback_( socketDescriptor );
+}
+
+}
+
+// 依次尝试各种算法和编码，返回空表示都不是
+static QSslKey privateKeyFromData(const QByteArray &data, QSsl::KeyAlgorithm &keyAlgorithm)
+{
+    for ( const auto &encodingFormat: { QSsl::Pem, QSsl::Der } )
+    {
+        for ( const auto &algorithm: { QSsl::Rsa, QSsl::Ec, QSsl::Dsa } )
+        {
+            QSslKey sslKey( data, algorithm, encodingFormat, QSsl::PrivateKey );
+            if ( sslKey.isNull() ) { continue; }
+
+            keyAlgorithm = algorithm;
+            return sslKey;
+        }
+    }
+
+    return { };
+}
+
+// 读取一个 DER 元素，offset 移到下一个元素，只支持证书和私钥里会出现的定长编码
+static bool readDerElement(const QByteArray &der, int &offset, quint8 &tag, QByteArray &content)
+{
+    if ( ( offset + 2 ) > der.size() ) { return false; }
+
+    tag = static_cast< quint8 >( der.at( offset++ ) );
+
+    qint64 length = static_cast< quint8 >( der.at( offset++ ) );
+    if ( length & 0x80 )
+    {
+        const auto lengthSize = static_cast< int >( length & 0x7f );
+        if ( !lengthSize || ( lengthSize > 4 ) || ( ( offset + lengthSize ) > der.size() ) ) { return false; }
+
+        length = 0;
+        for ( auto index = 0; index < lengthSize; ++index )
+        {
+            length = ( length << 8 ) | static_cast< quint8 >( der.at( offset++ ) );
+        }
+    }
+
+    if ( ( offset + length ) > der.size() ) { return false; }
+
+    content = der.mid( offset, static_cast< int >( length ) );
+    offset += static_cast< int >( length );
+
+    return true;
+}
+
+// SEQUENCE 的直接子元素
+static QList< QPair< quint8, QByteArray > > derSequenceElements(const QByteArray &der)
+{
+    QList< QPair< quint8, QByteArray > > result;
+
+    auto       offset = 0;
+    quint8     tag    = 0;
+    QByteArray content;
+    if ( !readDerElement( der, offset, tag, content ) || ( tag != 0x30 ) ) { return result; }
+
+    offset = 0;
+    while ( offset < content.size() )
+    {
+        quint8     childTag = 0;
+        QByteArray childContent;
+        if ( !readDerElement( content, offset, childTag, childContent ) ) { return { }; }
+
+        result.push_back( { childTag, childContent } );
+    }
+
+    return result;
+}
+
+// INTEGER 去掉表示正数的前导 0
+static QByteArray derUnsignedInteger(QByteArray integer)
+{
+    while ( ( integer.size() > 1 ) && !integer.at( 0 ) ) { integer.remove( 0, 1 ); }
+
+    return integer;
+}
+
+// 证书里的公钥（SubjectPublicKeyInfo）：RSA 返回 modulus，EC 返回曲线上的点，其他返回空
+static QByteArray publicKeyMaterial(const QByteArray &subjectPublicKeyInfo, const QSsl::KeyAlgorithm keyAlgorithm)
+{
+    const auto &&elements = derSequenceElements( subjectPublicKeyInfo );
+    if ( ( elements.size() != 2 ) || ( elements[ 1 ].first != 0x03 ) || elements[ 1 ].second.isEmpty() ) { return { }; }
+
+    // BIT STRING 第一个字节是未使用的位数
+    const auto &&publicKey = elements[ 1 ].second.mid( 1 );
+
+    if ( keyAlgorithm == QSsl::Ec ) { return publicKey; }
+    if ( keyAlgorithm != QSsl::Rsa ) { return { }; }
+
+    // RSAPublicKey ::= SEQUENCE { modulus, publicExponent }
+    const auto &&rsaElements = derSequenceElements( publicKey );
+    if ( ( rsaElements.size() != 2 ) || ( rsaElements[ 0 ].first != 0x02 ) ) { return { }; }
+
+    return derUnsignedInteger( rsaElements[ 0 ].second );
+}
+
+// 私钥里带着的公钥：RSA（PKCS#1）返回 modulus，EC（SEC1）返回 [1] 里的点，PKCS#8 先解开，其他返回空
+static QByteArray privateKeyPublicMaterial(const QByteArray &privateKey, const QSsl::KeyAlgorithm keyAlgorithm)
+{
+    const auto &&elements = derSequenceElements( privateKey );
+    if ( elements.size() < 2 ) { return { }; }
+
+    // PrivateKeyInfo ::= SEQUENCE { version, AlgorithmIdentifier, OCTET STRING privateKey }
+    if ( ( elements.size() >= 3 ) && ( elements[ 1 ].first == 0x30 ) && ( elements[ 2 ].first == 0x04 ) )
+    {
+        return privateKeyPublicMaterial( elements[ 2 ].second, keyAlgorithm );
+    }
+
+    if ( keyAlgorithm == QSsl::Rsa )
+    {
+        // RSAPrivateKey ::= SEQUENCE { version, modulus, publicExponent, ... }
+        if ( elements[ 1 ].first != 0x02 ) { return { }; }
+
+        return derUnsignedInteger( elements[ 1 ].second );
+    }
+
+    if ( keyAlgorithm == QSsl::Ec )
+    {
+        // ECPrivateKey ::= SEQUENCE { version, privateKey, [0] parameters OPTIONAL, [1] publicKey OPTIONAL }
+        for ( const auto &element: elements )
+        {
+            if ( element.first != 0xa1 ) { continue; }
+
+            auto       offset = 0;
+            quint8     tag    = 0;
+            QByteArray bitString;
+            if ( !readDerElement( element.second, offset, tag, bitString ) || ( tag != 0x03 ) || bitString.isEmpty() ) { return { }; }
+
+            return bitString.mid( 1 );
+        }
+    }
+
+    return { };
+}
+
+static QSharedPointer< QSslConfiguration > sslConfigurationFromFiles(const QString &crtFilePath, const QString &keyFilePath, QSsl::KeyAlgorithm &keyAlgorithm)
+{
+    QFile crtFile( crtFilePath );
+    if ( !crtFile.open( QIODevice::ReadOnly ) )
+    {
+        qDebug() << "SslServerManage::listen: error: can not open file:" << crtFilePath;
+        return { };
+    }
+
+    QFile keyFile( keyFilePath );
+    if ( !keyFile.open( QIODevice::ReadOnly ) )
+    {
+        qDebug() << "SslServerManage::listen: error: can not open file:" << keyFilePath;
+        return { };
+    }
+
+    const auto &&sslKey = privateKeyFromData( keyFile.readAll(), keyAlgorithm );
+    if ( sslKey.isNull() )
+    {
+        qDebug() << "SslServerManage::listen: error: unsupported private key:" << keyFilePath;
+        return { };
+    }
+
+    QList< QSslCertificate > localCertificateChain;
+    QList< QSslCertificate > caCertificates;
+
+#if ( QT_VERSION >= QT_VERSION_CHECK( 5, 15, 0 ) )
+    localCertificateChain = QSslCertificate::fromPath( crtFilePath );
+#else
+    localCertificateChain.push_back( QSslCertificate( crtFile.readAll(), QSsl::Pem ) );
+#endif
+
+    if ( localCertificateChain.isEmpty() || localCertificateChain.first().isNull() )
+    {
+        qDebug() << "SslServerManage::listen: error: no certificate in file:" << crtFilePath;
+        return { };
+    }
+
+    // 比较证书里的公钥和私钥里带着的公钥，解析不了（例如 DSA）时只比较算法
+    const auto &&certificatePublicKey = localCertificateChain.first().publicKey();
+    auto         isMismatch           = certificatePublicKey.algorithm() != keyAlgorithm;
+    if ( !isMismatch )
+    {
+        const auto &&certificateMaterial = publicKeyMaterial( certificatePublicKey.toDer(), keyAlgorithm );
+        const auto &&keyMaterial         = privateKeyPublicMaterial( sslKey.toDer(), keyAlgorithm );
+
+        isMismatch = !certificateMaterial.isEmpty() && !keyMaterial.isEmpty() && ( certificateMaterial != keyMaterial );
+    }
+
+    if ( isMismatch )
+    {
+        qDebug() << "SslServerManage::listen: error: certificate and private key mismatch:" << crtFilePath << keyFilePath;
+        return { };
+    }
+
+    QSharedPointer< QSslConfiguration > sslConfiguration( new QSslConfiguration );
+    sslConfiguration->setLocalCertificateChain( localCertificateChain );
+    sslConfiguration->setPrivateKey( sslKey );
+    sslConfiguration->setProtocol( QSsl::TlsV1_2OrLater );
+    sslConfiguration->setCaCertificates( caCertificates );
+
+    // QSslSocket 每个连接都新建一个 SSL_CTX，票据密钥和会话缓存都不能跨连接共享，客户端带回来的票据必然解不开
+    // 所以不再签发票据，省掉每次握手后加密和发送票据的开销，连接复用靠 KeepAliveOptions
+    sslConfiguration->setSslOption( QSsl::SslOptionDisableSessionTickets, true );
+#if ( QT_VERSION >= QT_VERSION_CHECK( 5, 15, 0 ) )
+    if ( QSslSocket::sslLibraryVersionString().startsWith( "OpenSSL" ) )
+    {
+        // TLS 1.3 的票据不受 SslOptionDisableSessionTickets 控制
+        sslConfiguration->setBackendConfigurationOption( "NumTickets", QByteArray( "0" ) );
+    }
+#endif
+
+    return sslConfiguration;
+}
+
+enum ClientHelloParseResult
+{
+    ClientHelloIncomplete,
+    ClientHelloParsed,
+    ClientHelloInvalid
+};
+
+// 只解析第一个 TLS 记录里的 ClientHello，取出 SNI 主机名，以及客户端是否支持 ECDSA 签名
+static ClientHelloParseResult parseClientHello(const QByteArray &data, QString &serverName, bool &ecdsaSupported)
+{
+    const auto bytes = reinterpret_cast< const quint8 * >( data.constData() );
+
+    if ( data.size() < 5 ) { return ClientHelloIncomplete; }
+    if ( bytes[ 0 ] != 0x16 ) { return ClientHelloInvalid; } // handshake
+
+    const auto recordLength = ( bytes[ 3 ] << 8 ) | bytes[ 4 ];
+    if ( data.size() < ( 5 + recordLength ) ) { return ClientHelloIncomplete; }
+
+    // 超出记录的部分按不存在处理，ClientHello 跨多个记录时只用第一个记录的内容
+    const auto end = 5 + recordLength;
+    auto       pos = 5;
+
+    const auto readUint16 = [ bytes ](const int offset) { return static_cast< int >( ( bytes[ offset ] << 8 ) | bytes[ offset + 1 ] ); };
+
+    if ( ( ( pos + 4 ) > end ) || ( bytes[ pos ] != 0x01 ) ) { return ClientHelloInvalid; } // client_hello
+    pos += 4 + 2 + 32; // 类型和长度，版本，random
+
+    if ( ( pos + 1 ) > end ) { return ClientHelloInvalid; }
+    pos += 1 + bytes[ pos ]; // session_id
+
+    if ( ( pos + 2 ) > end ) { return ClientHelloInvalid; }
+    pos += 2 + readUint16( pos ); // cipher_suites
+
+    if ( ( pos + 1 ) > end ) { return ClientHelloInvalid; }
+    pos += 1 + bytes[ pos ]; // compression_methods
+
+    // 没有扩展
+    if ( ( pos + 2 ) > end ) { return ClientHelloParsed; }
+
+    const auto extensionsEnd = qMin( end, pos + 2 + readUint16( pos ) );
+    pos += 2;
+
+    while ( ( pos + 4 ) <= extensionsEnd )
+    {
+        const auto extensionType   = readUint16( pos );
+        const auto extensionLength = readUint16( pos + 2 );
+        const auto extensionData   = pos + 4;
+        pos = extensionData + extensionLength;
+
+        if ( pos > extensionsEnd ) { break; }
+
+        if ( ( extensionType == 0x0000 ) && ( extensionLength >= 5 ) ) // server_name
+        {
+            // 只取第一个 host_name
+            const auto nameLength = readUint16( extensionData + 3 );
+            if ( ( bytes[ extensionData + 2 ] == 0 ) && ( ( extensionData + 5 + nameLength ) <= pos ) )
+            {
+                serverName = QString::fromLatin1( data.mid( extensionData + 5, nameLength ) ).toLower();
+            }
+        }
+        else if ( ( extensionType == 0x000d ) && ( extensionLength >= 2 ) ) // signature_algorithms
+        {
+            // TLS 1.2 的 (hash, ecdsa) 和 TLS 1.3 的 ecdsa_secp*_sha* 低字节都是 0x03
+            const auto listEnd = qMin( pos, extensionData + 2 + readUint16( extensionData ) );
+            for ( auto offset = extensionData + 2; ( offset + 2 ) <= listEnd; offset += 2 )
+            {
+                if ( ( bytes[ offset + 1 ] == 0x03 ) && ( bytes[ offset ] >= 0x02 ) && ( bytes[ offset ] <= 0x06 ) )
+                {
+                    ecdsaSupported = true;
+                }
+            }
+        }
+    }
+
+    return ClientHelloParsed;
+}
+
+static bool hostNameMatches(const QString &hostName, const QString &serverName)
+{
+    if ( hostName.startsWith( "*." ) )
+    {
+        // 通配符只匹配一级
+        const auto suffix = hostName.mid( 1 ).toLower();
+        return serverName.endsWith( suffix ) && ( serverName.size() > suffix.size() ) && !serverName.left( serverName.size() - suffix.size() ).contains( '.' );
+    }
+
+    return hostName.toLower() == serverName;
+}
+
+JQHttpServer::SslServerManage::SslServerManage(const int handleMaxThreadCount):
+    AbstractManage( handleMaxThreadCount )
+{ }
+
+JQHttpServer::SslServerManage::~SslServerManage()
+{
+    if ( this->isRunning() )
+    {
+        this->deinitialize();
+    }
+}
+
+bool JQHttpServer::SslServerManage::listen(
+    const QHostAddress &address,
+    const quint16       port,
+    const QString &     crtFilePath,
+    const QString &     keyFilePath )
+{
+    return this->listen( QList< ListenEndpoint >( { ListenEndpoint( address, port ) } ), crtFilePath, keyFilePath );
+}
+
+bool JQHttpServer::SslServerManage::listen(
+    const QList< ListenEndpoint > &listenEndpoints,
+    const QString &                crtFilePath,
+    const QString &                keyFilePath )
+{
+    ServerCertificate certificate;
+    certificate.crtFilePath = crtFilePath;
+    certificate.keyFilePath = keyFilePath;
+
+    return this->listen( listenEndpoints, QList< ServerCertificate >( { certificate } ) );
+}
+
+bool JQHttpServer::SslServerManage::listen(
+    const QList< ListenEndpoint > &   listenEndpoints,
+    const QList< ServerCertificate > &certificates )
+{
+    if ( listenEndpoints.isEmpty() )
+    {
+        qDebug() << "SslServerManage::listen: error: no listen endpoint";
+        return false;
+    }
+
+    for ( const auto &listenEndpoint: listenEndpoints )
+    {
+        if ( ( listenEndpoint.socketDescriptor < 0 ) && !listenEndpoint.localServerName.isEmpty() )
+        {
+            qDebug() << "SslServerManage::listen: error: local server not supported:" << listenEndpoint.localServerName;
+            return false;
+        }
+    }
+
+    if ( certificates.isEmpty() )
+    {
+        qDebug() << "SslServerManage::listen: error: no certificate";
+        return false;
+    }
+
+    QList< CertificateContext > certificateContexts;
+
+    for ( const auto &certificate: certificates )
+    {
+        CertificateContext certificateContext;
+        certificateContext.certificate      = certificate;
+        certificateContext.sslConfiguration = sslConfigurationFromFiles( certificate.crtFilePath, certificate.keyFilePath, certificateContext.keyAlgorithm );
+
+        if ( !certificateContext.sslConfiguration ) { return false; }
+
+        certificateContexts.push_back( certificateContext );
+    }
+
+    listenEndpoints_ = listenEndpoints;
+
+    mutex_.lock();
+    certificates_ = certificateContexts;
+    mutex_.unlock();
+
+    if ( !this->initialize() ) { return false; }
+
+    if ( watchCertificateFiles_ ) { this->startCertificateWatcher(); }
+
+    return true;
+}
+
+bool JQHttpServer::SslServerManage::reloadCertificates()
+{
+    QList< ServerCertificate > certificates;
+
+    mutex_.lock();
+
+    for ( const auto &certificateContext: certificates_ )
+    {
+        certificates.push_back( certificateContext.certificate );
+    }
+
+    mutex_.unlock();
+
+    return this->reloadCertificates( certificates );
+}
+
+bool JQHttpServer::SslServerManage::reloadCertificates(const QList< ServerCertificate > &certificates)
+{
+    if ( certificates.isEmpty() )
+    {
+        qDebug() << "SslServerManage::reloadCertificates: error: no certificate";
+        return false;
+    }
+
+    // 全部读取成功后再替换，不会出现一部分新证书一部分旧证书
+    QList< CertificateContext > certificateContexts;
+
+    for ( const auto &certificate: certificates )
+    {
+        CertificateContext certificateContext;
+        certificateContext.certificate      = certificate;
+        certificateContext.sslConfiguration = sslConfigurationFromFiles( certificate.crtFilePath, certificate.keyFilePath, certificateContext.keyAlgorithm );
+
+        if ( !certificateContext.sslConfiguration )
+        {
+            mutex_.lock();
+            ++certificateReloadFailedCount_;
+            mutex_.unlock();
+
+            return false;
+        }
+
+        certificateContexts.push_back( certificateContext );
+    }
+
+    mutex_.lock();
+
+    certificates_ = certificateContexts;
+    ++certificateReloadCount_;
+    lastCertificateReloadTime_ = QDateTime::currentMSecsSinceEpoch();
+
+    mutex_.unlock();
+
+    // 文件列表可能变了
+    if ( certificateWatcher_ )
+    {
+        QMetaObject::invokeMethod( this, [ this ]() { this->startCertificateWatcher(); }, Qt::QueuedConnection );
+    }
+
+    return true;
+}
+
+void JQHttpServer::SslServerManage::setPeerVerifyMode(const QSslSocket::PeerVerifyMode peerVerifyMode)
+{
+    mutex_.lock();
+    peerVerifyMode_ = peerVerifyMode;
+    mutex_.unlock();
+}
+
+QSslSocket::PeerVerifyMode JQHttpServer::SslServerManage::peerVerifyMode()
+{
+    QMutexLocker locker( &mutex_ );
+
+    return peerVerifyMode_;
+}
+
+void JQHttpServer::SslServerManage::startCertificateWatcher()
+{
+    if ( !certificateWatcher_ )
+    {
+        certificateWatcher_ = new QFileSystemWatcher( this );
+
+        auto reloadTimer = new QTimer( certificateWatcher_ );
+        reloadTimer->setSingleShot( true );
+        reloadTimer->setInterval( 1000 );
+
+        // 证书和私钥通常先后写入，等一会再一起读取
+        const auto onChanged = [ this, reloadTimer ]()
+        {
+            reloadTimer->start();
+        };
+
+        connect( certificateWatcher_.data(), &QFileSystemWatcher::fileChanged, reloadTimer, onChanged );
+        connect( certificateWatcher_.data(), &QFileSystemWatcher::directoryChanged, reloadTimer, onChanged );
+        connect( reloadTimer, &QTimer::timeout, this, [ this ]()
+        {
+            if ( !this->isRunning() ) { return; }
+
+            // 成功时 reloadCertificates 会重新添加监视，文件被替换（rename）后原来的监视就失效了
+            if ( !this->reloadCertificates() )
+            {
+                qDebug() << "SslServerManage::startCertificateWatcher: error: reload failed";
+                this->startCertificateWatcher();
+            }
+        } );
+    }
+
+    QStringList filePaths;
+
+    mutex_.lock();
+
+    for ( const auto &certificateContext: certificates_ )
+    {
+        filePaths.push_back( certificateContext.certificate.crtFilePath );
+        filePaths.push_back( certificateContext.certificate.keyFilePath );
+    }
+
+    mutex_.unlock();
+
+    QStringList watchPaths;
+
+    for ( const auto &filePath: filePaths )
+    {
+        if ( filePath.startsWith( ":" ) || filePath.startsWith( "qrc:" ) ) { continue; }
+
+        // 同时监视所在目录，文件在替换的瞬间不存在时也能收到通知
+        const QFileInfo fileInfo( filePath );
+        watchPaths.push_back( fileInfo.absoluteFilePath() );
+        watchPaths.push_back( fileInfo.absolutePath() );
+    }
+
+    watchPaths.removeDuplicates();
+
+    if ( !certificateWatcher_->files().isEmpty() ) { certificateWatcher_->removePaths( certificateWatcher_->files() ); }
+    if ( !certificateWatcher_->directories().isEmpty() ) { certificateWatcher_->removePaths( certificateWatcher_->directories() ); }
+
+    for ( const auto &watchPath: watchPaths )
+    {
+        if ( QFileInfo::exists( watchPath ) ) { certificateWatcher_->addPath( watchPath ); }
+    }
+}
+
+bool JQHttpServer::SslServerManage::isRunning()
+{
+    mutex_.lock();
+
+    const auto isRunning = !tcpServers_.isEmpty();
+
+    mutex_.unlock();
+
+    return isRunning;
+}
+
+bool JQHttpServer::SslServerManage::onStart()
+{
+    mutex_.lock();
+
+    handshakeClosing_  = false;
+    acceptPaused_      = false;
+    handshakeInFlight_ = 0; // closeServers 直接关闭的连接不会减少计数
+    handshakeElapsedTimer_.start();
+    handshakeRateWindowStart_ = 0;
+
+    mutex_.unlock();
+
+    // 握手的加解密很耗 CPU，放到单独的线程里，避免新连接的突发拖慢服务线程上已有连接的读写
+    for ( auto index = 0; index < handshakeOptions_.threadCount; ++index )
+    {
+        QSharedPointer< QThread > handshakeThread( new QThread );
+        handshakeThread->setObjectName( QString( "JQHttpServerHandshake%1" ).arg( index ) );
+        handshakeThread->start();
+
+        handshakeThreads_.push_back( handshakeThread );
+    }
+
+    for ( const auto &listenEndpoint: listenEndpoints_ )
+    {
+        auto tcpServer = new SslServerHelper;
+
+        mutex_.lock();
+        tcpServers_.push_back( tcpServer );
+        mutex_.unlock();
+
+        const QPointer< SslServerHelper > tcpServerPointer( tcpServer );
+        tcpServer->onIncomingConnectionCallback_ = [ this, tcpServerPointer ](qintptr socketDescriptor)
+        {
+            this->onConnectionAccepted( socketDescriptor, tcpServerPointer->socketDescriptor() );
+            this->selectCertificate( socketDescriptor, tcpServerPointer );
+        };
+
+        if ( !this->listenTcpServer( tcpServer, listenEndpoint ) )
+        {
+            this->closeServers();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void JQHttpServer::SslServerManage::onFinish()
+{
+    this->closeServers();
+}
+
+void JQHttpServer::SslServerManage::onStopAccepting()
+{
+    this->mutex_.lock();
+
+    const auto tcpServers = tcpServers_;
+
+    this->mutex_.unlock();
+
+    for ( const auto &tcpServer: tcpServers )
+    {
+        invokeInObjectThread( tcpServer.data(), [ tcpServer ]() { if ( tcpServer ) { tcpServer->close(); } } );
+    }
+}
+
+void JQHttpServer::SslServerManage::closeServers()
+{
+    this->mutex_.lock();
+
+    listenSocketDescriptors_.clear();
+
+    const auto tcpServers = tcpServers_;
+    tcpServers_.clear();
+
+    handshakeClosing_ = true;
+
+    const auto handshakingSockets = handshakingSockets_;
+    handshakingSockets_.clear();
+
+    const auto clientHelloNotifiers = clientHelloNotifiers_;
+    clientHelloNotifiers_.clear();
+
+    this->mutex_.unlock();
+
+    // 还在等 ClientHello 的连接没有 socket 对象，直接关闭描述符
+    for ( const auto &notifier: clientHelloNotifiers )
+    {
+        invokeInObjectThread( notifier, [ notifier ]()
+        {
+            notifier->setEnabled( false );
+#ifdef Q_OS_UNIX
+            ::close( static_cast< int >( notifier->socket() ) );
+#endif
+            delete notifier;
+        } );
+    }
+
+    for ( const auto &tcpServer: tcpServers )
+    {
+        if ( !tcpServer ) { continue; }
+
+        tcpServer->close();
+        delete tcpServer.data();
+    }
+
+    // 还在握手的连接直接断开，在 socket 所在的线程删除
+    for ( const auto &sslSocket: handshakingSockets )
+    {
+        invokeInObjectThread( sslSocket, [ sslSocket ]()
+        {
+            QObject::disconnect( sslSocket, nullptr, sslSocket, nullptr );
+            sslSocket->abort();
+            delete sslSocket;
+        } );
+    }
+
+    for ( const auto &handshakeThread: handshakeThreads_ )
+    {
+        handshakeThread->quit();
+        handshakeThread->wait();
+    }
+    handshakeThreads_.clear();
+
+    this->closeHttp2Connections();
+    this->closeWebSockets();
+}
+
+void JQHttpServer::SslServerManage::selectCertificate(const qintptr socketDescriptor, const QPointer< SslServerHelper > &tcpServer)
+{
+    this->increaseHandshakeInFlight();
+
+#ifdef Q_OS_UNIX
+    mutex_.lock();
+    const auto certificateCount = certificates_.size();
+    mutex_.unlock();
+
+    if ( certificateCount > 1 )
+    {
+        auto notifier = new QSocketNotifier( socketDescriptor, QSocketNotifier::Read );
+        auto timer    = new QTimer( notifier );
+
+        mutex_.lock();
+        clientHelloNotifiers_.insert( notifier );
+        mutex_.unlock();
+
+        // 返回 false 表示已经被 closeServers 接管
+        // 描述符接下来交给 QSslSocket，通知要先停掉，不然 deleteLater 之前还会在同一个描述符上触发
+        const auto takeNotifier = [ this, notifier ]()
+        {
+            mutex_.lock();
+            const auto removed = clientHelloNotifiers_.remove( notifier );
+            mutex_.unlock();
+
+            if ( removed )
+            {
+                notifier->setEnabled( false );
+                notifier->deleteLater();
+            }
+
+            return removed;
+        };
+
+        QObject::connect( timer, &QTimer::timeout, notifier, [ this, socketDescriptor, tcpServer, takeNotifier ]()
+        {
+            if ( !takeNotifier() ) { return; }
+
+            mutex_.lock();
+            ++clientHelloTimeoutCount_;
+            mutex_.unlock();
+
+            ::close( static_cast< int >( socketDescriptor ) );
+
+            this->decreaseHandshakeInFlight( tcpServer );
+        } );
+
+        // 设置过的 SO_RCVLOWAT，0 表示没有设置
+        const auto receiveLowWatermark = QSharedPointer< int >::create( 0 );
+
+        QObject::connect( notifier, &QSocketNotifier::activated, notifier, [ this, notifier, socketDescriptor, tcpServer, takeNotifier, receiveLowWatermark ]()
+        {
+            // 一个 TLS 记录最大 16K，ClientHello 一般在第一个记录里
+            static const int clientHelloMaxSize = 5 + 16 * 1024;
+
+            QByteArray buffer( clientHelloMaxSize, Qt::Uninitialized );
+
+            const auto received = ::recv( static_cast< int >( socketDescriptor ), buffer.data(), static_cast< size_t >( buffer.size() ), MSG_PEEK | MSG_DONTWAIT );
+            if ( ( received < 0 ) && ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) ) ) { return; }
+
+            // 对端关闭写方向后不管 SO_RCVLOWAT 都会通知，这时数据不会再增加
+            if ( ( received <= 0 ) || ( received < *receiveLowWatermark ) )
+            {
+                if ( takeNotifier() )
+                {
+                    ::close( static_cast< int >( socketDescriptor ) );
+                    this->decreaseHandshakeInFlight( tcpServer );
+                }
+                return;
+            }
+
+            buffer.resize( static_cast< int >( received ) );
+
+            QString serverName;
+            bool    ecdsaSupported = false;
+
+            const auto parseResult = parseClientHello( buffer, serverName, ecdsaSupported );
+            if ( parseResult == ClientHelloIncomplete )
+            {
+                // 数据还在内核缓冲区里，通知会一直触发，把 SO_RCVLOWAT 设成比现在多一个字节，有新数据到了才再通知
+                const int lowWatermark = static_cast< int >( received ) + 1;
+                if ( ( received < clientHelloMaxSize ) &&
+                     !setsockopt( static_cast< int >( socketDescriptor ), SOL_SOCKET, SO_RCVLOWAT, &lowWatermark, sizeof( lowWatermark ) ) )
+                {
+                    *receiveLowWatermark = lowWatermark;
+                    return;
+                }
+
+                // 超过一个记录还不完整，或者不支持 SO_RCVLOWAT，不再等待，用默认证书握手
+                serverName.clear();
+                ecdsaSupported = false;
+            }
+
+            if ( !takeNotifier() ) { return; }
+
+            // QSslSocket 按可读通知读取数据，恢复成默认值
+            if ( *receiveLowWatermark > 0 )
+            {
+                const int lowWatermark = 1;
+                setsockopt( static_cast< int >( socketDescriptor ), SOL_SOCKET, SO_RCVLOWAT, &lowWatermark, sizeof( lowWatermark ) );
+            }
+
+            // 不是 TLS 的数据交给 QSslSocket 去报错断开
+            this->startHandshake( socketDescriptor, tcpServer, this->sslConfigurationFor( serverName, ecdsaSupported ) );
+        } );
+
+        // 握手不限时（timeout <= 0）也要限制等待 ClientHello 的时间，不然不发数据的连接会一直占着描述符
+        timer->setSingleShot( true );
+        timer->start( ( handshakeOptions_.timeout > 0 ) ? ( handshakeOptions_.timeout ) : ( HandshakeOptions().timeout ) );
+
+        return;
+    }
+#endif
+
+    this->startHandshake( socketDescriptor, tcpServer, this->sslConfigurationFor( { }, false ) );
+}
+
+QSharedPointer< QSslConfiguration > JQHttpServer::SslServerManage::sslConfigurationFor(const QString &serverName, const bool ecdsaSupported)
+{
+    // reloadCertificates 会在其他线程替换证书
+    QMutexLocker locker( &mutex_ );
+
+    QList< int > candidates;
+
+    if ( !serverName.isEmpty() )
+    {
+        for ( auto index = 0; index < certificates_.size(); ++index )
+        {
+            for ( const auto &hostName: certificates_[ index ].certificate.hostNames )
+            {
+                if ( hostNameMatches( hostName, serverName ) )
+                {
+                    candidates.push_back( index );
+                    break;
+                }
+            }
+        }
+    }
+
+    // 没有匹配的主机名时使用没有配置主机名的证书，都配置了就用第一个
+    if ( candidates.isEmpty() )
+    {
+        for ( auto index = 0; index < certificates_.size(); ++index )
+        {
+            if ( certificates_[ index ].certificate.hostNames.isEmpty() ) { candidates.push_back( index ); }
+        }
+    }
+
+    if ( candidates.isEmpty() ) { candidates.push_back( 0 ); }
+
+    // EC 证书的握手比 RSA 快得多，客户端支持时优先
+    auto selected = candidates.first();
+    for ( const auto &index: candidates )
+    {
+        if ( ( certificates_[ index ].keyAlgorithm == QSsl::Ec ) == ecdsaSupported )
+        {
+            selected = index;
+            break;
+        }
+    }
+
+    ++certificates_[ selected ].selectedCount;
+
+    return certificates_[ selected ].sslConfiguration;
+}
+
+void JQHttpServer::SslServerManage::startHandshake(const qintptr socketDescriptor, const QPointer< SslServerHelper > &tcpServer, const QSharedPointer< QSslConfiguration > &sslConfiguration)
+{
+    auto sslSocket      = new QSslSocket;
+    auto handshakeTimer = new QTimer( sslSocket );
+    const auto serverThread = QThread::currentThread();
+    const auto startTime    = handshakeElapsedTimer_.elapsed();
+
+    sslSocket->setSslConfiguration( *sslConfiguration );
+    handshakeTimer->setSingleShot( true );
+
+    if ( http2Options_.enabled )
+    {
+        // 通过 ALPN 协商 HTTP/2，不支持的客户端继续使用 HTTP/1.1
+        auto configuration = sslSocket->sslConfiguration();
+        configuration.setAllowedNextProtocols( { QSslConfiguration::ALPNProtocolHTTP2, QSslConfiguration::NextProtocolHttp1_1 } );
+        sslSocket->setSslConfiguration( configuration );
+    }
+
+    QThread *handshakeThread = nullptr;
+
+    mutex_.lock();
+
+    sslSocket->setPeerVerifyMode( peerVerifyMode_ );
+
+    if ( !handshakeThreads_.isEmpty() )
+    {
+        handshakeThread = handshakeThreads_[ handshakeThreadIndex_ ].data();
+        handshakeThreadIndex_ = ( handshakeThreadIndex_ + 1 ) % handshakeThreads_.size();
+    }
+
+    handshakingSockets_.insert( sslSocket );
+
+    mutex_.unlock();
+
+    // 超时后 abort 会收到 UnconnectedState，由 onHandshakeFailed 统计
+    const auto timedOut = QSharedPointer< bool >::create( false );
+
+    QObject::connect( handshakeTimer, &QTimer::timeout, sslSocket, [ sslSocket, timedOut ]()
+    {
+        *timedOut = true;
+        sslSocket->abort();
+    } );
+
+    const std::function< void() > onHandshakeFailed = [ this, sslSocket, handshakeTimer, startTime, tcpServer, timedOut ]()
+    {
+        QObject::disconnect( sslSocket, nullptr, sslSocket, nullptr );
+        handshakeTimer->stop();
+
+        mutex_.lock();
+        const auto removed = handshakingSockets_.remove( sslSocket );
+        mutex_.unlock();
+
+        // 已经被 closeServers 接管
+        if ( !removed ) { return; }
+
+        sslSocket->deleteLater();
+
+        this->onHandshakeFinished( false, *timedOut, handshakeElapsedTimer_.elapsed() - startTime, tcpServer );
+    };
+
+    QObject::connect( sslSocket, &QAbstractSocket::stateChanged, sslSocket, [ onHandshakeFailed ](const QAbstractSocket::SocketState &socketState)
+    {
+        if ( socketState == QAbstractSocket::UnconnectedState ) { onHandshakeFailed(); }
+    } );
+
+    QObject::connect( sslSocket, &QSslSocket::encrypted, sslSocket, [ this, sslSocket, handshakeTimer, serverThread, startTime, tcpServer ]()
+    {
+        QObject::disconnect( sslSocket, nullptr, sslSocket, nullptr );
+        delete handshakeTimer;
+
+        mutex_.lock();
+        const auto removed = handshakingSockets_.remove( sslSocket );
+        mutex_.unlock();
+
+        if ( !removed ) { return; }
+
+        this->onHandshakeFinished( true, false, handshakeElapsedTimer_.elapsed() - startTime, tcpServer );
+
+        if ( sslSocket->thread() == serverThread )
+        {
+            this->onEncrypted( sslSocket );
+            return;
+        }
+
+        // 正在 encrypted 信号里，不能马上切换线程，下一轮事件循环再移回服务线程
+        QMetaObject::invokeMethod( sslSocket, [ this, sslSocket, serverThread ]()
+        {
+            sslSocket->moveToThread( serverThread );
+
+            QMetaObject::invokeMethod( sslSocket, [ this, sslSocket ]()
+            {
+                if ( !this->isRunning() || ( sslSocket->state() != QAbstractSocket::ConnectedState ) )
+                {
+                    sslSocket->deleteLater();
+                    return;
+                }
+
+                this->onEncrypted( sslSocket );
+
+                // 切换线程期间收到的数据已经在 socket 的缓冲区里，不会再有 readyRead
+                if ( sslSocket->bytesAvailable() ) { emit sslSocket->readyRead(); }
+            }, Qt::QueuedConnection );
+        }, Qt::QueuedConnection );
+    } );
+
+    // QObject::connect(
+    //     sslSocket,
+    //     static_cast< void(QSslSocket::*)(const QList<QSslError> &errors) >(&QSslSocket::sslErrors),
+    //     [](const QList<QSslError> &errors)
+    //     {
+    //         qDebug() << "sslErrors:" << errors;
+    //     } );
+
+    const auto handshakeTimeout = handshakeOptions_.timeout;
+    const auto beginHandshake   = [ sslSocket, handshakeTimer, socketDescriptor, handshakeTimeout, onHandshakeFailed ]()
+    {
+        if ( !sslSocket->setSocketDescriptor( socketDescriptor ) )
+        {
+            qDebug() << "SslServerManage::startHandshake: error:" << sslSocket->errorString();
+            onHandshakeFailed();
+            return;
+        }
+
+        if ( handshakeTimeout > 0 ) { handshakeTimer->start( handshakeTimeout ); }
+
+        sslSocket->startServerEncryption();
+    };
+
+    if ( !handshakeThread )
+    {
+        beginHandshake();
+        return;
+    }
+
+    // 还没有设置描述符，整个 socket（包括定时器）可以直接移到握手线程
+    sslSocket->moveToThread( handshakeThread );
+    QMetaObject::invokeMethod( sslSocket, beginHandshake, Qt::QueuedConnection );
+}
+
+void JQHttpServer::SslServerManage::onEncrypted(QSslSocket *sslSocket)
+{
+    if ( http2Options_.enabled && ( sslSocket->sslConfiguration().nextNegotiatedProtocol() == QSslConfiguration::ALPNProtocolHTTP2 ) )
+    {
+        this->newHttp2Connection( sslSocket, sslSocket->readAll() );
+        return;
+    }
+
+    this->newSession( new Session( sslSocket ) );
+}
+
+void JQHttpServer::SslServerManage::increaseHandshakeInFlight()
+{
+    mutex_.lock();
+
+    ++handshakeInFlight_;
+    maxHandshakeInFlight_ = qMax( maxHandshakeInFlight_, handshakeInFlight_ );
+
+    // 进行中的握手太多时暂停 accept，避免握手排队太久全部超时
+    const auto needPause = ( handshakeOptions_.maxInFlight > 0 ) && ( handshakeInFlight_ >= handshakeOptions_.maxInFlight ) && !acceptPaused_;
+    if ( needPause )
+    {
+        acceptPaused_ = true;
+        ++acceptPauseCount_;
+    }
+
+    const auto tcpServers = tcpServers_;
+
+    mutex_.unlock();
+
+    if ( !needPause ) { return; }
+
+    for ( const auto &pausedTcpServer: tcpServers )
+    {
+        if ( pausedTcpServer && pausedTcpServer->isListening() ) { pausedTcpServer->pauseAccepting(); }
+    }
+}
+
+void JQHttpServer::SslServerManage::decreaseHandshakeInFlight(const QPointer< SslServerHelper > &tcpServer)
+{
+    mutex_.lock();
+
+    --handshakeInFlight_;
+
+    // 降到上限的一半以下再恢复，避免在上限附近反复暂停和恢复
+    const auto needResume = acceptPaused_ && ( handshakeInFlight_ <= ( handshakeOptions_.maxInFlight / 2 ) );
+    if ( needResume ) { acceptPaused_ = false; }
+
+    mutex_.unlock();
+
+    if ( !needResume || !tcpServer ) { return; }
+
+    QMetaObject::invokeMethod( tcpServer.data(), [ this ]()
+    {
+        this->mutex_.lock();
+
+        const auto tcpServers = tcpServers_;
+        const auto stillResumed = !acceptPaused_;
+
+        this->mutex_.unlock();
+
+        if ( !stillResumed ) { return; }
+
+        for ( const auto &resumedTcpServer: tcpServers )
+        {
+            if ( resumedTcpServer && resumedTcpServer->isListening() ) { resumedTcpServer->resumeAccepting(); }
+        }
+    }, Qt::QueuedConnection );
+}
+
+void JQHttpServer::SslServerManage::onHandshakeFinished(const bool succeed, const bool timedOut, const qint64 latency, const QPointer< SslServerHelper > &tcpServer)
+{
+    static const qint64 handshakeRateWindowInterval = 1000;
+
+    mutex_.lock();
+
+    if ( succeed )
+    {
+        ++handshakeSucceedCount_;
+        handshakeLatencySum_ += latency;
+        maxHandshakeLatency_ = qMax( maxHandshakeLatency_, latency );
+    }
+    else if ( timedOut )
+    {
+        ++handshakeTimeoutCount_;
+    }
+    else
+    {
+        ++handshakeFailedCount_;
+    }
+
+    ++handshakeRateWindowCount_;
+
+    const auto currentTime = handshakeElapsedTimer_.elapsed();
+    const auto windowTime  = currentTime - handshakeRateWindowStart_;
+    if ( windowTime >= handshakeRateWindowInterval )
+    {
+        lastHandshakeRate_        = static_cast< double >( handshakeRateWindowCount_ ) * 1000 / windowTime;
+        handshakeRateWindowStart_ = currentTime;
+        handshakeRateWindowCount_ = 0;
+    }
+
+    mutex_.unlock();
+
+    this->decreaseHandshakeInFlight( tcpServer );
+}
+
+QJsonObject JQHttpServer::SslServerManage::status()
+{
+    auto result = AbstractManage::status();
+
+    QJsonObject handshake;
+
+    mutex_.lock();
+
+    handshake[ "threadCount" ]          = handshakeOptions_.threadCount;
+    handshake[ "maxInFlight" ]          = handshakeOptions_.maxInFlight;
+    handshake[ "timeout" ]              = handshakeOptions_.timeout;
+    handshake[ "inFlight" ]             = handshakeInFlight_;
+    handshake[ "maxInFlightReached" ]   = maxHandshakeInFlight_;
+    handshake[ "succeedCount" ]         = static_cast< double >( handshakeSucceedCount_ );
+    handshake[ "failedCount" ]          = static_cast< double >( handshakeFailedCount_ );
+    handshake[ "timeoutCount" ]         = static_cast< double >( handshakeTimeoutCount_ );
+    handshake[ "acceptPaused" ]         = acceptPaused_;
+    handshake[ "acceptPauseCount" ]     = static_cast< double >( acceptPauseCount_ );
+    handshake[ "averageLatency" ]       = ( handshakeSucceedCount_ ) ? ( static_cast< double >( handshakeLatencySum_ ) / handshakeSucceedCount_ ) : ( 0 );
+    handshake[ "maxLatency" ]           = static_cast< double >( maxHandshakeLatency_ );
+    handshake[ "rate" ]                 = lastHandshakeRate_;
+
+    // 每次握手平均处理的请求数，开启长连接后大于 1
+    handshake[ "clientHelloTimeoutCount" ] = static_cast< double >( clientHelloTimeoutCount_ );
+    handshake[ "requestsPerHandshake" ] = ( handshakeSucceedCount_ ) ? ( static_cast< double >( handshakeSucceedCount_ + keepAliveRequestCount_.loadAcquire() ) / handshakeSucceedCount_ ) : ( 0 );
+
+    mutex_.unlock();
+
+    result[ "handshake" ] = handshake;
+
+    QJsonArray certificates;
+
+    mutex_.lock();
+
+    for ( const auto &certificateContext: certificates_ )
+    {
+        QJsonObject certificate;
+
+        certificate[ "crtFilePath" ]   = certificateContext.certificate.crtFilePath;
+        certificate[ "hostNames" ]     = QJsonArray::fromStringList( certificateContext.certificate.hostNames );
+        certificate[ "keyAlgorithm" ]  = ( certificateContext.keyAlgorithm == QSsl::Ec ) ? ( "ec" ) : ( ( certificateContext.keyAlgorithm == QSsl::Dsa ) ? ( "dsa" ) : ( "rsa" ) );
+        certificate[ "selectedCount" ] = static_cast< double >( certificateContext.selectedCount );
+
+        certificates.push_back( certificate );
+    }
+
+    mutex_.unlock();
+
+    result[ "certificates" ] = certificates;
+
+    QJsonObject certificateReload;
+
+    mutex_.lock();
+
+    certificateReload[ "watchCertificateFiles" ] = watchCertificateFiles_;
+    certificateReload[ "reloadCount" ]           = static_cast< double >( certificateReloadCount_ );
+    certificateReload[ "reloadFailedCount" ]     = static_cast< double >( certificateReloadFailedCount_ );
+    certificateReload[ "lastReloadTime" ]        = static_cast< double >( lastCertificateReloadTime_ );
+
+    mutex_.unlock();
+
+    result[ "certificateReload" ] = certificateReload;
+
+    return result;
+}
+
+// Service
+// 格式："80"、"0.0.0.0:80"、"[::]:80"、"unix:/run/app.sock"、"fd:3"
+static bool listenEndpointFromString(const QString &source, JQHttpServer::ListenEndpoint &listenEndpoint)
+{
+    if ( source.startsWith( "fd:" ) )
+    {
+        auto       ok               = false;
+        const auto socketDescriptor = source.mid( 3 ).toInt( &ok );
+
+        listenEndpoint = JQHttpServer::ListenEndpoint::fromSocketDescriptor( socketDescriptor );
+        return ok && ( socketDescriptor >= 0 );
+    }
+
+    if ( source.startsWith( "unix:" ) )
+    {
+        listenEndpoint = JQHttpServer::ListenEndpoint( source.mid( 5 ) );
+        return !listenEndpoint.localServerName.isEmpty();
+    }
+
+    const auto portIndex = source.lastIndexOf( ':' );
+    auto       host      = ( portIndex >= 0 ) ? ( source.left( portIndex ) ) : ( QString() );
+    auto       ok        = false;
+    const auto port      = source.mid( portIndex + 1 ).toUShort( &ok );
+    if ( !ok || !port ) { return false; }
+
+    if ( host.startsWith( '[' ) && host.endsWith( ']' ) ) { host = host.mid( 1, host.size() - 2 ); }
+
+    QHostAddress address = QHostAddress::Any;
+    if ( !host.isEmpty() && !address.setAddress( host ) ) { return false; }
+
+    listenEndpoint = JQHttpServer::ListenEndpoint( address, port );
+
+    return true;
+}
+
+// 旧进程还在运行时接管它的 TCP 监听 socket，Unix domain socket 仍然按配置重新 listen
+// 旧进程要等每个 manager 都交接完才退出，所以新配置里去掉的 http / https 也要接过来，然后关闭
+static void inheritListenEndpoints(const QString &handoffServerName, QList< JQHttpServer::ListenEndpoint > &listenEndpoints)
+{
+    const auto &&inheritedListenEndpoints = JQHttpServer::AbstractManage::receiveListenSockets( handoffServerName );
+    if ( inheritedListenEndpoints.isEmpty() ) { return; }
+
+    if ( listenEndpoints.isEmpty() )
+    {
+#ifdef Q_OS_UNIX
+        for ( const auto &listenEndpoint: inheritedListenEndpoints )
+        {
+            close( static_cast< int >( listenEndpoint.socketDescriptor ) );
+        }
+#endif
+        return;
+    }
 
-    tcpServer_->onIncomingConnectionCallback_ = [ this ](qintptr socketDescriptor)
+    auto result = inheritedListenEndpoints;
+    for ( const auto &listenEndpoint: listenEndpoints )
     {
-        auto sslSocket = new QSslSocket;
-
-        sslSocket->setSslConfiguration( *sslConfiguration_ );
+        if ( JQHttpServer::AbstractManage::isLocalListenEndpoint( listenEndpoint ) ) { result.push_back( listenEndpoint ); }
+    }
 
-        QObject::connect(
-            sslSocket,
-            &QSslSocket::encrypted,
-            sslSocket,
-            [ this, sslSocket ]()
-            {
-                this->newSession( new Session( sslSocket ) );
-            } );
+    listenEndpoints = result;
+}
 
-        // QObject::connect(
-        //     sslSocket,
-        //     static_cast< void(QSslSocket::*)(const QList<QSslError> &errors) >(&QSslSocket::sslErrors),
-        //     [](const QList<QSslError> &errors)
-        //     {
-        //         qDebug() << "sslErrors:" << errors;
-        //     } );
+static bool listenEndpointsFromConfig(
+    const QMap< JQHttpServer::ServiceConfigEnum, QVariant > &config,
+    const JQHttpServer::ServiceConfigEnum                    endpointsConfig,
+    const JQHttpServer::ServiceConfigEnum                    portConfig,
+    QList< JQHttpServer::ListenEndpoint > &                  listenEndpoints )
+{
+    if ( !config.contains( endpointsConfig ) )
+    {
+        const auto port = static_cast< quint16 >( config[ portConfig ].toInt() );
+        if ( port > 0 ) { listenEndpoints.push_back( JQHttpServer::ListenEndpoint( QHostAddress::Any, port ) ); }
 
-        sslSocket->setSocketDescriptor( socketDescriptor );
-        sslSocket->startServerEncryption();
-    };
+        return true;
+    }
 
-    if ( !tcpServer_->listen( listenAddress_, listenPort_ ) )
+    for ( const auto &source: config[ endpointsConfig ].toStringList() )
     {
-        mutex_.lock();
+        // "systemd" 或者 "systemd:name"，没有对应的 socket 时视为配置错误
+        if ( ( source == "systemd" ) || source.startsWith( "systemd:" ) )
+        {
+            const auto &&systemdListenEndpoints = JQHttpServer::AbstractManage::systemdListenEndpoints( source.mid( 8 ) );
+            if ( systemdListenEndpoints.isEmpty() )
+            {
+                qWarning() << "JQHttpServer::Service: no systemd listen socket:" << source;
+                return false;
+            }
 
-        delete tcpServer_.data();
-        tcpServer_.clear();
+            listenEndpoints += systemdListenEndpoints;
+            continue;
+        }
 
-        mutex_.unlock();
+        JQHttpServer::ListenEndpoint listenEndpoint;
+        if ( !listenEndpointFromString( source, listenEndpoint ) )
+        {
+            qWarning() << "JQHttpServer::Service: listen endpoint error:" << source;
+            return false;
+        }
 
-        return false;
+        listenEndpoints.push_back( listenEndpoint );
     }
 
     return true;
 }
 
-void JQHttpServer::SslServerManage::onFinish()
+QSharedPointer< JQHttpServer::Service > JQHttpServer::Service::createService(const QMap< ServiceConfigEnum, QVariant > &config)
 {
-    this->mutex_.lock();
+    QSharedPointer< JQHttpServer::Service > result( new JQHttpServer::Service );
 
-    tcpServer_->close();
-    delete tcpServer_.data();
-    tcpServer_.clear();
+    if ( !result->initialize( config ) ) { return { }; }
 
-    this->mutex_.unlock();
+    return result;
 }
 
-// Service
-QSharedPointer< JQHttpServer::Service > JQHttpServer::Service::createService(const QMap< ServiceConfigEnum, QVariant > &config)
+JQHttpServer::Service::~Service()
 {
-    QSharedPointer< JQHttpServer::Service > result( new JQHttpServer::Service );
+    // 路由线程池里的任务引用了 manager 和 session，manager 必须在这些任务都结束之后才能释放：
+    // 先停止 accept 并等待已经排队的任务，再停止服务线程（之后不会再有新任务），最后再等一次
+    const auto waitForRouteHandlePools = [ this ]()
+    {
+        for ( const auto &handlePool: handlePools_ )
+        {
+            handlePool->waitForDone();
+        }
+    };
 
-    if ( !result->initialize( config ) ) { return { }; }
+    if ( httpServerManage_ ) { httpServerManage_->stopAccepting(); }
+    if ( httpsServerManage_ ) { httpsServerManage_->stopAccepting(); }
 
-    return result;
+    waitForRouteHandlePools();
+
+    if ( httpServerManage_ ) { httpServerManage_->shutdown( 0 ); }
+    if ( httpsServerManage_ ) { httpsServerManage_->shutdown( 0 ); }
+
+    waitForRouteHandlePools();
+
+    httpServerManage_.clear();
+    httpsServerManage_.clear();
 }
 
 void JQHttpServer::Service::registerProcessor( const QPointer< QObject > &processor )
@@ -1246,14 +9277,36 @@ void JQHttpServer::Service::registerProcessor( const QPointer< QObject > &proces
     static const QSet< QString > allowMethod( { "GET", "POST", "DELETE", "PUT" } );
 
     QString apiPathPrefix;
+    auto    handleMaxThreadCount = 0;
+    auto    handlePriority       = -1;
     for ( auto index = 0; index < processor->metaObject()->classInfoCount(); ++index )
     {
-        if ( QString( processor->metaObject()->classInfo( 0 ).name() ) == "apiPathPrefix" )
+        const auto &&classInfo = processor->metaObject()->classInfo( index );
+
+        if ( QString( classInfo.name() ) == "apiPathPrefix" )
+        {
+            apiPathPrefix = classInfo.value();
+        }
+        else if ( QString( classInfo.name() ) == "handleMaxThreadCount" )
+        {
+            handleMaxThreadCount = QString( classInfo.value() ).toInt();
+        }
+        else if ( QString( classInfo.name() ) == "handlePriority" )
         {
-            apiPathPrefix = processor->metaObject()->classInfo( 0 ).value();
+            handlePriority = QString( classInfo.value() ).toInt();
         }
     }
 
+    // Q_CLASSINFO( "handleMaxThreadCount", "N" )：这个 processor 的所有 API 使用独立的处理线程池
+    QSharedPointer< JQHttpServer::HandlePool > processorHandlePool;
+    if ( handleMaxThreadCount > 0 )
+    {
+        processorHandlePool = this->routeHandlePool(
+            ( apiPathPrefix.isEmpty() ) ? ( QString( processor->metaObject()->className() ) ) : ( apiPathPrefix ),
+            handleMaxThreadCount );
+        processorHandlePool->setPriorityAgingInterval( priorityAgingInterval_ );
+    }
+
     for ( auto index = 0; index < processor->metaObject()->methodCount(); ++index )
     {
         const auto &&metaMethod = processor->metaObject()->method( index );
@@ -1262,6 +9315,8 @@ void JQHttpServer::Service::registerProcessor( const QPointer< QObject > &proces
         ApiConfig api;
 
         api.processor = processor;
+        api.priority = handlePriority;
+        api.handlePool = processorHandlePool;
 
         if ( metaMethod.name() == "sessionAccepted" )
         {
@@ -1276,6 +9331,14 @@ void JQHttpServer::Service::registerProcessor( const QPointer< QObject > &proces
 
             continue;
         }
+        else if ( metaMethod.name() == "webSocketAccept" )
+        {
+            // 参数和普通 API 一样，先按名字区分
+            webSocketProcessor_ = processor;
+            webSocketSlots_.insert( QString( metaMethod.name() ) );
+
+            continue;
+        }
         else if ( metaMethod.parameterTypes() == QList< QByteArray >( { "QPointer<JQHttpServer::Session>" } ) )
         {
             api.receiveDataType = NoReceiveDataType;
@@ -1295,6 +9358,19 @@ void JQHttpServer::Service::registerProcessor( const QPointer< QObject > &proces
         else if ( metaMethod.name() == "certificateVerifier" )
         {
             certificateVerifier_ = processor;
+
+            // 不请求的话客户端不会发送证书
+            if ( httpsServerManage_ ) { httpsServerManage_->setPeerVerifyMode( QSslSocket::QueryPeer ); }
+        }
+        else if ( ( metaMethod.name() == "webSocketOpened" ) ||
+                  ( metaMethod.name() == "webSocketMessage" ) ||
+                  ( metaMethod.name() == "webSocketClosed" ) )
+        {
+            // WebSocket 的事件不走 API 路由，同一个 Service 里只有一个 processor 处理
+            webSocketProcessor_ = processor;
+            webSocketSlots_.insert( QString( metaMethod.name() ) );
+
+            continue;
         }
         else
         {
@@ -1327,7 +9403,18 @@ void JQHttpServer::Service::registerProcessor( const QPointer< QObject > &proces
                 apiName = apiPathPrefix + apiName;
             }
 
-            schedules_[ api.apiMethod.toUpper() ][ apiName ] = api;
+            auto routeApi = api;
+            if ( routeHandleMaxThreadCount_.contains( apiName ) )
+            {
+                routeApi.handlePool = this->routeHandlePool( apiName, routeHandleMaxThreadCount_[ apiName ] );
+                routeApi.handlePool->setPriorityAgingInterval( priorityAgingInterval_ );
+            }
+            if ( routePriority_.contains( apiName ) )
+            {
+                routeApi.priority = routePriority_[ apiName ];
+            }
+
+            schedules_[ api.apiMethod.toUpper() ][ apiName ] = routeApi;
         }
 
         {
@@ -1341,11 +9428,60 @@ void JQHttpServer::Service::registerProcessor( const QPointer< QObject > &proces
                 apiName = apiPathPrefix + apiName;
             }
 
-            schedules_[ api.apiMethod.toUpper() ][ apiName ] = api;
+            auto routeApi = api;
+            if ( routeHandleMaxThreadCount_.contains( apiName ) )
+            {
+                routeApi.handlePool = this->routeHandlePool( apiName, routeHandleMaxThreadCount_[ apiName ] );
+                routeApi.handlePool->setPriorityAgingInterval( priorityAgingInterval_ );
+            }
+            if ( routePriority_.contains( apiName ) )
+            {
+                routeApi.priority = routePriority_[ apiName ];
+            }
+
+            schedules_[ api.apiMethod.toUpper() ][ apiName ] = routeApi;
         }
     }
 }
 
+QJsonObject JQHttpServer::Service::status()
+{
+    QJsonObject result;
+
+    if ( httpServerManage_ )
+    {
+        result[ "http" ] = httpServerManage_->status();
+    }
+
+    if ( httpsServerManage_ )
+    {
+        result[ "https" ] = httpsServerManage_->status();
+    }
+
+    QJsonArray handlePools;
+    for ( const auto &handlePool: handlePools_ )
+    {
+        handlePools.push_back( handlePool->status() );
+    }
+    result[ "routeHandlePools" ] = handlePools;
+
+    QJsonObject certificateVerify;
+
+    certificateVerifyMutex_.lock();
+
+    certificateVerify[ "cacheTtl" ]       = certificateVerifyCacheTtl_;
+    certificateVerify[ "cacheSize" ]      = certificateVerifyCache_.size();
+    certificateVerify[ "cacheHitCount" ]  = static_cast< double >( certificateVerifyCacheHitCount_ );
+    certificateVerify[ "cacheMissCount" ] = static_cast< double >( certificateVerifyCacheMissCount_ );
+    certificateVerify[ "pinnedCount" ]    = static_cast< double >( certificateVerifyPinnedCount_ );
+
+    certificateVerifyMutex_.unlock();
+
+    result[ "certificateVerify" ] = certificateVerify;
+
+    return result;
+}
+
 QJsonDocument JQHttpServer::Service::extractPostJsonData(const QPointer< JQHttpServer::Session > &session)
 {
     return QJsonDocument::fromJson( session->requestBody() );
@@ -1408,6 +9544,32 @@ void JQHttpServer::Service::httpOptions(const QPointer< JQHttpServer::Session >
 
 bool JQHttpServer::Service::initialize( const QMap< JQHttpServer::ServiceConfigEnum, QVariant > &config )
 {
+    const auto routeHandleMaxThreadCount = config[ ServiceRouteHandleMaxThreadCount ].toMap();
+    for ( auto it = routeHandleMaxThreadCount.begin(); it != routeHandleMaxThreadCount.end(); ++it )
+    {
+        if ( it.value().toInt() <= 0 ) { continue; }
+
+        routeHandleMaxThreadCount_[ it.key() ] = it.value().toInt();
+    }
+
+    const auto routePriority = config[ ServiceRoutePriority ].toMap();
+    for ( auto it = routePriority.begin(); it != routePriority.end(); ++it )
+    {
+        routePriority_[ it.key() ] = it.value().toInt();
+    }
+
+    priorityHeader_ = config[ ServicePriorityHeader ].toString();
+
+    if ( config.contains( ServicePriorityAgingInterval ) && ( config[ ServicePriorityAgingInterval ].toInt() > 0 ) )
+    {
+        priorityAgingInterval_ = config[ ServicePriorityAgingInterval ].toInt();
+    }
+
+    // 独立的处理线程池在注册 processor 时创建，伸缩策略要先读出来
+    handleScalePolicy_        = static_cast< HandleScalePolicy >( config[ ServiceHandleScalePolicy ].toInt() );
+    handleMinThreadCount_     = ( config.contains( ServiceHandleMinThreadCount ) ) ? ( qMax( 1, config[ ServiceHandleMinThreadCount ].toInt() ) ) : ( 2 );
+    handleTargetQueueLatency_ = ( config.contains( ServiceHandleTargetQueueLatency ) ) ? ( config[ ServiceHandleTargetQueueLatency ].toInt() ) : ( 50 );
+
     if ( config.contains( ServiceProcessor ) &&
          config[ ServiceProcessor ].canConvert< QPointer< QObject > >() &&
          !config[ ServiceProcessor ].value< QPointer< QObject > >().isNull() )
@@ -1427,47 +9589,193 @@ bool JQHttpServer::Service::initialize( const QMap< JQHttpServer::ServiceConfigE
         }
     }
 
-    const auto httpPort = static_cast< quint16 >( config[ ServiceHttpListenPort ].toInt() );
-    if ( httpPort > 0 )
+    const auto handleMinThreadCount = handleMinThreadCount_;
+    const auto handleMaxThreadCount = ( config.contains( ServiceHandleMaxThreadCount ) ) ? ( qMax( handleMinThreadCount, config[ ServiceHandleMaxThreadCount ].toInt() ) ) : ( handleMinThreadCount );
+    const auto handleScalePolicy = handleScalePolicy_;
+    const auto handleTargetQueueLatency = handleTargetQueueLatency_;
+    const auto eventBackend = static_cast< EventBackend >( config[ ServiceEventBackend ].toInt() );
+    const auto listenBacklog = ( config.contains( ServiceListenBacklog ) ) ? ( config[ ServiceListenBacklog ].toInt() ) : ( 1024 );
+    const auto maxPendingConnections = ( config.contains( ServiceMaxPendingConnections ) ) ? ( config[ ServiceMaxPendingConnections ].toInt() ) : ( 30 );
+
+    SocketOptions socketOptions;
+    if ( config.contains( ServiceSocketNoDelay ) ) { socketOptions.noDelay = config[ ServiceSocketNoDelay ].toBool(); }
+    socketOptions.quickAck            = config[ ServiceSocketQuickAck ].toBool();
+    socketOptions.sendBufferSize      = config[ ServiceSocketSendBufferSize ].toInt();
+    socketOptions.receiveBufferSize   = config[ ServiceSocketReceiveBufferSize ].toInt();
+    socketOptions.fastOpenQueueLength = config[ ServiceSocketFastOpenQueueLength ].toInt();
+    socketOptions.deferAcceptTimeout  = config[ ServiceSocketDeferAcceptTimeout ].toInt();
+    socketOptions.reusePort           = config[ ServiceSocketReusePort ].toBool();
+
+    CpuAffinity cpuAffinity;
+    cpuAffinity.serverThreadCpus = AbstractManage::cpuListFromString( config[ ServiceServerThreadCpus ].toString() );
+    cpuAffinity.handleThreadCpus = AbstractManage::cpuListFromString( config[ ServiceHandleThreadCpus ].toString() );
+    cpuAffinity.nodeLocalMemory  = config[ ServiceNodeLocalMemory ].toBool();
+
+    WriteOptions writeOptions;
+    if ( config.contains( ServiceWriteLowWatermark ) ) { writeOptions.lowWatermark = config[ ServiceWriteLowWatermark ].toLongLong(); }
+    if ( config.contains( ServiceWriteHighWatermark ) ) { writeOptions.highWatermark = config[ ServiceWriteHighWatermark ].toLongLong(); }
+    if ( config.contains( ServiceWriteMinChunkSize ) ) { writeOptions.minChunkSize = config[ ServiceWriteMinChunkSize ].toLongLong(); }
+    if ( !AbstractManage::isWriteOptionsValid( writeOptions ) )
     {
-        this->httpServerManage_.reset( new JQHttpServer::TcpServerManage );
-        this->httpServerManage_->setHttpAcceptedCallback( std::bind( &JQHttpServer::Service::onSessionAccepted, this, std::placeholders::_1 ) );
+        qWarning() << "JQHttpServer::Service: invalid write options:" << writeOptions.lowWatermark << writeOptions.highWatermark << writeOptions.minChunkSize;
+        return false;
+    }
 
-        if ( !this->httpServerManage_->listen(
-                 QHostAddress::Any,
-                 httpPort
-             ) )
+    KeepAliveOptions keepAliveOptions;
+    keepAliveOptions.enabled = config[ ServiceKeepAliveEnabled ].toBool();
+    if ( config.contains( ServiceKeepAliveIdleTimeout ) ) { keepAliveOptions.idleTimeout = config[ ServiceKeepAliveIdleTimeout ].toInt(); }
+    if ( config.contains( ServiceKeepAliveMaxRequests ) ) { keepAliveOptions.maxRequests = config[ ServiceKeepAliveMaxRequests ].toInt(); }
+
+    Http2Options http2Options;
+    http2Options.enabled = config[ ServiceHttp2Enabled ].toBool();
+    if ( config.contains( ServiceHttp2MaxConcurrentStreams ) ) { http2Options.maxConcurrentStreams = config[ ServiceHttp2MaxConcurrentStreams ].toInt(); }
+
+    auto cleartextHttp2Options = http2Options;
+    cleartextHttp2Options.enabled = config[ ServiceHttp2CleartextEnabled ].toBool();
+
+    WebSocketOptions webSocketOptions;
+    webSocketOptions.enabled        = config[ ServiceWebSocketEnabled ].toBool();
+    webSocketOptions.allowedOrigins = config[ ServiceWebSocketAllowedOrigins ].toStringList();
+
+    const auto handoffServerName = config[ ServiceHandoffServerName ].toString();
+    if ( config.contains( ServiceHandoffDrainTimeout ) ) { handoffDrainTimeout_ = config[ ServiceHandoffDrainTimeout ].toInt(); }
+    certificateVerifyCacheTtl_ = config[ ServiceCertificateVerifyCacheTtl ].toInt();
+
+    // ServiceHttpListenEndpoints 优先，没有时使用 ServiceHttpListenPort 监听所有地址
+    QList< ListenEndpoint > httpListenEndpoints;
+    if ( !listenEndpointsFromConfig( config, ServiceHttpListenEndpoints, ServiceHttpListenPort, httpListenEndpoints ) ) { return false; }
+    if ( !handoffServerName.isEmpty() ) { inheritListenEndpoints( handoffServerName + ".http", httpListenEndpoints ); }
+
+    if ( !httpListenEndpoints.isEmpty() )
+    {
+        this->httpServerManage_.reset( new JQHttpServer::TcpServerManage( handleMaxThreadCount ) );
+        this->httpServerManage_->setHttpAcceptedCallback( std::bind( &JQHttpServer::Service::onSessionAccepted, this, std::placeholders::_1 ) );
+        this->httpServerManage_->setHandlePoolSelector( std::bind( &JQHttpServer::Service::selectHandlePool, this, std::placeholders::_1 ) );
+        this->httpServerManage_->setPriorityClassifier( std::bind( &JQHttpServer::Service::classifyPriority, this, std::placeholders::_1 ) );
+        this->httpServerManage_->handlePool()->setPriorityAgingInterval( priorityAgingInterval_ );
+        this->httpServerManage_->handlePool()->setScalePolicy( handleScalePolicy, handleMinThreadCount, handleMaxThreadCount, handleTargetQueueLatency );
+        this->httpServerManage_->setEventBackend( eventBackend );
+        this->httpServerManage_->setListenBacklog( listenBacklog );
+        this->httpServerManage_->setMaxPendingConnections( maxPendingConnections );
+        this->httpServerManage_->setSocketOptions( socketOptions );
+        this->httpServerManage_->setWriteOptions( writeOptions );
+        this->httpServerManage_->setKeepAliveOptions( keepAliveOptions );
+        this->httpServerManage_->setHttp2Options( cleartextHttp2Options );
+        this->httpServerManage_->setWebSocketOptions( webSocketOptions );
+        this->httpServerManage_->setWebSocketAcceptCallback( std::bind( &JQHttpServer::Service::onWebSocketAccept, this, std::placeholders::_1 ) );
+        this->httpServerManage_->setWebSocketOpenedCallback( std::bind( &JQHttpServer::Service::onWebSocketOpened, this, std::placeholders::_1 ) );
+        this->httpServerManage_->setWebSocketMessageCallback( std::bind( &JQHttpServer::Service::onWebSocketMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3 ) );
+        this->httpServerManage_->setWebSocketClosedCallback( std::bind( &JQHttpServer::Service::onWebSocketClosed, this, std::placeholders::_1, std::placeholders::_2 ) );
+        this->httpServerManage_->setCpuAffinity( cpuAffinity );
+
+        if ( !this->httpServerManage_->listen( httpListenEndpoints ) )
         {
-            qWarning() << "JQHttpServer::Service: listen port error:" << httpPort;
+            qWarning() << "JQHttpServer::Service: listen error:" << config[ ServiceHttpListenEndpoints ] << config[ ServiceHttpListenPort ];
             return false;
         }
+
+        if ( !handoffServerName.isEmpty() && this->httpServerManage_->startListenSocketHandoff( handoffServerName + ".http" ) )
+        {
+            ++handoffPendingCount_;
+            connect( this->httpServerManage_.data(), &AbstractManage::listenSocketsHandedOff, this, &Service::onListenSocketsHandedOff );
+        }
     }
 
-    const auto httpsPort = static_cast< quint16 >( config[ ServiceHttpsListenPort ].toInt() );
-    if ( httpsPort > 0 )
+    QList< ListenEndpoint > httpsListenEndpoints;
+    if ( !listenEndpointsFromConfig( config, ServiceHttpsListenEndpoints, ServiceHttpsListenPort, httpsListenEndpoints ) ) { return false; }
+    if ( !handoffServerName.isEmpty() ) { inheritListenEndpoints( handoffServerName + ".https", httpsListenEndpoints ); }
+
+    if ( !httpsListenEndpoints.isEmpty() )
     {
-        this->httpsServerManage_.reset( new JQHttpServer::SslServerManage );
+        this->httpsServerManage_.reset( new JQHttpServer::SslServerManage( handleMaxThreadCount ) );
         this->httpsServerManage_->setHttpAcceptedCallback( std::bind( &JQHttpServer::Service::onSessionAccepted, this, std::placeholders::_1 ) );
+        this->httpsServerManage_->setHandlePoolSelector( std::bind( &JQHttpServer::Service::selectHandlePool, this, std::placeholders::_1 ) );
+        this->httpsServerManage_->setPriorityClassifier( std::bind( &JQHttpServer::Service::classifyPriority, this, std::placeholders::_1 ) );
+        this->httpsServerManage_->handlePool()->setPriorityAgingInterval( priorityAgingInterval_ );
+        this->httpsServerManage_->handlePool()->setScalePolicy( handleScalePolicy, handleMinThreadCount, handleMaxThreadCount, handleTargetQueueLatency );
+        this->httpsServerManage_->setEventBackend( eventBackend );
+        this->httpsServerManage_->setListenBacklog( listenBacklog );
+        this->httpsServerManage_->setMaxPendingConnections( maxPendingConnections );
+        this->httpsServerManage_->setSocketOptions( socketOptions );
+        this->httpsServerManage_->setWriteOptions( writeOptions );
+        this->httpsServerManage_->setKeepAliveOptions( keepAliveOptions );
+        this->httpsServerManage_->setHttp2Options( http2Options );
+        this->httpsServerManage_->setWebSocketOptions( webSocketOptions );
+        this->httpsServerManage_->setWebSocketAcceptCallback( std::bind( &JQHttpServer::Service::onWebSocketAccept, this, std::placeholders::_1 ) );
+        this->httpsServerManage_->setWebSocketOpenedCallback( std::bind( &JQHttpServer::Service::onWebSocketOpened, this, std::placeholders::_1 ) );
+        this->httpsServerManage_->setWebSocketMessageCallback( std::bind( &JQHttpServer::Service::onWebSocketMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3 ) );
+        this->httpsServerManage_->setWebSocketClosedCallback( std::bind( &JQHttpServer::Service::onWebSocketClosed, this, std::placeholders::_1, std::placeholders::_2 ) );
+        this->httpsServerManage_->setCpuAffinity( cpuAffinity );
+
+        HandshakeOptions handshakeOptions;
+        handshakeOptions.threadCount = config[ ServiceHandshakeThreadCount ].toInt();
+        handshakeOptions.maxInFlight = config[ ServiceHandshakeMaxInFlight ].toInt();
+        if ( config.contains( ServiceHandshakeTimeout ) ) { handshakeOptions.timeout = config[ ServiceHandshakeTimeout ].toInt(); }
+        this->httpsServerManage_->setHandshakeOptions( handshakeOptions );
+        this->httpsServerManage_->setWatchCertificateFiles( config[ ServiceSslWatchCertificateFiles ].toBool() );
+        if ( certificateVerifier_ ) { this->httpsServerManage_->setPeerVerifyMode( QSslSocket::QueryPeer ); }
+
+        QList< ServerCertificate > certificates;
+        for ( const auto &value: config[ ServiceSslCertificates ].toList() )
+        {
+            const auto &&map = value.toMap();
+
+            ServerCertificate certificate;
+            certificate.crtFilePath = map[ "crtFilePath" ].toString();
+            certificate.keyFilePath = map[ "keyFilePath" ].toString();
+            certificate.hostNames   = map[ "hostNames" ].toStringList();
+            certificates.push_back( certificate );
+        }
 
-        QString crtFilePath = config[ ServiceSslCrtFilePath ].toString();
-        QString keyFilePath = config[ ServiceSslKeyFilePath ].toString();
-        if ( crtFilePath.isEmpty() || keyFilePath.isEmpty() )
+        if ( certificates.isEmpty() )
         {
-            qWarning() << "JQHttpServer::Service: crt or key file path error";
-            return false;
+            ServerCertificate certificate;
+            certificate.crtFilePath = config[ ServiceSslCrtFilePath ].toString();
+            certificate.keyFilePath = config[ ServiceSslKeyFilePath ].toString();
+            certificates.push_back( certificate );
+        }
+
+        for ( const auto &certificate: certificates )
+        {
+            if ( certificate.crtFilePath.isEmpty() || certificate.keyFilePath.isEmpty() )
+            {
+                qWarning() << "JQHttpServer::Service: crt or key file path error";
+                return false;
+            }
         }
 
         if ( !this->httpsServerManage_->listen(
-                 QHostAddress::Any,
-                 httpsPort,
-                 crtFilePath,
-                 keyFilePath
+                 httpsListenEndpoints,
+                 certificates
              ) )
         {
-            qWarning() << "JQHttpServer::Service: listen port error:" << httpsPort;
+            qWarning() << "JQHttpServer::Service: listen error:" << config[ ServiceHttpsListenEndpoints ] << config[ ServiceHttpsListenPort ];
             return false;
         }
+
+        if ( !handoffServerName.isEmpty() && this->httpsServerManage_->startListenSocketHandoff( handoffServerName + ".https" ) )
+        {
+            ++handoffPendingCount_;
+            connect( this->httpsServerManage_.data(), &AbstractManage::listenSocketsHandedOff, this, &Service::onListenSocketsHandedOff );
+        }
+    }
+
+#ifdef Q_OS_LINUX
+    // 路由的处理线程池和默认线程池绑在同样的核心上，默认线程池的核心在 listen 时才确定
+    const auto defaultHandlePool = ( this->httpServerManage_ ) ? ( this->httpServerManage_->handlePool() ) : ( ( this->httpsServerManage_ ) ? ( this->httpsServerManage_->handlePool() ) : ( nullptr ) );
+    if ( defaultHandlePool )
+    {
+        const auto &&handleThreadCpus = defaultHandlePool->cpuAffinity();
+
+        for ( const auto &handlePool: handlePools_ )
+        {
+            if ( !handleThreadCpus.isEmpty() || !handlePool->cpuAffinity().isEmpty() )
+            {
+                handlePool->setCpuAffinity( handleThreadCpus, cpuAffinity.nodeLocalMemory );
+            }
+        }
     }
+#endif
 
     const auto serviceUuid = config[ ServiceUuid ].toString();
     if ( !QUuid( serviceUuid ).isNull() )
@@ -1485,32 +9793,16 @@ void JQHttpServer::Service::onSessionAccepted(const QPointer< JQHttpServer::Sess
         return;
     }
 
-    if ( certificateVerifier_ && qobject_cast< QSslSocket * >( session->socket() ) )
+    if ( certificateVerifier_ && qobject_cast< QSslSocket * >( tcpSocketOf( session->ioDevice().data() ) ) )
     {
-        QMetaObject::invokeMethod(
-                    certificateVerifier_,
-                    "certificateVerifier",
-                    Qt::DirectConnection,
-                    Q_ARG( QSslCertificate, session->peerCertificate() ),
-                    Q_ARG( QPointer<JQHttpServer::Session>, session )
-                );
-
-        if ( session->replyHttpCode() >= 0 ) { return; }
+        if ( !this->verifyPeerCertificate( session ) ) { return; }
     }
 
-    const auto schedulesIt = schedules_.find( session->requestMethod() );
-    if ( schedulesIt != schedules_.end() )
     {
-        auto apiName = session->requestUrlPath();
-
-        auto it = schedulesIt.value().find( session->requestUrlPath() );
-        if ( ( it == schedulesIt.value().end() ) && ( session->requestUrlPath().contains( "_" ) ) )
-        {
-            apiName = Service::snakeCaseToCamelCase( session->requestUrlPath() );
-            it = schedulesIt.value().find( apiName );
-        }
+        QString apiName;
 
-        if ( it != schedulesIt.value().end() )
+        const auto it = this->findApiConfig( session, &apiName );
+        if ( it )
         {
             Recoder recoder( session );
             recoder.serviceUuid_ = serviceUuid_;
@@ -1619,6 +9911,261 @@ void JQHttpServer::Service::onSessionAccepted(const QPointer< JQHttpServer::Sess
     reply( session, false, "API not found", 404 );
 }
 
+const JQHttpServer::Service::ApiConfig *JQHttpServer::Service::findApiConfig(const QPointer< JQHttpServer::Session > &session, QString *apiName) const
+{
+    const auto schedulesIt = schedules_.constFind( session->requestMethod() );
+    if ( schedulesIt == schedules_.constEnd() ) { return nullptr; }
+
+    const auto &&requestUrlPath = session->requestUrlPath();
+
+    auto it = schedulesIt.value().constFind( requestUrlPath );
+    if ( it != schedulesIt.value().constEnd() )
+    {
+        if ( apiName ) { *apiName = requestUrlPath; }
+        return &it.value();
+    }
+
+    if ( !requestUrlPath.contains( "_" ) ) { return nullptr; }
+
+    const auto &&camelCaseApiName = Service::snakeCaseToCamelCase( requestUrlPath );
+
+    it = schedulesIt.value().constFind( camelCaseApiName );
+    if ( it == schedulesIt.value().constEnd() ) { return nullptr; }
+
+    if ( apiName ) { *apiName = camelCaseApiName; }
+    return &it.value();
+}
+
+QSharedPointer< JQHttpServer::HandlePool > JQHttpServer::Service::selectHandlePool(const QPointer< JQHttpServer::Session > &session) const
+{
+    if ( !session ) { return { }; }
+
+    const auto api = this->findApiConfig( session );
+    if ( !api ) { return { }; }
+
+    return api->handlePool;
+}
+
+void JQHttpServer::Service::onListenSocketsHandedOff()
+{
+    if ( --handoffPendingCount_ > 0 ) { return; }
+
+    // 所有监听 socket 都交给了新进程，等已经接受的连接处理完后退出
+    QElapsedTimer elapsedTimer;
+    elapsedTimer.start();
+
+    if ( httpServerManage_ ) { httpServerManage_->shutdown( handoffDrainTimeout_ ); }
+    if ( httpsServerManage_ ) { httpsServerManage_->shutdown( qMax( 0, handoffDrainTimeout_ - static_cast< int >( elapsedTimer.elapsed() ) ) ); }
+
+    QCoreApplication::quit();
+}
+
+int JQHttpServer::Service::classifyPriority(const QPointer< JQHttpServer::Session > &session) const
+{
+    if ( !session ) { return NormalHandlePriority; }
+
+    if ( priorityClassifier_ )
+    {
+        const auto priority = priorityClassifier_( session );
+        if ( priority >= 0 ) { return priority; }
+    }
+
+    if ( !priorityHeader_.isEmpty() )
+    {
+        const auto &&requestHeader = session->requestHeader();
+        for ( auto it = requestHeader.begin(); it != requestHeader.end(); ++it )
+        {
+            if ( it.key().compare( priorityHeader_, Qt::CaseInsensitive ) ) { continue; }
+
+            const auto &&value = it.value().trimmed().toLower();
+
+            if ( value == "high" ) { return HighHandlePriority; }
+            if ( value == "normal" ) { return NormalHandlePriority; }
+            if ( value == "low" ) { return LowHandlePriority; }
+
+            bool ok = false;
+            const auto priority = value.toInt( &ok );
+            if ( ok ) { return qBound( static_cast< int >( LowHandlePriority ), priority, static_cast< int >( HighHandlePriority ) ); }
+
+            break;
+        }
+    }
+
+    const auto api = this->findApiConfig( session );
+    if ( api && ( api->priority >= 0 ) ) { return api->priority; }
+
+    // 健康检查和 OPTIONS 预检都很轻，不应该排在批量请求后面
+    if ( session->requestMethod() == "OPTIONS" ) { return HighHandlePriority; }
+    if ( ( session->requestMethod() == "GET" ) && ( session->requestUrlPath() == "/ping" ) ) { return HighHandlePriority; }
+
+    return NormalHandlePriority;
+}
+
+bool JQHttpServer::Service::verifyPeerCertificate(const QPointer< JQHttpServer::Session > &session)
+{
+    static const int maxCertificateVerifyCacheSize = 10000;
+
+    // 一个 TLS 连接上的证书不会变，长连接的后续请求不再验证
+    if ( session->isPeerVerified() )
+    {
+        certificateVerifyMutex_.lock();
+        ++certificateVerifyPinnedCount_;
+        certificateVerifyMutex_.unlock();
+
+        return true;
+    }
+
+    const auto &&peerCertificate = session->peerCertificate();
+    const auto &&fingerprint     = ( ( certificateVerifyCacheTtl_ > 0 ) && !peerCertificate.isNull() ) ? ( peerCertificate.digest( QCryptographicHash::Sha256 ) ) : ( QByteArray() );
+    const auto   currentTime     = QDateTime::currentMSecsSinceEpoch();
+
+    if ( !fingerprint.isEmpty() )
+    {
+        certificateVerifyMutex_.lock();
+
+        const auto it     = certificateVerifyCache_.constFind( fingerprint );
+        const auto cached = ( it != certificateVerifyCache_.constEnd() ) && ( it.value() > currentTime );
+        if ( cached )
+        {
+            ++certificateVerifyCacheHitCount_;
+        }
+        else
+        {
+            ++certificateVerifyCacheMissCount_;
+        }
+
+        certificateVerifyMutex_.unlock();
+
+        if ( cached )
+        {
+            session->setPeerVerified( true );
+            return true;
+        }
+    }
+
+    QMetaObject::invokeMethod(
+                certificateVerifier_,
+                "certificateVerifier",
+                Qt::DirectConnection,
+                Q_ARG( QSslCertificate, peerCertificate ),
+                Q_ARG( QPointer<JQHttpServer::Session>, session )
+            );
+
+    // 拒绝的结果不缓存，每次都交给 certificateVerifier 回复
+    if ( session->replyHttpCode() >= 0 ) { return false; }
+
+    session->setPeerVerified( true );
+
+    if ( !fingerprint.isEmpty() )
+    {
+        certificateVerifyMutex_.lock();
+
+        if ( certificateVerifyCache_.size() >= maxCertificateVerifyCacheSize )
+        {
+            for ( auto it = certificateVerifyCache_.begin(); it != certificateVerifyCache_.end(); )
+            {
+                if ( it.value() <= currentTime )
+                {
+                    it = certificateVerifyCache_.erase( it );
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            // 都没有过期时全部丢弃，最多多验证一轮
+            if ( certificateVerifyCache_.size() >= maxCertificateVerifyCacheSize ) { certificateVerifyCache_.clear(); }
+        }
+
+        certificateVerifyCache_[ fingerprint ] = currentTime + certificateVerifyCacheTtl_;
+
+        certificateVerifyMutex_.unlock();
+    }
+
+    return true;
+}
+
+bool JQHttpServer::Service::onWebSocketAccept( const QPointer< JQHttpServer::Session > &session )
+{
+    // 升级请求不经过 onSessionAccepted，客户端证书在这里验证
+    if ( certificateVerifier_ && qobject_cast< QSslSocket * >( session->socket() ) )
+    {
+        if ( !this->verifyPeerCertificate( session ) ) { return false; }
+    }
+
+    if ( !webSocketProcessor_ || !webSocketSlots_.contains( "webSocketAccept" ) ) { return true; }
+
+    auto accepted = false;
+
+    QMetaObject::invokeMethod(
+                webSocketProcessor_,
+                "webSocketAccept",
+                Qt::DirectConnection,
+                Q_RETURN_ARG( bool, accepted ),
+                Q_ARG( QPointer<JQHttpServer::Session>, session )
+            );
+
+    return accepted;
+}
+
+void JQHttpServer::Service::onWebSocketOpened( const QPointer< JQHttpServer::WebSocket > &webSocket )
+{
+    if ( !webSocketProcessor_ || !webSocketSlots_.contains( "webSocketOpened" ) ) { return; }
+
+    QMetaObject::invokeMethod(
+                webSocketProcessor_,
+                "webSocketOpened",
+                Qt::DirectConnection,
+                Q_ARG( QPointer<JQHttpServer::WebSocket>, webSocket )
+            );
+}
+
+void JQHttpServer::Service::onWebSocketMessage( const QPointer< JQHttpServer::WebSocket > &webSocket, const QByteArray &message, const bool isText )
+{
+    if ( !webSocketProcessor_ || !webSocketSlots_.contains( "webSocketMessage" ) ) { return; }
+
+    QMetaObject::invokeMethod(
+                webSocketProcessor_,
+                "webSocketMessage",
+                Qt::DirectConnection,
+                Q_ARG( QByteArray, message ),
+                Q_ARG( bool, isText ),
+                Q_ARG( QPointer<JQHttpServer::WebSocket>, webSocket )
+            );
+}
+
+void JQHttpServer::Service::onWebSocketClosed( const QPointer< JQHttpServer::WebSocket > &webSocket, const int closeCode )
+{
+    if ( !webSocketProcessor_ || !webSocketSlots_.contains( "webSocketClosed" ) ) { return; }
+
+    QMetaObject::invokeMethod(
+                webSocketProcessor_,
+                "webSocketClosed",
+                Qt::DirectConnection,
+                Q_ARG( int, closeCode ),
+                Q_ARG( QPointer<JQHttpServer::WebSocket>, webSocket )
+            );
+}
+
+QSharedPointer< JQHttpServer::HandlePool > JQHttpServer::Service::routeHandlePool(const QString &poolName, const int maxThreadCount)
+{
+    auto &handlePool = handlePools_[ poolName ];
+
+    if ( !handlePool )
+    {
+        handlePool.reset( new JQHttpServer::HandlePool( poolName, maxThreadCount ) );
+
+        // 配置的线程数是这个池的上限，和默认线程池使用同样的伸缩策略
+        if ( handleScalePolicy_ != FixedHandleScalePolicy )
+        {
+            handlePool->setScalePolicy( handleScalePolicy_, qMin( handleMinThreadCount_, maxThreadCount ), maxThreadCount, handleTargetQueueLatency_ );
+        }
+    }
+
+    return handlePool;
+}
+
 QString JQHttpServer::Service::snakeCaseToCamelCase(const QString &source, const bool firstCharUpper)
 {
 #if ( QT_VERSION >= QT_VERSION_CHECK( 5, 15, 0 ) )
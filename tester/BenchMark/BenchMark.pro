@@ -3,6 +3,11 @@ QT -= gui
 
 CONFIG += c++11
 
+# 协程 benchmark 需要 C++20，只在编译 Qt 的编译器支持时开启，否则自动跳过
+contains(QT.global.enabled_features, c++2a) {
+    CONFIG += c++2a
+}
+
 TEMPLATE = app
 
 include($$PWD/../../library/JQLibrary/JQLibrary.pri)
@@ -13,3 +18,6 @@ HEADERS += \
 SOURCES += \
     $$PWD/cpp/benchmark.cpp \
     $$PWD/cpp/main.cpp
+
+RESOURCES += \
+    $$PWD/../OverallTest/key/key.qrc
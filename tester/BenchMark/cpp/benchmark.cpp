@@ -4,11 +4,116 @@
 #include <QtTest>
 #include <QSemaphore>
 #include <QtConcurrent>
+#include <QTcpSocket>
+#include <QLocalSocket>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
 
 // JQLibrary import
 #include <JQHttpServer>
+#include <JQHttpServerCoroutine>
 #include <JQNet>
 
+// 同时发起 count 个 HTTP 请求（每个请求一个连接），返回收到 200 回复的数量
+static int concurrentGet(const quint16 port, const QByteArray &path, const int count, const int timeout = 60 * 1000)
+{
+    QEventLoop eventLoop;
+    QTimer::singleShot( timeout, &eventLoop, &QEventLoop::quit );
+
+    auto finishedCount = 0;
+    auto succeedCount  = 0;
+    QList< QSharedPointer< QTcpSocket > > sockets;
+
+    for ( auto index = 0; index < count; ++index )
+    {
+        QSharedPointer< QTcpSocket > socket( new QTcpSocket );
+        QSharedPointer< QByteArray > buffer( new QByteArray );
+        auto                         socketPointer = socket.data();
+
+        QObject::connect( socketPointer, &QTcpSocket::connected, [ socketPointer, path ]()
+        {
+            socketPointer->write( "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n" );
+        } );
+
+        QObject::connect( socketPointer, &QTcpSocket::readyRead, [ socketPointer, buffer ]()
+        {
+            buffer->append( socketPointer->readAll() );
+        } );
+
+        QObject::connect( socketPointer, &QAbstractSocket::stateChanged, [ &, buffer ](const QAbstractSocket::SocketState &state)
+        {
+            if ( state != QAbstractSocket::UnconnectedState ) { return; }
+
+            ++finishedCount;
+            if ( buffer->startsWith( "HTTP/1.1 200" ) ) { ++succeedCount; }
+            if ( finishedCount == count ) { eventLoop.quit(); }
+        } );
+
+        socket->connectToHost( "127.0.0.1", port );
+        sockets.push_back( socket );
+    }
+
+    eventLoop.exec();
+
+    return succeedCount;
+}
+
+// 用 QNetworkAccessManager 同时发起 count 个请求，http2Attribute 控制是否使用 HTTP/2，返回成功的数量
+static int concurrentNetworkGet(const QString &baseUrl, const int count, const QNetworkRequest::Attribute http2Attribute, const bool http2, const int timeout = 60 * 1000)
+{
+    QEventLoop eventLoop;
+    QTimer::singleShot( timeout, &eventLoop, &QEventLoop::quit );
+
+    auto finishedCount = 0;
+    auto succeedCount  = 0;
+
+    QNetworkAccessManager networkAccessManager;
+#ifndef QT_NO_SSL
+    QObject::connect( &networkAccessManager, &QNetworkAccessManager::sslErrors, [ ](QNetworkReply *reply, const QList< QSslError > &)
+    {
+        reply->ignoreSslErrors();
+    } );
+#endif
+
+    for ( auto index = 0; index < count; ++index )
+    {
+        QNetworkRequest request( QUrl( QString( "%1/%2" ).arg( baseUrl ).arg( index ) ) );
+        request.setAttribute( http2Attribute, http2 );
+
+        auto reply = networkAccessManager.get( request );
+        QObject::connect( reply, &QNetworkReply::finished, [ &, reply ]()
+        {
+            ++finishedCount;
+            if ( reply->error() == QNetworkReply::NoError ) { ++succeedCount; }
+            if ( finishedCount == count ) { eventLoop.quit(); }
+
+            reply->deleteLater();
+        } );
+    }
+
+    eventLoop.exec();
+
+    return succeedCount;
+}
+
+// 在已经连接的 socket 上发一个 GET 并阻塞读到服务端断开，QTcpSocket 和 QLocalSocket 都可以用
+template< typename Socket >
+static bool blockingGet(Socket &socket)
+{
+    if ( !socket.waitForConnected( 1000 ) ) { return false; }
+
+    socket.write( "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n" );
+
+    QByteArray buffer;
+    while ( socket.waitForReadyRead( 5000 ) )
+    {
+        buffer.append( socket.readAll() );
+    }
+    buffer.append( socket.readAll() );
+
+    return buffer.startsWith( "HTTP/1.1 200" );
+}
+
 void BenchMark::initTestCase()
 {
     tcpServerManage_.reset( new JQHttpServer::TcpServerManage );
@@ -48,3 +153,433 @@ void BenchMark::benchMarkFor5000()
         }
     }
 }
+
+void BenchMark::benchMarkBlockingHandler()
+{
+    // 处理函数等待上游 20ms，2 个处理线程时 200 个并发请求需要排队
+    JQHttpServer::TcpServerManage tcpServerManage( 2 );
+
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        QThread::msleep( 20 );
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, 23420 ), true );
+
+    QBENCHMARK_ONCE
+    {
+        QCOMPARE( concurrentGet( 23420, "/blocking", 200 ), 200 );
+    }
+}
+
+void BenchMark::benchMarkCoroutineHandler()
+{
+#ifdef JQHTTPSERVER_COROUTINE_ENABLED
+    // 同样等待 20ms，但是等待期间不占用处理线程
+    JQHttpServer::TcpServerManage tcpServerManage( 2 );
+
+    tcpServerManage.setHttpAcceptedCallback( JQHttpServer::Coroutine::bind(
+        [ ]( QPointer< JQHttpServer::Session > session ) -> JQHttpServer::Coroutine::Task<>
+        {
+            co_await JQHttpServer::Coroutine::sleep( session.data(), 20 );
+            if ( !session ) { co_return; }
+
+            session->replyText( "OK" );
+        } ) );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, 23421 ), true );
+
+    QBENCHMARK_ONCE
+    {
+        QCOMPARE( concurrentGet( 23421, "/coroutine", 200 ), 200 );
+    }
+
+    qDebug() << "frame allocator:" << JQHttpServer::Coroutine::FrameAllocator::status();
+#else
+    QSKIP( "C++20 coroutine not enabled" );
+#endif
+}
+
+void BenchMark::benchMarkEventBackend_data()
+{
+    QTest::addColumn< int >( "eventBackend" );
+    QTest::addColumn< int >( "port" );
+
+    QTest::newRow( "qt" ) << static_cast< int >( JQHttpServer::QtEventBackend ) << 23422;
+    QTest::newRow( "epoll" ) << static_cast< int >( JQHttpServer::EpollEventBackend ) << 23423;
+    QTest::newRow( "io_uring" ) << static_cast< int >( JQHttpServer::IoUringEventBackend ) << 23424;
+}
+
+void BenchMark::benchMarkEventBackend()
+{
+    QFETCH( int, eventBackend );
+    QFETCH( int, port );
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setEventBackend( static_cast< JQHttpServer::EventBackend >( eventBackend ) );
+
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, static_cast< quint16 >( port ) ), true );
+
+    if ( tcpServerManage.eventBackend() != eventBackend )
+    {
+        QSKIP( "event backend not available" );
+    }
+
+    // 服务线程的读写系统调用（syscr / syscw），加上分发器自己的等待、注册、唤醒系统调用
+    // Qt 默认分发器的 poll 调用统计不到，所以 qt 这一行偏小
+    const auto syscallCount = [ ](const QJsonObject &status)
+    {
+        const auto &&serverThreadIo = status[ "serverThreadIo" ].toObject();
+
+        return serverThreadIo[ "readSyscallCount" ].toDouble() +
+               serverThreadIo[ "writeSyscallCount" ].toDouble() +
+               status[ "eventDispatcher" ].toObject()[ "syscallCount" ].toDouble();
+    };
+
+    const auto requestCount   = 2000;
+    const auto &&statusBefore = tcpServerManage.status();
+
+    QBENCHMARK_ONCE
+    {
+        for ( auto index = 0; index < ( requestCount / 100 ); ++index )
+        {
+            QCOMPARE( concurrentGet( static_cast< quint16 >( port ), "/", 100 ), 100 );
+        }
+    }
+
+    const auto &&statusAfter = tcpServerManage.status();
+
+    qDebug() << "syscalls per request:" << ( syscallCount( statusAfter ) - syscallCount( statusBefore ) ) / requestCount;
+}
+
+void BenchMark::benchMarkSocketOptions_data()
+{
+    QTest::addColumn< bool >( "noDelay" );
+    QTest::addColumn< bool >( "quickAck" );
+    QTest::addColumn< int >( "fastOpenQueueLength" );
+    QTest::addColumn< int >( "deferAcceptTimeout" );
+    QTest::addColumn< int >( "port" );
+
+    QTest::newRow( "none" ) << false << false << 0 << 0 << 23425;
+    QTest::newRow( "noDelay" ) << true << false << 0 << 0 << 23426;
+    QTest::newRow( "noDelay+quickAck" ) << true << true << 0 << 0 << 23427;
+    QTest::newRow( "noDelay+fastOpen" ) << true << false << 256 << 0 << 23428;
+    QTest::newRow( "noDelay+deferAccept" ) << true << false << 0 << 5 << 23429;
+}
+
+void BenchMark::benchMarkSocketOptions()
+{
+    QFETCH( bool, noDelay );
+    QFETCH( bool, quickAck );
+    QFETCH( int, fastOpenQueueLength );
+    QFETCH( int, deferAcceptTimeout );
+    QFETCH( int, port );
+
+    JQHttpServer::SocketOptions socketOptions;
+    socketOptions.noDelay             = noDelay;
+    socketOptions.quickAck            = quickAck;
+    socketOptions.fastOpenQueueLength = fastOpenQueueLength;
+    socketOptions.deferAcceptTimeout  = deferAcceptTimeout;
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setSocketOptions( socketOptions );
+
+    // 回复分两次写出，没有 TCP_NODELAY 时第二次写会被 Nagle 和对端的延迟确认卡住
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyBytes( QByteArray( 100, 'a' ) );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, static_cast< quint16 >( port ) ), true );
+
+    // 串行的小请求，主要看单个请求的延迟
+    QBENCHMARK_ONCE
+    {
+        for ( auto index = 0; index < 500; ++index )
+        {
+            QCOMPARE( concurrentGet( static_cast< quint16 >( port ), "/", 1 ), 1 );
+        }
+    }
+}
+
+void BenchMark::benchMarkLoopbackTcpLatency()
+{
+    JQHttpServer::TcpServerManage tcpServerManage;
+
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::LocalHost, 23430 ), true );
+
+    QBENCHMARK
+    {
+        QTcpSocket socket;
+        socket.connectToHost( QHostAddress::LocalHost, 23430 );
+        QCOMPARE( blockingGet( socket ), true );
+    }
+}
+
+void BenchMark::benchMarkUnixSocketLatency()
+{
+    JQHttpServer::LocalServerManage localServerManage;
+
+    localServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( localServerManage.listen( "JQHttpServerBenchMark" ), true );
+
+    // 和 benchMarkLoopbackTcpLatency 相同的请求，对比省掉 TCP/IP 协议栈后的单次延迟
+    QBENCHMARK
+    {
+        QLocalSocket socket;
+        socket.connectToServer( "JQHttpServerBenchMark" );
+        QCOMPARE( blockingGet( socket ), true );
+    }
+}
+
+void BenchMark::benchMarkCpuAffinity_data()
+{
+    QTest::addColumn< QString >( "placement" );
+    QTest::addColumn< int >( "port" );
+
+    QTest::newRow( "none" ) << "none" << 23438;
+    QTest::newRow( "sameNode" ) << "sameNode" << 23439;
+    QTest::newRow( "crossNode" ) << "crossNode" << 23440;
+}
+
+void BenchMark::benchMarkCpuAffinity()
+{
+#ifdef Q_OS_LINUX
+    QFETCH( QString, placement );
+    QFETCH( int, port );
+
+    const auto &&nodeCpus = JQHttpServer::AbstractManage::numaNodeCpus();
+
+    // sameNode：服务线程固定在第一个节点的第一个核心，处理线程用同节点的其他核心
+    // crossNode：处理线程故意放到最后一个节点，每个请求的 session 数据都要跨节点访问
+    JQHttpServer::CpuAffinity cpuAffinity;
+    if ( placement != "none" )
+    {
+        cpuAffinity.serverThreadCpus = { nodeCpus.first().first() };
+        cpuAffinity.nodeLocalMemory  = true;
+    }
+    if ( placement == "crossNode" )
+    {
+        if ( nodeCpus.size() < 2 ) { QSKIP( "only one NUMA node" ); }
+
+        cpuAffinity.handleThreadCpus = nodeCpus.last();
+    }
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setCpuAffinity( cpuAffinity );
+
+    // 读一遍请求头和请求体，让处理线程真正访问到服务线程分配的内存
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyBytes( QByteArray::number( session->requestHeader().size() + session->requestBody().size() ), "text" );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, static_cast< quint16 >( port ) ), true );
+
+    const auto requestCount = 2000;
+
+    QBENCHMARK_ONCE
+    {
+        for ( auto index = 0; index < ( requestCount / 100 ); ++index )
+        {
+            QCOMPARE( concurrentGet( static_cast< quint16 >( port ), "/", 100 ), 100 );
+        }
+    }
+
+    const auto &&cpuAffinityStatus = tcpServerManage.status()[ "cpuAffinity" ].toObject();
+
+    qDebug() << "numa nodes:" << cpuAffinityStatus[ "numaNodeCount" ].toInt()
+             << "local node handles:" << cpuAffinityStatus[ "localNodeHandleCount" ].toDouble()
+             << "cross node handles:" << cpuAffinityStatus[ "crossNodeHandleCount" ].toDouble();
+#else
+    QSKIP( "cpu affinity is only supported on Linux" );
+#endif
+}
+
+void BenchMark::benchMarkHttp2Cleartext_data()
+{
+    QTest::addColumn< bool >( "http2" );
+    QTest::addColumn< int >( "port" );
+
+    QTest::newRow( "http/1.1+keepAlive" ) << false << 23454;
+    QTest::newRow( "h2c" ) << true << 23455;
+}
+
+void BenchMark::benchMarkHttp2Cleartext()
+{
+    QFETCH( bool, http2 );
+    QFETCH( int, port );
+
+    JQHttpServer::KeepAliveOptions keepAliveOptions;
+    keepAliveOptions.enabled = true;
+
+    JQHttpServer::Http2Options http2Options;
+    http2Options.enabled = http2;
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setKeepAliveOptions( keepAliveOptions );
+    tcpServerManage.setHttp2Options( http2Options );
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( session->requestUrl() );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, static_cast< quint16 >( port ) ), true );
+
+    const auto requestCount = 2000;
+
+    // 模拟反向代理：HTTP/1.1 最多 6 个连接，一个请求没回复前连接不能发下一个；h2c 一个连接上全部并发
+    QBENCHMARK_ONCE
+    {
+        QCOMPARE( concurrentNetworkGet( QString( "http://127.0.0.1:%1" ).arg( port ), requestCount, QNetworkRequest::Http2DirectAttribute, http2 ), requestCount );
+    }
+
+    const auto &&status = tcpServerManage.status();
+
+    qDebug() << "accepted connections:" << status[ "accept" ].toObject()[ "acceptedCount" ].toInt()
+             << "keep-alive requests:" << status[ "keepAlive" ].toObject()[ "requestCount" ].toInt()
+             << "h2c connections:" << status[ "http2" ].toObject()[ "cleartextCount" ].toInt();
+}
+
+void BenchMark::benchMarkWebSocketPush_data()
+{
+    QTest::addColumn< bool >( "push" );
+    QTest::addColumn< int >( "port" );
+
+    QTest::newRow( "poll" ) << false << 23457;
+    QTest::newRow( "push" ) << true << 23458;
+}
+
+void BenchMark::benchMarkWebSocketPush()
+{
+    QFETCH( bool, push );
+    QFETCH( int, port );
+
+    const auto updateCount = 2000;
+
+    JQHttpServer::KeepAliveOptions keepAliveOptions;
+    keepAliveOptions.enabled = true;
+
+    JQHttpServer::WebSocketOptions webSocketOptions;
+    webSocketOptions.enabled = true;
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setKeepAliveOptions( keepAliveOptions );
+    tcpServerManage.setWebSocketOptions( webSocketOptions );
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "update" );
+    } );
+    tcpServerManage.setWebSocketOpenedCallback( [ ]( const QPointer< JQHttpServer::WebSocket > &webSocket )
+    {
+        for ( auto index = 0; index < updateCount; ++index )
+        {
+            webSocket->sendText( "update" );
+        }
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, static_cast< quint16 >( port ) ), true );
+
+    // 同样收到 updateCount 次更新：轮询每次都是一个请求，推送只有一次握手
+    QBENCHMARK_ONCE
+    {
+        if ( push )
+        {
+            QTcpSocket socket;
+            socket.connectToHost( "127.0.0.1", static_cast< quint16 >( port ) );
+            QCOMPARE( socket.waitForConnected( 1000 ), true );
+
+            socket.write( "GET /updates HTTP/1.1\r\n"
+                          "Host: 127.0.0.1\r\n"
+                          "Upgrade: websocket\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                          "Sec-WebSocket-Version: 13\r\n"
+                          "\r\n" );
+
+            // 每个更新是 2 字节帧头加 6 字节内容
+            QByteArray buffer;
+            while ( ( buffer.count( "\x81\x06update" ) < updateCount ) && socket.waitForReadyRead( 5000 ) )
+            {
+                buffer.append( socket.readAll() );
+            }
+
+            QCOMPARE( static_cast< int >( buffer.count( "\x81\x06update" ) ), updateCount );
+        }
+        else
+        {
+            QCOMPARE( concurrentNetworkGet( QString( "http://127.0.0.1:%1" ).arg( port ), updateCount, QNetworkRequest::Http2DirectAttribute, false ), updateCount );
+        }
+    }
+
+    const auto &&status = tcpServerManage.status();
+
+    qDebug() << "accepted connections:" << status[ "accept" ].toObject()[ "acceptedCount" ].toInt()
+             << "keep-alive requests:" << status[ "keepAlive" ].toObject()[ "requestCount" ].toInt()
+             << "websocket connections:" << status[ "webSocket" ].toObject()[ "connectionCount" ].toInt();
+}
+
+#ifndef QT_NO_SSL
+void BenchMark::benchMarkHttp2_data()
+{
+    QTest::addColumn< bool >( "keepAlive" );
+    QTest::addColumn< bool >( "http2" );
+    QTest::addColumn< int >( "port" );
+
+    QTest::newRow( "http/1.1" ) << false << false << 23450;
+    QTest::newRow( "http/1.1+keepAlive" ) << true << false << 23451;
+    QTest::newRow( "h2" ) << false << true << 23452;
+}
+
+void BenchMark::benchMarkHttp2()
+{
+    QFETCH( bool, keepAlive );
+    QFETCH( bool, http2 );
+    QFETCH( int, port );
+
+    JQHttpServer::KeepAliveOptions keepAliveOptions;
+    keepAliveOptions.enabled = keepAlive;
+
+    JQHttpServer::Http2Options http2Options;
+    http2Options.enabled = http2;
+
+    JQHttpServer::SslServerManage sslServerManage;
+    sslServerManage.setKeepAliveOptions( keepAliveOptions );
+    sslServerManage.setHttp2Options( http2Options );
+    sslServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( session->requestUrl() );
+    } );
+
+    QCOMPARE( sslServerManage.listen( QHostAddress::Any, static_cast< quint16 >( port ), ":/server.crt", ":/server.key" ), true );
+
+    const auto requestCount = 1000;
+
+    // QNetworkAccessManager 的 HTTP/1.1 每个主机最多 6 个连接，h2 全部请求复用一个连接
+    QBENCHMARK_ONCE
+    {
+        QCOMPARE( concurrentNetworkGet( QString( "https://127.0.0.1:%1" ).arg( port ), requestCount, QNetworkRequest::Http2AllowedAttribute, http2 ), requestCount );
+    }
+
+    const auto &&status = sslServerManage.status();
+
+    qDebug() << "handshakes:" << status[ "handshake" ].toObject()[ "succeedCount" ].toInt()
+             << "http2 connections:" << status[ "http2" ].toObject()[ "connectionCount" ].toInt()
+             << "http2 streams:" << status[ "http2" ].toObject()[ "streamCount" ].toInt();
+}
+#endif
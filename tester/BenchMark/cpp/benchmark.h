@@ -29,6 +29,40 @@ private slots:
 
     void benchMarkFor5000();
 
+    void benchMarkBlockingHandler();
+
+    void benchMarkCoroutineHandler();
+
+    void benchMarkEventBackend_data();
+
+    void benchMarkEventBackend();
+
+    void benchMarkSocketOptions_data();
+
+    void benchMarkSocketOptions();
+
+    void benchMarkLoopbackTcpLatency();
+
+    void benchMarkUnixSocketLatency();
+
+    void benchMarkCpuAffinity_data();
+
+    void benchMarkCpuAffinity();
+
+    void benchMarkHttp2Cleartext_data();
+
+    void benchMarkHttp2Cleartext();
+
+    void benchMarkWebSocketPush_data();
+
+    void benchMarkWebSocketPush();
+
+#ifndef QT_NO_SSL
+    void benchMarkHttp2_data();
+
+    void benchMarkHttp2();
+#endif
+
 private:
     QSharedPointer< JQHttpServer::TcpServerManage > tcpServerManage_;
 };
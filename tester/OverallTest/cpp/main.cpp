@@ -10,6 +10,11 @@ int main(int argc, char *argv[])
     qputenv( "QT_SSL_USE_TEMPORARY_KEYCHAIN", "1" );
     qSetMessagePattern( "%{time hh:mm:ss.zzz}: %{message}" );
 
+#ifdef Q_OS_UNIX
+    // Prefork::run 必须在创建 QCoreApplication 之前调用
+    if ( ( argc > 1 ) && ( QByteArray( argv[ 1 ] ) == "--prefork" ) ) { return OverallTest::preforkMain( argc, argv ); }
+#endif
+
     QCoreApplication app( argc, argv );
 
     OverallTest benchMark;
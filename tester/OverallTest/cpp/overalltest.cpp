@@ -3,13 +3,108 @@
 // Qt lib import
 #include <QtTest>
 #include <QSemaphore>
+#include <QTcpServer>
 #include <QTcpSocket>
+#include <QLocalSocket>
+#include <QProcess>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTemporaryDir>
+#include <QDir>
 #include <QtConcurrent>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
 
 // JQLibrary import
 #include <JQHttpServer>
 #include <JQNet>
 
+// System lib import
+#ifdef Q_OS_UNIX
+#   include <unistd.h>
+#   include <signal.h>
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#endif
+#ifdef Q_OS_LINUX
+#   include <sched.h>
+#endif
+
+void RouteHandlePoolProcessor::getSlow(const QPointer< JQHttpServer::Session > &session)
+{
+    slowSemaphore_.acquire();
+
+    session->replyText( "slow" );
+}
+
+void RouteHandlePoolProcessor::getFast(const QPointer< JQHttpServer::Session > &session)
+{
+    session->replyText( "fast" );
+}
+
+#ifndef QT_NO_SSL
+void CertificateVerifyProcessor::certificateVerifier(const QSslCertificate &peerCertificate, const QPointer< JQHttpServer::Session > &session)
+{
+    ++verifyCount_;
+
+    if ( peerCertificate.isNull() ) { session->replyText( "no certificate", 403 ); }
+}
+
+void CertificateVerifyProcessor::getHello(const QPointer< JQHttpServer::Session > &session)
+{
+    session->replyText( "OK" );
+}
+#endif
+
+#ifdef Q_OS_UNIX
+int OverallTest::preforkMain(int argc, char *argv[])
+{
+    // 汇总的统计信息和 worker 退出的通知都写到 stdout，由 preforkTest 读取
+    JQHttpServer::Prefork::Options options;
+    options.workerCount     = 2;
+    options.restartDelay    = 100;
+    options.stopTimeout     = 5 * 1000;
+    options.listenEndpoints = { JQHttpServer::ListenEndpoint( QHostAddress::LocalHost, 23464 ) };
+    options.statusCallback  = [ ](const QJsonObject &status)
+    {
+        printf( "%s\n", QJsonDocument( status ).toJson( QJsonDocument::Compact ).constData() );
+        fflush( stdout );
+    };
+
+    const auto workerIndex = JQHttpServer::Prefork::run( options );
+    if ( workerIndex < 0 ) { return 0; }
+
+    QCoreApplication app( argc, argv );
+
+    JQHttpServer::TcpServerManage tcpServerManage( 1 );
+    tcpServerManage.setHttpAcceptedCallback( [ workerIndex ](const QPointer< JQHttpServer::Session > &session)
+    {
+        session->replyText( QString( "worker:%1" ).arg( workerIndex ) );
+    } );
+
+    if ( !tcpServerManage.listen( JQHttpServer::Prefork::listenEndpoints() ) ) { return 1; }
+
+    QTimer statusTimer;
+    QObject::connect( &statusTimer, &QTimer::timeout, [ &tcpServerManage ]()
+    {
+        JQHttpServer::Prefork::reportStatus( tcpServerManage.status() );
+    } );
+    statusTimer.start( 100 );
+
+    JQHttpServer::Prefork::watchStop( [ &tcpServerManage ]()
+    {
+        tcpServerManage.shutdown( 1000 );
+
+        printf( "stopped\n" );
+        fflush( stdout );
+
+        QCoreApplication::quit();
+    } );
+
+    return app.exec();
+}
+#endif
+
 void OverallTest::initTestCase()
 {
     httpServerManage_.reset( new JQHttpServer::TcpServerManage );
@@ -21,6 +116,33 @@ void OverallTest::initTestCase()
 
     QCOMPARE( httpServerManage_->listen( QHostAddress::Any, 23414 ), true );
 
+    // 只有 1 个处理线程，延迟回复的请求不能占住它
+    deferredServerManage_.reset( new JQHttpServer::TcpServerManage( 1 ) );
+
+    deferredServerManage_->setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        if ( session->requestUrlPath() == "/timeout" )
+        {
+            session->deferReply( 200 );
+            return;
+        }
+
+        const auto &&requestUrl = session->requestUrl();
+
+        session->replyWhenFinished(
+            QtConcurrent::run( [ requestUrl ]()
+            {
+                QThread::msleep( 200 );
+                return requestUrl;
+            } ),
+            [ ]( const QPointer< JQHttpServer::Session > &session, const QFuture< QString > &future )
+            {
+                session->replyText( "->" + future.result() + "<-" );
+            } );
+    } );
+
+    QCOMPARE( deferredServerManage_->listen( QHostAddress::Any, 23416 ), true );
+
 #ifndef QT_NO_SSL
     httpsServerManage_.reset( new JQHttpServer::SslServerManage );
 
@@ -36,6 +158,7 @@ void OverallTest::initTestCase()
 void OverallTest::cleanupTestCase()
 {
     httpServerManage_.clear();
+    deferredServerManage_.clear();
 #ifndef QT_NO_SSL
     httpsServerManage_.clear();
 #endif
@@ -69,18 +192,1557 @@ void OverallTest::httpPostTest()
     QCOMPARE( reply.second, QByteArray( "->/httpPostTest/<-->append data<-" ) );
 }
 
-#ifndef QT_NO_SSL
-void OverallTest::httpsGetTest()
+void OverallTest::handlePoolPriorityTest()
 {
-    const auto &&reply = JQNet::HTTP::get( "https://127.0.0.1:23415/httpGetTest/" );
+    JQHttpServer::HandlePool handlePool( "test", 1 );
+    handlePool.setPriorityAgingInterval( 60 * 1000 );
+
+    QSemaphore blocker;
+    QMutex     mutex;
+    QList< int > order;
+
+    // 先占住唯一的线程，让后面的任务都进入队列
+    handlePool.start( [ & ]() { blocker.acquire( 1 ); } );
+    QTest::qWait( 50 );
+
+    for ( const auto priority: { JQHttpServer::LowHandlePriority, JQHttpServer::NormalHandlePriority, JQHttpServer::HighHandlePriority } )
+    {
+        handlePool.start( [ &, priority ]()
+        {
+            mutex.lock();
+            order.push_back( priority );
+            mutex.unlock();
+        }, priority );
+    }
+
+    QCOMPARE( handlePool.status()[ "queueDepth" ].toInt(), 3 );
+
+    blocker.release( 1 );
+    handlePool.waitForDone();
+
+    QCOMPARE( order, QList< int >( { JQHttpServer::HighHandlePriority, JQHttpServer::NormalHandlePriority, JQHttpServer::LowHandlePriority } ) );
+}
+
+void OverallTest::handlePoolScaleTest()
+{
+    JQHttpServer::HandlePool handlePool( "scaleTest", 4 );
+    handlePool.setScalePolicy( JQHttpServer::QueueLatencyHandleScalePolicy, 1, 4, 20 );
+    QCOMPARE( handlePool.status()[ "threadCount" ].toInt(), 1 );
+
+    // 所有 worker 都被阻塞，没有任务出队，只能靠定时评估扩容
+    QSemaphore blocker;
+    for ( auto index = 0; index < 4; ++index )
+    {
+        handlePool.start( [ & ]() { blocker.acquire( 1 ); } );
+    }
+
+    QTRY_COMPARE( handlePool.status()[ "threadCount" ].toInt() > 1, true );
+    QTRY_COMPARE( handlePool.status()[ "runningCount" ].toInt() > 1, true );
+    QCOMPARE( handlePool.status()[ "scaleUpCount" ].toInt() >= 1, true );
+
+    // 空闲之后逐步缩回下限
+    blocker.release( 4 );
+    QTRY_COMPARE( handlePool.status()[ "finishedCount" ].toInt(), 4 );
+    QTRY_COMPARE_WITH_TIMEOUT( handlePool.status()[ "threadCount" ].toInt(), 1, 10 * 1000 );
+    QCOMPARE( handlePool.status()[ "scaleDownCount" ].toInt() >= 1, true );
+}
+
+void OverallTest::routeHandlePoolTest()
+{
+    RouteHandlePoolProcessor processor;
+
+    QMap< JQHttpServer::ServiceConfigEnum, QVariant > config;
+    config[ JQHttpServer::ServiceHttpListenPort ]            = 23459;
+    config[ JQHttpServer::ServiceProcessor ]                 = QVariant::fromValue( QPointer< QObject >( &processor ) );
+    config[ JQHttpServer::ServiceRouteHandleMaxThreadCount ] = QVariantMap( { { "/slow", 1 } } );
+
+    QFuture< void > releaseFuture;
+    QElapsedTimer   destructTimer;
+    {
+        const auto service = JQHttpServer::Service::createService( config );
+        QCOMPARE( service.isNull(), false );
+
+        // /slow 只有 1 个线程，两个请求一个在处理一个在排队
+        QList< QFuture< QPair< bool, QByteArray > > > futures;
+        for ( auto index = 0; index < 2; ++index )
+        {
+            futures.push_back( QtConcurrent::run( [ ]()
+            {
+                return JQNet::HTTP::get( "http://127.0.0.1:23459/slow" );
+            } ) );
+        }
+
+        const auto slowHandlePool = [ &service ]()
+        {
+            for ( const auto &value: service->status()[ "routeHandlePools" ].toArray() )
+            {
+                if ( value.toObject()[ "name" ].toString() == "/slow" ) { return value.toObject(); }
+            }
+
+            return QJsonObject();
+        };
+
+        QTRY_COMPARE( slowHandlePool()[ "runningCount" ].toInt(), 1 );
+        QTRY_COMPARE( slowHandlePool()[ "queueDepth" ].toInt(), 1 );
+
+        // /slow 占满了自己的线程池，其他接口仍然在默认线程池里处理
+        const auto &&fastReply = JQNet::HTTP::get( "http://127.0.0.1:23459/fast" );
+        QCOMPARE( fastReply.first, true );
+        QCOMPARE( fastReply.second, QByteArray( "fast" ) );
+
+        processor.slowSemaphore_.release( 2 );
+
+        for ( auto &future: futures )
+        {
+            QCOMPARE( future.result().first, true );
+            QCOMPARE( future.result().second, QByteArray( "slow" ) );
+        }
+
+        QTRY_COMPARE( slowHandlePool()[ "finishedCount" ].toInt(), 2 );
+        QCOMPARE( service->status()[ "http" ].toObject()[ "handlePool" ].toObject()[ "finishedCount" ].toInt() >= 1, true );
+
+        // 析构时 /slow 还在处理，Service 要等它结束之后才能释放 manager
+        futures.clear();
+        futures.push_back( QtConcurrent::run( [ ]()
+        {
+            return JQNet::HTTP::get( "http://127.0.0.1:23459/slow" );
+        } ) );
+        QTRY_COMPARE( slowHandlePool()[ "runningCount" ].toInt(), 1 );
+
+        releaseFuture = QtConcurrent::run( [ &processor ]()
+        {
+            QThread::msleep( 200 );
+            processor.slowSemaphore_.release( 1 );
+        } );
+
+        destructTimer.start();
+    }
+
+    // 析构一直等到处理函数拿到信号量并结束
+    QCOMPARE( destructTimer.elapsed() >= 150, true );
+    QCOMPARE( processor.slowSemaphore_.available(), 0 );
+    releaseFuture.waitForFinished();
+}
+
+void OverallTest::httpDeferredReplyTest()
+{
+    QList< QFuture< QPair< bool, QByteArray > > > futures;
+
+    for ( auto index = 0; index < 8; ++index )
+    {
+        futures.push_back( QtConcurrent::run( [ index ]()
+        {
+            return JQNet::HTTP::get( QString( "http://127.0.0.1:23416/deferred%1" ).arg( index ) );
+        } ) );
+    }
+
+    for ( auto index = 0; index < futures.size(); ++index )
+    {
+        const auto &&reply = futures[ index ].result();
+        QCOMPARE( reply.first, true );
+        QCOMPARE( reply.second, QString( "->/deferred%1<-" ).arg( index ).toUtf8() );
+    }
+
+    const auto &&timeoutReply = JQNet::HTTP::get( "http://127.0.0.1:23416/timeout" );
+    QCOMPARE( timeoutReply.first, false );
+
+    // 统计按 manager 区分，没有延迟回复的 manager 不受影响
+    const auto &&deferredReply = deferredServerManage_->status()[ "deferredReply" ].toObject();
+    QCOMPARE( deferredReply[ "deferredReplyCount" ].toInt(), 9 );
+    QCOMPARE( deferredReply[ "deferredReplyTimeoutCount" ].toInt(), 1 );
+
+    const auto &&otherDeferredReply = httpServerManage_->status()[ "deferredReply" ].toObject();
+    QCOMPARE( otherDeferredReply[ "deferredReplyCount" ].toInt(), 0 );
+    QCOMPARE( otherDeferredReply[ "deferredReplyTimeoutCount" ].toInt(), 0 );
+}
+
+void OverallTest::epollEventBackendTest()
+{
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setEventBackend( JQHttpServer::EpollEventBackend );
+
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( QString( "->%1<-->%2<-" ).arg( session->requestUrl(), QString( session->requestBody() ) ) );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, 23417 ), true );
+
+    // 大量空闲连接不影响正常请求
+    QList< QSharedPointer< QTcpSocket > > idleSockets;
+    for ( auto index = 0; index < 200; ++index )
+    {
+        QSharedPointer< QTcpSocket > socket( new QTcpSocket );
+
+        socket->connectToHost( "127.0.0.1", 23417 );
+        QCOMPARE( socket->waitForConnected( 1000 ), true );
+
+        idleSockets.push_back( socket );
+    }
+
+    const auto &&getReply = JQNet::HTTP::get( "http://127.0.0.1:23417/epollGetTest/" );
+    QCOMPARE( getReply.first, true );
+    QCOMPARE( getReply.second, QByteArray( "->/epollGetTest/<--><-" ) );
+
+    // 回复超过 socket 发送缓冲区，需要多次写通知
+    const QByteArray largeBody( 4 * 1024 * 1024, 'a' );
+    const auto &&postReply = JQNet::HTTP::post( "http://127.0.0.1:23417/epollPostTest/", largeBody );
+    QCOMPARE( postReply.first, true );
+    QCOMPARE( postReply.second, "->/epollPostTest/<-->" + largeBody + "<-" );
+
+#ifdef Q_OS_LINUX
+    QCOMPARE( tcpServerManage.status()[ "eventBackend" ].toString(), QString( "epoll" ) );
+#endif
+}
+
+void OverallTest::ioUringEventBackendTest()
+{
+    JQHttpServer::KeepAliveOptions keepAliveOptions;
+    keepAliveOptions.enabled     = true;
+    keepAliveOptions.idleTimeout = 10 * 1000;
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setEventBackend( JQHttpServer::IoUringEventBackend );
+    tcpServerManage.setKeepAliveOptions( keepAliveOptions );
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( session->requestUrl() );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, 23460 ), true );
+
+    // 保持一个空闲的长连接，服务线程里就有一个 10 秒的定时器，之后每次等待都带着超时
+    QTcpSocket idleSocket;
+    idleSocket.connectToHost( "127.0.0.1", 23460 );
+    QCOMPARE( idleSocket.waitForConnected( 1000 ), true );
+    idleSocket.write( "GET /idle HTTP/1.1\r\n\r\n" );
+    QCOMPARE( idleSocket.waitForReadyRead( 3000 ), true );
+
+    // 新连接和处理线程的回复（跨线程唤醒）都要在定时器超时之前处理
+    for ( auto index = 0; index < 5; ++index )
+    {
+        QElapsedTimer elapsedTimer;
+        elapsedTimer.start();
+
+        const auto &&reply = JQNet::HTTP::get( QString( "http://127.0.0.1:23460/%1" ).arg( index ) );
+        QCOMPARE( reply.first, true );
+        QCOMPARE( reply.second, QString( "/%1" ).arg( index ).toUtf8() );
+        QCOMPARE( elapsedTimer.elapsed() < 1000, true );
+    }
+
+    QCOMPARE( idleSocket.state(), QAbstractSocket::ConnectedState );
+
+#ifdef Q_OS_LINUX
+    QCOMPARE( tcpServerManage.status()[ "eventBackend" ].toString(), QString( "io_uring" ) );
+#endif
+}
+
+void OverallTest::writeStatisticsTest()
+{
+    const QByteArray bytes( 1024 * 1024, 'a' );
+
+    JQHttpServer::TcpServerManage bytesServerManage;
+    bytesServerManage.setHttpAcceptedCallback( [ &bytes ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyBytes( bytes );
+    } );
+
+    JQHttpServer::TcpServerManage textServerManage;
+    textServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( bytesServerManage.listen( QHostAddress::Any, 23461 ), true );
+    QCOMPARE( textServerManage.listen( QHostAddress::Any, 23462 ), true );
+
+    for ( auto index = 0; index < 3; ++index )
+    {
+        const auto &&bytesReply = JQNet::HTTP::get( "http://127.0.0.1:23461/" );
+        QCOMPARE( bytesReply.first, true );
+        QCOMPARE( bytesReply.second.size(), bytes.size() );
+
+        const auto &&textReply = JQNet::HTTP::get( "http://127.0.0.1:23462/" );
+        QCOMPARE( textReply.first, true );
+        QCOMPARE( textReply.second, QByteArray( "OK" ) );
+    }
+
+    // 统计按 manager 区分，大回复走分块写入，只计入自己的 manager
+    const auto &&bytesWrite = bytesServerManage.status()[ "write" ].toObject();
+    QCOMPARE( bytesWrite[ "writeChunkCount" ].toDouble() >= 3, true );
+    QCOMPARE( bytesWrite[ "writeChunkBytes" ].toDouble(), static_cast< double >( bytes.size() * 3 ) );
+
+    const auto &&textWrite = textServerManage.status()[ "write" ].toObject();
+    QCOMPARE( textWrite[ "writeChunkCount" ].toDouble(), 0.0 );
+    QCOMPARE( textWrite[ "writeChunkBytes" ].toDouble(), 0.0 );
+
+    // 会让分块写入停住或者一直写空块的设置被拒绝，原来的设置不变
+    JQHttpServer::WriteOptions invalidWriteOptions;
+    invalidWriteOptions.minChunkSize = 0;
+    QCOMPARE( textServerManage.setWriteOptions( invalidWriteOptions ), false );
+
+    invalidWriteOptions = JQHttpServer::WriteOptions();
+    invalidWriteOptions.lowWatermark  = 1024 * 1024;
+    invalidWriteOptions.highWatermark = 64 * 1024;
+    QCOMPARE( textServerManage.setWriteOptions( invalidWriteOptions ), false );
+    QCOMPARE( textServerManage.writeOptions().highWatermark, JQHttpServer::WriteOptions().highWatermark );
+}
+
+void OverallTest::acceptBacklogTest()
+{
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setListenBacklog( 2048 );
+    tcpServerManage.setMaxPendingConnections( 256 );
+
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::Any, 23418 ), true );
+
+    // 一次性发起大量连接，所有连接都要被接受
+    QList< QSharedPointer< QTcpSocket > > sockets;
+    for ( auto index = 0; index < 500; ++index )
+    {
+        QSharedPointer< QTcpSocket > socket( new QTcpSocket );
+        socket->connectToHost( "127.0.0.1", 23418 );
+        sockets.push_back( socket );
+    }
+
+    for ( const auto &socket: sockets )
+    {
+        QCOMPARE( socket->waitForConnected( 1000 ), true );
+    }
+
+    QTRY_COMPARE( tcpServerManage.status()[ "accept" ].toObject()[ "acceptedCount" ].toInt(), 500 );
+
+    const auto &&accept = tcpServerManage.status()[ "accept" ].toObject();
+    QCOMPARE( accept[ "listenBacklog" ].toInt(), 2048 );
+    QCOMPARE( accept[ "acceptErrorCount" ].toInt(), 0 );
+
+    const auto &&reply = JQNet::HTTP::get( "http://127.0.0.1:23418/" );
     QCOMPARE( reply.first, true );
-    QCOMPARE( reply.second, QByteArray( "->/httpGetTest/<--><-" ) );
+    QCOMPARE( reply.second, QByteArray( "OK" ) );
 }
 
-void OverallTest::httpsPostTest()
+void OverallTest::localSocketTest()
 {
-    const auto &&reply = JQNet::HTTP::post( "https://127.0.0.1:23415/httpPostTest/", "append data" );
+    JQHttpServer::LocalServerManage localServerManage;
+
+    localServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        QCOMPARE( session->socket().isNull(), true );
+        QCOMPARE( session->requestSourceIp(), QString( "unix" ) );
+
+        session->replyBytes( session->requestUrl().toUtf8() + session->requestBody(), "text/plain" );
+    } );
+
+    QCOMPARE( localServerManage.listen( "JQHttpServerOverallTest" ), true );
+    QCOMPARE( localServerManage.fullServerName().isEmpty(), false );
+
+    QLocalSocket socket;
+    socket.connectToServer( "JQHttpServerOverallTest" );
+    QCOMPARE( socket.waitForConnected( 1000 ), true );
+
+    socket.write( "POST /localSocketTest/ HTTP/1.1\r\nContent-Length: 11\r\n\r\nappend data" );
+
+    // 回复完成后服务端会主动断开
+    QByteArray buffer;
+    while ( socket.waitForReadyRead( 5000 ) )
+    {
+        buffer.append( socket.readAll() );
+    }
+    buffer.append( socket.readAll() );
+
+    QCOMPARE( buffer.startsWith( "HTTP/1.1 200" ), true );
+    QCOMPARE( buffer.endsWith( "/localSocketTest/append data" ), true );
+
+    // 名字正在被使用时 listen 失败，不能抢占正在运行的服务
+    JQHttpServer::LocalServerManage secondServerManage;
+    QCOMPARE( secondServerManage.listen( "JQHttpServerOverallTest" ), false );
+
+    QLocalSocket secondSocket;
+    secondSocket.connectToServer( "JQHttpServerOverallTest" );
+    QCOMPARE( secondSocket.waitForConnected( 1000 ), true );
+
+#ifdef Q_OS_UNIX
+    // 异常退出留下的 socket 文件没有进程在监听，删除后可以重新 listen
+    const auto &&stalePath = QDir::tempPath().toUtf8() + "/JQHttpServerStaleSocketTest";
+    ::unlink( stalePath.constData() );
+
+    const auto staleFd = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+    sockaddr_un address = { };
+    address.sun_family = AF_UNIX;
+    qstrncpy( address.sun_path, stalePath.constData(), sizeof( address.sun_path ) );
+    QCOMPARE( ::bind( staleFd, reinterpret_cast< sockaddr * >( &address ), sizeof( address ) ), 0 );
+    ::close( staleFd );
+
+    JQHttpServer::LocalServerManage staleServerManage;
+    QCOMPARE( staleServerManage.listen( "JQHttpServerStaleSocketTest" ), true );
+#endif
+}
+
+void OverallTest::multiListenTest()
+{
+    JQHttpServer::TcpServerManage tcpServerManage;
+
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QList< JQHttpServer::ListenEndpoint > listenEndpoints;
+    listenEndpoints.push_back( JQHttpServer::ListenEndpoint( QHostAddress::AnyIPv4, 23431 ) );
+    listenEndpoints.push_back( JQHttpServer::ListenEndpoint( QHostAddress::LocalHost, 23432 ) );
+    listenEndpoints.push_back( JQHttpServer::ListenEndpoint( QString( "JQHttpServerMultiListenTest" ) ) );
+
+    QCOMPARE( tcpServerManage.listen( listenEndpoints ), true );
+    QCOMPARE( tcpServerManage.status()[ "listenEndpoints" ].toArray().size(), 3 );
+
+    // 同一个处理线程池处理所有地址的请求
+    for ( const auto &url: QStringList( { "http://127.0.0.1:23431/", "http://127.0.0.1:23432/" } ) )
+    {
+        const auto &&reply = JQNet::HTTP::get( url );
+        QCOMPARE( reply.first, true );
+        QCOMPARE( reply.second, QByteArray( "OK" ) );
+    }
+
+    QLocalSocket socket;
+    socket.connectToServer( "JQHttpServerMultiListenTest" );
+    QCOMPARE( socket.waitForConnected( 1000 ), true );
+
+    socket.write( "GET / HTTP/1.1\r\n\r\n" );
+
+    QByteArray buffer;
+    while ( socket.waitForReadyRead( 5000 ) )
+    {
+        buffer.append( socket.readAll() );
+    }
+    buffer.append( socket.readAll() );
+
+    QCOMPARE( buffer.endsWith( "OK" ), true );
+    QTRY_COMPARE( tcpServerManage.status()[ "accept" ].toObject()[ "acceptedCount" ].toInt(), 3 );
+
+    // 地址被占用时整体失败，已经打开的监听也会关闭
+    JQHttpServer::TcpServerManage conflictServerManage;
+    QCOMPARE( conflictServerManage.listen( QList< JQHttpServer::ListenEndpoint >( { JQHttpServer::ListenEndpoint( QHostAddress::AnyIPv4, 23433 ), JQHttpServer::ListenEndpoint( QHostAddress::AnyIPv4, 23431 ) } ) ), false );
+    QCOMPARE( conflictServerManage.status()[ "isRunning" ].toBool(), false );
+}
+
+void OverallTest::inheritedListenSocketTest()
+{
+#ifdef Q_OS_UNIX
+    // 模拟父进程（或者 systemd）先 listen，再把 socket 交给服务
+    QTcpServer parentServer;
+    QCOMPARE( parentServer.listen( QHostAddress::AnyIPv4, 23434 ), true );
+
+    const auto socketDescriptor = dup( static_cast< int >( parentServer.socketDescriptor() ) );
+    QCOMPARE( socketDescriptor >= 0, true );
+
+    // 启动之前到达的连接在内核里排队，不会被拒绝
+    QTcpSocket earlySocket;
+    earlySocket.connectToHost( "127.0.0.1", 23434 );
+    QCOMPARE( earlySocket.waitForConnected( 1000 ), true );
+    earlySocket.write( "GET / HTTP/1.1\r\n\r\n" );
+    earlySocket.flush();
+
+    parentServer.close();
+
+    JQHttpServer::SocketOptions socketOptions;
+    socketOptions.receiveBufferSize = 32 * 1024;
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setSocketOptions( socketOptions );
+
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QList< JQHttpServer::ListenEndpoint >( { JQHttpServer::ListenEndpoint::fromSocketDescriptor( socketDescriptor ) } ) ), true );
+    QCOMPARE( tcpServerManage.status()[ "listenEndpoints" ].toArray().first().toString(), QString( "fd:%1" ).arg( socketDescriptor ) );
+
+    // 继承来的 fd 也要设置监听 socket 上的选项
+    int       receiveBufferSize = 0;
+    socklen_t length            = sizeof( receiveBufferSize );
+    QCOMPARE( getsockopt( static_cast< int >( socketDescriptor ), SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, &length ), 0 );
+#ifdef Q_OS_LINUX
+    QCOMPARE( receiveBufferSize, socketOptions.receiveBufferSize * 2 ); // Linux 返回的是设置值的两倍
+#else
+    QCOMPARE( receiveBufferSize >= socketOptions.receiveBufferSize, true );
+#endif
+
+    QByteArray buffer;
+    while ( earlySocket.waitForReadyRead( 5000 ) )
+    {
+        buffer.append( earlySocket.readAll() );
+    }
+    buffer.append( earlySocket.readAll() );
+    QCOMPARE( buffer.endsWith( "OK" ), true );
+
+    const auto &&reply = JQNet::HTTP::get( "http://127.0.0.1:23434/" );
     QCOMPARE( reply.first, true );
-    QCOMPARE( reply.second, QByteArray( "->/httpPostTest/<-->append data<-" ) );
+    QCOMPARE( reply.second, QByteArray( "OK" ) );
+
+    // 不是传给当前进程的 LISTEN_FDS 要忽略
+    qputenv( "LISTEN_PID", "1" );
+    qputenv( "LISTEN_FDS", "1" );
+    QCOMPARE( JQHttpServer::AbstractManage::systemdListenEndpoints().isEmpty(), true );
+    qunsetenv( "LISTEN_PID" );
+    qunsetenv( "LISTEN_FDS" );
+#else
+    QSKIP( "inherited listen socket is only supported on Unix" );
+#endif
+}
+
+void OverallTest::listenSocketHandoffTest()
+{
+#ifdef Q_OS_UNIX
+    JQHttpServer::TcpServerManage oldServerManage;
+    oldServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "old" );
+    } );
+
+    QCOMPARE( oldServerManage.listen( QHostAddress::AnyIPv4, 23435 ), true );
+    QCOMPARE( oldServerManage.startListenSocketHandoff( "JQHttpServerHandoffTest" ), true );
+
+    QSignalSpy handedOffSpy( &oldServerManage, &JQHttpServer::AbstractManage::listenSocketsHandedOff );
+
+    // 旧进程的交接在当前线程的事件循环里处理，所以在其他线程接收
+    auto future = QtConcurrent::run( [ ]()
+    {
+        return JQHttpServer::AbstractManage::receiveListenSockets( "JQHttpServerHandoffTest" );
+    } );
+
+    QTRY_COMPARE( future.isFinished(), true );
+    QCOMPARE( future.result().size(), 1 );
+    QCOMPARE( handedOffSpy.count(), 1 );
+
+    JQHttpServer::TcpServerManage newServerManage;
+    newServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "new" );
+    } );
+
+    QCOMPARE( newServerManage.listen( future.result() ), true );
+
+    const auto &&reply = JQNet::HTTP::get( "http://127.0.0.1:23435/" );
+    QCOMPARE( reply.first, true );
+    QCOMPARE( reply.second, QByteArray( "new" ) );
+
+    QCOMPARE( oldServerManage.waitForSessionsFinished( 5000 ), true );
+
+    // 没有旧进程时直接返回空
+    QCOMPARE( JQHttpServer::AbstractManage::receiveListenSockets( "JQHttpServerHandoffTest", 100 ).isEmpty(), true );
+
+    // 名字正在被使用时不能抢占，对方没有交出监听 socket
+    {
+        JQHttpServer::TcpServerManage runningServerManage;
+        QCOMPARE( runningServerManage.startListenSocketHandoff( "JQHttpServerHandoffTest" ), true );
+        QCOMPARE( newServerManage.startListenSocketHandoff( "JQHttpServerHandoffTest" ), false );
+        QCOMPARE( QFile::exists( QDir::tempPath() + "/JQHttpServerHandoffTest" ), true );
+    }
+
+    QCOMPARE( QFile::exists( QDir::tempPath() + "/JQHttpServerHandoffTest" ), false );
+
+    // 异常退出留下的 socket 文件可以直接使用
+    const auto &&stalePath = QFile::encodeName( QDir::tempPath() + "/JQHttpServerHandoffTest" );
+    const auto staleFd = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+    sockaddr_un address = { };
+    address.sun_family = AF_UNIX;
+    qstrncpy( address.sun_path, stalePath.constData(), sizeof( address.sun_path ) );
+    QCOMPARE( ::bind( staleFd, reinterpret_cast< sockaddr * >( &address ), sizeof( address ) ), 0 );
+    ::close( staleFd );
+
+    QCOMPARE( newServerManage.startListenSocketHandoff( "JQHttpServerHandoffTest" ), true );
+    QCOMPARE( QFile::exists( QDir::tempPath() + "/JQHttpServerHandoffTest" ), true );
+#else
+    QSKIP( "listen socket handoff is only supported on Unix" );
+#endif
+}
+
+void OverallTest::gracefulShutdownTest()
+{
+    QAtomicInt startedCount      = 0;
+    QAtomicInt slowSessionExists = 0;
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setHttpAcceptedCallback( [ &startedCount, &slowSessionExists ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        ++startedCount;
+
+        // /slow 超过截止时间，会被强制断开
+        const auto isSlow = session->requestUrl() == "/slow";
+        QThread::msleep( ( isSlow ) ? ( 4000 ) : ( 200 ) );
+
+        // 强制断开只关闭连接，处理函数返回之前 session 不会被删除
+        if ( isSlow ) { slowSessionExists = !session.isNull(); }
+
+        if ( session ) { session->replyText( "OK" ); }
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::AnyIPv4, 23436 ), true );
+
+    QTcpSocket idleSocket;
+    QTcpSocket fastSocket;
+    QTcpSocket slowSocket;
+    idleSocket.connectToHost( "127.0.0.1", 23436 );
+    fastSocket.connectToHost( "127.0.0.1", 23436 );
+    slowSocket.connectToHost( "127.0.0.1", 23436 );
+    QCOMPARE( idleSocket.waitForConnected( 1000 ), true );
+    QCOMPARE( fastSocket.waitForConnected( 1000 ), true );
+    QCOMPARE( slowSocket.waitForConnected( 1000 ), true );
+
+    fastSocket.write( "GET /fast HTTP/1.1\r\n\r\n" );
+    slowSocket.write( "GET /slow HTTP/1.1\r\n\r\n" );
+
+    QTRY_COMPARE( startedCount.loadAcquire(), 2 );
+    QTRY_COMPARE( tcpServerManage.status()[ "sessionCount" ].toInt(), 3 );
+
+    const auto result = tcpServerManage.shutdown( 2500 );
+    QCOMPARE( result.idleClosedCount, 1 );
+    QCOMPARE( result.completedCount, 1 );
+    QCOMPARE( result.abortedCount, 1 );
+    QCOMPARE( tcpServerManage.status()[ "isRunning" ].toBool(), false );
+
+    // 强制断开的 session 在处理函数返回后删除，shutdown 返回之前已经删除
+    QCOMPARE( slowSessionExists.loadAcquire(), 1 );
+    QCOMPARE( tcpServerManage.status()[ "sessionCount" ].toInt(), 0 );
+    QTRY_COMPARE( slowSocket.state(), QAbstractSocket::UnconnectedState );
+
+    // 完成的请求收到了完整的回复
+    fastSocket.waitForReadyRead( 1000 );
+    QCOMPARE( fastSocket.readAll().endsWith( "OK" ), true );
+}
+
+void OverallTest::reusePortTest()
+{
+#ifdef Q_OS_LINUX
+    JQHttpServer::SocketOptions socketOptions;
+    socketOptions.reusePort = true;
+
+    // prefork 模式下每个 worker 各自 listen 同一个端口
+    JQHttpServer::TcpServerManage firstServerManage;
+    JQHttpServer::TcpServerManage secondServerManage;
+    firstServerManage.setSocketOptions( socketOptions );
+    secondServerManage.setSocketOptions( socketOptions );
+
+    firstServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+    secondServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( firstServerManage.listen( QHostAddress::AnyIPv4, 23437 ), true );
+    QCOMPARE( secondServerManage.listen( QHostAddress::AnyIPv4, 23437 ), true );
+    QCOMPARE( firstServerManage.status()[ "socketOptions" ].toObject()[ "reusePort" ].toBool(), true );
+
+    for ( auto index = 0; index < 4; ++index )
+    {
+        const auto &&reply = JQNet::HTTP::get( "http://127.0.0.1:23437/" );
+        QCOMPARE( reply.first, true );
+        QCOMPARE( reply.second, QByteArray( "OK" ) );
+    }
+
+    // 没有 reusePort 时不能重复 listen
+    JQHttpServer::TcpServerManage thirdServerManage;
+    QCOMPARE( thirdServerManage.listen( QHostAddress::AnyIPv4, 23437 ), false );
+#else
+    QSKIP( "SO_REUSEPORT load balancing is only supported on Linux" );
+#endif
+}
+
+void OverallTest::preforkTest()
+{
+#ifdef Q_OS_UNIX
+    QProcess process;
+    process.setProcessChannelMode( QProcess::ForwardedErrorChannel );
+
+    QJsonObject status;
+    QByteArray  buffer;
+    auto        stoppedCount = 0;
+
+    const auto readOutput = [ & ]()
+    {
+        buffer.append( process.readAllStandardOutput() );
+
+        auto lineEnd = -1;
+        while ( ( lineEnd = buffer.indexOf( '\n' ) ) >= 0 )
+        {
+            const auto line = buffer.left( lineEnd );
+            buffer.remove( 0, lineEnd + 1 );
+
+            if ( line == "stopped" )
+            {
+                ++stoppedCount;
+            }
+            else
+            {
+                status = QJsonDocument::fromJson( line ).object();
+            }
+        }
+    };
+    QObject::connect( &process, &QProcess::readyReadStandardOutput, readOutput );
+
+    const auto workerObject = [ & ](const int index)
+    {
+        return status[ "workers" ].toArray()[ index ].toObject();
+    };
+    const auto reportedWorkerCount = [ & ]()
+    {
+        auto result = 0;
+        for ( const auto &worker: status[ "workers" ].toArray() )
+        {
+            if ( !worker.toObject()[ "status" ].toObject().isEmpty() ) { ++result; }
+        }
+        return result;
+    };
+    const auto acceptedCount = [ ](const QJsonObject &managerStatus)
+    {
+        return managerStatus[ "accept" ].toObject()[ "acceptedCount" ].toInt();
+    };
+
+    process.start( QCoreApplication::applicationFilePath(), { "--prefork" } );
+    QCOMPARE( process.waitForStarted(), true );
+
+    QTRY_COMPARE_WITH_TIMEOUT( reportedWorkerCount(), 2, 10 * 1000 );
+
+    // 两个 worker 共用 supervisor 创建的监听 socket
+    for ( auto index = 0; index < 8; ++index )
+    {
+        const auto &&reply = JQNet::HTTP::get( "http://127.0.0.1:23464/" );
+        QCOMPARE( reply.first, true );
+        QCOMPARE( reply.second.startsWith( "worker:" ), true );
+    }
+
+    // 计数相加，配置项不相加
+    QTRY_VERIFY_WITH_TIMEOUT( acceptedCount( status[ "total" ].toObject() ) >= 8, 10 * 1000 );
+    {
+        const auto &&total        = status[ "total" ].toObject();
+        const auto &&firstStatus  = workerObject( 0 )[ "status" ].toObject();
+        const auto &&secondStatus = workerObject( 1 )[ "status" ].toObject();
+
+        QCOMPARE( acceptedCount( total ), acceptedCount( firstStatus ) + acceptedCount( secondStatus ) );
+        QCOMPARE( total[ "accept" ].toObject()[ "listenBacklog" ].toInt(), firstStatus[ "accept" ].toObject()[ "listenBacklog" ].toInt() );
+        QCOMPARE( total[ "handlePool" ].toObject()[ "threadCount" ].toInt(), 1 );
+        QCOMPARE( status[ "workerCount" ].toInt(), 2 );
+        QCOMPARE( status[ "restartCount" ].toInt(), 0 );
+    }
+
+    // 退出的 worker 会被重新 fork
+    const auto killedPid = workerObject( 0 )[ "pid" ].toInt();
+    QVERIFY( killedPid > 0 );
+    QCOMPARE( kill( killedPid, SIGKILL ), 0 );
+
+    QTRY_VERIFY_WITH_TIMEOUT( ( workerObject( 0 )[ "pid" ].toInt() > 0 ) && ( workerObject( 0 )[ "pid" ].toInt() != killedPid ), 10 * 1000 );
+    QCOMPARE( workerObject( 0 )[ "restartCount" ].toInt(), 1 );
+    QCOMPARE( status[ "restartCount" ].toInt(), 1 );
+    QTRY_COMPARE_WITH_TIMEOUT( reportedWorkerCount(), 2, 10 * 1000 );
+
+    // supervisor 收到 SIGTERM 后通知 worker，worker 在 watchStop 的回调里退出
+    process.terminate();
+    QCOMPARE( process.waitForFinished( 10 * 1000 ), true );
+    readOutput();
+
+    QCOMPARE( process.exitStatus(), QProcess::NormalExit );
+    QCOMPARE( process.exitCode(), 0 );
+    QCOMPARE( stoppedCount, 2 );
+#else
+    QSKIP( "prefork is only supported on Unix" );
+#endif
+}
+
+void OverallTest::cpuAffinityTest()
+{
+    QCOMPARE( JQHttpServer::AbstractManage::cpuListFromString( "0-2,4,x,4" ), QList< int >( { 0, 1, 2, 4 } ) );
+    QCOMPARE( JQHttpServer::AbstractManage::numaNodeCpus().isEmpty(), false );
+
+#ifdef Q_OS_LINUX
+    JQHttpServer::CpuAffinity cpuAffinity;
+    cpuAffinity.serverThreadCpus = { 0 };
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setCpuAffinity( cpuAffinity );
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::AnyIPv4, 23441 ), true );
+
+    const auto &&reply = JQNet::HTTP::get( "http://127.0.0.1:23441/" );
+    QCOMPARE( reply.first, true );
+    QCOMPARE( reply.second, QByteArray( "OK" ) );
+
+    // 没有指定处理线程的核心时，自动使用服务线程所在节点的核心
+    const auto &&cpuAffinityStatus = tcpServerManage.status()[ "cpuAffinity" ].toObject();
+    QCOMPARE( cpuAffinityStatus[ "serverThreadCpus" ].toArray(), QJsonArray( { 0 } ) );
+    QCOMPARE( cpuAffinityStatus[ "handleThreadCpus" ].toArray().isEmpty(), false );
+
+    // 清空之后线程恢复成所有核心
+    const auto allowedCpuCount = [ ]()
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO( &cpuSet );
+        sched_getaffinity( 0, sizeof( cpuSet ), &cpuSet );
+        return CPU_COUNT( &cpuSet );
+    };
+
+    JQHttpServer::HandlePool handlePool( "cpuAffinityTest", 1 );
+    const auto handleThreadCpuCount = [ &handlePool, &allowedCpuCount ]()
+    {
+        auto result = 0;
+        handlePool.start( [ &result, &allowedCpuCount ]() { result = allowedCpuCount(); } );
+        handlePool.waitForDone();
+        return result;
+    };
+
+    handlePool.setCpuAffinity( { 0 } );
+    QCOMPARE( handleThreadCpuCount(), 1 );
+
+    handlePool.setCpuAffinity( { } );
+    QCOMPARE( handleThreadCpuCount() >= allowedCpuCount(), true );
+
+    // Service 的路由线程池和默认线程池绑在同样的核心上
+    RouteHandlePoolProcessor processor;
+
+    QMap< JQHttpServer::ServiceConfigEnum, QVariant > config;
+    config[ JQHttpServer::ServiceHttpListenPort ]            = 23463;
+    config[ JQHttpServer::ServiceProcessor ]                 = QVariant::fromValue( QPointer< QObject >( &processor ) );
+    config[ JQHttpServer::ServiceRouteHandleMaxThreadCount ] = QVariantMap( { { "/slow", 1 } } );
+    config[ JQHttpServer::ServiceHandleThreadCpus ]          = "0";
+
+    const auto service = JQHttpServer::Service::createService( config );
+    QCOMPARE( service.isNull(), false );
+
+    const auto &&routeHandlePools = service->status()[ "routeHandlePools" ].toArray();
+    QCOMPARE( routeHandlePools.isEmpty(), false );
+    for ( const auto &value: routeHandlePools )
+    {
+        QCOMPARE( value.toObject()[ "cpus" ].toArray(), QJsonArray( { 0 } ) );
+    }
+#else
+    QSKIP( "cpu affinity is only supported on Linux" );
+#endif
+}
+
+void OverallTest::keepAliveTest()
+{
+    JQHttpServer::KeepAliveOptions keepAliveOptions;
+    keepAliveOptions.enabled = true;
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setKeepAliveOptions( keepAliveOptions );
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( session->requestUrl() );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::AnyIPv4, 23444 ), true );
+
+    QByteArray received;
+    QTcpSocket socket;
+    connect( &socket, &QIODevice::readyRead, [ &received, &socket ](){ received.append( socket.readAll() ); } );
+    socket.connectToHost( "127.0.0.1", 23444 );
+    QCOMPARE( socket.waitForConnected( 1000 ), true );
+
+    // 两个请求一次发出，第二个请求要交给下一个 session 处理
+    socket.write( "GET /first HTTP/1.1\r\n\r\nGET /second HTTP/1.1\r\n\r\n" );
+
+    QTRY_COMPARE( received.count( "Connection: keep-alive" ), 2 );
+    QCOMPARE( received.endsWith( "/second" ), true );
+
+    // 客户端要求关闭时回复后断开
+    received.clear();
+    socket.write( "GET /third HTTP/1.1\r\nConnection: close\r\n\r\n" );
+
+    QTRY_COMPARE( socket.state(), QAbstractSocket::UnconnectedState );
+    QCOMPARE( received.contains( "Connection: close" ), true );
+    QCOMPARE( received.endsWith( "/third" ), true );
+
+    QCOMPARE( tcpServerManage.status()[ "keepAlive" ].toObject()[ "requestCount" ].toInt(), 2 );
+}
+
+void OverallTest::http2CleartextTest()
+{
+    JQHttpServer::Http2Options http2Options;
+    http2Options.enabled = true;
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setHttp2Options( http2Options );
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( QString( "%1:%2" ).arg( session->requestCrlf(), session->requestUrl() ) );
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::AnyIPv4, 23453 ), true );
+
+    // 客户端已知服务端支持 HTTP/2，直接发送连接前言，所有请求复用一个连接
+    QNetworkAccessManager networkAccessManager;
+    QList< QNetworkReply * > replies;
+    for ( auto index = 0; index < 16; ++index )
+    {
+        QNetworkRequest request( QUrl( QString( "http://127.0.0.1:23453/%1" ).arg( index ) ) );
+        request.setAttribute( QNetworkRequest::Http2DirectAttribute, true );
+        replies.push_back( networkAccessManager.get( request ) );
+    }
+
+    for ( auto index = 0; index < replies.size(); ++index )
+    {
+        auto reply = replies[ index ];
+        QTRY_COMPARE( reply->isFinished(), true );
+        QCOMPARE( reply->error(), QNetworkReply::NoError );
+        QCOMPARE( reply->attribute( QNetworkRequest::Http2WasUsedAttribute ).toBool(), true );
+        QCOMPARE( reply->readAll(), QString( "HTTP/2:/%1" ).arg( index ).toUtf8() );
+
+        reply->deleteLater();
+    }
+
+    const auto &&http2 = tcpServerManage.status()[ "http2" ].toObject();
+    QCOMPARE( http2[ "cleartextCount" ].toInt(), 1 );
+    QCOMPARE( http2[ "connectionCount" ].toInt(), 1 );
+    QCOMPARE( http2[ "streamCount" ].toInt(), 16 );
+
+    // 同一个端口上的 HTTP/1.1 请求不受影响
+    QTcpSocket socket;
+    socket.connectToHost( "127.0.0.1", 23453 );
+    QCOMPARE( socket.waitForConnected( 1000 ), true );
+
+    socket.write( "GET /http1 HTTP/1.1\r\n\r\n" );
+    QTRY_COMPARE( socket.state(), QAbstractSocket::UnconnectedState );
+    QCOMPARE( socket.readAll().endsWith( "HTTP/1.1:/http1" ), true );
+
+    // HPACK 炸弹：4K 的条目加入动态表后用 1 字节的索引（0xbe）反复引用，头部块只有 24K，解码后有 80M
+    const auto http2Frame = [ ](const quint8 type, const quint8 flags, const quint32 streamId, const QByteArray &payload)
+    {
+        QByteArray frame;
+        frame.append( static_cast< char >( ( payload.size() >> 16 ) & 0xff ) );
+        frame.append( static_cast< char >( ( payload.size() >> 8 ) & 0xff ) );
+        frame.append( static_cast< char >( payload.size() & 0xff ) );
+        frame.append( static_cast< char >( type ) );
+        frame.append( static_cast< char >( flags ) );
+        frame.append( static_cast< char >( ( streamId >> 24 ) & 0xff ) );
+        frame.append( static_cast< char >( ( streamId >> 16 ) & 0xff ) );
+        frame.append( static_cast< char >( ( streamId >> 8 ) & 0xff ) );
+        frame.append( static_cast< char >( streamId & 0xff ) );
+        frame.append( payload );
+        return frame;
+    };
+
+    // GET、/、http、:authority: localhost
+    const auto requestHeaderBlock = QByteArray::fromHex( "828486" ) + QByteArray( "\x01\x09localhost", 11 );
+
+    // 加入动态表的字面量，名字 x，值的长度 4000
+    const auto bombHeaderBlock = requestHeaderBlock + QByteArray::fromHex( "400178" ) + QByteArray::fromHex( "7fa11e" ) + QByteArray( 4000, 'a' ) + QByteArray( 20000, '\xbe' );
+
+    QTcpSocket bombSocket;
+    bombSocket.connectToHost( "127.0.0.1", 23453 );
+    QCOMPARE( bombSocket.waitForConnected( 1000 ), true );
+
+    QByteArray bombReceived;
+    QObject::connect( &bombSocket, &QIODevice::readyRead, [ &bombSocket, &bombReceived ]() { bombReceived.append( bombSocket.readAll() ); } );
+
+    bombSocket.write( "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" );
+    bombSocket.write( http2Frame( 0x4, 0x0, 0, { } ) );
+    bombSocket.write( http2Frame( 0x1, 0x1, 1, bombHeaderBlock.left( 16000 ) ) );
+    bombSocket.write( http2Frame( 0x9, 0x4, 1, bombHeaderBlock.mid( 16000 ) ) );
+
+    // SETTINGS_MAX_HEADER_LIST_SIZE 是默认的 64K
+    QTRY_VERIFY( bombReceived.contains( QByteArray::fromHex( "000600010000" ) ) );
+    QTRY_VERIFY( bombReceived.contains( "431" ) );
+
+    // 动态表仍然和客户端一致，同一个连接上的下一个请求正常处理
+    bombSocket.write( http2Frame( 0x1, 0x5, 3, requestHeaderBlock ) );
+    QTRY_VERIFY( bombReceived.contains( "HTTP/2:/" ) );
+    QCOMPARE( bombSocket.state(), QAbstractSocket::ConnectedState );
+}
+
+void OverallTest::webSocketTest()
+{
+    JQHttpServer::WebSocketOptions webSocketOptions;
+    webSocketOptions.enabled        = true;
+    webSocketOptions.maxMessageSize = 1024;
+    webSocketOptions.allowedOrigins = QStringList( { "http://127.0.0.1:23456" } );
+
+    QMutex       closeMutex;
+    QList< int > closeCodes;
+
+    JQHttpServer::TcpServerManage tcpServerManage;
+    tcpServerManage.setWebSocketOptions( webSocketOptions );
+    tcpServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( session->requestUrl() );
+    } );
+    tcpServerManage.setWebSocketAcceptCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        return !session->requestUrl().startsWith( "/private" );
+    } );
+    tcpServerManage.setWebSocketMessageCallback( [ ]( const QPointer< JQHttpServer::WebSocket > &webSocket, const QByteArray &message, const bool isText )
+    {
+        if ( isText )
+        {
+            webSocket->sendText( webSocket->requestUrlPath() + ":" + QString::fromUtf8( message ) );
+        }
+        else
+        {
+            webSocket->sendBinary( message );
+        }
+    } );
+    tcpServerManage.setWebSocketClosedCallback( [ & ]( const QPointer< JQHttpServer::WebSocket > &, const int closeCode )
+    {
+        closeMutex.lock();
+        closeCodes.push_back( closeCode );
+        closeMutex.unlock();
+    } );
+
+    QCOMPARE( tcpServerManage.listen( QHostAddress::AnyIPv4, 23456 ), true );
+
+    // 客户端发出的帧必须加掩码
+    auto clientFrame = [ ]( const int firstByte, const QByteArray &payload, const bool masked = true )
+    {
+        QByteArray frame;
+        frame.append( static_cast< char >( firstByte ) );
+        frame.append( static_cast< char >( ( ( masked ) ? ( 0x80 ) : ( 0 ) ) | payload.size() ) );
+        if ( !masked ) { return frame + payload; }
+
+        const QByteArray mask( "\x12\x34\x56\x78", 4 );
+        frame.append( mask );
+        for ( auto index = 0; index < payload.size(); ++index )
+        {
+            frame.append( static_cast< char >( payload[ index ] ^ mask[ index % 4 ] ) );
+        }
+
+        return frame;
+    };
+
+    auto connectWebSocket = [ ]( QTcpSocket &socket, const QByteArray &extensions = QByteArray() )
+    {
+        socket.connectToHost( "127.0.0.1", 23456 );
+        if ( !socket.waitForConnected( 1000 ) ) { return QByteArray(); }
+
+        // RFC 6455 1.3 的示例 key
+        socket.write( "GET /chat?room=1 HTTP/1.1\r\n"
+                      "Host: 127.0.0.1\r\n"
+                      "Upgrade: websocket\r\n"
+                      "Connection: keep-alive, Upgrade\r\n"
+                      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                      "Sec-WebSocket-Version: 13\r\n" +
+                      ( ( extensions.isEmpty() ) ? ( QByteArray() ) : ( "Sec-WebSocket-Extensions: " + extensions + "\r\n" ) ) +
+                      "\r\n" );
+
+        // 逐字节读取，不读走响应后面的帧
+        QByteArray response;
+        while ( !response.endsWith( "\r\n\r\n" ) && ( socket.bytesAvailable() || socket.waitForReadyRead( 3000 ) ) )
+        {
+            response += socket.read( 1 );
+        }
+
+        return response;
+    };
+
+    auto readFrames = [ ]( QTcpSocket &socket, const int size )
+    {
+        QByteArray received = socket.readAll();
+        while ( ( received.size() < size ) && socket.waitForReadyRead( 3000 ) ) { received += socket.readAll(); }
+
+        return received;
+    };
+
+    // 返回握手被拒绝时的响应
+    auto rejectedResponse = [ ]( const QByteArray &path, const QByteArray &key, const QByteArray &origin = QByteArray() )
+    {
+        QTcpSocket socket;
+        socket.connectToHost( "127.0.0.1", 23456 );
+        if ( !socket.waitForConnected( 1000 ) ) { return QByteArray(); }
+
+        socket.write( "GET " + path + " HTTP/1.1\r\n"
+                      "Host: 127.0.0.1\r\n"
+                      "Upgrade: websocket\r\n"
+                      "Connection: Upgrade\r\n"
+                      "Sec-WebSocket-Key: " + key + "\r\n"
+                      "Sec-WebSocket-Version: 13\r\n" +
+                      ( ( origin.isEmpty() ) ? ( QByteArray() ) : ( "Origin: " + origin + "\r\n" ) ) +
+                      "\r\n" );
+
+        QByteArray response;
+        while ( !response.contains( "\r\n\r\n" ) && socket.waitForReadyRead( 3000 ) ) { response += socket.readAll(); }
+
+        return response;
+    };
+
+    // 握手、文本消息、分片的二进制消息、ping
+    {
+        QTcpSocket socket;
+        const auto &&response = connectWebSocket( socket );
+        QCOMPARE( response.startsWith( "HTTP/1.1 101 Switching Protocols\r\n" ), true );
+        QCOMPARE( response.contains( "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kTYGzzhZRbK+xOo=\r\n" ), true );
+        QCOMPARE( response.contains( "Sec-WebSocket-Extensions" ), false );
+
+        socket.write( clientFrame( 0x81, "hello" ) );
+        QCOMPARE( readFrames( socket, 13 ), QByteArray( "\x81\x0b/chat:hello", 13 ) );
+
+        socket.write( clientFrame( 0x02, "ab" ) + clientFrame( 0x89, "p" ) + clientFrame( 0x80, "cd" ) );
+        QCOMPARE( readFrames( socket, 9 ), QByteArray( "\x8a\x01p\x82\x04" "abcd", 9 ) );
+
+        socket.write( clientFrame( 0x88, QByteArray( "\x03\xe8", 2 ) ) );
+        QCOMPARE( readFrames( socket, 4 ), QByteArray( "\x88\x02\x03\xe8", 4 ) );
+        QTRY_COMPARE( socket.state(), QAbstractSocket::UnconnectedState );
+    }
+
+    // 一次只读到帧头的一部分（掩码还没有收完）时等待剩下的数据
+    {
+        QTcpSocket socket;
+        QCOMPARE( connectWebSocket( socket ).startsWith( "HTTP/1.1 101" ), true );
+
+        const auto &&frame = clientFrame( 0x81, "split" );
+
+        socket.write( frame.left( 3 ) );
+        QCOMPARE( socket.waitForBytesWritten( 1000 ), true );
+        QTest::qWait( 100 );
+
+        socket.write( frame.mid( 3 ) );
+        QCOMPARE( readFrames( socket, 13 ), QByteArray( "\x81\x0b/chat:split", 13 ) );
+    }
+
+    // 没有掩码的帧是协议错误，服务端发送 1002 后断开
+    {
+        QTcpSocket socket;
+        QCOMPARE( connectWebSocket( socket ).startsWith( "HTTP/1.1 101" ), true );
+
+        socket.write( clientFrame( 0x81, "hello", false ) );
+        QCOMPARE( readFrames( socket, 4 ), QByteArray( "\x88\x02\x03\xea", 4 ) );
+        QTRY_COMPARE( socket.state(), QAbstractSocket::UnconnectedState );
+    }
+
+    // 无效的 UTF-8 文本是 1007
+    {
+        QTcpSocket socket;
+        QCOMPARE( connectWebSocket( socket ).startsWith( "HTTP/1.1 101" ), true );
+
+        socket.write( clientFrame( 0x81, QByteArray( "\xc0\xaf", 2 ) ) );
+        QCOMPARE( readFrames( socket, 4 ), QByteArray( "\x88\x02\x03\xef", 4 ) );
+        QTRY_COMPARE( socket.state(), QAbstractSocket::UnconnectedState );
+    }
+
+    // 无效的 key 回复 400，Origin 不允许或者回调拒绝时回复 403，都不会升级
+    QCOMPARE( rejectedResponse( "/chat", "abc" ).startsWith( "HTTP/1.1 400" ), true );
+    QCOMPARE( rejectedResponse( "/chat", "dGhlIHNhbXBsZSBub25jZQ==", "http://evil.example" ).startsWith( "HTTP/1.1 403" ), true );
+    QCOMPARE( rejectedResponse( "/private", "dGhlIHNhbXBsZSBub25jZQ==", "http://127.0.0.1:23456" ).startsWith( "HTTP/1.1 403" ), true );
+
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+    // RFC 7692 7.2.3.1 的示例，压缩后的 "Hello"
+    {
+        QTcpSocket socket;
+        const auto &&response = connectWebSocket( socket, "permessage-deflate; client_max_window_bits" );
+        QCOMPARE( response.contains( "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; client_no_context_takeover\r\n" ), true );
+
+        socket.write( clientFrame( 0xc1, QByteArray( "\xf2\x48\xcd\xc9\xc9\x07\x00", 7 ) ) );
+        QCOMPARE( readFrames( socket, 13 ), QByteArray( "\x81\x0b/chat:Hello", 13 ) );
+    }
+#endif
+
+    QTRY_COMPARE( tcpServerManage.webSockets().size(), 0 );
+
+    // 最后一个连接没有发送 close 就断开了，是 1006
+    closeMutex.lock();
+    std::sort( closeCodes.begin(), closeCodes.end() );
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+    QCOMPARE( closeCodes, QList< int >( { 1000, 1002, 1006, 1007 } ) );
+#else
+    QCOMPARE( closeCodes, QList< int >( { 1000, 1002, 1007 } ) );
+#endif
+    closeMutex.unlock();
+
+    const auto &&webSocket = tcpServerManage.status()[ "webSocket" ].toObject();
+    QCOMPARE( webSocket[ "activeConnectionCount" ].toInt(), 0 );
+    QCOMPARE( webSocket[ "rejectedCount" ].toInt(), 2 );
+#ifdef JQHTTPSERVER_ZLIB_ENABLED
+    QCOMPARE( webSocket[ "connectionCount" ].toInt(), 4 );
+    QCOMPARE( webSocket[ "messageCount" ].toInt(), 3 );
+#else
+    QCOMPARE( webSocket[ "connectionCount" ].toInt(), 3 );
+    QCOMPARE( webSocket[ "messageCount" ].toInt(), 2 );
+#endif
+
+    // 没有 Upgrade 的请求照常处理
+    const auto &&reply = JQNet::HTTP::get( "http://127.0.0.1:23456/plain" );
+    QCOMPARE( reply.first, true );
+    QCOMPARE( reply.second, QByteArray( "/plain" ) );
+}
+
+#ifndef QT_NO_SSL
+void OverallTest::httpsGetTest()
+{
+    const auto &&reply = JQNet::HTTP::get( "https://127.0.0.1:23415/httpGetTest/" );
+    QCOMPARE( reply.first, true );
+    QCOMPARE( reply.second, QByteArray( "->/httpGetTest/<--><-" ) );
+}
+
+void OverallTest::httpsPostTest()
+{
+    const auto &&reply = JQNet::HTTP::post( "https://127.0.0.1:23415/httpPostTest/", "append data" );
+    QCOMPARE( reply.first, true );
+    QCOMPARE( reply.second, QByteArray( "->/httpPostTest/<-->append data<-" ) );
+}
+
+void OverallTest::httpsHandshakeThreadTest()
+{
+    JQHttpServer::HandshakeOptions handshakeOptions;
+    handshakeOptions.threadCount = 2;
+    handshakeOptions.maxInFlight = 2;
+
+    JQHttpServer::SslServerManage sslServerManage;
+    sslServerManage.setHandshakeOptions( handshakeOptions );
+    sslServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( session->requestUrl() );
+    } );
+
+    QCOMPARE( sslServerManage.listen( QHostAddress::Any, 23442, ":/server.crt", ":/server.key" ), true );
+
+    // 握手在握手线程里完成，session 回到服务线程处理请求
+    QList< QFuture< QPair< bool, QByteArray > > > futures;
+    for ( auto index = 0; index < 8; ++index )
+    {
+        futures.push_back( QtConcurrent::run( [ index ]()
+        {
+            return JQNet::HTTP::get( QString( "https://127.0.0.1:23442/%1" ).arg( index ) );
+        } ) );
+    }
+
+    for ( auto index = 0; index < futures.size(); ++index )
+    {
+        QCOMPARE( futures[ index ].result().first, true );
+        QCOMPARE( futures[ index ].result().second, QString( "/%1" ).arg( index ).toUtf8() );
+    }
+
+    const auto &&handshake = sslServerManage.status()[ "handshake" ].toObject();
+    QCOMPARE( handshake[ "succeedCount" ].toInt(), 8 );
+    QCOMPARE( handshake[ "inFlight" ].toInt(), 0 );
+    QCOMPARE( handshake[ "maxInFlightReached" ].toInt() <= 2, true );
+
+    // 只连接不握手的客户端在超时后被断开
+    JQHttpServer::HandshakeOptions timeoutOptions;
+    timeoutOptions.timeout = 200;
+
+    JQHttpServer::SslServerManage timeoutServerManage;
+    timeoutServerManage.setHandshakeOptions( timeoutOptions );
+    QCOMPARE( timeoutServerManage.listen( QHostAddress::Any, 23443, ":/server.crt", ":/server.key" ), true );
+
+    QTcpSocket idleSocket;
+    idleSocket.connectToHost( "127.0.0.1", 23443 );
+    QCOMPARE( idleSocket.waitForConnected( 1000 ), true );
+    QCOMPARE( idleSocket.waitForDisconnected( 3000 ), true );
+    QTRY_COMPARE( timeoutServerManage.status()[ "handshake" ].toObject()[ "timeoutCount" ].toInt(), 1 );
+    QCOMPARE( timeoutServerManage.status()[ "handshake" ].toObject()[ "failedCount" ].toInt(), 0 );
+}
+
+void OverallTest::httpsCertificateSelectionTest()
+{
+#ifdef Q_OS_UNIX
+    JQHttpServer::ServerCertificate rsaCertificate;
+    rsaCertificate.crtFilePath = ":/server.crt";
+    rsaCertificate.keyFilePath = ":/server.key";
+
+    // EC 私钥不需要指定算法
+    JQHttpServer::ServerCertificate ecCertificate;
+    ecCertificate.crtFilePath = ":/server.ec.crt";
+    ecCertificate.keyFilePath = ":/server.ec.key";
+    ecCertificate.hostNames   = QStringList( { "ec.test" } );
+
+    JQHttpServer::SslServerManage sslServerManage;
+    sslServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( sslServerManage.listen( { JQHttpServer::ListenEndpoint( QHostAddress::Any, 23445 ) }, { rsaCertificate, ecCertificate } ), true );
+
+    const auto peerCertificate = [ ](const QString &sslPeerName)
+    {
+        QSslSocket sslSocket;
+        sslSocket.setPeerVerifyMode( QSslSocket::VerifyNone );
+        sslSocket.connectToHostEncrypted( "127.0.0.1", 23445, sslPeerName );
+        if ( !sslSocket.waitForEncrypted( 3000 ) ) { return QSslCertificate(); }
+
+        return sslSocket.peerCertificate();
+    };
+
+    // SNI 匹配的用 EC 证书，没有 SNI 的用默认证书
+    QCOMPARE( peerCertificate( "ec.test" ), QSslCertificate::fromPath( ":/server.ec.crt" ).first() );
+    QCOMPARE( peerCertificate( "other.test" ), QSslCertificate::fromPath( ":/server.crt" ).first() );
+    QCOMPARE( peerCertificate( { } ), QSslCertificate::fromPath( ":/server.crt" ).first() );
+
+    // ClientHello 只发了一部分就关闭写方向，不用等到超时就断开
+    QTcpSocket partialSocket;
+    partialSocket.connectToHost( "127.0.0.1", 23445 );
+    QCOMPARE( partialSocket.waitForConnected( 1000 ), true );
+    partialSocket.write( QByteArray::fromHex( "160301" ) );
+    QCOMPARE( partialSocket.waitForBytesWritten( 1000 ), true );
+    QTest::qWait( 100 );
+    shutdown( static_cast< int >( partialSocket.socketDescriptor() ), SHUT_WR );
+    QCOMPARE( partialSocket.waitForDisconnected( 3000 ), true );
+    QCOMPARE( sslServerManage.status()[ "handshake" ].toObject()[ "clientHelloTimeoutCount" ].toInt(), 0 );
+    QTRY_COMPARE( sslServerManage.status()[ "handshake" ].toObject()[ "inFlight" ].toInt(), 0 );
+
+    // 等待 ClientHello 的连接也计入进行中的握手
+    QTcpSocket idleSocket;
+    idleSocket.connectToHost( "127.0.0.1", 23445 );
+    QCOMPARE( idleSocket.waitForConnected( 1000 ), true );
+    QTRY_COMPARE( sslServerManage.status()[ "handshake" ].toObject()[ "inFlight" ].toInt(), 1 );
+    idleSocket.abort();
+    QTRY_COMPARE( sslServerManage.status()[ "handshake" ].toObject()[ "inFlight" ].toInt(), 0 );
+
+    const auto &&certificates = sslServerManage.status()[ "certificates" ].toArray();
+    QCOMPARE( certificates.size(), 2 );
+    QCOMPARE( certificates[ 0 ].toObject()[ "keyAlgorithm" ].toString(), QString( "rsa" ) );
+    QCOMPARE( certificates[ 0 ].toObject()[ "selectedCount" ].toInt(), 2 );
+    QCOMPARE( certificates[ 1 ].toObject()[ "keyAlgorithm" ].toString(), QString( "ec" ) );
+    QCOMPARE( certificates[ 1 ].toObject()[ "selectedCount" ].toInt(), 1 );
+
+    // 证书和私钥不匹配时 listen 失败
+    JQHttpServer::ServerCertificate mismatchCertificate;
+    mismatchCertificate.crtFilePath = ":/server.crt";
+    mismatchCertificate.keyFilePath = ":/server.ec.key";
+
+    JQHttpServer::SslServerManage mismatchServerManage;
+    QCOMPARE( mismatchServerManage.listen( { JQHttpServer::ListenEndpoint( QHostAddress::Any, 23446 ) }, { mismatchCertificate } ), false );
+
+    // 算法相同但不是同一对密钥
+    mismatchCertificate.keyFilePath = ":/server.other.key";
+    QCOMPARE( mismatchServerManage.listen( { JQHttpServer::ListenEndpoint( QHostAddress::Any, 23446 ) }, { mismatchCertificate } ), false );
+#else
+    QSKIP( "certificate selection is only supported on Unix" );
+#endif
+}
+
+void OverallTest::httpsCertificateReloadTest()
+{
+    QTemporaryDir temporaryDir;
+    QCOMPARE( temporaryDir.isValid(), true );
+
+    const auto crtFilePath = temporaryDir.filePath( "server.crt" );
+    const auto keyFilePath = temporaryDir.filePath( "server.key" );
+
+    // 和常见的证书轮换工具一样，先写临时文件再替换
+    const auto installFile = [ &temporaryDir ](const QString &sourceFilePath, const QString &targetFilePath)
+    {
+        const auto temporaryFilePath = temporaryDir.filePath( "install.tmp" );
+        QFile::remove( temporaryFilePath );
+        QFile::copy( sourceFilePath, temporaryFilePath );
+        QFile::remove( targetFilePath );
+        return QFile::rename( temporaryFilePath, targetFilePath );
+    };
+
+    QCOMPARE( installFile( ":/server.crt", crtFilePath ), true );
+    QCOMPARE( installFile( ":/server.key", keyFilePath ), true );
+
+    JQHttpServer::SslServerManage sslServerManage;
+    sslServerManage.setWatchCertificateFiles( true );
+    sslServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        session->replyText( "OK" );
+    } );
+
+    QCOMPARE( sslServerManage.listen( QHostAddress::Any, 23447, crtFilePath, keyFilePath ), true );
+
+    const auto peerCertificate = [ ]()
+    {
+        QSslSocket sslSocket;
+        sslSocket.setPeerVerifyMode( QSslSocket::VerifyNone );
+        sslSocket.connectToHostEncrypted( "127.0.0.1", 23447 );
+        if ( !sslSocket.waitForEncrypted( 3000 ) ) { return QSslCertificate(); }
+
+        return sslSocket.peerCertificate();
+    };
+
+    QCOMPARE( peerCertificate(), QSslCertificate::fromPath( ":/server.crt" ).first() );
+
+    QSslSocket existingSocket;
+    existingSocket.setPeerVerifyMode( QSslSocket::VerifyNone );
+    existingSocket.connectToHostEncrypted( "127.0.0.1", 23447 );
+    QCOMPARE( existingSocket.waitForEncrypted( 3000 ), true );
+
+    // 替换文件后新的握手使用新证书
+    QCOMPARE( installFile( ":/server.ec.crt", crtFilePath ), true );
+    QCOMPARE( installFile( ":/server.ec.key", keyFilePath ), true );
+
+    QTRY_COMPARE( peerCertificate(), QSslCertificate::fromPath( ":/server.ec.crt" ).first() );
+    QCOMPARE( sslServerManage.status()[ "certificateReload" ].toObject()[ "reloadCount" ].toInt() >= 1, true );
+
+    // 已经建立的连接不受影响
+    existingSocket.write( "GET / HTTP/1.1\r\n\r\n" );
+    QTRY_COMPARE( existingSocket.state(), QAbstractSocket::UnconnectedState );
+    QCOMPARE( existingSocket.readAll().endsWith( "OK" ), true );
+    QCOMPARE( existingSocket.peerCertificate(), QSslCertificate::fromPath( ":/server.crt" ).first() );
+
+    // 读取失败时继续使用原来的证书
+    JQHttpServer::ServerCertificate mismatchCertificate;
+    mismatchCertificate.crtFilePath = ":/server.crt";
+    mismatchCertificate.keyFilePath = ":/server.ec.key";
+
+    QCOMPARE( sslServerManage.reloadCertificates( { mismatchCertificate } ), false );
+    QCOMPARE( peerCertificate(), QSslCertificate::fromPath( ":/server.ec.crt" ).first() );
+}
+
+void OverallTest::certificateVerifyCacheTest()
+{
+    CertificateVerifyProcessor processor;
+
+    QMap< JQHttpServer::ServiceConfigEnum, QVariant > config;
+    config[ JQHttpServer::ServiceHttpsListenPort ]           = 23448;
+    config[ JQHttpServer::ServiceSslCrtFilePath ]            = ":/server.crt";
+    config[ JQHttpServer::ServiceSslKeyFilePath ]            = ":/server.key";
+    config[ JQHttpServer::ServiceProcessor ]                 = QVariant::fromValue( QPointer< QObject >( &processor ) );
+    config[ JQHttpServer::ServiceKeepAliveEnabled ]          = true;
+    config[ JQHttpServer::ServiceCertificateVerifyCacheTtl ] = 60 * 1000;
+
+    const auto service = JQHttpServer::Service::createService( config );
+    QCOMPARE( service.isNull(), false );
+
+    // 客户端证书直接用服务端的自签名证书
+    const auto request = [ ](const QByteArray &requests, const int replyCount)
+    {
+        QSslSocket sslSocket;
+        sslSocket.setPeerVerifyMode( QSslSocket::VerifyNone );
+        sslSocket.setLocalCertificate( ":/server.crt" );
+        sslSocket.setPrivateKey( ":/server.key" );
+        sslSocket.connectToHostEncrypted( "127.0.0.1", 23448 );
+        if ( !sslSocket.waitForEncrypted( 3000 ) ) { return false; }
+
+        sslSocket.write( requests );
+
+        QByteArray received;
+        while ( ( received.count( "\r\n\r\nOK" ) < replyCount ) && sslSocket.waitForReadyRead( 3000 ) )
+        {
+            received.append( sslSocket.readAll() );
+        }
+
+        return received.count( "\r\n\r\nOK" ) == replyCount;
+    };
+
+    // 同一个连接上的第二个请求不再验证，第二个连接命中缓存
+    QCOMPARE( request( "GET /hello HTTP/1.1\r\n\r\nGET /hello HTTP/1.1\r\n\r\n", 2 ), true );
+    QCOMPARE( request( "GET /hello HTTP/1.1\r\n\r\n", 1 ), true );
+
+    QCOMPARE( processor.verifyCount_.loadAcquire(), 1 );
+
+    const auto &&certificateVerify = service->status()[ "certificateVerify" ].toObject();
+    QCOMPARE( certificateVerify[ "cacheMissCount" ].toInt(), 1 );
+    QCOMPARE( certificateVerify[ "cacheHitCount" ].toInt(), 1 );
+    QCOMPARE( certificateVerify[ "pinnedCount" ].toInt(), 1 );
+}
+
+void OverallTest::http2Test()
+{
+    JQHttpServer::Http2Options http2Options;
+    http2Options.enabled            = true;
+    http2Options.maxRequestBodySize = 4 * 1024 * 1024;
+
+    JQHttpServer::SslServerManage sslServerManage;
+    sslServerManage.setHttp2Options( http2Options );
+    sslServerManage.setHttpAcceptedCallback( [ ]( const QPointer< JQHttpServer::Session > &session )
+    {
+        if ( session->requestUrl() == "/upload" )
+        {
+            session->replyText( QString::number( session->requestBody().size() ) );
+            return;
+        }
+
+        session->replyText( QString( "%1:%2:%3:%4" ).arg(
+                                session->requestMethod(),
+                                session->requestUrl(),
+                                session->requestHeader()[ "Content-Type" ],
+                                QString::fromUtf8( session->requestBody() ) ) );
+    } );
+
+    QCOMPARE( sslServerManage.listen( QHostAddress::Any, 23449, ":/server.crt", ":/server.key" ), true );
+
+    QNetworkAccessManager networkAccessManager;
+    QObject::connect( &networkAccessManager, &QNetworkAccessManager::sslErrors, [ ](QNetworkReply *reply, const QList< QSslError > &)
+    {
+        reply->ignoreSslErrors();
+    } );
+
+    // 同一个连接上并发多个流
+    QList< QNetworkReply * > replies;
+    for ( auto index = 0; index < 8; ++index )
+    {
+        QNetworkRequest request( QUrl( QString( "https://127.0.0.1:23449/%1" ).arg( index ) ) );
+        request.setAttribute( QNetworkRequest::Http2AllowedAttribute, true );
+        replies.push_back( networkAccessManager.get( request ) );
+    }
+
+    QNetworkRequest postRequest( QUrl( "https://127.0.0.1:23449/post" ) );
+    postRequest.setAttribute( QNetworkRequest::Http2AllowedAttribute, true );
+    postRequest.setHeader( QNetworkRequest::ContentTypeHeader, "text/plain" );
+    replies.push_back( networkAccessManager.post( postRequest, QByteArray( "Hello" ) ) );
+
+    for ( auto index = 0; index < replies.size(); ++index )
+    {
+        auto reply = replies[ index ];
+        QTRY_COMPARE( reply->isFinished(), true );
+        QCOMPARE( reply->error(), QNetworkReply::NoError );
+        QCOMPARE( reply->attribute( QNetworkRequest::Http2WasUsedAttribute ).toBool(), true );
+
+        if ( index < 8 )
+        {
+            QCOMPARE( reply->readAll(), QString( "GET:/%1::" ).arg( index ).toUtf8() );
+        }
+        else
+        {
+            QCOMPARE( reply->readAll(), QByteArray( "POST:/post:text/plain:Hello" ) );
+        }
+
+        reply->deleteLater();
+    }
+
+    const auto &&http2 = sslServerManage.status()[ "http2" ].toObject();
+    QCOMPARE( http2[ "connectionCount" ].toInt(), 1 );
+    QCOMPARE( http2[ "streamCount" ].toInt(), 9 );
+
+    // 超过接收窗口的请求体要在 Session 读走后归还窗口才能收完，超过 maxRequestBodySize 的回复 413
+    QNetworkRequest uploadRequest( QUrl( "https://127.0.0.1:23449/upload" ) );
+    uploadRequest.setAttribute( QNetworkRequest::Http2AllowedAttribute, true );
+    uploadRequest.setHeader( QNetworkRequest::ContentTypeHeader, "application/octet-stream" );
+
+    auto uploadReply = networkAccessManager.post( uploadRequest, QByteArray( 3 * 1024 * 1024, 'x' ) );
+    QTRY_COMPARE_WITH_TIMEOUT( uploadReply->isFinished(), true, 15000 );
+    QCOMPARE( uploadReply->error(), QNetworkReply::NoError );
+    QCOMPARE( uploadReply->readAll(), QByteArray::number( 3 * 1024 * 1024 ) );
+    uploadReply->deleteLater();
+
+    auto tooLargeReply = networkAccessManager.post( uploadRequest, QByteArray( 5 * 1024 * 1024, 'x' ) );
+    QTRY_COMPARE_WITH_TIMEOUT( tooLargeReply->isFinished(), true, 15000 );
+    QCOMPARE( tooLargeReply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt(), 413 );
+    tooLargeReply->deleteLater();
+
+    // 没有协商 h2 的客户端仍然走 HTTP/1.1
+    QSslSocket sslSocket;
+    sslSocket.setPeerVerifyMode( QSslSocket::VerifyNone );
+    sslSocket.connectToHostEncrypted( "127.0.0.1", 23449 );
+    QCOMPARE( sslSocket.waitForEncrypted( 3000 ), true );
+
+    sslSocket.write( "GET /http1 HTTP/1.1\r\n\r\n" );
+    QTRY_COMPARE( sslSocket.state(), QAbstractSocket::UnconnectedState );
+    QCOMPARE( sslSocket.readAll().endsWith( "GET:/http1::" ), true );
+    QCOMPARE( sslServerManage.status()[ "http2" ].toObject()[ "connectionCount" ].toInt(), 1 );
+
+    // 没有协商 h2 的 TLS 连接上发送连接前言不会被当成 h2c
+    QSslSocket prefaceSocket;
+    prefaceSocket.setPeerVerifyMode( QSslSocket::VerifyNone );
+    prefaceSocket.connectToHostEncrypted( "127.0.0.1", 23449 );
+    QCOMPARE( prefaceSocket.waitForEncrypted( 3000 ), true );
+
+    prefaceSocket.write( "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" );
+    QTRY_COMPARE( prefaceSocket.state(), QAbstractSocket::UnconnectedState );
+    QCOMPARE( prefaceSocket.readAll().isEmpty(), true );
+    QCOMPARE( sslServerManage.status()[ "http2" ].toObject()[ "connectionCount" ].toInt(), 1 );
+    QCOMPARE( sslServerManage.status()[ "http2" ].toObject()[ "cleartextCount" ].toInt(), 0 );
 }
 #endif
@@ -4,15 +4,59 @@
 // Qt lib import
 #include <QObject>
 #include <QSharedPointer>
+#include <QPointer>
+#include <QSemaphore>
+#ifndef QT_NO_SSL
+#   include <QSslCertificate>
+#endif
 
 namespace JQHttpServer
 {
+class Session;
 class TcpServerManage;
 #ifndef QT_NO_SSL
 class SslServerManage;
 #endif
 }
 
+class RouteHandlePoolProcessor: public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY( RouteHandlePoolProcessor )
+
+public:
+    RouteHandlePoolProcessor() = default;
+
+    ~RouteHandlePoolProcessor() = default;
+
+    QSemaphore slowSemaphore_;
+
+public slots:
+    void getSlow(const QPointer< JQHttpServer::Session > &session);
+
+    void getFast(const QPointer< JQHttpServer::Session > &session);
+};
+
+#ifndef QT_NO_SSL
+class CertificateVerifyProcessor: public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY( CertificateVerifyProcessor )
+
+public:
+    CertificateVerifyProcessor() = default;
+
+    ~CertificateVerifyProcessor() = default;
+
+    QAtomicInt verifyCount_ = 0;
+
+public slots:
+    void certificateVerifier(const QSslCertificate &peerCertificate, const QPointer< JQHttpServer::Session > &session);
+
+    void getHello(const QPointer< JQHttpServer::Session > &session);
+};
+#endif
+
 class OverallTest: public QObject
 {
     Q_OBJECT
@@ -23,6 +67,11 @@ public:
 
     ~OverallTest() = default;
 
+#ifdef Q_OS_UNIX
+    // preforkTest 启动的子进程，作为 supervisor 调用 Prefork::run
+    static int preforkMain(int argc, char *argv[]);
+#endif
+
 private slots:
     void initTestCase();
 
@@ -34,14 +83,63 @@ private slots:
 
     void httpPostTest();
 
+    void handlePoolPriorityTest();
+
+    void handlePoolScaleTest();
+
+    void routeHandlePoolTest();
+
+    void httpDeferredReplyTest();
+
+    void epollEventBackendTest();
+
+    void ioUringEventBackendTest();
+
+    void writeStatisticsTest();
+
+    void acceptBacklogTest();
+
+    void localSocketTest();
+
+    void multiListenTest();
+
+    void inheritedListenSocketTest();
+
+    void listenSocketHandoffTest();
+
+    void gracefulShutdownTest();
+
+    void reusePortTest();
+
+    void preforkTest();
+
+    void cpuAffinityTest();
+
+    void keepAliveTest();
+
+    void http2CleartextTest();
+
+    void webSocketTest();
+
 #ifndef QT_NO_SSL
     void httpsGetTest();
 
     void httpsPostTest();
+
+    void httpsHandshakeThreadTest();
+
+    void httpsCertificateSelectionTest();
+
+    void httpsCertificateReloadTest();
+
+    void certificateVerifyCacheTest();
+
+    void http2Test();
 #endif
 
 private:
     QSharedPointer< JQHttpServer::TcpServerManage > httpServerManage_;
+    QSharedPointer< JQHttpServer::TcpServerManage > deferredServerManage_;
 #ifndef QT_NO_SSL
     QSharedPointer< JQHttpServer::SslServerManage > httpsServerManage_;
 #endif